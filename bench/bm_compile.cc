@@ -0,0 +1,74 @@
+#include "benchmark/benchmark.h"
+#include "csmith.h"
+#include "diagnostics.h"
+#include "llvmemitter.h"
+#include "parser.h"
+// ---------------------------------------------------------------------------
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+using Parser = qcp::Parser<qcp::emitter::LLVMEmitter>;
+using Options = qcp::emitter::LLVMEmitter::Options;
+// ---------------------------------------------------------------------------
+// parses a csmith program and writes its object file
+void compile(benchmark::State& state, const Options& options) {
+   std::string src{qcp::tool::random_c_program("gcc", 0)};
+   int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+   std::ostringstream log;
+   for (auto _ : state) {
+      qcp::DiagnosticTracker diag{"<csmith>", src, log};
+      Parser parser{src, diag, log, options};
+      parser.addIntTypeDef("__builtin_va_list");
+      parser.parse();
+      parser.getEmitter().writeToObjFile(devNull);
+   }
+   close(devNull);
+   state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * src.size()));
+}
+// ---------------------------------------------------------------------------
+// -O0 as compiled before the fast path: SelectionDAG at CodeGenOptLevel::Default, value names
+// and the verifier
+void CompileO0SelectionDAG(benchmark::State& state) {
+   Options options;
+   options.fastISel = false;
+   options.fastCodeGen = false;
+   options.discardValueNames = false;
+   options.verify = true;
+   compile(state, options);
+}
+// ---------------------------------------------------------------------------
+// -O0 as compiled by default: FastISel, no value names, no verifier
+void CompileO0Fast(benchmark::State& state) {
+   Options options;
+   options.discardValueNames = true;
+   options.verify = false;
+   compile(state, options);
+}
+// ---------------------------------------------------------------------------
+// -O2 with the verifier and the function passes run inline when a function is finished
+void CompileO2InlinePasses(benchmark::State& state) {
+   Options options;
+   options.optLevel = Options::OptLevel::O2;
+   options.verify = true;
+   options.backgroundPasses = false;
+   compile(state, options);
+}
+// ---------------------------------------------------------------------------
+// -O2 with the verifier and the function passes run on the worker while parsing continues
+void CompileO2BackgroundPasses(benchmark::State& state) {
+   Options options;
+   options.optLevel = Options::OptLevel::O2;
+   options.verify = true;
+   options.backgroundPasses = true;
+   compile(state, options);
+}
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+BENCHMARK(CompileO0SelectionDAG)->Unit(benchmark::kMillisecond);
+BENCHMARK(CompileO0Fast)->Unit(benchmark::kMillisecond);
+BENCHMARK(CompileO2InlinePasses)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(CompileO2BackgroundPasses)->Unit(benchmark::kMillisecond)->UseRealTime();
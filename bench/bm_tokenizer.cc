@@ -1,12 +1,14 @@
-
 #include "benchmark/benchmark.h"
 #include "csmith.h"
+#include "simdscan.h"
 #include "tokenizer.h"
 // ---------------------------------------------------------------------------
 namespace {
 // ---------------------------------------------------------------------------
-void Tokenizer(benchmark::State& state) {
+// reports MB/s, so that the scans of each instruction set can be compared
+void tokenize(benchmark::State& state, qcp::simd::Isa isa) {
    std::string src{qcp::tool::random_c_program("gcc", 0)};
+   qcp::simd::Isa previous = qcp::simd::use(isa);
    std::size_t n = 0;
    for (auto _ : state) {
       qcp::DiagnosticTracker diag{"<csmith>", src};
@@ -16,9 +18,30 @@ void Tokenizer(benchmark::State& state) {
          benchmark::DoNotOptimize(token);
       }
    }
+   qcp::simd::use(previous);
    state.SetItemsProcessed(n);
+   state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * src.size()));
+}
+// ---------------------------------------------------------------------------
+void Tokenizer(benchmark::State& state) {
+   tokenize(state, qcp::simd::detect());
+}
+// ---------------------------------------------------------------------------
+void TokenizerScalar(benchmark::State& state) {
+   tokenize(state, qcp::simd::Isa::SCALAR);
+}
+// ---------------------------------------------------------------------------
+void TokenizerSSE2(benchmark::State& state) {
+   tokenize(state, qcp::simd::Isa::SSE2);
+}
+// ---------------------------------------------------------------------------
+void TokenizerAVX2(benchmark::State& state) {
+   tokenize(state, qcp::simd::Isa::AVX2);
 }
 // ---------------------------------------------------------------------------
 } // namespace
 // ---------------------------------------------------------------------------
 BENCHMARK(Tokenizer)->Unit(benchmark::kNanosecond);
+BENCHMARK(TokenizerScalar)->Unit(benchmark::kNanosecond);
+BENCHMARK(TokenizerSSE2)->Unit(benchmark::kNanosecond);
+BENCHMARK(TokenizerAVX2)->Unit(benchmark::kNanosecond);
@@ -0,0 +1,52 @@
+#ifndef QCP_ARENA_H
+#define QCP_ARENA_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+// the bytes of decoded literals of a translation unit. strings are bumped off
+// blocks that are only freed with the arena, so their views stay valid.
+// the last string can still grow, e.g. by a concatenated literal
+class Arena {
+   public:
+   static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+   Arena() = default;
+   Arena(const Arena&) = delete;
+   Arena& operator=(const Arena&) = delete;
+
+   // starts a new string after the last one
+   void start() {
+      begin_ = top_;
+   }
+
+   void append(const char* begin, const char* end);
+
+   void push_back(char c) {
+      append(&c, &c + 1);
+   }
+
+   // the string started last
+   std::string_view back() const {
+      return {begin_, static_cast<std::size_t>(top_ - begin_)};
+   }
+
+   private:
+   // moves the last string to a block with room for size more bytes
+   void grow(std::size_t size);
+
+   std::vector<std::unique_ptr<char[]>> blocks_{};
+   char* begin_ = nullptr;
+   char* top_ = nullptr;
+   char* end_ = nullptr;
+};
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_ARENA_H
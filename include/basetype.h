@@ -568,7 +568,7 @@ void Base<T>::populateEmitterType(TypeFactory<T> &factory, T &emitter) {
       for (const auto &member : structOrUnionTy().members) {
          members.push_back(member);
       }
-      static Ident ANON {"anon"};
+      static Ident ANON{Ident::Static{}, "anon"};
       Ident tag = structOrUnionTy().tag ? structOrUnionTy().tag : ANON;
       ref_ = emitter.emitStructTy(members, structOrUnionTy().incomplete, tag.prefix("struct."));
    } else if (kind_ == Kind::UNION_T) {
@@ -0,0 +1,385 @@
+#ifndef QCP_BYTECODE_EMITTER_H
+#define QCP_BYTECODE_EMITTER_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "emittertraits.h"
+#include "stringpool.h"
+// ---------------------------------------------------------------------------
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+namespace op {
+enum class Kind; // forward declaration
+} // namespace op
+// ---------------------------------------------------------------------------
+namespace type {
+// ---------------------------------------------------------------------------
+enum class Cast; // forward declaration
+// ---------------------------------------------------------------------------
+template <typename T>
+class Type; // forward declaration
+} // namespace type
+// ---------------------------------------------------------------------------
+namespace emitter {
+// ---------------------------------------------------------------------------
+// lowers the input to a register based bytecode that run() interprets right away, for --run
+// without any machine code generation. every value gets a register of its own in the frame of
+// its function, constants are copied to their registers when a function is entered. functions
+// that are only declared are looked up in the process with dlsym and called with the x86-64
+// System V calling convention.
+// constructs it does not handle make supported() return false, the input has to be run with
+// the JIT then. so does taking the address of a defined function: native code cannot call into
+// the interpreter.
+class BytecodeEmitter {
+   public:
+   struct Ty {
+      enum class Kind : unsigned char {
+         VOID,
+         INT,
+         FLOAT,
+         DOUBLE,
+         PTR,
+         ARRAY,
+         STRUCT,
+         FN,
+      };
+
+      Kind kind;
+      unsigned bits = 0;
+      std::uint64_t size = 0;
+      std::uint64_t align = 1;
+      // element type of arrays, return type of functions
+      Ty* elem = nullptr;
+      std::uint64_t count = 0;
+      // members of structs, parameters of functions
+      std::vector<Ty*> members{};
+      std::vector<std::uint64_t> offsets{};
+      // narrow signed integers are extended to int when passed to native functions
+      std::vector<bool> signedParams{};
+      bool varArg = false;
+   };
+
+   struct Function;
+   struct GlobalVar;
+
+   struct Value {
+      enum class Kind : unsigned char {
+         // the value is held by register reg of the function that computed it, aggregates
+         // are held as the address of a copy
+         REG,
+         UNDEF,
+         // constants
+         INT,
+         FP,
+         NULLPTR,
+         ZERO,
+         ARRAY,
+         STRUCT,
+         STRING,
+         FUNC,
+         // the address of var + offset
+         GLOBAL,
+      };
+
+      Kind kind;
+      Ty* ty;
+      std::uint32_t reg = 0;
+      std::int64_t offset = 0;
+      GlobalVar* var = nullptr;
+   };
+
+   struct Constant : Value {
+      std::uint64_t value = 0;
+      double fp = 0;
+      std::vector<Constant*> elems{};
+      std::string str{};
+      Function* fn = nullptr;
+   };
+
+   struct ConstantInt : Constant {};
+
+   struct GlobalVar : Value {
+      std::string name{};
+      Ty* varTy = nullptr;
+      Constant* init = nullptr;
+      bool zeroInit = false;
+      // set by link()
+      char* address = nullptr;
+   };
+
+   // operands are register numbers unless noted otherwise
+   struct Instr {
+      std::uint8_t op;
+      // the width of integer operands
+      std::uint8_t bits = 64;
+      std::uint32_t a = 0;
+      std::uint32_t b = 0;
+      std::uint32_t c = 0;
+   };
+
+   struct Switch;
+
+   struct BasicBlock {
+      enum class Term : unsigned char {
+         NONE,
+         JUMP,
+         BRANCH,
+         RET,
+         SWITCH,
+      };
+
+      Function* fn;
+      std::vector<Instr> code{};
+      // terminators are only generated when the function is finalized, phi moves are appended before them
+      Term term = Term::NONE;
+      BasicBlock* targets[2] = {nullptr, nullptr};
+      Value* operand = nullptr;
+      Switch* sw = nullptr;
+      std::uint32_t offset = 0;
+   };
+
+   struct Switch {
+      Value* value;
+      std::vector<std::pair<std::uint64_t, BasicBlock*>> cases{};
+      BasicBlock* defaultTarget = nullptr;
+   };
+
+   // sorted cases of a switch, targets are instruction indices
+   struct JumpTable {
+      std::vector<std::pair<std::uint64_t, std::uint32_t>> cases{};
+      std::uint32_t defaultTarget;
+   };
+
+   struct Call {
+      // nullptr for calls through the pointer in register target
+      Function* callee;
+      std::uint32_t target;
+      std::vector<std::uint32_t> args{};
+      // per argument, whether it is passed in a vector register by native calls
+      std::vector<bool> fpArgs{};
+      // per argument, the width of signed integers narrower than int, 0 for everything else
+      std::vector<std::uint8_t> signBits{};
+      Ty* retTy;
+   };
+
+   struct Function {
+      Ty* ty;
+      std::string name;
+      Constant address;
+      std::vector<BasicBlock*> blocks{};
+      std::vector<Value*> params{};
+      bool hasBody = false;
+      // whether a call or the address refers to it
+      bool used = false;
+      // the address is used as a value and could reach native code, e.g. a comparator of qsort
+      bool addressTaken = false;
+      std::vector<Instr> code{};
+      std::vector<Call> calls{};
+      std::vector<JumpTable> tables{};
+      std::uint32_t regs = 0;
+      // register of each constant the function uses, their values are computed by link()
+      std::unordered_map<Value*, std::uint32_t> constantRegs{};
+      std::vector<std::pair<std::uint32_t, Value*>> constants{};
+      std::vector<std::pair<std::uint32_t, std::uint64_t>> constantValues{};
+      // registers holding the address of a local variable and its offset from the locals of the frame
+      std::vector<std::pair<std::uint32_t, std::uint64_t>> locals{};
+      std::uint64_t localsSize = 0;
+      // the size of a frame in 8 byte words, registers first, then locals
+      std::uint64_t frameWords = 0;
+      // the definition in the process for declarations
+      void* native = nullptr;
+   };
+
+   using ssa_t = Value;
+   using const_t = Constant;
+   using iconst_t = ConstantInt;
+   using phi_t = Value;
+   using bb_t = BasicBlock;
+   using ty_t = Ty;
+   using fn_t = Function;
+   using sw_t = Switch;
+
+   using Type = typename emitter_traits<BytecodeEmitter>::Type;
+   using value_t = typename emitter_traits<BytecodeEmitter>::value_t;
+   using const_or_iconst_t = typename emitter_traits<BytecodeEmitter>::const_or_iconst_t;
+
+   static constexpr bool CHAR_HAS_16_BIT = false;
+   static constexpr bool CHAR_IS_SIGNED = true;
+   static constexpr bool INT_HAS_64_BIT = false;
+   static constexpr bool LONG_HAS_64_BIT = true;
+
+   struct Options {
+      // bytes of the interpreter stack, registers and local variables of all active calls live there
+      std::size_t stackSize = std::size_t{64} << 20;
+   };
+
+   BytecodeEmitter() : BytecodeEmitter(Options{}) {}
+   explicit BytecodeEmitter(const Options& options);
+
+   // false if the input used something this emitter cannot compile, its output is unusable then
+   bool supported() const;
+
+   // calls main with args, nullopt if the program could not be linked
+   std::optional<int> run(std::vector<char*> args, std::ostream& log);
+   // lists the functions and the number of their instructions
+   void dumpToStdout();
+
+   void finalizeFn(fn_t* fn);
+
+   unsigned long long getUIntegerValue(iconst_t* c) {
+      return c->value;
+   }
+
+   long long getIntegerValue(iconst_t* c);
+
+   iconst_t* sizeOf(Type ty);
+
+   ty_t* emitVoidTy();
+   ty_t* emitIntTy(unsigned bits);
+   ty_t* emitFloatTy();
+   ty_t* emitDoubleTy();
+   ty_t* emitLongDoubleTy();
+   ty_t* emitPtrTo(Type ty);
+   ty_t* emitArrayTy(Type ty, iconst_t* size);
+   ty_t* emitStructTy(std::span<const Type> tys, bool incomplete, Ident name = Ident());
+
+   ssa_t* emitUndef();
+   ssa_t* emitPoison();
+
+   ty_t* emitFnTy(Type retTy, std::vector<Type> argTys, bool isVarArgFnTy);
+
+   ssa_t* emitGlobalVar(Type ty, Ident name = Ident());
+   const_t* emitFnPtr(Type ty, fn_t* fn);
+
+   void setInitValueGlobalVar(ssa_t* val, const_or_iconst_t init);
+   void zeroInitGlobalVar(Type ty, ssa_t* val);
+
+   fn_t* emitFnProto(Type fnTy, bool alwaysInline, bool noReturn, Ident name = Ident());
+   bb_t* emitFn(fn_t* fnProto);
+   bool isFnProto(fn_t* fn);
+   ssa_t* getParam(fn_t* fn, unsigned idx);
+
+   bb_t* emitBB(fn_t* fn, bb_t* insertBefore = nullptr, Ident name = Ident());
+
+   iconst_t* emitIConst(Type ty, unsigned long value);
+   const_t* emitFPConst(Type ty, double value);
+   const_t* emitNullPtr(Type ty);
+   const_or_iconst_t emitZeroConst(Type ty);
+
+   const_t* emitArrayConst(Type ty, std::span<const const_or_iconst_t> values);
+   const_t* emitArrayConst(Type ty, const_or_iconst_t value);
+
+   const_t* emitStructConst(Type ty, std::span<const const_or_iconst_t> values);
+
+   const_t* emitStringLiteral(const std::string_view str);
+
+   ssa_t* emitLocalVar(fn_t* fn, bb_t* entry, Type ty, Ident name = Ident(), bool insertAtBegin = false);
+   void zeroInitLocalVar(bb_t* entry, Type ty, ssa_t* val);
+
+   ssa_t* emitLoad(bb_t* bb, Type ty, ssa_t* ptr, Ident name = Ident());
+   void emitStore(bb_t* bb, Type ty, value_t value, ssa_t* ptr);
+
+   ssa_t* emitJump(bb_t* bb, bb_t* target);
+   ssa_t* emitBranch(bb_t* bb, bb_t* trueBB, bb_t* falseBB, value_t cond);
+   ssa_t* emitRet(bb_t* bb, value_t value);
+
+   ssa_t* emitPhi(bb_t* bb, Type ty, std::span<std::pair<value_t, bb_t*>> incoming, Ident name = Ident());
+
+   ssa_t* emitBinOp(bb_t* bb, Type ty, op::Kind kind, value_t lhs, value_t rhs, ssa_t* dest = nullptr, Ident name = Ident());
+   const_or_iconst_t emitConstBinOp(bb_t* bb, Type ty, op::Kind kind, const_or_iconst_t lhs, const_or_iconst_t rhs, Ident name = Ident());
+   ssa_t* emitIncDecOp(bb_t* bb, Type ty, op::Kind kind, ssa_t* operand, Ident name = Ident());
+   ssa_t* emitNeg(bb_t* bb, Type ty, ssa_t* operand, Ident name = Ident());
+   const_or_iconst_t emitConstNeg(bb_t* bb, Type ty, const_or_iconst_t operand, Ident name = Ident());
+   ssa_t* emitBWNeg(bb_t* bb, Type ty, ssa_t* operand, Ident name = Ident());
+   const_or_iconst_t emitConstBWNeg(bb_t* bb, Type ty, const_or_iconst_t operand, Ident name = Ident());
+   const_or_iconst_t emitConstCast(bb_t* bb, Type fromTy, const_or_iconst_t val, Type toTy, qcp::type::Cast cast);
+
+   ssa_t* emitCast(bb_t* bb, Type fromTy, ssa_t* val, Type toTy, qcp::type::Cast cast);
+
+   ssa_t* emitCall(bb_t* bb, fn_t* fn, std::span<const value_t> args, Ident name = Ident());
+   ssa_t* emitCall(bb_t* bb, Type fnTy, value_t fnPtr, std::span<const value_t> args, Ident name = Ident());
+
+   ssa_t* emitGEP(bb_t* bb, Type ty, value_t ptr, std::span<const uint64_t> idx, Ident name = Ident());
+   ssa_t* emitGEP(bb_t* bb, Type ty, value_t ptr, std::span<const std::uint32_t> idx, Ident name = Ident());
+   ssa_t* emitGEP(bb_t* bb, Type ty, value_t ptr, value_t idx, Ident name = Ident());
+
+   sw_t* emitSwitch(bb_t* bb, value_t value);
+   void addSwitchCase(sw_t* sw, iconst_t* value, bb_t* target);
+   void addSwitchDefault(sw_t* sw, bb_t* target);
+
+   private:
+   // records that the input cannot be compiled, returns a value that keeps the parser going
+   Value* unsupported();
+   Constant* unsupportedConstant(Ty* ty);
+   Constant* asConstant(const const_or_iconst_t& value);
+   Value* asValue(const value_t& value);
+
+   Ty* newTy(Ty ty);
+   Value* newValue(Value::Kind kind, Ty* ty);
+   Constant* newConstant(Value::Kind kind, Ty* ty);
+   ConstantInt* newInt(Ty* ty, std::uint64_t value);
+   Constant* newFP(Ty* ty, double value);
+   // a value in a new register of the function of bb
+   Value* newReg(BasicBlock* bb, Ty* ty);
+   // a register of the function of bb holding the address of size new bytes of the frame
+   Value* newLocal(Function* fn, std::uint64_t size, std::uint64_t align);
+
+   // the register holding value in the function of bb
+   std::uint32_t operand(BasicBlock* bb, Value* value);
+   void append(BasicBlock* bb, Instr instr);
+   // dst = op(lhs, rhs), the result has type ty
+   Value* binary(BasicBlock* bb, Ty* ty, std::uint8_t op, std::uint8_t bits, Value* lhs, Value* rhs);
+   Value* unary(BasicBlock* bb, Ty* ty, std::uint8_t op, std::uint8_t bits, Value* value, std::uint32_t c = 0);
+   void store(BasicBlock* bb, Ty* ty, Value* value, Value* ptr);
+   Value* offsetPointer(BasicBlock* bb, Value* ptr, std::int64_t offset);
+
+   template <typename T>
+   ssa_t* emitGEPImpl(bb_t* bb, Ty* ty, value_t ptr, std::span<T> indices);
+   ssa_t* emitCallImpl(BasicBlock* bb, Ty* fnTy, Function* callee, Value* target, std::span<const value_t> args);
+   void emitTerminator(BasicBlock* bb, BasicBlock* next);
+
+   // allocates and initializes the globals and resolves the constants of all functions
+   bool link(std::ostream& log);
+   // the bits of a constant, aggregates are copied to memory and their address is returned
+   std::uint64_t constantBits(Value* value);
+   char* materialize(Constant* c);
+   void serialize(Constant* c, char* data, std::size_t size);
+
+   std::size_t stackSize_;
+   std::deque<Ty> tys_{};
+   std::deque<Value> values_{};
+   std::deque<Constant> constants_{};
+   std::deque<ConstantInt> ints_{};
+   std::map<std::pair<Ty*, std::uint64_t>, ConstantInt*> uniqueInts_{};
+   std::deque<GlobalVar> globals_{};
+   std::deque<BasicBlock> blocks_{};
+   std::deque<Function> fns_{};
+   std::deque<Switch> switches_{};
+   Ty* intTys_[65] = {};
+   Ty* voidTy_;
+   Ty* floatTy_;
+   Ty* doubleTy_;
+   Ty* ptrTy_;
+   // the memory of globals and of aggregate constants, 8 byte aligned
+   std::deque<std::vector<std::uint64_t>> memory_{};
+   std::unordered_map<Constant*, char*> materialized_{};
+   bool supported_ = true;
+};
+// ---------------------------------------------------------------------------
+} // namespace emitter
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_BYTECODE_EMITTER_H
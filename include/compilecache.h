@@ -0,0 +1,75 @@
+#ifndef QCP_COMPILECACHE_H
+#define QCP_COMPILECACHE_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+// ---------------------------------------------------------------------------
+#include "llvm/Support/BLAKE3.h"
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+class CacheKey {
+   public:
+   CacheKey& add(std::string_view data);
+   CacheKey& add(std::uint64_t value);
+
+   std::string hex();
+
+   private:
+   llvm::BLAKE3 hasher_{};
+};
+// ---------------------------------------------------------------------------
+// an on-disk cache of compilation results, keyed by the hash of everything
+// that influences the output. entries are written to temporary files and
+// renamed into place, so concurrent compilers can share a cache directory.
+//
+// results are keyed by the preprocessed source. in direct mode a manifest
+// keyed by the unpreprocessed source maps to the result and lists the
+// included files with their hashes and the include candidates that were
+// missing, so that hits skip the preprocessor too.
+class CompileCache {
+   public:
+   struct Dependency {
+      std::string path;
+      // empty for paths that must not exist, e.g. include directories searched before the header
+      std::string hash;
+      std::int64_t mtime;
+      std::int64_t size;
+   };
+
+   explicit CompileCache(std::string dir);
+
+   // $QCP_CACHE_DIR, $XDG_CACHE_HOME/qcp or ~/.cache/qcp
+   static std::string defaultDir();
+
+   // a key over the compiler itself, extended by the caller with its options
+   static CacheKey baseKey();
+
+   static std::string hashFile(std::string_view contents);
+
+   // copies the result to fd on a hit
+   bool fetch(const std::string& key, int fd) const;
+   // copies the contents of fd, which must support pread(), into the cache
+   bool store(const std::string& key, int fd) const;
+   // the same for results that are kept in memory
+   std::optional<std::string> fetch(const std::string& key) const;
+   bool store(const std::string& key, std::string_view data) const;
+
+   std::optional<std::string> lookupManifest(const std::string& directKey) const;
+   void storeManifest(const std::string& directKey, const std::string& key, const std::vector<Dependency>& deps) const;
+
+   private:
+   std::string path(const std::string& key, std::string_view suffix) const;
+   bool write(const std::string& path, std::string_view data) const;
+
+   std::string dir_;
+};
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_COMPILECACHE_H
@@ -0,0 +1,52 @@
+#ifndef QCP_COMPILESERVER_H
+#define QCP_COMPILESERVER_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include <optional>
+#include <ostream>
+#include <string>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+// a long running compiler process that keeps its initialized state between
+// invocations. clients forward their command line, working directory and
+// stdio over a unix socket. jobs run one after another in the working
+// directory of the client, a job may still compile its files in parallel.
+// the environment is not forwarded, settings taken from it are passed as
+// options by the client.
+class CompileServer {
+   public:
+   using Driver = int (*)(int argc, char** argv);
+
+   CompileServer(std::string socketPath, Driver driver);
+   ~CompileServer();
+
+   CompileServer(const CompileServer&) = delete;
+   CompileServer& operator=(const CompileServer&) = delete;
+
+   // fails if the socket cannot be created or another server is using it
+   bool listen(std::ostream& log);
+   // serves jobs until the process is terminated
+   void run();
+
+   // $QCP_SERVER, $XDG_RUNTIME_DIR/qcp.sock or /tmp/qcp-UID.sock
+   static std::string defaultSocketPath();
+
+   // runs argv on the server and returns its exit code, nullopt if no server is running
+   static std::optional<int> forward(const std::string& socketPath, int argc, char** argv);
+
+   private:
+   void serve(int conn);
+
+   std::string socketPath_;
+   Driver driver_;
+   int fd_ = -1;
+   // restored after every job
+   int cwd_ = -1;
+   int stdio_[3] = {-1, -1, -1};
+};
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_COMPILESERVER_H
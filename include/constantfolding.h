@@ -0,0 +1,118 @@
+#ifndef QCP_CONSTANTFOLDING_H
+#define QCP_CONSTANTFOLDING_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "operator.h"
+// ---------------------------------------------------------------------------
+#include <cstdint>
+#include <optional>
+// ---------------------------------------------------------------------------
+namespace qcp {
+namespace emitter {
+// ---------------------------------------------------------------------------
+// folding of constant expressions for the emitters that do not have LLVM do it
+// ---------------------------------------------------------------------------
+inline std::uint64_t truncate(std::uint64_t value, unsigned bits) {
+   return bits >= 64 ? value : value & ((std::uint64_t{1} << bits) - 1);
+}
+// ---------------------------------------------------------------------------
+inline std::int64_t signExtend(std::uint64_t value, unsigned bits) {
+   if (bits >= 64) {
+      return static_cast<std::int64_t>(value);
+   }
+   std::uint64_t sign = std::uint64_t{1} << (bits - 1);
+   return static_cast<std::int64_t>((truncate(value, bits) ^ sign) - sign);
+}
+// ---------------------------------------------------------------------------
+// the operator applied by a compound assignment, END for everything else
+inline op::Kind decomposeAssignOp(op::Kind kind) {
+   switch (kind) {
+      case op::Kind::ADD_ASSIGN: return op::Kind::ADD;
+      case op::Kind::SUB_ASSIGN: return op::Kind::SUB;
+      case op::Kind::MUL_ASSIGN: return op::Kind::MUL;
+      case op::Kind::DIV_ASSIGN: return op::Kind::DIV;
+      case op::Kind::REM_ASSIGN: return op::Kind::REM;
+      case op::Kind::BW_AND_ASSIGN: return op::Kind::BW_AND;
+      case op::Kind::BW_OR_ASSIGN: return op::Kind::BW_OR;
+      case op::Kind::BW_XOR_ASSIGN: return op::Kind::BW_XOR;
+      case op::Kind::SHL_ASSIGN: return op::Kind::SHL;
+      case op::Kind::SHR_ASSIGN: return op::Kind::SHR;
+      default: return op::Kind::END;
+   }
+}
+// ---------------------------------------------------------------------------
+template <typename T>
+bool foldComparison(op::Kind kind, T lhs, T rhs) {
+   switch (kind) {
+      case op::Kind::EQ: return lhs == rhs;
+      case op::Kind::NE: return lhs != rhs;
+      case op::Kind::LT: return lhs < rhs;
+      case op::Kind::LE: return lhs <= rhs;
+      case op::Kind::GT: return lhs > rhs;
+      default: return lhs >= rhs;
+   }
+}
+// ---------------------------------------------------------------------------
+// operands and result are truncated to bits, comparisons yield 0 or 1.
+// nullopt if the operation is undefined or not an integer operation
+inline std::optional<std::uint64_t> foldIntBinOp(op::Kind kind, std::uint64_t lhs, std::uint64_t rhs, unsigned bits, bool isSigned) {
+   std::uint64_t a = truncate(lhs, bits);
+   std::uint64_t b = truncate(rhs, bits);
+   std::int64_t sa = signExtend(a, bits);
+   std::int64_t sb = signExtend(b, bits);
+   switch (kind) {
+      case op::Kind::ADD: return truncate(a + b, bits);
+      case op::Kind::SUB: return truncate(a - b, bits);
+      case op::Kind::MUL: return truncate(a * b, bits);
+      case op::Kind::DIV:
+      case op::Kind::REM:
+         if (b == 0 || (isSigned && sb == -1 && sa == signExtend(std::uint64_t{1} << (bits - 1), bits))) {
+            return std::nullopt;
+         }
+         if (kind == op::Kind::DIV) {
+            return truncate(isSigned ? static_cast<std::uint64_t>(sa / sb) : a / b, bits);
+         }
+         return truncate(isSigned ? static_cast<std::uint64_t>(sa % sb) : a % b, bits);
+      // like the LLVMEmitter, the operands of logical operators are already 0 or 1
+      case op::Kind::L_AND:
+      case op::Kind::BW_AND: return a & b;
+      case op::Kind::L_OR:
+      case op::Kind::BW_OR: return a | b;
+      case op::Kind::BW_XOR: return a ^ b;
+      case op::Kind::SHL:
+      case op::Kind::SHR:
+         if (b >= bits) {
+            return std::nullopt;
+         }
+         if (kind == op::Kind::SHL) {
+            return truncate(a << b, bits);
+         }
+         return truncate(isSigned ? static_cast<std::uint64_t>(sa >> b) : a >> b, bits);
+      default:
+         if (op::isComparisonOp(kind)) {
+            return isSigned ? foldComparison(kind, sa, sb) : foldComparison(kind, a, b);
+         }
+         return std::nullopt;
+   }
+}
+// ---------------------------------------------------------------------------
+// comparisons yield 0 or 1, nullopt if it is not a floating point operation
+inline std::optional<double> foldFPBinOp(op::Kind kind, double lhs, double rhs) {
+   switch (kind) {
+      case op::Kind::ADD: return lhs + rhs;
+      case op::Kind::SUB: return lhs - rhs;
+      case op::Kind::MUL: return lhs * rhs;
+      case op::Kind::DIV: return lhs / rhs;
+      default:
+         if (op::isComparisonOp(kind)) {
+            return foldComparison(kind, lhs, rhs) ? 1.0 : 0.0;
+         }
+         return std::nullopt;
+   }
+}
+// ---------------------------------------------------------------------------
+} // namespace emitter
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_CONSTANTFOLDING_H
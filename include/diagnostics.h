@@ -44,7 +44,7 @@ class DiagnosticMessage {
 
    private:
    std::vector<long long>::const_iterator findLineBegin() const;
-   std::map<std::size_t, std::pair<std::string, std::size_t>>::const_iterator findFileBegin() const;
+   std::map<long long, std::pair<std::string, std::size_t>>::const_iterator findFileBegin() const;
 
    const DiagnosticTracker& tracker_;
    Kind kind_;
@@ -60,8 +60,8 @@ class DiagnosticTracker {
    friend class DiagnosticMessage;
 
    public:
-   DiagnosticTracker(std::string filename, std::string_view prog) : filename{std::move(filename)}, prog_{prog} {
-      fileStack_[0] = std::make_pair(this->filename, 0);
+   DiagnosticTracker(std::string filename, std::string_view prog, std::ostream& out = std::cerr) : filename{std::move(filename)}, prog_{prog}, out_{&out} {
+      fileStack_[-1] = std::make_pair(this->filename, 0);
    }
 
    template <typename T>
@@ -74,14 +74,20 @@ class DiagnosticTracker {
    bool empty() const;
    std::size_t count(DiagnosticMessage::Kind kind) const;
 
-   void registerLineBreak(long long pos);
+   // the program text grows while it is tokenized from a stream
+   void extendProgram(std::string_view prog) {
+      prog_ = prog;
+   }
 
    void unsilence() {
       silenced = false;
    }
 
-   void registerFileMapping(std::string filename, std::size_t srcOffset) {
-      fileStack_[lineBreaks_.size() - 1] = std::make_pair(std::move(filename), srcOffset);
+   // the mapping applies to the lines after the one containing pos. it is keyed by the
+   // newline ending that line, so that lines are only counted once a diagnostic is reported
+   void registerFileMapping(std::string filename, std::size_t srcOffset, long long pos) {
+      std::size_t end = prog_.find('\n', static_cast<std::size_t>(pos));
+      fileStack_[static_cast<long long>(end == std::string_view::npos ? prog_.size() : end)] = std::make_pair(std::move(filename), srcOffset);
    }
 
    private:
@@ -89,11 +95,17 @@ class DiagnosticTracker {
    std::stringstream os_{};
    std::optional<SrcLoc> loc_{};
    std::vector<DiagnosticMessage> diagnostics_{};
-   std::vector<long long> lineBreaks_{-1}; // first linebreak is right before the first character
-   std::map<std::size_t, std::pair<std::string, std::size_t>> fileStack_{};
+   // the offsets of the newlines of the program, scanned up to scanned_ when they are needed
+   const std::vector<long long>& lineBreaks() const;
+
+   mutable std::vector<long long> lineBreaks_{-1}; // first linebreak is right before the first character
+   mutable std::size_t scanned_ = 0;
+   std::map<long long, std::pair<std::string, std::size_t>> fileStack_{};
    bool silenced = false;
    std::string filename;
    std::string_view prog_;
+   // messages are reported here as soon as they are complete
+   std::ostream* out_;
 };
 // ---------------------------------------------------------------------------
 template <typename T>
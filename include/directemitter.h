@@ -0,0 +1,349 @@
+#ifndef QCP_DIRECT_EMITTER_H
+#define QCP_DIRECT_EMITTER_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "elfwriter.h"
+#include "emittertraits.h"
+#include "stringpool.h"
+// ---------------------------------------------------------------------------
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+namespace op {
+enum class Kind; // forward declaration
+} // namespace op
+// ---------------------------------------------------------------------------
+namespace type {
+// ---------------------------------------------------------------------------
+enum class Cast; // forward declaration
+// ---------------------------------------------------------------------------
+template <typename T>
+class Type; // forward declaration
+} // namespace type
+// ---------------------------------------------------------------------------
+namespace emitter {
+// ---------------------------------------------------------------------------
+// writes x86-64 machine code and an ELF object file straight from the parser, without building any IR.
+// every value lives in a stack slot of its own, instructions only work on rax, rcx and rdx (xmm0 and
+// xmm1 for floating point) and each block remembers which value rax still holds. this is a single
+// pass over the input and no register allocation is done beyond that.
+// constructs it does not handle make supported() return false, the input has to be compiled with
+// the LLVMEmitter then.
+class DirectEmitter {
+   public:
+   struct Ty {
+      enum class Kind : unsigned char {
+         VOID,
+         INT,
+         FLOAT,
+         DOUBLE,
+         PTR,
+         ARRAY,
+         STRUCT,
+         FN,
+      };
+
+      Kind kind;
+      unsigned bits = 0;
+      std::uint64_t size = 0;
+      std::uint64_t align = 1;
+      // element type of arrays, return type of functions
+      Ty* elem = nullptr;
+      std::uint64_t count = 0;
+      // members of structs, parameters of functions
+      std::vector<Ty*> members{};
+      std::vector<std::uint64_t> offsets{};
+      // integers narrower than int are extended according to these when passed or returned
+      std::vector<bool> signedParams{};
+      bool signedRet = false;
+      bool varArg = false;
+   };
+
+   struct Value {
+      enum class Kind : unsigned char {
+         // the value is stored in the 8 byte stack slot rbp + offset
+         TEMP,
+         // the address rbp + offset
+         FRAME,
+         // the address of sym + offset
+         GLOBAL,
+         // an aggregate copied to rbp + offset
+         AGGREGATE,
+         UNDEF,
+         // constants
+         INT,
+         FP,
+         NULLPTR,
+         ZERO,
+         ARRAY,
+         STRUCT,
+         STRING,
+         FUNC,
+      };
+
+      Kind kind;
+      Ty* ty;
+      std::int64_t offset = 0;
+      ElfWriter::SymbolId sym = 0;
+   };
+
+   struct Constant : Value {
+      std::uint64_t value = 0;
+      double fp = 0;
+      std::vector<Constant*> elems{};
+      std::string str{};
+   };
+
+   struct ConstantInt : Constant {};
+
+   struct Function;
+   struct Switch;
+
+   struct BasicBlock {
+      enum class Term : unsigned char {
+         NONE,
+         JUMP,
+         BRANCH,
+         RET,
+         SWITCH,
+      };
+
+      struct Relocation {
+         std::uint32_t offset;
+         ElfWriter::SymbolId sym;
+         std::uint32_t type;
+         std::int64_t addend;
+      };
+
+      Function* fn;
+      std::string code{};
+      std::vector<Relocation> relocations{};
+      // rel32 operands of jumps, patched once the blocks are placed
+      std::vector<std::pair<std::uint32_t, BasicBlock*>> jumps{};
+      // terminators are only generated when the function is finalized, phi moves are appended before them
+      Term term = Term::NONE;
+      BasicBlock* targets[2] = {nullptr, nullptr};
+      Value* operand = nullptr;
+      Switch* sw = nullptr;
+      std::uint32_t offset = 0;
+      // the value rax holds at the end of code
+      Value* rax = nullptr;
+   };
+
+   struct Switch {
+      Value* value;
+      std::vector<std::pair<std::uint64_t, BasicBlock*>> cases{};
+      BasicBlock* defaultTarget = nullptr;
+   };
+
+   struct Function {
+      Ty* ty;
+      std::string name;
+      ElfWriter::SymbolId sym;
+      Constant address;
+      std::vector<BasicBlock*> blocks{};
+      std::vector<Value*> params{};
+      // bytes of stack below rbp
+      std::int64_t frameSize = 0;
+   };
+
+   using ssa_t = Value;
+   using const_t = Constant;
+   using iconst_t = ConstantInt;
+   using phi_t = Value;
+   using bb_t = BasicBlock;
+   using ty_t = Ty;
+   using fn_t = Function;
+   using sw_t = Switch;
+
+   using Type = typename emitter_traits<DirectEmitter>::Type;
+   using value_t = typename emitter_traits<DirectEmitter>::value_t;
+   using const_or_iconst_t = typename emitter_traits<DirectEmitter>::const_or_iconst_t;
+
+   static constexpr bool CHAR_HAS_16_BIT = false;
+   static constexpr bool CHAR_IS_SIGNED = true;
+   static constexpr bool INT_HAS_64_BIT = false;
+   static constexpr bool LONG_HAS_64_BIT = true;
+
+   struct Options {};
+
+   DirectEmitter() : DirectEmitter(Options{}) {}
+   explicit DirectEmitter(const Options& options);
+
+   // false if the input used something this emitter cannot compile, its output is unusable then
+   bool supported() const {
+      return supported_;
+   }
+
+   void writeToObjFile(int fd);
+   // lists the functions and the size of their code
+   void dumpToStdout();
+
+   void finalizeFn(fn_t* fn);
+
+   unsigned long long getUIntegerValue(iconst_t* c) {
+      return c->value;
+   }
+
+   long long getIntegerValue(iconst_t* c);
+
+   iconst_t* sizeOf(Type ty);
+
+   ty_t* emitVoidTy();
+   ty_t* emitIntTy(unsigned bits);
+   ty_t* emitFloatTy();
+   ty_t* emitDoubleTy();
+   ty_t* emitLongDoubleTy();
+   ty_t* emitPtrTo(Type ty);
+   ty_t* emitArrayTy(Type ty, iconst_t* size);
+   ty_t* emitStructTy(std::span<const Type> tys, bool incomplete, Ident name = Ident());
+
+   ssa_t* emitUndef();
+   ssa_t* emitPoison();
+
+   ty_t* emitFnTy(Type retTy, std::vector<Type> argTys, bool isVarArgFnTy);
+
+   ssa_t* emitGlobalVar(Type ty, Ident name = Ident());
+   const_t* emitFnPtr(Type ty, fn_t* fn);
+
+   void setInitValueGlobalVar(ssa_t* val, const_or_iconst_t init);
+   void zeroInitGlobalVar(Type ty, ssa_t* val);
+
+   fn_t* emitFnProto(Type fnTy, bool alwaysInline, bool noReturn, Ident name = Ident());
+   bb_t* emitFn(fn_t* fnProto);
+   bool isFnProto(fn_t* fn);
+   ssa_t* getParam(fn_t* fn, unsigned idx);
+
+   bb_t* emitBB(fn_t* fn, bb_t* insertBefore = nullptr, Ident name = Ident());
+
+   iconst_t* emitIConst(Type ty, unsigned long value);
+   const_t* emitFPConst(Type ty, double value);
+   const_t* emitNullPtr(Type ty);
+   const_or_iconst_t emitZeroConst(Type ty);
+
+   const_t* emitArrayConst(Type ty, std::span<const const_or_iconst_t> values);
+   const_t* emitArrayConst(Type ty, const_or_iconst_t value);
+
+   const_t* emitStructConst(Type ty, std::span<const const_or_iconst_t> values);
+
+   const_t* emitStringLiteral(const std::string_view str);
+
+   ssa_t* emitLocalVar(fn_t* fn, bb_t* entry, Type ty, Ident name = Ident(), bool insertAtBegin = false);
+   void zeroInitLocalVar(bb_t* entry, Type ty, ssa_t* val);
+
+   ssa_t* emitLoad(bb_t* bb, Type ty, ssa_t* ptr, Ident name = Ident());
+   void emitStore(bb_t* bb, Type ty, value_t value, ssa_t* ptr);
+
+   ssa_t* emitJump(bb_t* bb, bb_t* target);
+   ssa_t* emitBranch(bb_t* bb, bb_t* trueBB, bb_t* falseBB, value_t cond);
+   ssa_t* emitRet(bb_t* bb, value_t value);
+
+   ssa_t* emitPhi(bb_t* bb, Type ty, std::span<std::pair<value_t, bb_t*>> incoming, Ident name = Ident());
+
+   ssa_t* emitBinOp(bb_t* bb, Type ty, op::Kind kind, value_t lhs, value_t rhs, ssa_t* dest = nullptr, Ident name = Ident());
+   const_or_iconst_t emitConstBinOp(bb_t* bb, Type ty, op::Kind kind, const_or_iconst_t lhs, const_or_iconst_t rhs, Ident name = Ident());
+   ssa_t* emitIncDecOp(bb_t* bb, Type ty, op::Kind kind, ssa_t* operand, Ident name = Ident());
+   ssa_t* emitNeg(bb_t* bb, Type ty, ssa_t* operand, Ident name = Ident());
+   const_or_iconst_t emitConstNeg(bb_t* bb, Type ty, const_or_iconst_t operand, Ident name = Ident());
+   ssa_t* emitBWNeg(bb_t* bb, Type ty, ssa_t* operand, Ident name = Ident());
+   const_or_iconst_t emitConstBWNeg(bb_t* bb, Type ty, const_or_iconst_t operand, Ident name = Ident());
+   const_or_iconst_t emitConstCast(bb_t* bb, Type fromTy, const_or_iconst_t val, Type toTy, qcp::type::Cast cast);
+
+   ssa_t* emitCast(bb_t* bb, Type fromTy, ssa_t* val, Type toTy, qcp::type::Cast cast);
+
+   ssa_t* emitCall(bb_t* bb, fn_t* fn, std::span<const value_t> args, Ident name = Ident());
+   ssa_t* emitCall(bb_t* bb, Type fnTy, value_t fnPtr, std::span<const value_t> args, Ident name = Ident());
+
+   ssa_t* emitGEP(bb_t* bb, Type ty, value_t ptr, std::span<const uint64_t> idx, Ident name = Ident());
+   ssa_t* emitGEP(bb_t* bb, Type ty, value_t ptr, std::span<const std::uint32_t> idx, Ident name = Ident());
+   ssa_t* emitGEP(bb_t* bb, Type ty, value_t ptr, value_t idx, Ident name = Ident());
+
+   sw_t* emitSwitch(bb_t* bb, value_t value);
+   void addSwitchCase(sw_t* sw, iconst_t* value, bb_t* target);
+   void addSwitchDefault(sw_t* sw, bb_t* target);
+
+   private:
+   struct GlobalVar : Value {
+      Ty* varTy = nullptr;
+      Constant* init = nullptr;
+      bool zeroInit = false;
+   };
+
+   struct Mem {
+      unsigned base;
+      std::int32_t disp;
+   };
+
+   // records that the input cannot be compiled, returns a value that keeps the parser going
+   Value* unsupported();
+   Constant* unsupportedConstant(Ty* ty);
+   Constant* asConstant(const const_or_iconst_t& value);
+   Constant* newFP(Ty* ty, double value);
+
+   Ty* newTy(Ty ty);
+   Value* newValue(Value::Kind kind, Ty* ty, std::int64_t offset = 0, ElfWriter::SymbolId sym = 0);
+   Constant* newConstant(Value::Kind kind, Ty* ty);
+   ConstantInt* newInt(Ty* ty, std::uint64_t value);
+   Value* newTemp(BasicBlock* bb, Ty* ty);
+   std::int64_t allocFrame(Function* fn, std::uint64_t size, std::uint64_t align);
+   ElfWriter::SymbolId symbol(const std::string& name);
+   Value* asValue(const value_t& value);
+
+   template <typename T>
+   ssa_t* emitGEPImpl(bb_t* bb, Ty* ty, value_t ptr, std::span<T> indices);
+   Value* offsetPointer(BasicBlock* bb, Value* ptr, std::int64_t offset);
+   ssa_t* emitCallImpl(BasicBlock* bb, Ty* fnTy, Function* callee, Value* target, std::span<const value_t> args);
+
+   // integers are extended to at least 32 bit
+   void load(BasicBlock* bb, unsigned reg, Value* value, bool signExtend);
+   void loadFP(BasicBlock* bb, unsigned xmm, Value* value, bool isDouble);
+   void loadAddress(BasicBlock* bb, unsigned reg, ElfWriter::SymbolId sym, std::int64_t addend);
+   // the memory operand ptr points to, scratch may be used to compute it
+   Mem address(BasicBlock* bb, Value* ptr, unsigned scratch);
+   void store(BasicBlock* bb, Ty* ty, Value* value, Value* ptr);
+   // stores rax or xmm0 to the slot of temp
+   void storeTemp(BasicBlock* bb, Value* temp, bool isFP = false, bool isDouble = true);
+   void copy(BasicBlock* bb, Value* src, Value* dst, std::uint64_t size);
+   void zero(BasicBlock* bb, Value* dst, std::uint64_t size);
+   Value* retype(BasicBlock* bb, Value* value, Ty* ty);
+   // the symbol of a copy of an aggregate constant in the data sections
+   ElfWriter::SymbolId constantSymbol(Constant* c, std::uint64_t size);
+   void serialize(Constant* c, std::string& data, std::size_t offset, std::vector<std::pair<std::size_t, ElfWriter::SymbolId>>& relocations);
+   void emitTerminator(BasicBlock* bb, BasicBlock* next);
+
+   ElfWriter elf_{};
+   std::deque<Ty> tys_{};
+   std::deque<Value> values_{};
+   std::deque<Constant> constants_{};
+   std::deque<ConstantInt> ints_{};
+   std::map<std::pair<Ty*, std::uint64_t>, ConstantInt*> uniqueInts_{};
+   std::deque<GlobalVar> globals_{};
+   std::deque<BasicBlock> blocks_{};
+   std::deque<Function> fns_{};
+   std::deque<Switch> switches_{};
+   Ty* intTys_[65] = {};
+   Ty* voidTy_;
+   Ty* floatTy_;
+   Ty* doubleTy_;
+   Ty* ptrTy_;
+   std::unordered_map<std::string, ElfWriter::SymbolId> symbols_{};
+   // symbol and size of the copies made by constantSymbol
+   std::unordered_map<Constant*, std::pair<ElfWriter::SymbolId, std::uint64_t>> constantSymbols_{};
+   unsigned anonymous_ = 0;
+   bool supported_ = true;
+};
+// ---------------------------------------------------------------------------
+} // namespace emitter
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_DIRECT_EMITTER_H
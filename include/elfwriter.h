@@ -0,0 +1,95 @@
+#ifndef QCP_ELFWRITER_H
+#define QCP_ELFWRITER_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+// collects code, data and symbols of a translation unit and writes them as
+// an x86-64 ELF relocatable object file
+class ElfWriter {
+   public:
+   enum class Section : unsigned char {
+      TEXT,
+      DATA,
+      RODATA,
+      BSS,
+      COUNT,
+   };
+
+   enum class Binding : unsigned char {
+      LOCAL,
+      GLOBAL,
+   };
+
+   enum class SymbolType : unsigned char {
+      NONE,
+      FUNC,
+      OBJECT,
+   };
+
+   using SymbolId = std::uint32_t;
+
+   // undefined until define() is called
+   SymbolId addSymbol(std::string name, Binding binding);
+   void define(SymbolId sym, Section section, std::uint64_t offset, std::uint64_t size, SymbolType type);
+   bool isDefined(SymbolId sym) const {
+      return symbols_[sym].defined;
+   }
+   bool isLocal(SymbolId sym) const {
+      return symbols_[sym].binding == Binding::LOCAL;
+   }
+
+   // appends data to a section at the given alignment and returns its offset
+   std::uint64_t append(Section section, std::string_view data, std::uint64_t align);
+   // reserves zero initialized space
+   std::uint64_t reserve(Section section, std::uint64_t size, std::uint64_t align);
+
+   // type is one of the R_X86_64_* relocations
+   void addRelocation(Section section, std::uint64_t offset, SymbolId sym, std::uint32_t type, std::int64_t addend);
+
+   bool write(int fd) const;
+
+   private:
+   struct Symbol {
+      std::string name;
+      Binding binding;
+      SymbolType type = SymbolType::NONE;
+      bool defined = false;
+      Section section = Section::TEXT;
+      std::uint64_t offset = 0;
+      std::uint64_t size = 0;
+   };
+
+   struct Relocation {
+      std::uint64_t offset;
+      SymbolId sym;
+      std::uint32_t type;
+      std::int64_t addend;
+   };
+
+   struct SectionData {
+      std::string data{};
+      // bss only has a size
+      std::uint64_t size = 0;
+      std::uint64_t align = 1;
+      std::vector<Relocation> relocations{};
+   };
+
+   SectionData& section(Section section) {
+      return sections_[static_cast<unsigned>(section)];
+   }
+
+   std::vector<Symbol> symbols_{};
+   std::array<SectionData, static_cast<unsigned>(Section::COUNT)> sections_{};
+};
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_ELFWRITER_H
@@ -0,0 +1,93 @@
+#ifndef QCP_JIT_H
+#define QCP_JIT_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "llvmemitter.h"
+// ---------------------------------------------------------------------------
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+// ---------------------------------------------------------------------------
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Error.h"
+// ---------------------------------------------------------------------------
+namespace llvm {
+class MemoryBuffer;
+namespace orc {
+class IndirectStubsManager;
+class LLJIT;
+} // namespace orc
+} // namespace llvm
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+class CompileCache; // forward declaration
+// ---------------------------------------------------------------------------
+// runs a translation unit in-process for --run. every function is called
+// through a stub. the first tier is compiled without optimizations and
+// counts the calls of each function, a function that gets hot is recompiled
+// with optimizations on a background thread and its stub is pointed at the
+// new code while the program keeps running.
+class JIT {
+   public:
+   struct Options {
+      // target and pipeline of hot functions
+      emitter::LLVMEmitter::Options hot{};
+      // calls after which a function is recompiled
+      unsigned hotCalls = 1000;
+      // objects are reused from here, nullptr if caching is disabled
+      const CompileCache* cache = nullptr;
+      // identifies the source of the module in the cache
+      std::string cacheKey{};
+   };
+
+   explicit JIT(Options options);
+   ~JIT();
+
+   JIT(const JIT&) = delete;
+   JIT& operator=(const JIT&) = delete;
+
+   // links the first tier of the module, the module is consumed
+   bool load(emitter::LLVMEmitter::OwnedModule module, std::ostream& log);
+   // calls main with args, nullopt if the module has no main
+   std::optional<int> run(std::vector<char*> args, std::ostream& log);
+
+   private:
+   // called by the first tier of a function on its hotCalls-th call
+   static void tierUp(std::uint32_t fn);
+   void compileHotFunctions();
+   // waits for the background thread, hot functions that are still queued are dropped
+   void stop();
+
+   llvm::Expected<std::uint64_t> lookup(const std::string& name);
+   std::string objectKey(std::string_view tier, std::string_view fn) const;
+   // nullptr on a miss
+   std::unique_ptr<llvm::MemoryBuffer> cachedObject(const std::string& key) const;
+   llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> compile(llvm::Module& mod, llvm::TargetMachine& tm, const std::string& key) const;
+
+   Options options_;
+   std::unique_ptr<llvm::orc::LLJIT> jit_;
+   std::unique_ptr<llvm::orc::IndirectStubsManager> stubs_;
+   // the names of the functions with a stub, indexed by the argument of tierUp
+   std::vector<std::string> fns_;
+   // the module before it was instrumented, hot functions are compiled from it
+   llvm::SmallVector<char, 0> bitcode_;
+   std::mutex mutex_;
+   std::condition_variable cv_;
+   std::deque<std::uint32_t> hot_;
+   bool stop_ = false;
+   std::thread compiler_;
+};
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_JIT_H
@@ -0,0 +1,154 @@
+#ifndef QCP_LEXTABLES_H
+#define QCP_LEXTABLES_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "token.h"
+// ---------------------------------------------------------------------------
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+// ---------------------------------------------------------------------------
+namespace qcp::lex {
+// ---------------------------------------------------------------------------
+// the tables of the tokenizer, built at compile time from defs/tokens.def.
+// a new punctuator only needs its NAMED_ENUM_ENTRY there
+struct Spelling {
+   token::Kind kind;
+   std::string_view repr;
+};
+// ---------------------------------------------------------------------------
+inline constexpr Spelling SPELLINGS[] = {
+#define ENUM_AS_SPELLING
+#include "defs/tokens.def"
+#undef ENUM_AS_SPELLING
+};
+// ---------------------------------------------------------------------------
+constexpr bool isLetter(char c) {
+   return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_';
+}
+// ---------------------------------------------------------------------------
+// keywords are spelled with letters and looked up by gperf
+constexpr bool isPunctuator(const Spelling& s) {
+   return !s.repr.empty() && !isLetter(s.repr.front());
+}
+// ---------------------------------------------------------------------------
+// the number of distinct prefixes of all punctuators, including the empty one
+constexpr unsigned countPrefixes() {
+   unsigned count = 1;
+   for (std::size_t i = 0; i < std::size(SPELLINGS); ++i) {
+      if (!isPunctuator(SPELLINGS[i])) {
+         continue;
+      }
+      for (std::size_t len = 1; len <= SPELLINGS[i].repr.size(); ++len) {
+         std::string_view prefix = SPELLINGS[i].repr.substr(0, len);
+         bool seen = false;
+         for (std::size_t j = 0; j < i && !seen; ++j) {
+            seen = isPunctuator(SPELLINGS[j]) && SPELLINGS[j].repr.starts_with(prefix);
+         }
+         count += !seen;
+      }
+   }
+   return count;
+}
+// ---------------------------------------------------------------------------
+// a trie of the punctuators: every state is a prefix, state 0 the empty one.
+// the longest match is the last accepting state before the walk dies
+class PunctuatorDFA {
+   public:
+   static constexpr unsigned STATES = countPrefixes();
+   static_assert(STATES < 256, "the states of the punctuator dfa must fit in a byte");
+
+   constexpr PunctuatorDFA() {
+      accept_.fill(token::Kind::UNKNOWN);
+      unsigned states = 1;
+      for (const Spelling& s : SPELLINGS) {
+         if (!isPunctuator(s)) {
+            continue;
+         }
+         unsigned state = 0;
+         for (char c : s.repr) {
+            std::uint8_t& next = next_[state][static_cast<unsigned char>(c)];
+            if (!next) {
+               next = static_cast<std::uint8_t>(states++);
+            }
+            state = next;
+         }
+         accept_[state] = s.kind;
+      }
+   }
+
+   // whether a punctuator starts with c
+   constexpr bool starts(char c) const {
+      return next_[0][static_cast<unsigned char>(c)];
+   }
+
+   // the longest punctuator at the start of [begin, end), UNKNOWN with length 0 if there is none
+   template <typename It>
+   constexpr std::pair<token::Kind, unsigned> match(It begin, It end) const {
+      std::pair<token::Kind, unsigned> result{token::Kind::UNKNOWN, 0};
+      unsigned state = 0;
+      for (It it = begin; it != end; ++it) {
+         state = next_[state][static_cast<unsigned char>(*it)];
+         if (!state) {
+            break;
+         }
+         if (accept_[state] != token::Kind::UNKNOWN) {
+            result = {accept_[state], static_cast<unsigned>(it - begin) + 1};
+         }
+      }
+      return result;
+   }
+
+   private:
+   // 0 is the dead state, nothing leads back to the start
+   std::array<std::array<std::uint8_t, 256>, STATES> next_{};
+   std::array<token::Kind, STATES> accept_{};
+};
+// ---------------------------------------------------------------------------
+inline constexpr PunctuatorDFA PUNCTUATORS{};
+// ---------------------------------------------------------------------------
+// character classes, one byte per character
+enum CharClass : std::uint8_t {
+   IDENT_START = 1 << 0,
+   DIGIT = 1 << 1,
+   OCTAL_DIGIT = 1 << 2,
+   HEX_DIGIT = 1 << 3,
+   SEPARATOR = 1 << 4,
+   // '#' is reported as an unknown punctuator until there is a preprocessor
+   PUNCTUATOR_START = 1 << 5,
+   SIMPLE_ESCAPE = 1 << 6,
+   // anything the tokenizer does not skip
+   TOKEN_START = 1 << 7,
+};
+// ---------------------------------------------------------------------------
+constexpr std::array<std::uint8_t, 256> charClasses() {
+   std::array<std::uint8_t, 256> result{};
+   for (unsigned i = 0; i < 256; ++i) {
+      char c = static_cast<char>(i);
+      std::uint8_t cls = 0;
+      cls |= isLetter(c) ? IDENT_START : 0;
+      cls |= (c >= '0' && c <= '9') ? DIGIT : 0;
+      cls |= (c >= '0' && c <= '7') ? OCTAL_DIGIT : 0;
+      cls |= ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f')) ? HEX_DIGIT : 0;
+      cls |= (c == ' ' || c == '\t' || c == '\n') ? SEPARATOR : 0;
+      cls |= (PUNCTUATORS.starts(c) || c == '#') ? PUNCTUATOR_START : 0;
+      cls |= std::string_view{"'\"?\\abfnrtv"}.find(c) != std::string_view::npos ? SIMPLE_ESCAPE : 0;
+      if ((cls & (IDENT_START | DIGIT | PUNCTUATOR_START)) || c == '"' || c == '\'' || c == '\n') {
+         cls |= TOKEN_START;
+      }
+      result[i] = cls;
+   }
+   return result;
+}
+// ---------------------------------------------------------------------------
+inline constexpr std::array<std::uint8_t, 256> CHAR_CLASSES = charClasses();
+// ---------------------------------------------------------------------------
+constexpr bool is(char c, std::uint8_t cls) {
+   return CHAR_CLASSES[static_cast<unsigned char>(c)] & cls;
+}
+// ---------------------------------------------------------------------------
+} // namespace qcp::lex
+// ---------------------------------------------------------------------------
+#endif // QCP_LEXTABLES_H
@@ -5,6 +5,7 @@
 // ---------------------------------------------------------------------------
 #include "stringpool.h"
 #include "emittertraits.h"
+#include "spscqueue.h"
 // ---------------------------------------------------------------------------
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
@@ -18,7 +19,11 @@
 // ---------------------------------------------------------------------------
 #include <array>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <span>
+#include <thread>
 #include <variant>
 #include <getopt.h>
 // ---------------------------------------------------------------------------
@@ -70,11 +75,90 @@ class LLVMEmitter {
    static constexpr const char* const HELP_MESSAGE = "  -emit-llvm-bc\n"
                                                      "  -emit-llvm\n";
 
-   LLVMEmitter();
+   struct Options {
+      enum class OptLevel : unsigned char {
+         O0,
+         O1,
+         O2,
+         O3,
+         Os,
+         Oz,
+      };
+
+      std::string cpu = "generic";
+      // comma separated, e.g. +avx2,-fma
+      std::string features{};
+      OptLevel optLevel = OptLevel::O0;
+      // a pass pipeline in the syntax of opt -passes, replaces the one of optLevel
+      std::string passes{};
+      // object files are generated from this many partitions of the module in parallel
+      unsigned codegenThreads = 1;
+      // the partitions are generated on at most this many threads, 0: one per partition
+      unsigned codegenWorkers = 0;
+      // combines the partitions with ld -r
+      std::string linker = "ld";
+      // large bitcode files are flushed while they are written instead of being buffered completely
+      bool streamBitcode = false;
+      // -O0 selects instructions with FastISel unless disabled
+      bool fastISel = true;
+      // -O0 generates code at CodeGenOptLevel::None unless disabled, then at Default
+      bool fastCodeGen = true;
+      // names of values only help reading the IR
+      bool discardValueNames = false;
+      // runs the IR verifier on every function
+#ifdef NDEBUG
+      bool verify = false;
+#else
+      bool verify = true;
+#endif
+      // finished functions are verified and simplified on another thread while parsing continues,
+      // otherwise when they are finished. the output is the same either way. off by default: the
+      // parser builds IR under a lock the worker takes for every pass
+      bool backgroundPasses = false;
+      // the module is only prepared for a ThinLTO link, which runs the rest of the pipeline
+      bool thinLTOPreLink = false;
+      // the module is created in this context instead of an own one, so that it can be linked with others
+      llvm::LLVMContext* context = nullptr;
+   };
+
+   LLVMEmitter() : LLVMEmitter(Options{}) {}
+   explicit LLVMEmitter(const Options& options);
+   ~LLVMEmitter();
+
+   // everything about the target machine and the options that influences the generated code
+   static std::string targetDescription(const Options& options);
+   // returns an error message if passes is not a valid pipeline
+   static std::optional<std::string> checkPasses(const std::string& passes);
+   // whether the target knows cpu, e.g. for -march=
+   static bool checkCPU(const std::string& cpu);
+   // initializes the target and creates a target machine for later emitters
+   static void prepareTarget();
+   // the cpu and features of the machine qcp runs on, for -march=native
+   static std::string hostCPU();
+   static std::string hostFeatures();
+   // runs the pipeline of options.passes or options.optLevel on mod
+   static void runPassPipeline(llvm::Module& mod, llvm::TargetMachine* tm, const Options& options);
+
+   // the types and constants of a module belong to its context
+   struct OwnedModule {
+      std::unique_ptr<llvm::LLVMContext> ctx;
+      std::unique_ptr<llvm::Module> mod;
+   };
+
+   // hands the finished module over, e.g. to the JIT. the emitter cannot be used afterwards.
+   // ctx is null if the context was passed in the options
+   OwnedModule takeModule();
+   // moves the module of other, which was created in the same context, into this one.
+   // other cannot be used afterwards, returns false and reports to log if a symbol is defined twice
+   bool linkIn(LLVMEmitter& other, std::ostream& log);
+   // once everything is linked in: gives every definition but main and exports internal linkage,
+   // so that the optimizer sees the whole program, and merges identical constants
+   void internalize(std::span<const std::string> exports);
 
    void dumpToFile(const std::string& filename) {
       std::error_code EC;
       llvm::raw_fd_ostream OS(filename, EC);
+      finishFunctions();
       Mod->print(OS, nullptr);
    }
 
@@ -82,17 +166,17 @@ class LLVMEmitter {
 
    void writeToObjFile(const std::string& filename);
 
-   void writeToBitcodeFile(int fd) {
-      llvm::raw_fd_ostream OS(fd, false);
-      Mod->print(OS, nullptr);
-   }
+   // bitcode with a module summary, functions can be loaded lazily
+   void writeToBitcodeFile(int fd);
 
 
    void dumpToStdout() {
+      finishFunctions();
       Mod->print(llvm::outs(), nullptr);
    }
 
    void writeLLVMToFile(int fd) {
+      optimize();
       llvm::raw_fd_ostream OS(fd, false);
       Mod->print(OS, nullptr);
    }
@@ -195,13 +279,37 @@ class LLVMEmitter {
    ssa_t* emitAllocaImpl(bb_t* bb, Type ty, ssa_t* size, Ident name, bool insertAtBegin);
 
    const_t* zeroConst(Type ty);
+   // runs the optimization pipeline once, before the module is first written
+   void optimize();
+   // all ir is built under this lock while functions are processed in the background
+   std::unique_lock<std::recursive_mutex> lockContext();
+   class FunctionPasses;
+   void runFunctionPasses();
+   // waits for the background passes of all finished functions
+   void finishFunctions();
    void writeToObjFileImpl(llvm::raw_fd_ostream& OS);
+   bool writeToObjFileParallel(llvm::raw_fd_ostream& OS);
+
+   // hands the target machine back to the pool
+   struct TargetMachineDeleter {
+      void operator()(llvm::TargetMachine* tm) const;
+   };
 
-   llvm::LLVMContext Ctx;
+   Options options_;
+   bool optimized_ = false;
+   // null after takeModule()
+   std::unique_ptr<llvm::LLVMContext> ctx_;
+   llvm::LLVMContext& Ctx;
    std::unique_ptr<llvm::Module> mod_;
    llvm::Module* Mod;
-   llvm::TargetMachine* TM;
+   std::unique_ptr<llvm::TargetMachine, TargetMachineDeleter> TM;
    llvm::IRBuilder<> Builder;
+   std::recursive_mutex ctxMutex_;
+   // null stops the worker
+   SPSCQueue<fn_t*, 256> finished_;
+   std::thread worker_;
+   // the passes of finished functions if there is no worker
+   std::unique_ptr<FunctionPasses> inlinePasses_;
 };
 // ---------------------------------------------------------------------------
 inline typename LLVMEmitter::ssa_t* asLLVMValue(const typename LLVMEmitter::value_t& val) {
@@ -217,6 +325,7 @@ inline typename LLVMEmitter::ssa_t* asLLVMValue(const typename LLVMEmitter::valu
 // ---------------------------------------------------------------------------
 template <typename T, typename Fn>
 typename LLVMEmitter::ssa_t* LLVMEmitter::emitGEPImpl(bb_t* bb, Type ty, value_t ptr, std::span<T> indices, Ident name, Fn fn) {
+   auto lock = lockContext();
    Builder.SetInsertPoint(bb);
    std::vector<llvm::Value*> llvmindices;
    llvmindices.reserve(indices.size());
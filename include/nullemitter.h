@@ -0,0 +1,286 @@
+#ifndef QCP_NULL_EMITTER_H
+#define QCP_NULL_EMITTER_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "emittertraits.h"
+#include "stringpool.h"
+// ---------------------------------------------------------------------------
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+namespace op {
+enum class Kind; // forward declaration
+} // namespace op
+// ---------------------------------------------------------------------------
+namespace type {
+// ---------------------------------------------------------------------------
+enum class Cast; // forward declaration
+// ---------------------------------------------------------------------------
+template <typename T>
+class Type; // forward declaration
+} // namespace type
+// ---------------------------------------------------------------------------
+namespace emitter {
+// ---------------------------------------------------------------------------
+// generates nothing, for -fsyntax-only. types only know their size and alignment and
+// only integer and floating point constants are folded, because the parser needs their
+// values for array sizes, case labels, enumerators and sizeof. every other value is the
+// same placeholder.
+class NullEmitter {
+   public:
+   struct Ty {
+      enum class Kind : unsigned char {
+         VOID,
+         INT,
+         FP,
+         PTR,
+         AGGREGATE,
+         FN,
+      };
+
+      Kind kind;
+      unsigned bits = 0;
+      std::uint64_t size = 0;
+      std::uint64_t align = 1;
+      // the element count of arrays
+      std::uint64_t count = 0;
+   };
+
+   struct Value {
+      Ty* ty = nullptr;
+   };
+
+   struct Constant : Value {
+      enum class Kind : unsigned char {
+         INT,
+         FP,
+         // addresses, aggregates and strings
+         OTHER,
+      };
+
+      Kind kind = Kind::OTHER;
+      std::uint64_t value = 0;
+      double fp = 0;
+   };
+
+   struct ConstantInt : Constant {};
+
+   struct BasicBlock {};
+
+   struct Function {
+      Ty* ty;
+      bool hasBody = false;
+   };
+
+   struct Switch {};
+
+   using ssa_t = Value;
+   using const_t = Constant;
+   using iconst_t = ConstantInt;
+   using phi_t = Value;
+   using bb_t = BasicBlock;
+   using ty_t = Ty;
+   using fn_t = Function;
+   using sw_t = Switch;
+
+   using Type = typename emitter_traits<NullEmitter>::Type;
+   using value_t = typename emitter_traits<NullEmitter>::value_t;
+   using const_or_iconst_t = typename emitter_traits<NullEmitter>::const_or_iconst_t;
+
+   static constexpr bool CHAR_HAS_16_BIT = false;
+   static constexpr bool CHAR_IS_SIGNED = true;
+   static constexpr bool INT_HAS_64_BIT = false;
+   static constexpr bool LONG_HAS_64_BIT = true;
+
+   struct Options {};
+
+   NullEmitter() : NullEmitter(Options{}) {}
+   explicit NullEmitter(const Options& options);
+
+   void dumpToStdout() {}
+
+   void finalizeFn([[maybe_unused]] fn_t* fn) {}
+
+   unsigned long long getUIntegerValue(iconst_t* c) {
+      return c->value;
+   }
+
+   long long getIntegerValue(iconst_t* c);
+
+   iconst_t* sizeOf(Type ty);
+
+   ty_t* emitVoidTy() {
+      return &voidTy_;
+   }
+   ty_t* emitIntTy(unsigned bits);
+   ty_t* emitFloatTy() {
+      return &floatTy_;
+   }
+   ty_t* emitDoubleTy() {
+      return &doubleTy_;
+   }
+   // like the LLVMEmitter, long double is a double
+   ty_t* emitLongDoubleTy() {
+      return &doubleTy_;
+   }
+   ty_t* emitPtrTo([[maybe_unused]] Type ty) {
+      return &ptrTy_;
+   }
+   ty_t* emitArrayTy(Type ty, iconst_t* size);
+   ty_t* emitStructTy(std::span<const Type> tys, bool incomplete, Ident name = Ident());
+
+   ssa_t* emitUndef() {
+      return &placeholder_;
+   }
+   ssa_t* emitPoison() {
+      return &placeholder_;
+   }
+
+   ty_t* emitFnTy(Type retTy, std::vector<Type> argTys, bool isVarArgFnTy);
+
+   ssa_t* emitGlobalVar([[maybe_unused]] Type ty, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+   const_t* emitFnPtr([[maybe_unused]] Type ty, [[maybe_unused]] fn_t* fn) {
+      return &address_;
+   }
+
+   void setInitValueGlobalVar([[maybe_unused]] ssa_t* val, [[maybe_unused]] const_or_iconst_t init) {}
+   void zeroInitGlobalVar([[maybe_unused]] Type ty, [[maybe_unused]] ssa_t* val) {}
+
+   fn_t* emitFnProto(Type fnTy, bool alwaysInline, bool noReturn, Ident name = Ident());
+   bb_t* emitFn(fn_t* fnProto);
+   bool isFnProto(fn_t* fn);
+   ssa_t* getParam([[maybe_unused]] fn_t* fn, [[maybe_unused]] unsigned idx) {
+      return &placeholder_;
+   }
+
+   bb_t* emitBB([[maybe_unused]] fn_t* fn, [[maybe_unused]] bb_t* insertBefore = nullptr, [[maybe_unused]] Ident name = Ident()) {
+      return &blocks_.emplace_back();
+   }
+
+   iconst_t* emitIConst(Type ty, unsigned long value);
+   const_t* emitFPConst(Type ty, double value);
+   const_t* emitNullPtr([[maybe_unused]] Type ty) {
+      return &address_;
+   }
+   const_or_iconst_t emitZeroConst(Type ty);
+
+   const_t* emitArrayConst([[maybe_unused]] Type ty, [[maybe_unused]] std::span<const const_or_iconst_t> values) {
+      return &address_;
+   }
+   const_t* emitArrayConst([[maybe_unused]] Type ty, [[maybe_unused]] const_or_iconst_t value) {
+      return &address_;
+   }
+
+   const_t* emitStructConst([[maybe_unused]] Type ty, [[maybe_unused]] std::span<const const_or_iconst_t> values) {
+      return &address_;
+   }
+
+   const_t* emitStringLiteral([[maybe_unused]] const std::string_view str) {
+      return &address_;
+   }
+
+   ssa_t* emitLocalVar([[maybe_unused]] fn_t* fn, [[maybe_unused]] bb_t* entry, [[maybe_unused]] Type ty, [[maybe_unused]] Ident name = Ident(), [[maybe_unused]] bool insertAtBegin = false) {
+      return &placeholder_;
+   }
+   void zeroInitLocalVar([[maybe_unused]] bb_t* entry, [[maybe_unused]] Type ty, [[maybe_unused]] ssa_t* val) {}
+
+   ssa_t* emitLoad([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type ty, [[maybe_unused]] ssa_t* ptr, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+   void emitStore([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type ty, [[maybe_unused]] value_t value, [[maybe_unused]] ssa_t* ptr) {}
+
+   ssa_t* emitJump([[maybe_unused]] bb_t* bb, [[maybe_unused]] bb_t* target) {
+      return nullptr;
+   }
+   ssa_t* emitBranch([[maybe_unused]] bb_t* bb, [[maybe_unused]] bb_t* trueBB, [[maybe_unused]] bb_t* falseBB, [[maybe_unused]] value_t cond) {
+      return nullptr;
+   }
+   ssa_t* emitRet([[maybe_unused]] bb_t* bb, [[maybe_unused]] value_t value) {
+      return nullptr;
+   }
+
+   ssa_t* emitPhi([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type ty, [[maybe_unused]] std::span<std::pair<value_t, bb_t*>> incoming, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+
+   ssa_t* emitBinOp([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type ty, [[maybe_unused]] op::Kind kind, [[maybe_unused]] value_t lhs, [[maybe_unused]] value_t rhs, [[maybe_unused]] ssa_t* dest = nullptr, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+   const_or_iconst_t emitConstBinOp(bb_t* bb, Type ty, op::Kind kind, const_or_iconst_t lhs, const_or_iconst_t rhs, Ident name = Ident());
+   ssa_t* emitIncDecOp([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type ty, [[maybe_unused]] op::Kind kind, [[maybe_unused]] ssa_t* operand, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+   ssa_t* emitNeg([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type ty, [[maybe_unused]] ssa_t* operand, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+   const_or_iconst_t emitConstNeg(bb_t* bb, Type ty, const_or_iconst_t operand, Ident name = Ident());
+   ssa_t* emitBWNeg([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type ty, [[maybe_unused]] ssa_t* operand, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+   const_or_iconst_t emitConstBWNeg(bb_t* bb, Type ty, const_or_iconst_t operand, Ident name = Ident());
+   const_or_iconst_t emitConstCast(bb_t* bb, Type fromTy, const_or_iconst_t val, Type toTy, qcp::type::Cast cast);
+
+   ssa_t* emitCast([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type fromTy, [[maybe_unused]] ssa_t* val, [[maybe_unused]] Type toTy, [[maybe_unused]] qcp::type::Cast cast) {
+      return &placeholder_;
+   }
+
+   ssa_t* emitCall([[maybe_unused]] bb_t* bb, [[maybe_unused]] fn_t* fn, [[maybe_unused]] std::span<const value_t> args, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+   ssa_t* emitCall([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type fnTy, [[maybe_unused]] value_t fnPtr, [[maybe_unused]] std::span<const value_t> args, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+
+   ssa_t* emitGEP([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type ty, [[maybe_unused]] value_t ptr, [[maybe_unused]] std::span<const uint64_t> idx, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+   ssa_t* emitGEP([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type ty, [[maybe_unused]] value_t ptr, [[maybe_unused]] std::span<const std::uint32_t> idx, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+   ssa_t* emitGEP([[maybe_unused]] bb_t* bb, [[maybe_unused]] Type ty, [[maybe_unused]] value_t ptr, [[maybe_unused]] value_t idx, [[maybe_unused]] Ident name = Ident()) {
+      return &placeholder_;
+   }
+
+   sw_t* emitSwitch([[maybe_unused]] bb_t* bb, [[maybe_unused]] value_t value) {
+      return &switch_;
+   }
+   void addSwitchCase([[maybe_unused]] sw_t* sw, [[maybe_unused]] iconst_t* value, [[maybe_unused]] bb_t* target) {}
+   void addSwitchDefault([[maybe_unused]] sw_t* sw, [[maybe_unused]] bb_t* target) {}
+
+   private:
+   Ty* newTy(Ty ty);
+   ConstantInt* newInt(Ty* ty, std::uint64_t value);
+   Constant* newFP(Ty* ty, double value);
+   Constant* asConstant(const const_or_iconst_t& value);
+
+   std::deque<Ty> tys_{};
+   std::deque<Constant> constants_{};
+   std::deque<ConstantInt> ints_{};
+   std::map<std::pair<Ty*, std::uint64_t>, ConstantInt*> uniqueInts_{};
+   std::deque<Function> fns_{};
+   // function bodies are never looked at, a block only needs an address
+   std::deque<BasicBlock> blocks_{};
+   Ty* intTys_[65] = {};
+   Ty voidTy_{.kind = Ty::Kind::VOID, .size = 1};
+   Ty floatTy_{.kind = Ty::Kind::FP, .bits = 32, .size = 4, .align = 4};
+   Ty doubleTy_{.kind = Ty::Kind::FP, .bits = 64, .size = 8, .align = 8};
+   Ty ptrTy_{.kind = Ty::Kind::PTR, .bits = 64, .size = 8, .align = 8};
+   Value placeholder_{};
+   Constant address_{};
+   Switch switch_{};
+};
+// ---------------------------------------------------------------------------
+} // namespace emitter
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_NULL_EMITTER_H
@@ -12,6 +12,7 @@
 #include "scope.h"
 #include "scopeinfo.h"
 #include "token.h"
+#include "tokenbuffer.h"
 #include "tokencounter.h"
 #include "tokenizer.h"
 #include "tracer.h"
@@ -57,13 +58,28 @@ class Parser {
    using value_t = typename T::value_t;
 
    public:
+   // lexThreads > 1 lexes large programs up front on that many threads
    Parser(std::string_view prog,
           DiagnosticTracker &diagnostics,
-          std::ostream &logStream = std::cout) : tokenizer_{prog, diagnostics},
-                                                 pos_{tokenizer_.begin()},
-                                                 diagnostics_{diagnostics},
-                                                 tracer_{logStream},
-                                                 factory_{emitter_} {}
+          std::ostream &logStream = std::cout,
+          const typename T::Options &emitterOptions = {},
+          unsigned lexThreads = 1) : tokenizer_{prog, diagnostics},
+                                     pos_{tokenizer_, lexThreads},
+                                                            emitter_{emitterOptions},
+                                                            diagnostics_{diagnostics},
+                                                            tracer_{logStream},
+                                                            factory_{emitter_} {}
+
+   // parses the input while it is still being produced
+   Parser(const StreamBuffer &stream,
+          DiagnosticTracker &diagnostics,
+          std::ostream &logStream = std::cout,
+          const typename T::Options &emitterOptions = {}) : tokenizer_{stream, diagnostics},
+                                                            pos_{tokenizer_},
+                                                            emitter_{emitterOptions},
+                                                            diagnostics_{diagnostics},
+                                                            tracer_{logStream},
+                                                            factory_{emitter_} {}
 
    void addIntTypeDef(const std::string &name) {
       typedefScope_.insert(Ident{name}, locatable<Type>{{}, factory_.intTy()});
@@ -494,8 +510,8 @@ class Parser {
    }
 
    Tokenizer tokenizer_;
-   typename Tokenizer::const_iterator pos_;
-   T emitter_{};
+   TokenBuffer pos_;
+   T emitter_;
 
    scope::Scope<Ident, ScopeInfo> varScope_{};
    scope::Scope<Ident, locatable<Type>> tagScope_{};
@@ -541,20 +557,22 @@ class Parser {
          std::vector<int> cmds{};
          while (pos_ && pos_->getKind() != TK::PP_END) {
             if (hasAnyOf(TK::ICONST)) {
-               cmds.push_back(pos_->getValue<int>());
+               cmds.push_back(tokenizer_.getValue<int>(*pos_));
             } else {
                diagnostics_ << pos_->getLoc() << "unexpected token in gcc-style preprocessor info" << std::endl;
             }
             ++pos_;
          }
+         if (lineNo && file) {
+            // register before consuming PP_END, the next token may be several lines further down.
+            // the mapping applies to the lines following the marker
+            std::string fileName{tokenizer_.getString(file)};
+            diagnostics_.registerFileMapping(fileName, tokenizer_.getValue<int>(lineNo) - 1, file.getLoc().loc());
+         }
          if (pos_) {
             // consume PP_END
             ++pos_;
          }
-         if (lineNo && file) {
-            std::string fileName{file.getString()};
-            diagnostics_.registerFileMapping(fileName, lineNo.getValue<int>());
-         }
       }
    }
 
@@ -572,7 +590,7 @@ class Parser {
    }
 
    bool isTypedef() {
-      return pos_->getKind() == TK::IDENT && typedefScope_.find(pos_->getValue<Ident>());
+      return pos_->getKind() == TK::IDENT && typedefScope_.find(pos_->getIdent());
    }
 
    std::vector<ScopeInfo *> externDeclarations_;
@@ -980,7 +998,7 @@ void Parser<T>::parse() {
          ssa_t *retVal = emitter_.emitLoad(retBB, state.retTy, retVar, Ident("__retVar"));
          emitter_.emitRet(retBB, retVal);
       }
-      static Ident MAIN{"main"};
+      static Ident MAIN{Ident::Static{}, "main"};
       for (auto bbloc : state.unsealedBlocks) {
          if (state.retTy->kind() == TYK::VOID) {
             emitter_.emitRet(static_cast<bb_t *>(bbloc), static_cast<ssa_t *>(nullptr));
@@ -1105,7 +1123,7 @@ int Parser<T>::parseOptLabelList(std::vector<attr_t> &attr) {
          }
       } else {
          // labeled-statement
-         Ident label = pos_->getValue<Ident>();
+         Ident label = pos_->getIdent();
          if (state.labels.contains(label)) {
             diagnostics_ << "Redefinition of label " << label << std::endl;
          }
@@ -1482,7 +1500,7 @@ void Parser<T>::parseJumpStmt() {
    SrcLoc loc = pos_->getLoc().truncate(0);
    if (consumeAnyOf(TK::GOTO)) {
       SrcLoc loc = pos_->getLoc();
-      Ident label = expect(TK::IDENT).template getValue<Ident>();
+      Ident label = expect(TK::IDENT).getIdent();
       expect(TK::SEMICOLON);
       if (isSealed(state.bb)) {
          return;
@@ -1844,7 +1862,7 @@ Parser<T>::expr_t Parser<T>::parsePostfixExpr(expr_t &&lhs) {
    } else {
       // member access
       consumeAnyOf(TK::DEREF, TK::PERIOD);
-      Ident member = expect(TK::IDENT).template getValue<Ident>();
+      Ident member = expect(TK::IDENT).getIdent();
 
       value_t ptr;
 
@@ -1897,15 +1915,19 @@ Parser<T>::expr_t Parser<T>::parsePrimaryExpr() {
       value_t value{};
       if (state.eval) {
          if (tk >= TK::FCONST) {
-            value = asValue(emitter_.emitFPConst(ty, t.getValue<double>()));
+            value = asValue(emitter_.emitFPConst(ty, tokenizer_.getValue<double>(t)));
          } else {
-            value = asValue(emitter_.emitIConst(ty, t.getValue<unsigned long long>()));
+            value = asValue(emitter_.emitIConst(ty, tokenizer_.getValue<unsigned long long>(t)));
          }
       }
       return std::make_unique<Expr<T>>(t.getLoc(), ty, value);
    } else if (consumeAnyOf(TK::SLITERAL)) {
-      // string literals
-      std::string_view str = t.getString();
+      // string literals, adjacent ones are one
+      std::string_view str = tokenizer_.getString(t);
+      while (hasAnyOf(TK::SLITERAL)) {
+         str = tokenizer_.getString(str, *pos_);
+         advance();
+      }
       const_t *sliteral = nullptr;
       if (state.eval) {
          sliteral = emitter_.emitStringLiteral(str);
@@ -1915,7 +1937,7 @@ Parser<T>::expr_t Parser<T>::parsePrimaryExpr() {
       return std::make_unique<Expr<T>>(t.getLoc(), ty, sliteral);
    } else if (consumeAnyOf(TK::CLITERAL)) {
       // character literals
-      std::string_view str = t.getString();
+      std::string_view str = tokenizer_.getString(t);
       if (str.size() > 1) {
          diagnostics_ << DiagnosticMessage::Kind::WARNING << t.getLoc() << "multi-character character constant" << std::endl;
       }
@@ -1930,10 +1952,10 @@ Parser<T>::expr_t Parser<T>::parsePrimaryExpr() {
       }
       return std::make_unique<Expr<T>>(t.getLoc(), ty, iconst);
    } else if (consumeAnyOf(TK::IDENT)) {
-      static const Ident FUNC{"__func__"};
+      static const Ident FUNC{Ident::Static{}, "__func__"};
 
       // Identifier
-      Ident name = t.getValue<Ident>();
+      Ident name = t.getIdent();
       ScopeInfo *info = varScope_.find(name);
       Type ty{};
       value_t value{};
@@ -2196,7 +2218,7 @@ typename Parser<T>::Declarator Parser<T>::parseDeclaratorImpl() {
    // direct-declarator
    decl.nameLoc = pos_->getLoc();
    if (Token t = consumeAnyOf(TK::IDENT)) {
-      decl.ident = t.getValue<Ident>();
+      decl.ident = t.getIdent();
    }
 
    if (!decl.ident && hasAnyOf(TK::L_BRACE)) {
@@ -2392,7 +2414,7 @@ typename Parser<T>::DeclarationSpecifier Parser<T>::parseDeclarationSpecifierLis
          advance();
          qualifiers[static_cast<int>(kind) - static_cast<int>(TK::CONST)] = true;
       } else if (kind == TK::IDENT) {
-         auto *tt = typedefScope_.find(t.getValue<Ident>());
+         auto *tt = typedefScope_.find(t.getIdent());
          if (tt) {
             advance();
             if (ty) {
@@ -2415,7 +2437,7 @@ typename Parser<T>::DeclarationSpecifier Parser<T>::parseDeclarationSpecifierLis
          // todo: incomplete struct or union
          parseOptAttributeSpecifierSequence();
          if (Token t = consumeAnyOf(TK::IDENT)) {
-            tag = t.getValue<Ident>();
+            tag = t.getIdent();
             completesTy = static_cast<Type *>(tagScope_.find(tag));
             tagLoc = t.getLoc();
          }
@@ -2464,7 +2486,7 @@ typename Parser<T>::DeclarationSpecifier Parser<T>::parseDeclarationSpecifierLis
          Type maxTy{};
          Type currentTy;
          if (Token t = consumeAnyOf(TK::IDENT)) {
-            tag = t.getValue<Ident>();
+            tag = t.getIdent();
             completesTy = static_cast<Type *>(tagScope_.find(tag));
             tagLoc = t.getLoc();
          }
@@ -2490,7 +2512,7 @@ typename Parser<T>::DeclarationSpecifier Parser<T>::parseDeclarationSpecifierLis
             }
             do {
                Token enumConstant = expect(TK::IDENT);
-               Ident name = enumConstant.getValue<Ident>();
+               Ident name = enumConstant.getIdent();
                parseOptAttributeSpecifierSequence();
                if (consumeAnyOf(TK::ASSIGN)) {
                   expr_t constant = parseConditionalExpr();
@@ -2688,9 +2710,9 @@ template <typename T>
 std::vector<typename Parser<T>::attr_t> Parser<T>::parseOptAttributeSpecifierSequence() {
    // todo: (jr) not implemented
    std::vector<Token> attrs{};
-   static Ident GNU_ATTRIBUTE_IDENTIFIER{"__attribute__"};
+   static Ident GNU_ATTRIBUTE_IDENTIFIER{Ident::Static{}, "__attribute__"};
    bool isGNUAttribute = false;
-   if (hasAnyOf(TK::IDENT) && pos_->getValue<Ident>() == GNU_ATTRIBUTE_IDENTIFIER) {
+   if (hasAnyOf(TK::IDENT) && pos_->getIdent() == GNU_ATTRIBUTE_IDENTIFIER) {
       isGNUAttribute = true;
    }
    while (pos_ && ((hasAnyOf(TK::L_BRACKET) && pos_.peek() == TK::L_BRACKET) || isGNUAttribute)) {
@@ -2707,11 +2729,11 @@ std::vector<typename Parser<T>::attr_t> Parser<T>::parseOptAttributeSpecifierSeq
          }
 
          Token t = expect(TK::IDENT);
-         Ident attr = t.getValue<Ident>();
+         Ident attr = t.getIdent();
          if (consumeAnyOf(TK::D_COLON)) {
             t = expect(TK::IDENT);
             attr += "::";
-            attr += t.getValue<Ident>();
+            attr += t.getIdent();
          }
          attrs.push_back(t);
          ++attrCount;
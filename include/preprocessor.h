@@ -0,0 +1,240 @@
+#ifndef QCP_PREPROCESSOR_H
+#define QCP_PREPROCESSOR_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+// ---------------------------------------------------------------------------
+namespace qcp {
+namespace pp {
+// ---------------------------------------------------------------------------
+// contents of source files read by the preprocessor, shared by all
+// translation units of the process. entries are revalidated with stat().
+class FileCache {
+   public:
+   struct File {
+      std::string path;
+      std::string contents;
+      std::int64_t mtime;
+      std::int64_t size;
+   };
+
+   // returns nullptr if the file cannot be read
+   std::shared_ptr<const File> get(const std::string& path);
+   // reads fd until the end of the input without caching the result, e.g. for stdin
+   static std::shared_ptr<File> read(int fd, std::string path);
+
+   // the include guard macro of a file, if the whole file is guarded by one
+   std::optional<std::string> guard(const std::shared_ptr<const File>& file);
+   void setGuard(const std::shared_ptr<const File>& file, std::string macro);
+
+   private:
+   struct Entry {
+      std::shared_ptr<const File> file;
+      std::optional<std::string> guard;
+   };
+
+   std::mutex mutex_;
+   std::unordered_map<std::string, Entry> entries_;
+};
+// ---------------------------------------------------------------------------
+// an in-process C preprocessor. the output is C source with gcc-style line
+// markers, ready to be consumed by the Tokenizer.
+class Preprocessor {
+   public:
+   Preprocessor(FileCache& cache, std::ostream& log);
+
+   Preprocessor(const Preprocessor&) = delete;
+   Preprocessor& operator=(const Preprocessor&) = delete;
+
+   void addIncludeDir(std::string dir);
+   // NAME, NAME=VALUE or NAME(PARAMS)=VALUE as given to -D
+   void define(std::string_view def);
+   void undefine(std::string_view name);
+
+   // preprocesses filename and appends the result to out, returns false on errors
+   bool run(const std::string& filename, std::string& out);
+   bool run(std::shared_ptr<const FileCache::File> file, std::string& out);
+
+   // every file opened while preprocessing, the main file first. files found by __has_include
+   // are included, their contents do not matter but their presence does
+   const std::vector<std::string>& dependencies() const {
+      return dependencies_;
+   }
+
+   // include candidates that did not exist, a file created there changes the output
+   const std::set<std::string>& missing() const {
+      return missing_;
+   }
+
+   // __DATE__ or __TIME__ was expanded, the output differs between runs
+   bool timeDependent() const {
+      return timeDependent_;
+   }
+
+   private:
+   struct Macro;
+
+   // macros a token must not be expanded by anymore
+   struct HideSet {
+      const Macro* macro;
+      const HideSet* next;
+   };
+
+   struct Token {
+      enum class Kind : unsigned char {
+         IDENT,
+         NUMBER,
+         STRING,
+         CHAR,
+         PUNCT,
+         OTHER,
+      };
+
+      bool is(std::string_view s) const {
+         return text == s;
+      }
+
+      std::string_view text;
+      const HideSet* hideSet = nullptr;
+      Kind kind;
+      bool space = false; // preceded by whitespace
+   };
+   using TokenList = std::vector<Token>;
+
+   struct Macro {
+      enum class Builtin : unsigned char {
+         NONE,
+         FILE,
+         LINE,
+         COUNTER,
+         DATE,
+         TIME,
+         PRAGMA,
+      };
+
+      std::string name;
+      TokenList body{};
+      std::vector<std::string_view> params{};
+      Builtin builtin = Builtin::NONE;
+      bool fnLike = false;
+      bool variadic = false;
+   };
+
+   struct Source {
+      std::shared_ptr<const FileCache::File> file;
+      std::string name; // as shown in line markers and diagnostics
+      std::string dir;
+      std::size_t pos = 0;
+      unsigned line = 1; // physical line of pos
+      std::size_t condDepth;
+      // index of the include directory the file was found in, for #include_next
+      std::size_t dirIndex;
+      // include guard detection
+      enum class Guard : unsigned char {
+         START,
+         OPEN,
+         CLOSED,
+         NONE,
+      } guardState = Guard::START;
+      std::string_view guard{};
+   };
+
+   struct Cond {
+      bool active;       // the current branch is emitted
+      bool taken;        // one of the branches was active
+      bool parentActive; // the enclosing group is emitted
+      bool sawElse = false;
+   };
+
+   struct StringHash {
+      using is_transparent = void;
+      std::size_t operator()(std::string_view s) const {
+         return std::hash<std::string_view>{}(s);
+      }
+   };
+   using MacroMap = std::unordered_map<std::string, Macro, StringHash, std::equal_to<>>;
+
+   // reading
+   bool readLine(Source& src, std::string_view& line, unsigned& firstLine);
+   void lexLine(std::string_view line, TokenList& tokens);
+   void pushSource(std::shared_ptr<const FileCache::File> file, std::string name, std::size_t dirIndex);
+   void popSource();
+
+   // directives
+   void handleDirective(TokenList& tokens, unsigned line);
+   void handleDefine(const TokenList& tokens, std::size_t i, unsigned line);
+   void handleInclude(TokenList& tokens, std::size_t i, unsigned line, bool next);
+   void handleLine(TokenList& tokens, std::size_t i, unsigned line);
+   bool evalCondition(TokenList& tokens, std::size_t i, unsigned line);
+   bool parseHeaderName(TokenList& tokens, std::size_t i, std::string& name, bool& angled, unsigned line);
+   std::shared_ptr<const FileCache::File> findInclude(const std::string& name, bool angled, std::size_t firstDir, std::string& path, std::size_t& dirIndex);
+   void invalidateGuard(Source& src);
+   // for #ifdef and defined, __has_include counts as a macro
+   bool isMacroDefined(std::string_view name) const;
+
+   // macro expansion
+   void expand(std::deque<Token>& in, TokenList& out, bool readMoreLines);
+   bool expandMacro(const Macro& m, const Token& tok, std::deque<Token>& in, bool readMoreLines);
+   bool collectArgs(const Macro& m, std::deque<Token>& in, bool readMoreLines, std::vector<TokenList>& args, Token& rparen);
+   TokenList substitute(const Macro& m, const std::vector<TokenList>& args, const Token& macroTok);
+   bool peekToken(std::deque<Token>& in, bool readMoreLines);
+   bool refill(std::deque<Token>& in);
+   Token stringize(const TokenList& arg);
+   bool paste(Token& lhs, const Token& rhs);
+   Token makeToken(std::string text, Token::Kind kind);
+   const Macro* findMacro(const Token& tok) const;
+
+   const HideSet* hideSetAdd(const HideSet* hs, const Macro* m);
+   const HideSet* hideSetUnion(const HideSet* a, const HideSet* b);
+   const HideSet* hideSetIntersection(const HideSet* a, const HideSet* b);
+   static bool hideSetContains(const HideSet* hs, const Macro* m);
+
+   // output
+   void syncLine(unsigned line);
+   void emitMarker(unsigned line, int flag);
+   void emitTokens(const TokenList& tokens, std::string_view line);
+
+   // diagnostics
+   std::ostream& diag(unsigned line, const char* kind);
+   std::ostream& error(unsigned line);
+
+   FileCache& cache_;
+   std::ostream& log_;
+   std::vector<std::string> includeDirs_{};
+   std::vector<std::string> dependencies_{};
+   std::set<std::string> missing_{};
+   std::unordered_set<std::string> pragmaOnce_{};
+   std::string date_;
+   std::string time_;
+
+   MacroMap macros_{};
+   std::vector<Source> sources_{};
+   std::vector<Cond> conds_{};
+   // keeps token texts and hide sets alive for the lifetime of the preprocessor
+   std::deque<std::string> strings_{};
+   std::deque<HideSet> hideSets_{};
+
+   std::string* out_ = nullptr;
+   unsigned outLine_ = 0;
+   unsigned currentLine_ = 0;
+   unsigned counter_ = 0;
+   unsigned errors_ = 0;
+   bool timeDependent_ = false;
+};
+// ---------------------------------------------------------------------------
+} // namespace pp
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_PREPROCESSOR_H
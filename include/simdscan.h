@@ -0,0 +1,37 @@
+#ifndef QCP_SIMDSCAN_H
+#define QCP_SIMDSCAN_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include <vector>
+// ---------------------------------------------------------------------------
+namespace qcp::simd {
+// ---------------------------------------------------------------------------
+// the scans of the tokenizer and line table, 16 or 32 bytes at a time where the cpu allows.
+// the vector code is picked once at startup based on the cpu
+enum class Isa {
+   SCALAR,
+   SSE2,
+   AVX2,
+};
+// ---------------------------------------------------------------------------
+// the best instruction set the cpu supports
+Isa detect();
+// switches all scans to isa, or the best the cpu has if it lacks isa, e.g. to compare them
+// in benchmarks. not thread-safe, returns the previous one
+Isa use(Isa isa);
+// ---------------------------------------------------------------------------
+// the first character that may start a token or is a newline, end if there is none
+const char* findTokenStart(const char* begin, const char* end);
+// the first character that cannot continue an identifier
+const char* findIdentEnd(const char* begin, const char* end);
+// the first newline, end if there is none
+const char* findNewline(const char* begin, const char* end);
+// the '*' of the first "*/", end if there is none
+const char* findCommentEnd(const char* begin, const char* end);
+// appends the offsets from base of all newlines in [begin, end)
+void findNewlines(const char* base, const char* begin, const char* end, std::vector<long long>& offsets);
+// ---------------------------------------------------------------------------
+} // namespace qcp::simd
+// ---------------------------------------------------------------------------
+#endif // QCP_SIMDSCAN_H
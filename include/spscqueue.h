@@ -0,0 +1,49 @@
+#ifndef QCP_SPSCQUEUE_H
+#define QCP_SPSCQUEUE_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include <array>
+#include <atomic>
+#include <cstddef>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+// a bounded lock-free queue between exactly one producer and one consumer
+// thread. push and pop block while the queue is full or empty.
+template <typename T, std::size_t N>
+class SPSCQueue {
+   static_assert((N & (N - 1)) == 0, "capacity must be a power of two");
+
+   public:
+   void push(T value) {
+      std::size_t tail = tail_.load(std::memory_order_relaxed);
+      for (std::size_t head = head_.load(std::memory_order_acquire); tail - head == N; head = head_.load(std::memory_order_acquire)) {
+         head_.wait(head, std::memory_order_acquire);
+      }
+      slots_[tail % N] = std::move(value);
+      tail_.store(tail + 1, std::memory_order_release);
+      tail_.notify_one();
+   }
+
+   T pop() {
+      std::size_t head = head_.load(std::memory_order_relaxed);
+      for (std::size_t tail = tail_.load(std::memory_order_acquire); tail == head; tail = tail_.load(std::memory_order_acquire)) {
+         tail_.wait(tail, std::memory_order_acquire);
+      }
+      T value = std::move(slots_[head % N]);
+      head_.store(head + 1, std::memory_order_release);
+      head_.notify_one();
+      return value;
+   }
+
+   private:
+   // written by the consumer and the producer respectively, kept on separate cache lines
+   alignas(64) std::atomic<std::size_t> head_{0};
+   alignas(64) std::atomic<std::size_t> tail_{0};
+   alignas(64) std::array<T, N> slots_{};
+};
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_SPSCQUEUE_H
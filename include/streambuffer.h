@@ -0,0 +1,64 @@
+#ifndef QCP_STREAMBUFFER_H
+#define QCP_STREAMBUFFER_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string_view>
+#include <thread>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+// input that is still being produced, e.g. the output of a preprocessor
+// read through a pipe. a background thread reads the file descriptor into
+// a buffer that never moves, so views into it stay valid while it grows.
+// only complete lines are made available until the input ends.
+class StreamBuffer {
+   public:
+   static constexpr std::size_t DEFAULT_CAPACITY = std::size_t{1} << 30;
+
+   // takes ownership of fd
+   explicit StreamBuffer(int fd, std::size_t capacity = DEFAULT_CAPACITY);
+   ~StreamBuffer();
+
+   StreamBuffer(const StreamBuffer&) = delete;
+   StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+   // blocks until more than size bytes are available or the input is complete,
+   // returns the number of available bytes
+   std::size_t wait(std::size_t size) const;
+
+   // blocks until the input is complete
+   std::string_view finish() const {
+      return {data_, wait(static_cast<std::size_t>(-1))};
+   }
+
+   const char* data() const {
+      return data_;
+   }
+
+   // a read error occured or the input did not fit into the buffer
+   bool failed() const {
+      return failed_;
+   }
+
+   private:
+   void read();
+
+   char* data_;
+   std::size_t capacity_;
+   int fd_;
+   std::atomic<std::size_t> available_{0};
+   bool done_ = false;
+   bool failed_ = false;
+   mutable std::mutex mutex_;
+   mutable std::condition_variable cv_;
+   std::thread reader_;
+};
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_STREAMBUFFER_H
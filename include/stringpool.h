@@ -3,6 +3,8 @@
 // ---------------------------------------------------------------------------
 // qcp
 // ---------------------------------------------------------------------------
+#include <deque>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -10,21 +12,36 @@
 // ---------------------------------------------------------------------------
 namespace qcp {
 // ---------------------------------------------------------------------------
+// the pool is shared by all translation units of a process and may be used
+// from multiple compile jobs at once
 class StringPool {
    public:
    static unsigned insert(const char *str);
    static unsigned insert(std::string &&str);
+   // the string keeps its index across reset(), for Idents held by statics
+   static unsigned insertStatic(const char *str);
 
    static std::string_view get(unsigned idx);
 
+   // drops every string but the ones of insertStatic(), no Ident of an
+   // earlier translation unit may be used afterwards
+   static void reset();
+
    private:
+   static std::shared_mutex mutex_;
    static std::unordered_map<std::size_t, std::vector<unsigned>> map_;
-   static std::vector<std::string> strings_;
+   // deque: references to the stored strings stay valid on insertion
+   static std::deque<std::string> strings_;
+   static std::vector<unsigned> statics_;
 };
 // ---------------------------------------------------------------------------
 class Ident {
    public:
+   // selects the constructor for Idents held by statics, they stay valid across StringPool::reset()
+   struct Static {};
+
    Ident() : tag{0} {}
+   Ident(Static, const char *str) : tag{StringPool::insertStatic(str)} {}
    explicit Ident(unsigned tag) : tag{tag} {}
    explicit Ident(std::string_view str) : tag{StringPool::insert(std::string(str))} {}
    explicit Ident(const char *str) : tag{StringPool::insert(str)} {}
@@ -34,6 +51,10 @@ class Ident {
    operator std::string() const;
    operator bool() const;
 
+   unsigned getTag() const {
+      return tag;
+   }
+
    bool operator==(const Ident &other) const;
    bool operator!=(const Ident &other) const;
 
@@ -0,0 +1,66 @@
+#ifndef QCP_THINLTO_H
+#define QCP_THINLTO_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "llvmemitter.h"
+// ---------------------------------------------------------------------------
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+// ---------------------------------------------------------------------------
+namespace llvm {
+class MemoryBuffer;
+namespace lto {
+class LTO;
+} // namespace lto
+} // namespace llvm
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+// links the bitcode files of -flto=thin. the thin link imports functions
+// across modules based on their summaries, then every module is optimized
+// and compiled on its own by a pool of threads. the objects are handed to
+// the system linker like those of a normal compilation.
+class ThinLTO {
+   public:
+   struct Options {
+      // target and pipeline of the backends
+      emitter::LLVMEmitter::Options codegen{};
+      // modules compiled in parallel
+      unsigned threads = 1;
+      // backend outputs are reused from here by module hash, empty if caching is disabled
+      std::string cacheDir{};
+      // symbols that stay visible besides main, everything else may be internalized
+      std::vector<std::string> exports{};
+   };
+
+   explicit ThinLTO(Options options);
+   ~ThinLTO();
+
+   ThinLTO(const ThinLTO&) = delete;
+   ThinLTO& operator=(const ThinLTO&) = delete;
+
+   // whether the file at path is bitcode, other objects are passed on to the system linker
+   static bool isBitcode(const std::string& path);
+   // adds the bitcode file with a module summary in fd, name identifies the module
+   bool add(int fd, const std::string& name, std::ostream& log);
+   // runs the thin link and the backends, returns the object files, nullopt on errors
+   std::optional<std::vector<std::FILE*>> run(std::ostream& log);
+
+   private:
+   Options options_;
+   std::unique_ptr<llvm::lto::LTO> lto_;
+   // the inputs refer to their buffers until the link is done
+   std::vector<std::unique_ptr<llvm::MemoryBuffer>> buffers_;
+   // symbols with a prevailing definition
+   std::unordered_set<std::string> defined_;
+};
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_THINLTO_H
@@ -7,16 +7,16 @@
 #include "stringpool.h"
 // ---------------------------------------------------------------------------
 #include <cassert>
+#include <cstdint>
 // Alexis hates iostream
 #include <iostream>
-#include <string>
-#include <string_view>
-#include <variant>
+#include <limits>
+#include <type_traits>
 // ---------------------------------------------------------------------------
 namespace qcp {
 namespace token {
 // ---------------------------------------------------------------------------
-enum class Kind {
+enum class Kind : std::uint8_t {
 #include "defs/tokens.def"
 };
 // ---------------------------------------------------------------------------
@@ -27,29 +27,18 @@ struct GPerfToken {
    int tokenType = static_cast<int>(Kind::UNKNOWN);
 };
 // ---------------------------------------------------------------------------
+// a token is its kind and where it is in the source. identifiers carry their
+// Ident, literals the index of their payload in the tokenizer, which decodes
+// it only when it is asked for. tokens are copied around freely by the parser
 class Token {
    public:
-   using data_t = std::variant<Ident, std::string, unsigned long long, long double>;
-
    Token() : type{Kind::UNKNOWN} {}
-
-   Token(SrcLoc loc, float value) : type{Kind::FCONST}, value{value}, loc_{loc} {}
-   Token(SrcLoc loc, double value) : type{Kind::DCONST}, value{value}, loc_{loc} {}
-   Token(SrcLoc loc, long double value) : type{Kind::LDCONST}, value{value}, loc_{loc} {}
-
-   Token(SrcLoc loc, unsigned long long value) : type{Kind::ULL_ICONST}, value{value}, loc_{loc} {}
-   Token(SrcLoc loc, unsigned long value) : type{Kind::UL_ICONST}, value{value}, loc_{loc} {}
-   Token(SrcLoc loc, unsigned value) : type{Kind::U_ICONST}, value{value}, loc_{loc} {}
-   Token(SrcLoc loc, long long value) : type{Kind::LL_ICONST}, value{static_cast<unsigned long long>(value)}, loc_{loc} {}
-   Token(SrcLoc loc, long value) : type{Kind::L_ICONST}, value{static_cast<unsigned long long>(value)}, loc_{loc} {}
-   Token(SrcLoc loc, int value) : type{Kind::ICONST}, value{static_cast<unsigned long long>(value)}, loc_{loc} {}
-
-   Token(SrcLoc loc, std::string&& value, Kind type) : type{type}, value{std::move(value)}, loc_{loc} { assert(type == Kind::SLITERAL || type == Kind::CLITERAL); }
-   Token(SrcLoc loc, Ident id, Kind type = Kind::IDENT) : type{type}, value{id}, loc_{loc} { assert(type != Kind::SLITERAL && type != Kind::CLITERAL); }
-
-   explicit Token(Kind type) : type{type}, loc_{} {}
-   Token(SrcLoc loc, Kind type) : type{type}, loc_{loc} {}
-   Token(SrcLoc loc, const GPerfToken& gperfToken) : type{static_cast<Kind>(gperfToken.tokenType)}, loc_{loc} {}
+   explicit Token(Kind type) : type{type} {}
+   Token(SrcLoc loc, Kind type, std::uint32_t payload = 0) : type{type}, offset_{static_cast<std::uint32_t>(loc.loc())}, len_{loc.len()}, payload_{payload} {
+      assert(loc.loc() >= 0 && loc.loc() <= std::numeric_limits<std::uint32_t>::max() && "token offset out of range");
+   }
+   Token(SrcLoc loc, Ident id) : Token{loc, Kind::IDENT, id.getTag()} {}
+   Token(SrcLoc loc, const GPerfToken& gperfToken) : Token{loc, static_cast<Kind>(gperfToken.tokenType)} {}
 
    Kind getKind() const {
       return type;
@@ -70,35 +59,26 @@ class Token {
       return type <=> other.type;
    }
 
-   template <typename T>
-   T getValue() const {
-      if constexpr (std::is_integral_v<T>) {
-         return static_cast<T>(std::get<unsigned long long>(value));
-      } else if constexpr (std::is_floating_point_v<T>) {
-         return static_cast<T>(std::get<long double>(value));
-      } else {
-         static_assert(std::is_same_v<T, std::string> || std::is_same_v<T, Ident>, "Invalid type for Token::getValue");
-         return std::get<T>(value);
-      }
+   Ident getIdent() const {
+      assert(type == Kind::IDENT);
+      return Ident{payload_};
    }
 
-   std::string_view getString() const {
-      return std::get<std::string>(value);
+   std::uint32_t getPayload() const {
+      return payload_;
    }
 
    SrcLoc getLoc() const {
-      return loc_;
-   }
-
-   data_t getRawValue() const {
-      return value;
+      return SrcLoc{static_cast<SrcLoc::loc_off_t>(offset_), len_};
    }
 
    private:
    Kind type;
-   data_t value;
-   SrcLoc loc_;
+   std::uint32_t offset_ = 0;
+   std::uint32_t len_ = 0;
+   std::uint32_t payload_ = 0;
 };
+static_assert(sizeof(Token) <= 16 && std::is_trivially_copyable_v<Token>);
 // ---------------------------------------------------------------------------
 std::ostream& operator<<(std::ostream& os, const Token& token);
 // ---------------------------------------------------------------------------
@@ -0,0 +1,110 @@
+#ifndef QCP_TOKENBUFFER_H
+#define QCP_TOKENBUFFER_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "tokenizer.h"
+// ---------------------------------------------------------------------------
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <vector>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+// the tokens of a tokenizer for the parser. every token is lexed exactly once,
+// tokens looked ahead at are kept in a ring buffer until they are consumed.
+// large programs may instead be lexed up front on several threads
+class TokenBuffer {
+   using TK = token::Kind;
+   using Token = token::Token;
+   static constexpr unsigned CAPACITY = 4;
+   static_assert((CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+   public:
+   // the number of tokens after the current one that peek can look at
+   static constexpr unsigned LOOKAHEAD = CAPACITY - 1;
+
+   explicit TokenBuffer(const Tokenizer& tokenizer, unsigned threads = 1) {
+      if (threads > 1) {
+         tokens_ = tokenizer.tokenize(threads);
+      }
+      if (tokens_.empty()) {
+         it_ = tokenizer.begin();
+         ring_[0] = *it_;
+         prevLoc_ = it_.getPrevLoc();
+         current_ = &ring_[0];
+      } else {
+         current_ = tokens_.data();
+      }
+   }
+
+   TokenBuffer(const TokenBuffer&) = delete;
+   TokenBuffer& operator=(const TokenBuffer&) = delete;
+
+   const Token& operator*() const {
+      return *current_;
+   }
+
+   const Token* operator->() const {
+      return current_;
+   }
+
+   TokenBuffer& operator++() {
+      if (!tokens_.empty()) {
+         prevLoc_ = current_->getLoc();
+         // stays at the end like the tokenizer
+         current_ += current_ != &tokens_.back();
+         return *this;
+      }
+      if (size_ == 1) {
+         fill();
+      }
+      prevLoc_ = ring_[head_].getLoc();
+      head_ = (head_ + 1) & (CAPACITY - 1);
+      --size_;
+      current_ = &ring_[head_];
+      return *this;
+   }
+
+   // the kind of the k-th token after the current one
+   TK peek(unsigned k = 1) {
+      assert(k <= LOOKAHEAD && "lookahead exceeds the token buffer");
+      if (!tokens_.empty()) {
+         return current_[std::min<std::size_t>(k, &tokens_.back() - current_)].getKind();
+      }
+      while (size_ <= k) {
+         fill();
+      }
+      return ring_[(head_ + k) & (CAPACITY - 1)].getKind();
+   }
+
+   SrcLoc getPrevLoc() const {
+      return prevLoc_;
+   }
+
+   operator bool() const {
+      return current_->getKind() != TK::END;
+   }
+
+   private:
+   void fill() {
+      ++it_;
+      ring_[(head_ + size_) & (CAPACITY - 1)] = *it_;
+      ++size_;
+   }
+
+   Tokenizer::const_iterator it_{};
+   std::array<Token, CAPACITY> ring_{};
+   // the current token and the lexed ones after it
+   unsigned head_ = 0;
+   unsigned size_ = 1;
+   // all tokens up to END if they were lexed up front
+   std::vector<Token> tokens_{};
+   const Token* current_;
+   SrcLoc prevLoc_{};
+};
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_TOKENBUFFER_H
@@ -3,13 +3,14 @@
 // ---------------------------------------------------------------------------
 // qcp
 // ---------------------------------------------------------------------------
+#include <cstdint>
 // alexis hates iostream
 #include <iostream>
 // ---------------------------------------------------------------------------
 namespace qcp {
 namespace token {
 // ---------------------------------------------------------------------------
-enum class Kind;
+enum class Kind : std::uint8_t;
 // ---------------------------------------------------------------------------
 // an array of counters for each token kind
 // useful for determining type specifiers
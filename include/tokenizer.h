@@ -3,12 +3,19 @@
 // ---------------------------------------------------------------------------
 // qcp
 // ---------------------------------------------------------------------------
+#include "arena.h"
 #include "diagnostics.h"
 #include "keywords.h"
+#include "streambuffer.h"
 #include "stringpool.h"
 // ---------------------------------------------------------------------------
+#include <cstdint>
 #include <limits>
+#include <optional>
+#include <string>
 #include <string_view>
+#include <type_traits>
+#include <vector>
 // ---------------------------------------------------------------------------
 namespace qcp {
 // ---------------------------------------------------------------------------
@@ -19,6 +26,10 @@ class Tokenizer {
 
    public:
    explicit Tokenizer(const std::string_view prog, DiagnosticTracker& diagnistics) : prog_{prog}, diagnostics_{diagnistics} {}
+   // tokenizes the input while it is still being read
+   explicit Tokenizer(const StreamBuffer& stream, DiagnosticTracker& diagnistics) : prog_{stream.data(), stream.wait(0)}, diagnostics_{diagnistics}, stream_{&stream} {
+      diagnostics_.extendProgram(prog_);
+   }
 
    explicit Tokenizer(const Tokenizer&) = delete;
    Tokenizer& operator=(const Tokenizer&) = delete;
@@ -35,15 +46,11 @@ class Tokenizer {
 
       private:
       public:
-      explicit const_iterator() : token_{TK::END}, prog_{}, progBegin_{prog_.begin()}, pp{0}, diagnostics_{nullptr} {}
-      explicit const_iterator(const std::string_view prog_, DiagnosticTracker& diagnistics) : token_{TK::UNKNOWN}, prog_{prog_}, progBegin_{prog_.begin()}, pp{!prog_.empty() && prog_.front() == '#' ? 1 : 0}, diagnostics_{&diagnistics} {
-         if (pp) {
-            token_ = Token{SrcLoc{0, 1u}, TK::PP_START};
-            this->prog_ = prog_.substr(1);
-         } else {
-            ++(*this);
-         }
-      }
+      explicit const_iterator() : token_{TK::END}, prog_{}, progBegin_{prog_.begin()}, pp{0}, tokenizer_{nullptr}, diagnostics_{nullptr} {}
+      explicit const_iterator(const Tokenizer& tokenizer) : const_iterator{tokenizer, 0, std::string_view::npos, true, 0} {}
+      // lexes from the offset begin in the state another iterator stopped in. the tokens end with
+      // END before the first one the lexer reaches at or after the offset limit
+      explicit const_iterator(const Tokenizer& tokenizer, std::size_t begin, std::size_t limit, bool lineStart, int pp);
 
       const_iterator& operator++();
       const_iterator operator++(int);
@@ -64,16 +71,20 @@ class Tokenizer {
          return token_ <=> other.token_;
       }
 
-      token::Kind peek() const {
-         auto next = *this;
-         ++next;
-         return next->getKind();
-      }
-
       SrcLoc getPrevLoc() const {
          return prevLoc_;
       }
 
+      // where the lexer stopped at the limit, past it if a comment spans the limit
+      std::size_t stop() const {
+         return stop_;
+      }
+
+      // whether the lexer stopped within a preprocessor line
+      int inPP() const {
+         return pp;
+      }
+
       operator bool() const {
          return token_.getKind() != TK::END;
       }
@@ -83,13 +94,19 @@ class Tokenizer {
       sv_it getPunctuator(sv_it begin);
       sv_it getSCharSequence(sv_it begin);
       sv_it getCCharSequence(sv_it begin);
+      bool refill();
+      const_iterator& stopAt(sv_it begin);
 
       Token token_;
       std::string_view prog_;
       sv_it progBegin_;
       SrcLoc prevLoc_{};
       int pp;
+      const Tokenizer* tokenizer_;
       DiagnosticTracker* diagnostics_;
+      const StreamBuffer* stream_ = nullptr;
+      std::size_t limit_ = std::string_view::npos;
+      std::size_t stop_ = 0;
    };
 
    const_iterator begin() const;
@@ -99,9 +116,59 @@ class Tokenizer {
 
    const std::string_view& data() const;
 
+   // lexes the whole program on up to threads threads. it is split into chunks at line
+   // breaks, a chunk that does not start where the one before it stopped, e.g. within a
+   // comment, is lexed again on this thread until both agree on a token, one with
+   // diagnostics completely. so the tokens and diagnostics are the same as without threads,
+   // but the diagnostics of the lexer come before those of the parser. empty if the program
+   // is too small to be split or is still being read
+   std::vector<Token> tokenize(unsigned threads) const;
+
+   // the value of a literal or identifier token, numbers are converted on first use
+   template <typename T>
+   T getValue(const Token& token) const {
+      if constexpr (std::is_same_v<T, Ident>) {
+         return token.getIdent();
+      } else if constexpr (std::is_integral_v<T>) {
+         return static_cast<T>(getNumber(token).integer);
+      } else {
+         static_assert(std::is_floating_point_v<T>, "Invalid type for Tokenizer::getValue");
+         return static_cast<T>(getNumber(token).floating);
+      }
+   }
+
+   // the bytes of a string or character literal. they are viewed in the program if the
+   // literal has no escapes, otherwise decoded into the arena on first use
+   std::string_view getString(const Token& token) const;
+   // the bytes of adjacent string literals, the last one is appended to the bytes of the
+   // ones before it, which are grown in place if they were the last ones decoded
+   std::string_view getString(std::string_view prefix, const Token& token) const;
+
    private:
+   // a numeric literal, the payload of its token is the index in numbers_
+   struct Number {
+      // the digits, without the prefix of hex and binary numbers
+      std::uint32_t begin;
+      std::uint32_t end;
+      std::uint8_t base;
+      bool valid;
+      bool decoded = false;
+      unsigned long long integer = 0;
+      long double floating = 0;
+   };
+
+   const Number& getNumber(const Token& token) const;
+   // appends the decoded bytes of a literal to the last string of the arena
+   void decodeString(const Token& token) const;
+
    const std::string_view prog_;
    DiagnosticTracker& diagnostics_;
+   const StreamBuffer* stream_ = nullptr;
+   // the payloads of the literals of this translation unit, filled by the iterators. the
+   // payload of a string or character literal with escapes is its index in strings_ + 1
+   mutable std::vector<Number> numbers_;
+   mutable std::vector<std::optional<std::string_view>> strings_;
+   mutable Arena arena_;
 };
 // ---------------------------------------------------------------------------
 template <typename T, typename U>
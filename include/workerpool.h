@@ -0,0 +1,79 @@
+#ifndef QCP_WORKERPOOL_H
+#define QCP_WORKERPOOL_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+// a fixed number of threads working off a FIFO queue of jobs
+class WorkerPool {
+   public:
+   explicit WorkerPool(unsigned threads) {
+      threads = threads ? threads : 1;
+      workers_.reserve(threads);
+      for (unsigned i = 0; i < threads; ++i) {
+         workers_.emplace_back([this] { work(); });
+      }
+   }
+
+   WorkerPool(const WorkerPool&) = delete;
+   WorkerPool& operator=(const WorkerPool&) = delete;
+
+   // finishes all queued jobs before returning
+   ~WorkerPool() {
+      {
+         std::lock_guard lock{mutex_};
+         stop_ = true;
+      }
+      cv_.notify_all();
+      for (auto& worker : workers_) {
+         worker.join();
+      }
+   }
+
+   void run(std::function<void()> job) {
+      {
+         std::lock_guard lock{mutex_};
+         jobs_.push_back(std::move(job));
+      }
+      cv_.notify_one();
+   }
+
+   unsigned size() const {
+      return static_cast<unsigned>(workers_.size());
+   }
+
+   private:
+   void work() {
+      while (true) {
+         std::function<void()> job;
+         {
+            std::unique_lock lock{mutex_};
+            cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+            if (jobs_.empty()) {
+               return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+         }
+         job();
+      }
+   }
+
+   std::mutex mutex_;
+   std::condition_variable cv_;
+   std::deque<std::function<void()>> jobs_;
+   std::vector<std::thread> workers_;
+   bool stop_ = false;
+};
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
+#endif // QCP_WORKERPOOL_H
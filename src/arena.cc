@@ -0,0 +1,37 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "arena.h"
+// ---------------------------------------------------------------------------
+#include <algorithm>
+#include <cstring>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+void Arena::append(const char *begin, const char *end) {
+   auto size = static_cast<std::size_t>(end - begin);
+   if (static_cast<std::size_t>(end_ - top_) < size) {
+      grow(size);
+   }
+   if (size) {
+      std::memcpy(top_, begin, size);
+      top_ += size;
+   }
+}
+// ---------------------------------------------------------------------------
+void Arena::grow(std::size_t size) {
+   // at least doubles a string that outgrows its block, so it is moved only a few times
+   std::size_t used = static_cast<std::size_t>(top_ - begin_);
+   std::size_t capacity = std::max(BLOCK_SIZE, 2 * (used + size));
+   blocks_.push_back(std::make_unique_for_overwrite<char[]>(capacity));
+   char *block = blocks_.back().get();
+   if (used) {
+      std::memcpy(block, begin_, used);
+   }
+   begin_ = block;
+   top_ = block + used;
+   end_ = block + capacity;
+}
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
@@ -0,0 +1,1583 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "bytecodeemitter.h"
+#include "basetype.h"
+#include "constantfolding.h"
+#include "operator.h"
+#include "type.h"
+#include "typefactory.h"
+// ---------------------------------------------------------------------------
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <unordered_set>
+#include <dlfcn.h>
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+using BytecodeEmitter = qcp::emitter::BytecodeEmitter;
+using OpKind = qcp::op::Kind;
+using Ty = BytecodeEmitter::Ty;
+using TyKind = BytecodeEmitter::Ty::Kind;
+using Value = BytecodeEmitter::Value;
+using ValueKind = BytecodeEmitter::Value::Kind;
+using Constant = BytecodeEmitter::Constant;
+using BasicBlock = BytecodeEmitter::BasicBlock;
+using Function = BytecodeEmitter::Function;
+using Instr = BytecodeEmitter::Instr;
+using Call = BytecodeEmitter::Call;
+using Type = typename BytecodeEmitter::Type;
+// ---------------------------------------------------------------------------
+// integers are held zero extended from the width of their type, the bits field of an
+// instruction says which width its signed operands are extended from and its result is
+// truncated to. floats are held in the lower half of a register.
+// a = b op c unless noted otherwise
+#define BYTECODE_OPS(X) \
+   X(MOV) \
+   X(ADD) \
+   X(SUB) \
+   X(MUL) \
+   X(SDIV) \
+   X(UDIV) \
+   X(SREM) \
+   X(UREM) \
+   X(AND) \
+   X(OR) \
+   X(XOR) \
+   X(SHL) \
+   X(LSHR) \
+   X(ASHR) \
+   X(EQ) \
+   X(NE) \
+   X(SLT) \
+   X(SLE) \
+   X(SGT) \
+   X(SGE) \
+   X(ULT) \
+   X(ULE) \
+   X(UGT) \
+   X(UGE) \
+   X(NEG) \
+   X(NOT) \
+   /* a = b + c, c is a signed immediate */ \
+   X(ADDI) \
+   /* a = b * c, c is a signed immediate */ \
+   X(SCALE) \
+   /* c is the width of the result */ \
+   X(SEXT) \
+   X(TRUNC) \
+   X(FADD) \
+   X(FSUB) \
+   X(FMUL) \
+   X(FDIV) \
+   X(FEQ) \
+   X(FNE) \
+   X(FLT) \
+   X(FLE) \
+   X(FGT) \
+   X(FGE) \
+   X(FNEG) \
+   X(DADD) \
+   X(DSUB) \
+   X(DMUL) \
+   X(DDIV) \
+   X(DEQ) \
+   X(DNE) \
+   X(DLT) \
+   X(DLE) \
+   X(DGT) \
+   X(DGE) \
+   X(DNEG) \
+   X(SITOF) \
+   X(SITOD) \
+   X(UITOF) \
+   X(UITOD) \
+   X(FTOSI) \
+   X(DTOSI) \
+   X(FTOUI) \
+   X(DTOUI) \
+   X(FTOD) \
+   X(DTOF) \
+   /* a = *b */ \
+   X(LOAD8) \
+   X(LOAD16) \
+   X(LOAD32) \
+   X(LOAD64) \
+   /* *b = a */ \
+   X(STORE8) \
+   X(STORE16) \
+   X(STORE32) \
+   X(STORE64) \
+   /* copies or clears c bytes at a */ \
+   X(COPY) \
+   X(ZERO) \
+   /* b, c and the operand of JMP are instruction indices */ \
+   X(JMP) \
+   X(BR) \
+   /* b is the index of the jump table */ \
+   X(SWITCH) \
+   /* b is the index of the call */ \
+   X(CALL) \
+   X(RET) \
+   X(RETV) \
+   X(TRAP)
+// ---------------------------------------------------------------------------
+enum Op : std::uint8_t {
+#define X(name) name,
+   BYTECODE_OPS(X)
+#undef X
+};
+// ---------------------------------------------------------------------------
+// the default target of a switch without one, the switch falls through to a trap
+constexpr std::uint32_t NO_TARGET = std::numeric_limits<std::uint32_t>::max();
+// ---------------------------------------------------------------------------
+// x86-64 System V
+constexpr unsigned INT_ARG_REGS = 6;
+constexpr unsigned FP_ARG_REGS = 8;
+constexpr unsigned STACK_ARGS = 8;
+// ---------------------------------------------------------------------------
+unsigned scalarBits(const Ty *ty) {
+   if (!ty) {
+      return 64;
+   }
+   switch (ty->kind) {
+      case TyKind::INT: return ty->bits;
+      case TyKind::FLOAT: return 32;
+      default: return 64;
+   }
+}
+// ---------------------------------------------------------------------------
+bool isFP(const Ty *ty) {
+   return ty && (ty->kind == TyKind::FLOAT || ty->kind == TyKind::DOUBLE);
+}
+// ---------------------------------------------------------------------------
+bool isAggregate(const Ty *ty) {
+   return ty && (ty->kind == TyKind::STRUCT || ty->kind == TyKind::ARRAY);
+}
+// ---------------------------------------------------------------------------
+bool isSigned(Type ty) {
+   return ty->isSignedTy() || ty->isSignedCharlikeTy();
+}
+// ---------------------------------------------------------------------------
+bool fitsInt32(std::int64_t value) {
+   return value >= std::numeric_limits<std::int32_t>::min() && value <= std::numeric_limits<std::int32_t>::max();
+}
+// ---------------------------------------------------------------------------
+std::uint64_t alignTo(std::uint64_t value, std::uint64_t align) {
+   return (value + align - 1) / align * align;
+}
+// ---------------------------------------------------------------------------
+std::uint64_t fpBits(double value, bool isDouble) {
+   return isDouble ? std::bit_cast<std::uint64_t>(value) : std::bit_cast<std::uint32_t>(static_cast<float>(value));
+}
+// ---------------------------------------------------------------------------
+bool isIntConstant(const Value *v) {
+   return v->kind == ValueKind::INT || v->kind == ValueKind::NULLPTR || v->kind == ValueKind::ZERO;
+}
+// ---------------------------------------------------------------------------
+double fpValue(const Constant *c) {
+   return c->kind == ValueKind::FP ? c->fp : static_cast<double>(static_cast<std::int64_t>(c->value));
+}
+// ---------------------------------------------------------------------------
+// the opcode of an integer binary operator, TRAP if there is none
+std::uint8_t intOp(OpKind kind, bool sign) {
+   switch (kind) {
+      case OpKind::ADD: return ADD;
+      case OpKind::SUB: return SUB;
+      case OpKind::MUL: return MUL;
+      case OpKind::DIV: return sign ? SDIV : UDIV;
+      case OpKind::REM: return sign ? SREM : UREM;
+      case OpKind::L_AND:
+      case OpKind::BW_AND: return AND;
+      case OpKind::L_OR:
+      case OpKind::BW_OR: return OR;
+      case OpKind::BW_XOR: return XOR;
+      case OpKind::SHL: return SHL;
+      case OpKind::SHR: return sign ? ASHR : LSHR;
+      case OpKind::EQ: return EQ;
+      case OpKind::NE: return NE;
+      case OpKind::LT: return sign ? SLT : ULT;
+      case OpKind::LE: return sign ? SLE : ULE;
+      case OpKind::GT: return sign ? SGT : UGT;
+      case OpKind::GE: return sign ? SGE : UGE;
+      default: return TRAP;
+   }
+}
+// ---------------------------------------------------------------------------
+// the opcode of a floating point binary operator, TRAP if there is none
+std::uint8_t fpOp(OpKind kind, bool isDouble) {
+   std::uint8_t op;
+   switch (kind) {
+      case OpKind::ADD: op = FADD; break;
+      case OpKind::SUB: op = FSUB; break;
+      case OpKind::MUL: op = FMUL; break;
+      case OpKind::DIV: op = FDIV; break;
+      case OpKind::EQ: op = FEQ; break;
+      case OpKind::NE: op = FNE; break;
+      case OpKind::LT: op = FLT; break;
+      case OpKind::LE: op = FLE; break;
+      case OpKind::GT: op = FGT; break;
+      case OpKind::GE: op = FGE; break;
+      default: return TRAP;
+   }
+   return isDouble ? op + (DADD - FADD) : op;
+}
+// ---------------------------------------------------------------------------
+std::uint64_t mask(std::uint64_t value, unsigned bits) {
+   return value & (~std::uint64_t{0} >> (64 - bits));
+}
+// ---------------------------------------------------------------------------
+std::int64_t sext(std::uint64_t value, unsigned bits) {
+   return static_cast<std::int64_t>(value << (64 - bits)) >> (64 - bits);
+}
+// ---------------------------------------------------------------------------
+float asFloat(std::uint64_t value) {
+   return std::bit_cast<float>(static_cast<std::uint32_t>(value));
+}
+// ---------------------------------------------------------------------------
+double asDouble(std::uint64_t value) {
+   return std::bit_cast<double>(value);
+}
+// ---------------------------------------------------------------------------
+std::uint64_t bits(float value) {
+   return std::bit_cast<std::uint32_t>(value);
+}
+// ---------------------------------------------------------------------------
+std::uint64_t bits(double value) {
+   return std::bit_cast<std::uint64_t>(value);
+}
+// ---------------------------------------------------------------------------
+struct Machine {
+   // the end of the interpreter stack
+   std::uint64_t *end;
+   // functions with bytecode, their address is the value of pointers to them
+   std::unordered_set<const Function *> fns;
+};
+// ---------------------------------------------------------------------------
+// calls a function of the process. integer arguments are passed in the six argument registers,
+// floating point arguments in the eight vector registers and the rest on the stack, like the
+// variadic call below does. al tells variadic callees how many vector registers are used.
+std::uint64_t callNative(void *target, const Call &call, const std::uint64_t *frame) {
+   std::uint64_t ints[INT_ARG_REGS] = {};
+   double fps[FP_ARG_REGS] = {};
+   std::uint64_t stack[STACK_ARGS] = {};
+   unsigned numInts = 0;
+   unsigned numFPs = 0;
+   unsigned numStack = 0;
+   for (std::size_t i = 0; i < call.args.size(); ++i) {
+      std::uint64_t value = frame[call.args[i]];
+      if (call.fpArgs[i] && numFPs < FP_ARG_REGS) {
+         fps[numFPs++] = asDouble(value);
+         continue;
+      } else if (call.signBits[i]) {
+         // narrow signed integers are extended to int
+         value = mask(static_cast<std::uint64_t>(sext(value, call.signBits[i])), 32);
+      }
+      if (!call.fpArgs[i] && numInts < INT_ARG_REGS) {
+         ints[numInts++] = value;
+      } else {
+         stack[numStack++] = value;
+      }
+   }
+#define NATIVE_ARGS ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], fps[0], fps[1], fps[2], fps[3], fps[4], fps[5], fps[6], fps[7], \
+                    stack[0], stack[1], stack[2], stack[3], stack[4], stack[5], stack[6], stack[7]
+   Ty *retTy = call.retTy;
+   if (retTy && retTy->kind == TyKind::DOUBLE) {
+      return bits(reinterpret_cast<double (*)(std::uint64_t, ...)>(target)(NATIVE_ARGS));
+   } else if (retTy && retTy->kind == TyKind::FLOAT) {
+      return bits(reinterpret_cast<float (*)(std::uint64_t, ...)>(target)(NATIVE_ARGS));
+   }
+   std::uint64_t result = reinterpret_cast<std::uint64_t (*)(std::uint64_t, ...)>(target)(NATIVE_ARGS);
+#undef NATIVE_ARGS
+   return mask(result, scalarBits(retTy && retTy->kind != TyKind::VOID ? retTy : nullptr));
+}
+// ---------------------------------------------------------------------------
+#pragma GCC diagnostic push
+// computed gotos are a GNU extension
+#pragma GCC diagnostic ignored "-Wpedantic"
+// runs fn in frame, the caller has stored the arguments to the first registers. every handler
+// jumps straight to the handler of the next instruction.
+std::uint64_t execute(const Function &fn, std::uint64_t *frame, Machine &machine) {
+   static const void *const handlers[] = {
+#define X(name) &&L_##name,
+      BYTECODE_OPS(X)
+#undef X
+   };
+
+   for (auto [reg, value] : fn.constantValues) {
+      frame[reg] = value;
+   }
+   char *base = reinterpret_cast<char *>(frame);
+   for (auto [reg, offset] : fn.locals) {
+      frame[reg] = reinterpret_cast<std::uint64_t>(base + offset);
+   }
+
+   const Instr *code = fn.code.data();
+   const Instr *ip = code;
+#define R(x) frame[ip->x]
+#define NEXT \
+   ++ip; \
+   goto *handlers[ip->op]
+#define INT_BINARY(name, expr) \
+   L_##name : { \
+      std::uint64_t l = R(b); \
+      std::uint64_t r = R(c); \
+      R(a) = mask(expr, ip->bits); \
+      NEXT; \
+   }
+#define FP_BINARY(name, T, conv, expr) \
+   L_##name : { \
+      T l = conv(R(b)); \
+      T r = conv(R(c)); \
+      R(a) = expr; \
+      NEXT; \
+   }
+#define CAST(name, expr) \
+   L_##name : { \
+      std::uint64_t v = R(b); \
+      R(a) = expr; \
+      NEXT; \
+   }
+
+   goto *handlers[ip->op];
+
+L_MOV:
+   R(a) = R(b);
+   NEXT;
+   INT_BINARY(ADD, l + r)
+   INT_BINARY(SUB, l - r)
+   INT_BINARY(MUL, l * r)
+   INT_BINARY(SDIV, static_cast<std::uint64_t>(sext(l, ip->bits) / sext(r, ip->bits)))
+   INT_BINARY(UDIV, l / r)
+   INT_BINARY(SREM, static_cast<std::uint64_t>(sext(l, ip->bits) % sext(r, ip->bits)))
+   INT_BINARY(UREM, l % r)
+   INT_BINARY(AND, l & r)
+   INT_BINARY(OR, l | r)
+   INT_BINARY(XOR, l ^ r)
+   INT_BINARY(SHL, l << (r & 63))
+   INT_BINARY(LSHR, l >> (r & 63))
+   INT_BINARY(ASHR, static_cast<std::uint64_t>(sext(l, ip->bits) >> (r & 63)))
+   INT_BINARY(EQ, std::uint64_t{l == r})
+   INT_BINARY(NE, std::uint64_t{l != r})
+   INT_BINARY(SLT, std::uint64_t{sext(l, ip->bits) < sext(r, ip->bits)})
+   INT_BINARY(SLE, std::uint64_t{sext(l, ip->bits) <= sext(r, ip->bits)})
+   INT_BINARY(SGT, std::uint64_t{sext(l, ip->bits) > sext(r, ip->bits)})
+   INT_BINARY(SGE, std::uint64_t{sext(l, ip->bits) >= sext(r, ip->bits)})
+   INT_BINARY(ULT, std::uint64_t{l < r})
+   INT_BINARY(ULE, std::uint64_t{l <= r})
+   INT_BINARY(UGT, std::uint64_t{l > r})
+   INT_BINARY(UGE, std::uint64_t{l >= r})
+   CAST(NEG, mask(0 - v, ip->bits))
+   CAST(NOT, mask(~v, ip->bits))
+   CAST(ADDI, v + static_cast<std::uint64_t>(static_cast<std::int32_t>(ip->c)))
+   CAST(SCALE, static_cast<std::uint64_t>(sext(v, ip->bits) * static_cast<std::int32_t>(ip->c)))
+   CAST(SEXT, mask(static_cast<std::uint64_t>(sext(v, ip->bits)), ip->c))
+   CAST(TRUNC, mask(v, ip->bits))
+   FP_BINARY(FADD, float, asFloat, bits(l + r))
+   FP_BINARY(FSUB, float, asFloat, bits(l - r))
+   FP_BINARY(FMUL, float, asFloat, bits(l * r))
+   FP_BINARY(FDIV, float, asFloat, bits(l / r))
+   FP_BINARY(FEQ, float, asFloat, std::uint64_t{l == r})
+   FP_BINARY(FNE, float, asFloat, std::uint64_t{l != r})
+   FP_BINARY(FLT, float, asFloat, std::uint64_t{l < r})
+   FP_BINARY(FLE, float, asFloat, std::uint64_t{l <= r})
+   FP_BINARY(FGT, float, asFloat, std::uint64_t{l > r})
+   FP_BINARY(FGE, float, asFloat, std::uint64_t{l >= r})
+   CAST(FNEG, bits(-asFloat(v)))
+   FP_BINARY(DADD, double, asDouble, bits(l + r))
+   FP_BINARY(DSUB, double, asDouble, bits(l - r))
+   FP_BINARY(DMUL, double, asDouble, bits(l * r))
+   FP_BINARY(DDIV, double, asDouble, bits(l / r))
+   FP_BINARY(DEQ, double, asDouble, std::uint64_t{l == r})
+   FP_BINARY(DNE, double, asDouble, std::uint64_t{l != r})
+   FP_BINARY(DLT, double, asDouble, std::uint64_t{l < r})
+   FP_BINARY(DLE, double, asDouble, std::uint64_t{l <= r})
+   FP_BINARY(DGT, double, asDouble, std::uint64_t{l > r})
+   FP_BINARY(DGE, double, asDouble, std::uint64_t{l >= r})
+   CAST(DNEG, bits(-asDouble(v)))
+   CAST(SITOF, bits(static_cast<float>(sext(v, ip->bits))))
+   CAST(SITOD, bits(static_cast<double>(sext(v, ip->bits))))
+   CAST(UITOF, bits(static_cast<float>(v)))
+   CAST(UITOD, bits(static_cast<double>(v)))
+   CAST(FTOSI, mask(static_cast<std::uint64_t>(static_cast<std::int64_t>(asFloat(v))), ip->bits))
+   CAST(DTOSI, mask(static_cast<std::uint64_t>(static_cast<std::int64_t>(asDouble(v))), ip->bits))
+   CAST(FTOUI, mask(static_cast<std::uint64_t>(asFloat(v)), ip->bits))
+   CAST(DTOUI, mask(static_cast<std::uint64_t>(asDouble(v)), ip->bits))
+   CAST(FTOD, bits(static_cast<double>(asFloat(v))))
+   CAST(DTOF, bits(static_cast<float>(asDouble(v))))
+
+L_LOAD8:
+   R(a) = *reinterpret_cast<const std::uint8_t *>(R(b));
+   NEXT;
+L_LOAD16 : {
+   std::uint16_t v;
+   std::memcpy(&v, reinterpret_cast<const void *>(R(b)), sizeof(v));
+   R(a) = v;
+   NEXT;
+}
+L_LOAD32 : {
+   std::uint32_t v;
+   std::memcpy(&v, reinterpret_cast<const void *>(R(b)), sizeof(v));
+   R(a) = v;
+   NEXT;
+}
+L_LOAD64:
+   std::memcpy(&R(a), reinterpret_cast<const void *>(R(b)), sizeof(std::uint64_t));
+   NEXT;
+   // the host is little endian, the low bytes of a register come first
+L_STORE8:
+   std::memcpy(reinterpret_cast<void *>(R(b)), &R(a), 1);
+   NEXT;
+L_STORE16:
+   std::memcpy(reinterpret_cast<void *>(R(b)), &R(a), 2);
+   NEXT;
+L_STORE32:
+   std::memcpy(reinterpret_cast<void *>(R(b)), &R(a), 4);
+   NEXT;
+L_STORE64:
+   std::memcpy(reinterpret_cast<void *>(R(b)), &R(a), 8);
+   NEXT;
+L_COPY:
+   std::memmove(reinterpret_cast<void *>(R(a)), reinterpret_cast<const void *>(R(b)), ip->c);
+   NEXT;
+L_ZERO:
+   std::memset(reinterpret_cast<void *>(R(a)), 0, ip->c);
+   NEXT;
+
+L_JMP:
+   ip = code + ip->a;
+   goto *handlers[ip->op];
+L_BR:
+   ip = code + (R(a) ? ip->b : ip->c);
+   goto *handlers[ip->op];
+L_SWITCH : {
+   const BytecodeEmitter::JumpTable &table = fn.tables[ip->b];
+   std::uint64_t v = R(a);
+   auto it = std::lower_bound(table.cases.begin(), table.cases.end(), v, [](const auto &c, std::uint64_t v) { return c.first < v; });
+   if (it != table.cases.end() && it->first == v) {
+      ip = code + it->second;
+   } else if (table.defaultTarget != NO_TARGET) {
+      ip = code + table.defaultTarget;
+   } else {
+      ++ip;
+   }
+   goto *handlers[ip->op];
+}
+L_CALL : {
+   const Call &call = fn.calls[ip->b];
+   const Function *callee = call.callee;
+   void *target = callee ? callee->native : reinterpret_cast<void *>(frame[call.target]);
+   if (!callee && machine.fns.contains(static_cast<const Function *>(target))) {
+      callee = static_cast<const Function *>(target);
+   }
+   if (callee && callee->hasBody) {
+      std::uint64_t *next = frame + fn.frameWords;
+      if (next + callee->frameWords > machine.end) {
+         std::cerr << "Stack overflow in '" << callee->name << "'\n";
+         std::abort();
+      }
+      std::size_t numArgs = std::min(call.args.size(), callee->params.size());
+      for (std::size_t i = 0; i < numArgs; ++i) {
+         next[i] = frame[call.args[i]];
+      }
+      R(a) = execute(*callee, next, machine);
+   } else {
+      R(a) = callNative(target, call, frame);
+   }
+   NEXT;
+}
+L_RET:
+   return R(a);
+L_RETV:
+   return 0;
+L_TRAP:
+   std::abort();
+
+#undef CAST
+#undef FP_BINARY
+#undef INT_BINARY
+#undef NEXT
+#undef R
+}
+#pragma GCC diagnostic pop
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+namespace qcp {
+namespace emitter {
+// ---------------------------------------------------------------------------
+BytecodeEmitter::BytecodeEmitter(const Options &options) : stackSize_(options.stackSize) {
+#if !defined(__x86_64__) || !defined(__ELF__)
+   // native calls use the x86-64 System V calling convention
+   supported_ = false;
+#endif
+   voidTy_ = newTy({.kind = Ty::Kind::VOID, .size = 1});
+   floatTy_ = newTy({.kind = Ty::Kind::FLOAT, .size = 4, .align = 4});
+   doubleTy_ = newTy({.kind = Ty::Kind::DOUBLE, .size = 8, .align = 8});
+   ptrTy_ = newTy({.kind = Ty::Kind::PTR, .size = 8, .align = 8});
+}
+// ---------------------------------------------------------------------------
+bool BytecodeEmitter::supported() const {
+   if (!supported_) {
+      return false;
+   }
+   // the address of a definition is its Function, which native code would jump into.
+   // declarations and definitions of the same name are separate Functions until link()
+   std::unordered_set<std::string_view> taken{};
+   for (const Function &fn : fns_) {
+      if (fn.addressTaken) {
+         taken.insert(fn.name);
+      }
+   }
+   return std::none_of(fns_.begin(), fns_.end(), [&taken](const Function &fn) { return fn.hasBody && taken.contains(fn.name); });
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Value *BytecodeEmitter::unsupported() {
+   supported_ = false;
+   return newValue(Value::Kind::UNDEF, voidTy_);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Constant *BytecodeEmitter::unsupportedConstant(Ty *ty) {
+   supported_ = false;
+   return newConstant(Value::Kind::ZERO, ty);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Ty *BytecodeEmitter::newTy(Ty ty) {
+   return &tys_.emplace_back(std::move(ty));
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Value *BytecodeEmitter::newValue(Value::Kind kind, Ty *ty) {
+   return &values_.emplace_back(Value{kind, ty});
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Constant *BytecodeEmitter::newConstant(Value::Kind kind, Ty *ty) {
+   Constant &c = constants_.emplace_back();
+   c.kind = kind;
+   c.ty = ty;
+   return &c;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ConstantInt *BytecodeEmitter::newInt(Ty *ty, std::uint64_t value) {
+   // the parser compares integer constants by address, like LLVM they are unique
+   value = truncate(value, scalarBits(ty));
+   auto [it, inserted] = uniqueInts_.try_emplace({ty, value}, nullptr);
+   if (inserted) {
+      ConstantInt &c = ints_.emplace_back();
+      c.kind = Value::Kind::INT;
+      c.ty = ty;
+      c.value = value;
+      it->second = &c;
+   }
+   return it->second;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Constant *BytecodeEmitter::newFP(Ty *ty, double value) {
+   Constant *c = newConstant(Value::Kind::FP, ty);
+   c->fp = ty->kind == Ty::Kind::FLOAT ? static_cast<float>(value) : value;
+   return c;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Value *BytecodeEmitter::newReg(BasicBlock *bb, Ty *ty) {
+   Value *value = newValue(Value::Kind::REG, ty);
+   value->reg = bb->fn->regs++;
+   return value;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Value *BytecodeEmitter::newLocal(Function *fn, std::uint64_t size, std::uint64_t align) {
+   Value *value = newValue(Value::Kind::REG, ptrTy_);
+   value->reg = fn->regs++;
+   // locals are at most 16 byte aligned like the frame
+   std::uint64_t offset = alignTo(fn->localsSize, std::min<std::uint64_t>(std::max<std::uint64_t>(align, 1), 16));
+   fn->localsSize = offset + std::max<std::uint64_t>(size, 1);
+   fn->locals.emplace_back(value->reg, offset);
+   return value;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Value *BytecodeEmitter::asValue(const value_t &value) {
+   if (ssa_t *const *ssa = std::get_if<ssa_t *>(&value)) {
+      return *ssa;
+   } else if (const_t *const *c = std::get_if<const_t *>(&value)) {
+      return *c;
+   } else if (iconst_t *const *ic = std::get_if<iconst_t *>(&value)) {
+      return *ic;
+   } else if (fn_t *const *fn = std::get_if<fn_t *>(&value)) {
+      (*fn)->used = true;
+      (*fn)->addressTaken = true;
+      return &(*fn)->address;
+   }
+   return nullptr;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Constant *BytecodeEmitter::asConstant(const const_or_iconst_t &value) {
+   if (const_t *const *c = std::get_if<const_t *>(&value)) {
+      return *c;
+   } else if (iconst_t *const *ic = std::get_if<iconst_t *>(&value)) {
+      return *ic;
+   }
+   return nullptr;
+}
+// ---------------------------------------------------------------------------
+std::uint32_t BytecodeEmitter::operand(BasicBlock *bb, Value *value) {
+   if (value->kind == Value::Kind::REG) {
+      return value->reg;
+   }
+   Function *fn = bb->fn;
+   auto [it, inserted] = fn->constantRegs.try_emplace(value, fn->regs);
+   if (inserted) {
+      fn->constants.emplace_back(fn->regs++, value);
+   }
+   return it->second;
+}
+// ---------------------------------------------------------------------------
+void BytecodeEmitter::append(BasicBlock *bb, Instr instr) {
+   bb->code.push_back(instr);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Value *BytecodeEmitter::binary(BasicBlock *bb, Ty *ty, std::uint8_t op, std::uint8_t bits, Value *lhs, Value *rhs) {
+   std::uint32_t l = operand(bb, lhs);
+   std::uint32_t r = operand(bb, rhs);
+   Value *result = newReg(bb, ty);
+   append(bb, {op, bits, result->reg, l, r});
+   return result;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Value *BytecodeEmitter::unary(BasicBlock *bb, Ty *ty, std::uint8_t op, std::uint8_t bits, Value *value, std::uint32_t c) {
+   std::uint32_t v = operand(bb, value);
+   Value *result = newReg(bb, ty);
+   append(bb, {op, bits, result->reg, v, c});
+   return result;
+}
+// ---------------------------------------------------------------------------
+void BytecodeEmitter::store(BasicBlock *bb, Ty *ty, Value *value, Value *ptr) {
+   if (!bb || !value || !ptr || !ty) {
+      unsupported();
+      return;
+   }
+   if (isAggregate(ty)) {
+      switch (value->kind) {
+         case Value::Kind::ZERO:
+         case Value::Kind::UNDEF:
+            append(bb, {ZERO, 64, operand(bb, ptr), 0, static_cast<std::uint32_t>(ty->size)});
+            return;
+         case Value::Kind::ARRAY:
+         case Value::Kind::STRUCT:
+         case Value::Kind::STRING:
+         case Value::Kind::REG:
+         case Value::Kind::GLOBAL:
+            // constants are copied from memory
+            append(bb, {COPY, 64, operand(bb, ptr), operand(bb, value), static_cast<std::uint32_t>(ty->size)});
+            return;
+         default:
+            unsupported();
+            return;
+      }
+   }
+   std::uint8_t op;
+   switch (ty->kind) {
+      case Ty::Kind::INT:
+      case Ty::Kind::FLOAT:
+      case Ty::Kind::DOUBLE:
+      case Ty::Kind::PTR: {
+         unsigned bits = scalarBits(ty);
+         op = bits <= 8 ? STORE8 : bits <= 16 ? STORE16 : bits <= 32 ? STORE32 : STORE64;
+         break;
+      }
+      default:
+         unsupported();
+         return;
+   }
+   append(bb, {op, 64, operand(bb, value), operand(bb, ptr)});
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::Value *BytecodeEmitter::offsetPointer(BasicBlock *bb, Value *ptr, std::int64_t offset) {
+   if (offset == 0) {
+      return ptr;
+   } else if (ptr->kind == Value::Kind::GLOBAL) {
+      Value *result = newValue(Value::Kind::GLOBAL, ptrTy_);
+      result->var = ptr->var;
+      result->offset = ptr->offset + offset;
+      return result;
+   } else if (!bb || !fitsInt32(offset)) {
+      return unsupported();
+   }
+   return unary(bb, ptrTy_, ADDI, 64, ptr, static_cast<std::uint32_t>(offset));
+}
+// ---------------------------------------------------------------------------
+bool BytecodeEmitter::link(std::ostream &log) {
+   std::unordered_map<std::string_view, GlobalVar *> vars{};
+   for (GlobalVar &var : globals_) {
+      if (!var.init && !var.zeroInit) {
+         continue;
+      }
+      std::uint64_t size = std::max<std::uint64_t>(var.varTy->size, var.init && var.init->ty ? var.init->ty->size : 0);
+      var.address = reinterpret_cast<char *>(memory_.emplace_back((size + 7) / 8 + 1).data());
+      if (!var.name.empty()) {
+         vars.try_emplace(var.name, &var);
+      }
+   }
+   for (GlobalVar &var : globals_) {
+      if (var.address) {
+         if (var.init) {
+            serialize(var.init, var.address, std::max<std::uint64_t>(var.varTy->size, var.init->ty ? var.init->ty->size : 0));
+         }
+      } else if (auto it = vars.find(var.name); it != vars.end()) {
+         var.address = it->second->address;
+      } else {
+         // like stdout, nullptr if the process has no such symbol
+         var.address = static_cast<char *>(dlsym(RTLD_DEFAULT, var.name.c_str()));
+      }
+   }
+
+   std::unordered_map<std::string_view, Function *> definitions{};
+   for (Function &fn : fns_) {
+      if (fn.hasBody) {
+         definitions.try_emplace(fn.name, &fn);
+      }
+   }
+   bool ok = true;
+   for (Function &fn : fns_) {
+      if (fn.hasBody || !fn.used || definitions.contains(fn.name)) {
+         continue;
+      }
+      fn.native = dlsym(RTLD_DEFAULT, fn.name.c_str());
+      if (!fn.native) {
+         log << "Undefined reference to '" << fn.name << "'\n";
+         ok = false;
+      }
+   }
+   for (Function &fn : fns_) {
+      for (Call &call : fn.calls) {
+         if (call.callee && !call.callee->hasBody) {
+            if (auto it = definitions.find(call.callee->name); it != definitions.end()) {
+               call.callee = it->second;
+            }
+         }
+      }
+      for (auto [reg, value] : fn.constants) {
+         if (value->kind == Value::Kind::GLOBAL && !value->var->address) {
+            log << "Undefined reference to '" << value->var->name << "'\n";
+            ok = false;
+         } else if (value->kind == Value::Kind::FUNC) {
+            Function *target = static_cast<Constant *>(value)->fn;
+            if (auto it = definitions.find(target->name); !target->hasBody && it != definitions.end()) {
+               // the address of a definition is the address of its function
+               fn.constantValues.emplace_back(reg, reinterpret_cast<std::uint64_t>(it->second));
+               continue;
+            }
+         }
+         fn.constantValues.emplace_back(reg, constantBits(value));
+      }
+   }
+   return ok;
+}
+// ---------------------------------------------------------------------------
+std::uint64_t BytecodeEmitter::constantBits(Value *value) {
+   Constant *c = static_cast<Constant *>(value);
+   switch (value->kind) {
+      case Value::Kind::INT:
+         return c->value;
+      case Value::Kind::FP:
+         return fpBits(c->fp, c->ty->kind != Ty::Kind::FLOAT);
+      case Value::Kind::ARRAY:
+      case Value::Kind::STRUCT:
+      case Value::Kind::STRING:
+         return reinterpret_cast<std::uint64_t>(materialize(c));
+      case Value::Kind::FUNC:
+         return c->fn->hasBody ? reinterpret_cast<std::uint64_t>(c->fn) : reinterpret_cast<std::uint64_t>(c->fn->native);
+      case Value::Kind::GLOBAL:
+         return reinterpret_cast<std::uint64_t>(value->var->address + value->offset);
+      default:
+         return 0;
+   }
+}
+// ---------------------------------------------------------------------------
+char *BytecodeEmitter::materialize(Constant *c) {
+   auto [it, inserted] = materialized_.try_emplace(c, nullptr);
+   if (inserted) {
+      std::uint64_t size = c->ty ? c->ty->size : 8;
+      it->second = reinterpret_cast<char *>(memory_.emplace_back((size + 7) / 8 + 1).data());
+      serialize(c, it->second, size);
+   }
+   return it->second;
+}
+// ---------------------------------------------------------------------------
+void BytecodeEmitter::serialize(Constant *c, char *data, std::size_t size) {
+   switch (c->kind) {
+      case Value::Kind::INT:
+      case Value::Kind::FP:
+      case Value::Kind::FUNC: {
+         std::uint64_t value = constantBits(c);
+         std::memcpy(data, &value, std::min<std::size_t>({size, c->ty ? c->ty->size : 8, 8}));
+         break;
+      }
+      case Value::Kind::ARRAY:
+         for (std::size_t i = 0; i < c->elems.size() && (i + 1) * c->ty->elem->size <= size; ++i) {
+            serialize(c->elems[i], data + i * c->ty->elem->size, c->ty->elem->size);
+         }
+         break;
+      case Value::Kind::STRUCT:
+         for (std::size_t i = 0; i < c->elems.size() && i < c->ty->offsets.size(); ++i) {
+            serialize(c->elems[i], data + c->ty->offsets[i], c->ty->members[i]->size);
+         }
+         break;
+      case Value::Kind::STRING:
+         std::memcpy(data, c->str.data(), std::min(c->str.size(), size));
+         break;
+      default:
+         // the memory is zeroed
+         break;
+   }
+}
+// ---------------------------------------------------------------------------
+std::optional<int> BytecodeEmitter::run(std::vector<char *> args, std::ostream &log) {
+   if (!link(log)) {
+      return std::nullopt;
+   }
+   auto main = std::find_if(fns_.begin(), fns_.end(), [](const Function &fn) { return fn.hasBody && fn.name == "main"; });
+   if (main == fns_.end()) {
+      log << "No definition of 'main'\n";
+      return std::nullopt;
+   }
+
+   Machine machine{};
+   for (const Function &fn : fns_) {
+      if (fn.hasBody) {
+         machine.fns.insert(&fn);
+      }
+   }
+   std::size_t words = stackSize_ / sizeof(std::uint64_t);
+   auto stack = std::make_unique_for_overwrite<std::uint64_t[]>(words);
+   machine.end = stack.get() + words;
+   if (main->frameWords > words) {
+      log << "Stack overflow in 'main'\n";
+      return std::nullopt;
+   }
+   int argc = static_cast<int>(args.size());
+   args.push_back(nullptr);
+   if (!main->params.empty()) {
+      stack[0] = static_cast<std::uint32_t>(argc);
+   }
+   if (main->params.size() > 1) {
+      stack[1] = reinterpret_cast<std::uint64_t>(args.data());
+   }
+   return static_cast<int>(static_cast<std::uint32_t>(execute(*main, stack.get(), machine)));
+}
+// ---------------------------------------------------------------------------
+void BytecodeEmitter::dumpToStdout() {
+   for (const Function &fn : fns_) {
+      std::cout << fn.name;
+      if (fn.hasBody) {
+         std::cout << ' ' << fn.code.size() << " instructions, " << fn.regs << " registers\n";
+      } else {
+         std::cout << " (declaration)\n";
+      }
+   }
+}
+// ---------------------------------------------------------------------------
+long long BytecodeEmitter::getIntegerValue(iconst_t *c) {
+   return signExtend(c->value, scalarBits(c->ty));
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::iconst_t *BytecodeEmitter::sizeOf(Type ty) {
+   Ty *t = ty;
+   return newInt(emitIntTy(64), t ? t->size : 0);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ty_t *BytecodeEmitter::emitVoidTy() {
+   return voidTy_;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ty_t *BytecodeEmitter::emitIntTy(unsigned bits) {
+   if (bits > 64) {
+      unsupported();
+      bits = 64;
+   }
+   if (!intTys_[bits]) {
+      std::uint64_t size = std::max(1u, (bits + 7) / 8);
+      intTys_[bits] = newTy({.kind = Ty::Kind::INT, .bits = bits, .size = size, .align = size});
+   }
+   return intTys_[bits];
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ty_t *BytecodeEmitter::emitFloatTy() {
+   return floatTy_;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ty_t *BytecodeEmitter::emitDoubleTy() {
+   return doubleTy_;
+}
+// ---------------------------------------------------------------------------
+// like the LLVMEmitter, long double is a double
+typename BytecodeEmitter::ty_t *BytecodeEmitter::emitLongDoubleTy() {
+   return doubleTy_;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ty_t *BytecodeEmitter::emitPtrTo([[maybe_unused]] Type ty) {
+   return ptrTy_;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ty_t *BytecodeEmitter::emitArrayTy(Type ty, iconst_t *size) {
+   Ty *elem = ty;
+   std::uint64_t elemSize = elem ? elem->size : 0;
+   return newTy({.kind = Ty::Kind::ARRAY, .size = elemSize * size->value, .align = elem ? elem->align : 1, .elem = elem, .count = size->value});
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ty_t *BytecodeEmitter::emitStructTy(std::span<const Type> tys, [[maybe_unused]] bool incomplete, [[maybe_unused]] Ident name) {
+   Ty ty{.kind = Ty::Kind::STRUCT};
+   std::uint64_t offset = 0;
+   for (const Type &member : tys) {
+      Ty *m = member;
+      if (!m) {
+         unsupported();
+         m = voidTy_;
+      }
+      offset = alignTo(offset, m->align);
+      ty.members.push_back(m);
+      ty.offsets.push_back(offset);
+      offset += m->size;
+      ty.align = std::max(ty.align, m->align);
+   }
+   ty.size = alignTo(offset, ty.align);
+   return newTy(std::move(ty));
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitUndef() {
+   return newValue(Value::Kind::UNDEF, voidTy_);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitPoison() {
+   return newValue(Value::Kind::UNDEF, voidTy_);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ty_t *BytecodeEmitter::emitFnTy(Type retTy, std::vector<Type> argTys, bool isVarArgFnTy) {
+   Ty ty{.kind = Ty::Kind::FN, .elem = retTy, .varArg = isVarArgFnTy};
+   for (const Type &argTy : argTys) {
+      ty.members.push_back(argTy);
+      ty.signedParams.push_back(isSigned(argTy));
+   }
+   return newTy(std::move(ty));
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitGlobalVar(Type ty, Ident name) {
+   GlobalVar &var = globals_.emplace_back();
+   var.kind = Value::Kind::GLOBAL;
+   var.ty = ptrTy_;
+   var.var = &var;
+   var.varTy = ty;
+   if (!var.varTy) {
+      unsupported();
+      var.varTy = voidTy_;
+   }
+   var.name = static_cast<std::string>(name);
+   return &var;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_t *BytecodeEmitter::emitFnPtr([[maybe_unused]] Type ty, fn_t *fn) {
+   fn->used = true;
+   fn->addressTaken = true;
+   return &fn->address;
+}
+// ---------------------------------------------------------------------------
+void BytecodeEmitter::setInitValueGlobalVar(ssa_t *val, const_or_iconst_t init) {
+   if (!val || val->kind != Value::Kind::GLOBAL) {
+      unsupported();
+      return;
+   }
+   static_cast<GlobalVar *>(val)->init = asConstant(init);
+}
+// ---------------------------------------------------------------------------
+void BytecodeEmitter::zeroInitGlobalVar([[maybe_unused]] Type ty, ssa_t *val) {
+   if (!val || val->kind != Value::Kind::GLOBAL) {
+      unsupported();
+      return;
+   }
+   static_cast<GlobalVar *>(val)->zeroInit = true;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::fn_t *BytecodeEmitter::emitFnProto(Type fnTy, [[maybe_unused]] bool alwaysInline, [[maybe_unused]] bool noReturn, Ident name) {
+   Function &fn = fns_.emplace_back();
+   fn.ty = fnTy;
+   fn.name = static_cast<std::string>(name);
+   fn.address.kind = Value::Kind::FUNC;
+   fn.address.ty = ptrTy_;
+   fn.address.fn = &fn;
+   return &fn;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::bb_t *BytecodeEmitter::emitFn(fn_t *fnProto) {
+   fnProto->hasBody = true;
+   bb_t *entry = emitBB(fnProto);
+   // the caller stores the arguments to the first registers
+   for (Ty *param : fnProto->ty->members) {
+      if (!param || isAggregate(param)) {
+         fnProto->params.push_back(unsupported());
+      } else {
+         fnProto->params.push_back(newReg(entry, param));
+      }
+   }
+   return entry;
+}
+// ---------------------------------------------------------------------------
+bool BytecodeEmitter::isFnProto(fn_t *fn) {
+   return !fn->hasBody;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::getParam(fn_t *fn, unsigned idx) {
+   if (idx >= fn->params.size()) {
+      return unsupported();
+   }
+   return fn->params[idx];
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::bb_t *BytecodeEmitter::emitBB(fn_t *fn, bb_t *insertBefore, [[maybe_unused]] Ident name) {
+   BasicBlock *bb = &blocks_.emplace_back();
+   bb->fn = fn;
+   auto it = std::find(fn->blocks.begin(), fn->blocks.end(), insertBefore);
+   fn->blocks.insert(it, bb);
+   return bb;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::iconst_t *BytecodeEmitter::emitIConst(Type ty, unsigned long value) {
+   return newInt(ty, value);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_t *BytecodeEmitter::emitFPConst(Type ty, double value) {
+   return newFP(ty, value);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_t *BytecodeEmitter::emitNullPtr(Type ty) {
+   return newConstant(Value::Kind::NULLPTR, ty);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_or_iconst_t BytecodeEmitter::emitZeroConst(Type ty) {
+   return newConstant(Value::Kind::ZERO, ty);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_t *BytecodeEmitter::emitArrayConst(Type ty, std::span<const const_or_iconst_t> values) {
+   Constant *c = newConstant(Value::Kind::ARRAY, ty);
+   c->elems.reserve(values.size());
+   for (const auto &value : values) {
+      c->elems.push_back(asConstant(value));
+   }
+   return c;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_t *BytecodeEmitter::emitArrayConst(Type ty, const_or_iconst_t value) {
+   Constant *c = newConstant(Value::Kind::ARRAY, ty);
+   c->elems.assign(c->ty->count, asConstant(value));
+   return c;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_t *BytecodeEmitter::emitStructConst(Type ty, std::span<const const_or_iconst_t> values) {
+   Constant *c = newConstant(Value::Kind::STRUCT, ty);
+   c->elems.reserve(values.size());
+   for (const auto &value : values) {
+      c->elems.push_back(asConstant(value));
+   }
+   return c;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_t *BytecodeEmitter::emitStringLiteral(const std::string_view str) {
+   // null terminated like the LLVMEmitter's
+   Ty *ty = newTy({.kind = Ty::Kind::ARRAY, .size = str.size() + 1, .elem = emitIntTy(8), .count = str.size() + 1});
+   Constant *c = newConstant(Value::Kind::STRING, ty);
+   c->str.reserve(str.size() + 1);
+   c->str.append(str).push_back('\0');
+   return c;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitLocalVar(fn_t *fn, [[maybe_unused]] bb_t *entry, Type ty, [[maybe_unused]] Ident name, [[maybe_unused]] bool insertAtBegin) {
+   Ty *t = ty;
+   if (!t) {
+      return unsupported();
+   }
+   return newLocal(fn, t->size, t->align);
+}
+// ---------------------------------------------------------------------------
+void BytecodeEmitter::zeroInitLocalVar(bb_t *entry, Type ty, ssa_t *val) {
+   Ty *t = ty;
+   append(entry, {ZERO, 64, operand(entry, val), 0, static_cast<std::uint32_t>(t->size)});
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitLoad(bb_t *bb, Type ty, ssa_t *ptr, [[maybe_unused]] Ident name) {
+   Ty *t = ty;
+   if (!bb || !ptr || !t) {
+      return unsupported();
+   }
+   if (isAggregate(t)) {
+      Value *copy = newLocal(bb->fn, t->size, t->align);
+      append(bb, {COPY, 64, copy->reg, operand(bb, ptr), static_cast<std::uint32_t>(t->size)});
+      copy->ty = t;
+      return copy;
+   }
+   if (t->kind != Ty::Kind::INT && t->kind != Ty::Kind::PTR && !isFP(t)) {
+      return unsupported();
+   }
+   unsigned bits = scalarBits(t);
+   return unary(bb, t, bits <= 8 ? LOAD8 : bits <= 16 ? LOAD16 : bits <= 32 ? LOAD32 : LOAD64, 64, ptr);
+}
+// ---------------------------------------------------------------------------
+void BytecodeEmitter::emitStore(bb_t *bb, Type ty, value_t value, ssa_t *ptr) {
+   store(bb, ty, asValue(value), ptr);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitJump(bb_t *bb, bb_t *target) {
+   if (bb && bb->term == BasicBlock::Term::NONE) {
+      bb->term = BasicBlock::Term::JUMP;
+      bb->targets[0] = target;
+   }
+   return nullptr;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitBranch(bb_t *bb, bb_t *trueBB, bb_t *falseBB, value_t cond) {
+   if (bb && bb->term == BasicBlock::Term::NONE) {
+      bb->term = BasicBlock::Term::BRANCH;
+      bb->targets[0] = trueBB;
+      bb->targets[1] = falseBB;
+      bb->operand = asValue(cond);
+      if (!bb->operand) {
+         return unsupported();
+      }
+   }
+   return nullptr;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitRet(bb_t *bb, value_t value) {
+   if (bb && bb->term == BasicBlock::Term::NONE) {
+      bb->term = BasicBlock::Term::RET;
+      bb->operand = asValue(value);
+   }
+   return nullptr;
+}
+// ---------------------------------------------------------------------------
+// the incoming values are moved to the register of the phi at the end of the predecessors
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitPhi(bb_t *bb, Type ty, std::span<std::pair<value_t, bb_t *>> incoming, [[maybe_unused]] Ident name) {
+   Ty *t = ty;
+   if (!bb || isAggregate(t)) {
+      return unsupported();
+   }
+   Value *result = newReg(bb, t);
+   for (const auto &[value, pred] : incoming) {
+      Value *v = asValue(value);
+      if (!v || !pred) {
+         continue;
+      }
+      append(pred, {MOV, 64, result->reg, operand(pred, v)});
+   }
+   return result;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitBinOp(bb_t *bb, Type ty, op::Kind kind, value_t lhs, value_t rhs, ssa_t *dest, [[maybe_unused]] Ident name) {
+   Value *l = asValue(lhs);
+   Value *r = asValue(rhs);
+   Ty *t = ty;
+   if (!bb || !l || !r || !t) {
+      return unsupported();
+   }
+   if (kind == OpKind::ASSIGN) {
+      store(bb, t, r, dest);
+      return r;
+   }
+   OpKind assignOp = qcp::emitter::decomposeAssignOp(kind);
+   bool isAssign = assignOp != OpKind::END;
+   kind = isAssign ? assignOp : kind;
+   Ty *resultTy = op::isComparisonOp(kind) ? emitIntTy(1) : t;
+   std::uint8_t op = isFP(t) ? fpOp(kind, t->kind == Ty::Kind::DOUBLE) : intOp(kind, isSigned(ty));
+   if (op == TRAP || (!isFP(t) && t->kind != Ty::Kind::INT && t->kind != Ty::Kind::PTR)) {
+      return unsupported();
+   }
+   Value *result = binary(bb, resultTy, op, static_cast<std::uint8_t>(scalarBits(t)), l, r);
+   if (isAssign) {
+      store(bb, t, result, dest);
+   }
+   return result;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_or_iconst_t BytecodeEmitter::emitConstBinOp([[maybe_unused]] bb_t *bb, Type ty, op::Kind kind, const_or_iconst_t lhs, const_or_iconst_t rhs, [[maybe_unused]] Ident name) {
+   Constant *l = asConstant(lhs);
+   Constant *r = asConstant(rhs);
+   Ty *t = ty;
+   if (!l || !r || !t) {
+      return unsupportedConstant(t);
+   }
+   OpKind assignOp = qcp::emitter::decomposeAssignOp(kind);
+   kind = assignOp != OpKind::END ? assignOp : kind;
+   if (isFP(t)) {
+      if ((l->kind != Value::Kind::FP && !isIntConstant(l)) || (r->kind != Value::Kind::FP && !isIntConstant(r))) {
+         return unsupportedConstant(t);
+      }
+      std::optional<double> result = foldFPBinOp(kind, fpValue(l), fpValue(r));
+      if (!result) {
+         return unsupportedConstant(t);
+      } else if (op::isComparisonOp(kind)) {
+         return newInt(emitIntTy(1), *result != 0);
+      }
+      return newFP(t, *result);
+   }
+   if (!isIntConstant(l) || !isIntConstant(r)) {
+      return unsupportedConstant(t);
+   }
+   std::optional<std::uint64_t> result = foldIntBinOp(kind, l->value, r->value, scalarBits(t), isSigned(ty));
+   if (!result) {
+      return unsupportedConstant(t);
+   }
+   return newInt(op::isComparisonOp(kind) ? emitIntTy(1) : t, *result);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitIncDecOp(bb_t *bb, Type ty, op::Kind kind, ssa_t *operand, Ident name) {
+   Ty *t = ty;
+   Value *value = emitLoad(bb, ty, operand, name);
+   if (!supported_) {
+      return value;
+   }
+   bool isInc = kind == OpKind::POSTINC || kind == OpKind::PREINC;
+   bool isPost = kind == OpKind::POSTINC || kind == OpKind::POSTDEC;
+   Value *result;
+   if (isFP(t)) {
+      bool isDouble = t->kind == Ty::Kind::DOUBLE;
+      result = binary(bb, t, fpOp(isInc ? OpKind::ADD : OpKind::SUB, isDouble), 64, value, newFP(t, 1.0));
+   } else if (t->kind == Ty::Kind::PTR) {
+      Ty *pointee = ty->getPointedToTy();
+      std::int64_t step = pointee && pointee->size ? static_cast<std::int64_t>(pointee->size) : 1;
+      result = offsetPointer(bb, value, isInc ? step : -step);
+   } else {
+      result = binary(bb, t, isInc ? ADD : SUB, static_cast<std::uint8_t>(scalarBits(t)), value, newInt(t, 1));
+   }
+   store(bb, t, result, operand);
+   return isPost ? value : result;
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitNeg(bb_t *bb, Type ty, ssa_t *operand, [[maybe_unused]] Ident name) {
+   Ty *t = ty;
+   if (!bb || !operand || !t) {
+      return unsupported();
+   }
+   if (isFP(t)) {
+      return unary(bb, t, t->kind == Ty::Kind::DOUBLE ? DNEG : FNEG, 64, operand);
+   } else if (ty->kind() == type::Kind::BOOL) {
+      // like the LLVMEmitter, xor with true
+      return unary(bb, t, NOT, 1, operand);
+   }
+   return unary(bb, t, NEG, static_cast<std::uint8_t>(scalarBits(t)), operand);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_or_iconst_t BytecodeEmitter::emitConstNeg([[maybe_unused]] bb_t *bb, Type ty, const_or_iconst_t operand, [[maybe_unused]] Ident name) {
+   Constant *c = asConstant(operand);
+   if (!c) {
+      return unsupportedConstant(ty);
+   } else if (c->kind == Value::Kind::FP) {
+      return newFP(c->ty, -c->fp);
+   } else if (!isIntConstant(c)) {
+      return unsupportedConstant(ty);
+   }
+   return newInt(c->ty, 0 - c->value);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitBWNeg(bb_t *bb, Type ty, ssa_t *operand, [[maybe_unused]] Ident name) {
+   Ty *t = ty;
+   if (!bb || !operand || !t) {
+      return unsupported();
+   }
+   return unary(bb, t, NOT, static_cast<std::uint8_t>(scalarBits(t)), operand);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_or_iconst_t BytecodeEmitter::emitConstBWNeg([[maybe_unused]] bb_t *bb, Type ty, const_or_iconst_t operand, [[maybe_unused]] Ident name) {
+   Constant *c = asConstant(operand);
+   if (!c || !isIntConstant(c)) {
+      return unsupportedConstant(ty);
+   }
+   return newInt(ty, ~c->value);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::const_or_iconst_t BytecodeEmitter::emitConstCast([[maybe_unused]] bb_t *bb, Type fromTy, const_or_iconst_t val, Type toTy, qcp::type::Cast cast) {
+   Constant *c = asConstant(val);
+   Ty *to = toTy;
+   if (!c || !to) {
+      return unsupportedConstant(to);
+   }
+   if (c->kind == Value::Kind::FP) {
+      switch (cast) {
+         case qcp::type::Cast::FPTRUNC:
+         case qcp::type::Cast::FPEXT:
+            return newFP(to, c->fp);
+         case qcp::type::Cast::FPTOSI:
+         case qcp::type::Cast::FPTOUI:
+            return newInt(to, static_cast<std::uint64_t>(static_cast<std::int64_t>(c->fp)));
+         default:
+            return unsupportedConstant(to);
+      }
+   } else if (!isIntConstant(c)) {
+      return unsupportedConstant(to);
+   }
+   switch (cast) {
+      case qcp::type::Cast::TRUNC:
+      case qcp::type::Cast::ZEXT:
+      case qcp::type::Cast::PTRTOINT:
+         return newInt(to, c->value);
+      case qcp::type::Cast::SEXT:
+         return newInt(to, static_cast<std::uint64_t>(signExtend(c->value, scalarBits(fromTy))));
+      case qcp::type::Cast::INTTOPTR:
+      case qcp::type::Cast::BITCAST:
+         // a pointer constant, not an integer constant expression
+         return static_cast<const_t *>(newInt(to, c->value));
+      case qcp::type::Cast::UITOFP:
+         return newFP(to, static_cast<double>(c->value));
+      case qcp::type::Cast::SITOFP:
+         return newFP(to, static_cast<double>(signExtend(c->value, scalarBits(fromTy))));
+      default:
+         return unsupportedConstant(to);
+   }
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitCast(bb_t *bb, Type fromTy, ssa_t *val, Type toTy, qcp::type::Cast cast) {
+   Ty *from = fromTy;
+   Ty *to = toTy;
+   if (!bb || !val || !from || !to) {
+      return unsupported();
+   }
+   std::uint8_t fromBits = static_cast<std::uint8_t>(scalarBits(from));
+   std::uint8_t toBits = static_cast<std::uint8_t>(scalarBits(to));
+   bool fromDouble = from->kind == Ty::Kind::DOUBLE;
+   bool toDouble = to->kind == Ty::Kind::DOUBLE;
+   switch (cast) {
+      case qcp::type::Cast::TRUNC:
+         return unary(bb, to, TRUNC, toBits, val);
+      case qcp::type::Cast::PTRTOINT:
+         if (toBits < 64) {
+            return unary(bb, to, TRUNC, toBits, val);
+         }
+         [[fallthrough]];
+      case qcp::type::Cast::INTTOPTR:
+      case qcp::type::Cast::BITCAST:
+      case qcp::type::Cast::ZEXT:
+         // the register already holds the bits
+         return unary(bb, to, MOV, 64, val);
+      case qcp::type::Cast::SEXT:
+         return unary(bb, to, SEXT, fromBits, val, toBits);
+      case qcp::type::Cast::SITOFP:
+         return unary(bb, to, toDouble ? SITOD : SITOF, fromBits, val);
+      case qcp::type::Cast::UITOFP:
+         return unary(bb, to, toDouble ? UITOD : UITOF, fromBits, val);
+      case qcp::type::Cast::FPTOSI:
+         return unary(bb, to, fromDouble ? DTOSI : FTOSI, toBits, val);
+      case qcp::type::Cast::FPTOUI:
+         return unary(bb, to, fromDouble ? DTOUI : FTOUI, toBits, val);
+      case qcp::type::Cast::FPEXT:
+      case qcp::type::Cast::FPTRUNC:
+         if (fromDouble == toDouble) {
+            // long double is a double
+            return unary(bb, to, MOV, 64, val);
+         }
+         return unary(bb, to, fromDouble ? DTOF : FTOD, 64, val);
+      default:
+         return unsupported();
+   }
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitCall(bb_t *bb, fn_t *fn, std::span<const value_t> args, [[maybe_unused]] Ident name) {
+   fn->used = true;
+   return emitCallImpl(bb, fn->ty, fn, nullptr, args);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitCall(bb_t *bb, Type fnTy, value_t fnPtr, std::span<const value_t> args, [[maybe_unused]] Ident name) {
+   if (fn_t **fn = std::get_if<fn_t *>(&fnPtr)) {
+      (*fn)->used = true;
+      return emitCallImpl(bb, fnTy, *fn, nullptr, args);
+   }
+   return emitCallImpl(bb, fnTy, nullptr, asValue(fnPtr), args);
+}
+// ---------------------------------------------------------------------------
+// aggregates are neither passed nor returned
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitCallImpl(BasicBlock *bb, Ty *fnTy, Function *callee, Value *target, std::span<const value_t> args) {
+   if (!bb || !fnTy || fnTy->kind != Ty::Kind::FN || (!callee && !target) || isAggregate(fnTy->elem)) {
+      return unsupported();
+   }
+   Call call{.callee = callee, .target = target ? operand(bb, target) : 0, .retTy = fnTy->elem};
+   unsigned ints = 0;
+   unsigned fps = 0;
+   for (std::size_t i = 0; i < args.size(); ++i) {
+      Value *value = asValue(args[i]);
+      if (!value) {
+         return unsupported();
+      }
+      bool isParam = i < fnTy->members.size();
+      Ty *ty = isParam ? fnTy->members[i] : value->ty;
+      if (!ty || isAggregate(ty) || ty->kind == Ty::Kind::VOID) {
+         return unsupported();
+      }
+      call.args.push_back(operand(bb, value));
+      call.fpArgs.push_back(isFP(ty));
+      call.signBits.push_back(isParam && fnTy->signedParams[i] && ty->bits < 32 ? static_cast<std::uint8_t>(ty->bits) : 0);
+      ++(isFP(ty) ? fps : ints);
+   }
+   // the native call passes a fixed number of arguments on the stack
+   if (std::max(ints, INT_ARG_REGS) - INT_ARG_REGS + std::max(fps, FP_ARG_REGS) - FP_ARG_REGS > STACK_ARGS) {
+      return unsupported();
+   }
+
+   Ty *retTy = fnTy->elem;
+   Value *result = retTy && retTy->kind != Ty::Kind::VOID ? newReg(bb, retTy) : newValue(Value::Kind::UNDEF, voidTy_);
+   // calls without a result write to a register that is never read
+   std::uint32_t dst = result->kind == Value::Kind::REG ? result->reg : bb->fn->regs++;
+   bb->fn->calls.push_back(std::move(call));
+   append(bb, {CALL, 64, dst, static_cast<std::uint32_t>(bb->fn->calls.size() - 1)});
+   return result;
+}
+// ---------------------------------------------------------------------------
+// constant indices are folded into the offset
+template <typename T>
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitGEPImpl(bb_t *bb, Ty *ty, value_t ptr, std::span<T> indices) {
+   Value *p = asValue(ptr);
+   if (!p || !ty || indices.empty()) {
+      return unsupported();
+   }
+   std::int64_t offset = static_cast<std::int64_t>(indices[0]) * static_cast<std::int64_t>(ty->size);
+   for (std::size_t i = 1; i < indices.size(); ++i) {
+      if (ty->kind == Ty::Kind::ARRAY) {
+         ty = ty->elem;
+         offset += static_cast<std::int64_t>(indices[i]) * static_cast<std::int64_t>(ty->size);
+      } else if (ty->kind == Ty::Kind::STRUCT && indices[i] < ty->members.size()) {
+         offset += static_cast<std::int64_t>(ty->offsets[indices[i]]);
+         ty = ty->members[indices[i]];
+      } else {
+         return unsupported();
+      }
+   }
+   return offsetPointer(bb, p, offset);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitGEP(bb_t *bb, Type ty, value_t ptr, value_t idx, [[maybe_unused]] Ident name) {
+   Ty *t = ty;
+   Value *p = asValue(ptr);
+   Value *i = asValue(idx);
+   if (!p || !i || !t) {
+      return unsupported();
+   }
+   // indices are signed
+   if (i->kind == Value::Kind::INT) {
+      return offsetPointer(bb, p, signExtend(static_cast<Constant *>(i)->value, scalarBits(i->ty)) * static_cast<std::int64_t>(t->size));
+   } else if (!bb || !fitsInt32(static_cast<std::int64_t>(t->size))) {
+      return unsupported();
+   }
+   Value *scaled = unary(bb, ptrTy_, SCALE, static_cast<std::uint8_t>(scalarBits(i->ty)), i, static_cast<std::uint32_t>(t->size));
+   return binary(bb, ptrTy_, ADD, 64, p, scaled);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitGEP(bb_t *bb, Type ty, value_t ptr, std::span<const uint64_t> idx, [[maybe_unused]] Ident name) {
+   return emitGEPImpl(bb, ty, ptr, idx);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::ssa_t *BytecodeEmitter::emitGEP(bb_t *bb, Type ty, value_t ptr, std::span<const std::uint32_t> idx, [[maybe_unused]] Ident name) {
+   return emitGEPImpl(bb, ty, ptr, idx);
+}
+// ---------------------------------------------------------------------------
+typename BytecodeEmitter::sw_t *BytecodeEmitter::emitSwitch(bb_t *bb, value_t value) {
+   Switch *sw = &switches_.emplace_back(Switch{asValue(value)});
+   if (!bb || !sw->value) {
+      unsupported();
+   } else if (bb->term == BasicBlock::Term::NONE) {
+      bb->term = BasicBlock::Term::SWITCH;
+      bb->sw = sw;
+   }
+   return sw;
+}
+// ---------------------------------------------------------------------------
+void BytecodeEmitter::addSwitchCase(sw_t *sw, iconst_t *value, bb_t *target) {
+   sw->cases.emplace_back(value->value, target);
+}
+// ---------------------------------------------------------------------------
+void BytecodeEmitter::addSwitchDefault(sw_t *sw, bb_t *target) {
+   sw->defaultTarget = target;
+}
+// ---------------------------------------------------------------------------
+// targets are indices into the blocks of the function until finalizeFn places them
+void BytecodeEmitter::emitTerminator(BasicBlock *bb, BasicBlock *next) {
+   const std::vector<BasicBlock *> &blocks = bb->fn->blocks;
+   auto index = [&](BasicBlock *target) {
+      return static_cast<std::uint32_t>(std::find(blocks.begin(), blocks.end(), target) - blocks.begin());
+   };
+   switch (bb->term) {
+      case BasicBlock::Term::NONE:
+         append(bb, {TRAP});
+         break;
+      case BasicBlock::Term::JUMP:
+         if (bb->targets[0] != next) {
+            append(bb, {JMP, 64, index(bb->targets[0])});
+         }
+         break;
+      case BasicBlock::Term::BRANCH:
+         append(bb, {BR, 64, operand(bb, bb->operand), index(bb->targets[0]), index(bb->targets[1])});
+         break;
+      case BasicBlock::Term::RET: {
+         Ty *retTy = bb->fn->ty->elem;
+         if (bb->operand && retTy && retTy->kind != Ty::Kind::VOID) {
+            append(bb, {RET, 64, operand(bb, bb->operand)});
+         } else {
+            append(bb, {RETV});
+         }
+         break;
+      }
+      case BasicBlock::Term::SWITCH: {
+         Switch *sw = bb->sw;
+         unsigned bits = scalarBits(sw->value->ty);
+         JumpTable table{.defaultTarget = sw->defaultTarget ? index(sw->defaultTarget) : NO_TARGET};
+         for (auto [value, target] : sw->cases) {
+            table.cases.emplace_back(truncate(value, bits), index(target));
+         }
+         std::sort(table.cases.begin(), table.cases.end());
+         bb->fn->tables.push_back(std::move(table));
+         append(bb, {SWITCH, 64, operand(bb, sw->value), static_cast<std::uint32_t>(bb->fn->tables.size() - 1)});
+         if (!sw->defaultTarget) {
+            append(bb, {TRAP});
+         }
+         break;
+      }
+   }
+}
+// ---------------------------------------------------------------------------
+void BytecodeEmitter::finalizeFn(fn_t *fn) {
+   if (!supported_) {
+      return;
+   }
+   for (std::size_t i = 0; i < fn->blocks.size(); ++i) {
+      emitTerminator(fn->blocks[i], i + 1 < fn->blocks.size() ? fn->blocks[i + 1] : nullptr);
+   }
+   for (BasicBlock *bb : fn->blocks) {
+      bb->offset = static_cast<std::uint32_t>(fn->code.size());
+      fn->code.insert(fn->code.end(), bb->code.begin(), bb->code.end());
+      // the blocks are not needed anymore
+      std::vector<Instr>{}.swap(bb->code);
+   }
+   for (Instr &instr : fn->code) {
+      if (instr.op == JMP) {
+         instr.a = fn->blocks[instr.a]->offset;
+      } else if (instr.op == BR) {
+         instr.b = fn->blocks[instr.b]->offset;
+         instr.c = fn->blocks[instr.c]->offset;
+      }
+   }
+   for (JumpTable &table : fn->tables) {
+      for (auto &[value, target] : table.cases) {
+         target = fn->blocks[target]->offset;
+      }
+      if (table.defaultTarget != NO_TARGET) {
+         table.defaultTarget = fn->blocks[table.defaultTarget]->offset;
+      }
+   }
+
+   // the locals follow the registers, frames stay 16 byte aligned
+   std::uint64_t regWords = alignTo(fn->regs, 2);
+   for (auto &[reg, offset] : fn->locals) {
+      offset += regWords * sizeof(std::uint64_t);
+   }
+   fn->frameWords = regWords + alignTo(fn->localsSize, 16) / sizeof(std::uint64_t);
+}
+// ---------------------------------------------------------------------------
+} // namespace emitter
+} // namespace qcp
+// ---------------------------------------------------------------------------
@@ -0,0 +1,229 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "compilecache.h"
+// ---------------------------------------------------------------------------
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// ---------------------------------------------------------------------------
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+// bump when the layout of the cache directory changes
+constexpr std::string_view CACHE_VERSION = "qcp-cache-1";
+// ---------------------------------------------------------------------------
+std::atomic<unsigned> tmpCounter{0};
+// ---------------------------------------------------------------------------
+bool copyFd(int from, int to) {
+   char buf[64 * 1024];
+   while (true) {
+      ssize_t n = ::read(from, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         return n == 0;
+      }
+      for (ssize_t written = 0; written < n;) {
+         ssize_t w = ::write(to, buf + written, static_cast<std::size_t>(n - written));
+         if (w < 0 && errno == EINTR) {
+            continue;
+         }
+         if (w < 0) {
+            return false;
+         }
+         written += w;
+      }
+   }
+}
+// ---------------------------------------------------------------------------
+std::int64_t mtimeOf(const struct stat& st) {
+   return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+}
+// ---------------------------------------------------------------------------
+std::string readFile(const std::string& path) {
+   std::ifstream is{path, std::ios::binary};
+   std::ostringstream os;
+   os << is.rdbuf();
+   return os.str();
+}
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+CacheKey& CacheKey::add(std::string_view data) {
+   // length prefix, so that consecutive parts cannot be confused
+   add(static_cast<std::uint64_t>(data.size()));
+   hasher_.update(llvm::StringRef{data.data(), data.size()});
+   return *this;
+}
+// ---------------------------------------------------------------------------
+CacheKey& CacheKey::add(std::uint64_t value) {
+   std::uint8_t bytes[sizeof(value)];
+   for (unsigned i = 0; i < sizeof(value); ++i) {
+      bytes[i] = static_cast<std::uint8_t>(value >> (8 * i));
+   }
+   hasher_.update(llvm::ArrayRef<std::uint8_t>{bytes, sizeof(bytes)});
+   return *this;
+}
+// ---------------------------------------------------------------------------
+std::string CacheKey::hex() {
+   auto hash = hasher_.final();
+   return llvm::toHex(llvm::ArrayRef<std::uint8_t>{hash.data(), hash.size()}, true);
+}
+// ---------------------------------------------------------------------------
+CompileCache::CompileCache(std::string dir) : dir_{std::move(dir)} {}
+// ---------------------------------------------------------------------------
+std::string CompileCache::defaultDir() {
+   if (const char* dir = std::getenv("QCP_CACHE_DIR"); dir && *dir) {
+      return dir;
+   }
+   if (const char* dir = std::getenv("XDG_CACHE_HOME"); dir && *dir) {
+      return std::string(dir) + "/qcp";
+   }
+   const char* home = std::getenv("HOME");
+   return std::string(home ? home : ".") + "/.cache/qcp";
+}
+// ---------------------------------------------------------------------------
+CacheKey CompileCache::baseKey() {
+   CacheKey key;
+   key.add(CACHE_VERSION).add(LLVM_VERSION_STRING);
+   // any rebuild of qcp invalidates the cache
+   struct stat st;
+   if (::stat("/proc/self/exe", &st) == 0) {
+      key.add(static_cast<std::uint64_t>(mtimeOf(st))).add(static_cast<std::uint64_t>(st.st_size));
+   }
+   return key;
+}
+// ---------------------------------------------------------------------------
+std::string CompileCache::hashFile(std::string_view contents) {
+   return CacheKey{}.add(contents).hex();
+}
+// ---------------------------------------------------------------------------
+std::string CompileCache::path(const std::string& key, std::string_view suffix) const {
+   return dir_ + '/' + key.substr(0, 2) + '/' + key.substr(2) + std::string(suffix);
+}
+// ---------------------------------------------------------------------------
+bool CompileCache::write(const std::string& path, std::string_view data) const {
+   std::error_code ec;
+   std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+   std::string tmpPath = path + ".tmp." + std::to_string(getpid()) + '.' + std::to_string(tmpCounter++);
+   {
+      std::ofstream os{tmpPath, std::ios::binary};
+      os.write(data.data(), static_cast<std::streamsize>(data.size()));
+      if (!os.flush()) {
+         ::unlink(tmpPath.c_str());
+         return false;
+      }
+   }
+   if (std::rename(tmpPath.c_str(), path.c_str())) {
+      ::unlink(tmpPath.c_str());
+      return false;
+   }
+   return true;
+}
+// ---------------------------------------------------------------------------
+bool CompileCache::fetch(const std::string& key, int fd) const {
+   int in = ::open(path(key, "").c_str(), O_RDONLY | O_CLOEXEC);
+   if (in < 0) {
+      return false;
+   }
+   bool ok = copyFd(in, fd);
+   ::close(in);
+   if (!ok) {
+      // do not leave a partial result behind
+      if (::ftruncate(fd, 0) == 0) {
+         ::lseek(fd, 0, SEEK_SET);
+      }
+   }
+   return ok;
+}
+// ---------------------------------------------------------------------------
+bool CompileCache::store(const std::string& key, int fd) const {
+   std::string data;
+   char buf[64 * 1024];
+   while (true) {
+      ssize_t n = ::pread(fd, buf, sizeof(buf), static_cast<off_t>(data.size()));
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n < 0) {
+         return false;
+      }
+      if (n == 0) {
+         break;
+      }
+      data.append(buf, static_cast<std::size_t>(n));
+   }
+   return write(path(key, ""), data);
+}
+// ---------------------------------------------------------------------------
+std::optional<std::string> CompileCache::fetch(const std::string& key) const {
+   std::ifstream is{path(key, ""), std::ios::binary};
+   if (!is) {
+      return std::nullopt;
+   }
+   std::ostringstream os;
+   os << is.rdbuf();
+   if (is.bad()) {
+      return std::nullopt;
+   }
+   return os.str();
+}
+// ---------------------------------------------------------------------------
+bool CompileCache::store(const std::string& key, std::string_view data) const {
+   return write(path(key, ""), data);
+}
+// ---------------------------------------------------------------------------
+std::optional<std::string> CompileCache::lookupManifest(const std::string& directKey) const {
+   std::ifstream is{path(directKey, ".manifest")};
+   std::string key;
+   if (!std::getline(is, key) || key.empty()) {
+      return std::nullopt;
+   }
+
+   // one line per included file: hash mtime size path, the hash is - for missing files
+   Dependency dep;
+   while (is >> dep.hash >> dep.mtime >> dep.size && is.get() == ' ' && std::getline(is, dep.path)) {
+      struct stat st;
+      if (dep.hash == "-") {
+         // the preprocessor only takes regular files
+         if (!::stat(dep.path.c_str(), &st) && S_ISREG(st.st_mode)) {
+            return std::nullopt;
+         }
+         continue;
+      }
+      if (::stat(dep.path.c_str(), &st)) {
+         return std::nullopt;
+      }
+      if (mtimeOf(st) == dep.mtime && st.st_size == dep.size) {
+         continue;
+      }
+      // touched, but possibly unchanged
+      if (hashFile(readFile(dep.path)) != dep.hash) {
+         return std::nullopt;
+      }
+   }
+   return is.eof() ? std::optional{key} : std::nullopt;
+}
+// ---------------------------------------------------------------------------
+void CompileCache::storeManifest(const std::string& directKey, const std::string& key, const std::vector<Dependency>& deps) const {
+   std::string data = key + '\n';
+   for (const Dependency& dep : deps) {
+      data += (dep.hash.empty() ? "-" : dep.hash) + ' ' + std::to_string(dep.mtime) + ' ' + std::to_string(dep.size) + ' ' + dep.path + '\n';
+   }
+   write(path(directKey, ".manifest"), data);
+}
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
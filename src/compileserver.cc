@@ -0,0 +1,345 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "compileserver.h"
+#include "stringpool.h"
+// ---------------------------------------------------------------------------
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+// sent by the client together with its stdin, stdout and stderr, followed by
+// size bytes: the working directory and argc arguments, each null terminated
+struct Request {
+   std::uint32_t argc;
+   std::uint32_t size;
+};
+// ---------------------------------------------------------------------------
+constexpr std::uint32_t MAX_REQUEST_SIZE = 16 * 1024 * 1024;
+constexpr int STDIO_FDS = 3;
+// ---------------------------------------------------------------------------
+volatile std::sig_atomic_t stopRequested = 0;
+// ---------------------------------------------------------------------------
+void requestStop(int) {
+   stopRequested = 1;
+}
+// ---------------------------------------------------------------------------
+bool sendAll(int fd, const void* data, std::size_t size) {
+   const char* p = static_cast<const char*>(data);
+   while (size) {
+      ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         return false;
+      }
+      p += n;
+      size -= static_cast<std::size_t>(n);
+   }
+   return true;
+}
+// ---------------------------------------------------------------------------
+bool recvAll(int fd, void* data, std::size_t size) {
+   char* p = static_cast<char*>(data);
+   while (size) {
+      ssize_t n = ::recv(fd, p, size, 0);
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         return false;
+      }
+      p += n;
+      size -= static_cast<std::size_t>(n);
+   }
+   return true;
+}
+// ---------------------------------------------------------------------------
+bool makeAddress(const std::string& path, sockaddr_un& addr) {
+   addr = {};
+   addr.sun_family = AF_UNIX;
+   if (path.size() >= sizeof(addr.sun_path)) {
+      return false;
+   }
+   std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+   return true;
+}
+// ---------------------------------------------------------------------------
+int connectTo(const std::string& path) {
+   sockaddr_un addr;
+   if (!makeAddress(path, addr)) {
+      return -1;
+   }
+   int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if (fd < 0) {
+      return -1;
+   }
+   if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr))) {
+      ::close(fd);
+      return -1;
+   }
+   return fd;
+}
+// ---------------------------------------------------------------------------
+void flushStdio() {
+   std::cout.flush();
+   std::cerr.flush();
+   std::fflush(nullptr);
+}
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+CompileServer::CompileServer(std::string socketPath, Driver driver) : socketPath_{std::move(socketPath)}, driver_{driver} {}
+// ---------------------------------------------------------------------------
+CompileServer::~CompileServer() {
+   if (fd_ >= 0) {
+      ::close(fd_);
+      ::unlink(socketPath_.c_str());
+   }
+   for (int fd : stdio_) {
+      if (fd >= 0) {
+         ::close(fd);
+      }
+   }
+   if (cwd_ >= 0) {
+      ::close(cwd_);
+   }
+}
+// ---------------------------------------------------------------------------
+std::string CompileServer::defaultSocketPath() {
+   if (const char* path = std::getenv("QCP_SERVER"); path && *path) {
+      return path;
+   }
+   if (const char* dir = std::getenv("XDG_RUNTIME_DIR"); dir && *dir) {
+      return std::string(dir) + "/qcp.sock";
+   }
+   return "/tmp/qcp-" + std::to_string(getuid()) + ".sock";
+}
+// ---------------------------------------------------------------------------
+bool CompileServer::listen(std::ostream& log) {
+   sockaddr_un addr;
+   if (!makeAddress(socketPath_, addr)) {
+      log << "Socket path '" << socketPath_ << "' is too long\n";
+      return false;
+   }
+
+   if (int fd = connectTo(socketPath_); fd >= 0) {
+      ::close(fd);
+      log << "A server is already listening on '" << socketPath_ << "'\n";
+      return false;
+   }
+   // left behind by a server that did not shut down cleanly
+   ::unlink(socketPath_.c_str());
+
+   int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if (fd < 0) {
+      log << "Failed to create socket: " << std::strerror(errno) << '\n';
+      return false;
+   }
+   // jobs run with the permissions of the server, only its user may connect
+   mode_t mask = ::umask(077);
+   int err = ::bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+   ::umask(mask);
+   if (err || ::listen(fd, SOMAXCONN)) {
+      log << "Failed to listen on '" << socketPath_ << "': " << std::strerror(errno) << '\n';
+      ::close(fd);
+      return false;
+   }
+   fd_ = fd;
+
+   cwd_ = ::open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   for (int i = 0; i < STDIO_FDS; ++i) {
+      stdio_[i] = ::fcntl(i, F_DUPFD_CLOEXEC, STDIO_FDS);
+   }
+   // a client may go away while its job is still writing to it
+   std::signal(SIGPIPE, SIG_IGN);
+   // interrupts accept(), so that the socket is removed on shutdown
+   struct sigaction action{};
+   action.sa_handler = requestStop;
+   sigemptyset(&action.sa_mask);
+   sigaction(SIGINT, &action, nullptr);
+   sigaction(SIGTERM, &action, nullptr);
+   return true;
+}
+// ---------------------------------------------------------------------------
+void CompileServer::run() {
+   while (!stopRequested) {
+      int conn = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (conn < 0) {
+         continue;
+      }
+      serve(conn);
+      ::close(conn);
+   }
+}
+// ---------------------------------------------------------------------------
+void CompileServer::serve(int conn) {
+   ucred cred;
+   socklen_t credSize = sizeof(cred);
+   if (::getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &credSize) || cred.uid != ::getuid()) {
+      return;
+   }
+
+   Request req;
+   alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * STDIO_FDS)];
+   iovec iov{.iov_base = &req, .iov_len = sizeof(req)};
+   msghdr msg{};
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+   ssize_t n;
+   do {
+      n = ::recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+   } while (n < 0 && errno == EINTR);
+   if (n <= 0) {
+      return;
+   }
+
+   std::vector<int> fds{};
+   for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+         std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+         for (std::size_t i = 0; i < count; ++i) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            fds.push_back(fd);
+         }
+      }
+   }
+
+   std::string payload{};
+   bool valid = fds.size() == STDIO_FDS &&
+                recvAll(conn, reinterpret_cast<char*>(&req) + n, sizeof(req) - static_cast<std::size_t>(n)) &&
+                req.size <= MAX_REQUEST_SIZE;
+   if (valid) {
+      payload.resize(req.size);
+      valid = recvAll(conn, payload.data(), payload.size());
+   }
+
+   // the working directory followed by the arguments
+   std::vector<std::string_view> parts{};
+   for (std::size_t pos = 0; valid && pos < payload.size();) {
+      std::size_t end = payload.find('\0', pos);
+      if (end == std::string::npos) {
+         valid = false;
+         break;
+      }
+      parts.push_back(std::string_view{payload}.substr(pos, end - pos));
+      pos = end + 1;
+   }
+   valid = valid && parts.size() == req.argc + 1;
+
+   std::int32_t status = 1;
+   if (valid) {
+      std::string program = "qcp";
+      std::vector<char*> argv{program.data()};
+      for (std::size_t i = 1; i < parts.size(); ++i) {
+         argv.push_back(const_cast<char*>(parts[i].data()));
+      }
+      argv.push_back(nullptr);
+
+      if (::chdir(parts[0].data()) == 0) {
+         flushStdio();
+         for (int i = 0; i < STDIO_FDS; ++i) {
+            ::dup2(fds[i], i);
+         }
+         status = driver_(static_cast<int>(argv.size() - 1), argv.data());
+         flushStdio();
+         for (int i = 0; i < STDIO_FDS; ++i) {
+            ::dup2(stdio_[i], i);
+         }
+         std::clearerr(stdout);
+         std::clearerr(stderr);
+         std::cout.clear();
+         std::cerr.clear();
+      } else {
+         dprintf(fds[2], "Failed to change to directory '%s': %s\n", parts[0].data(), std::strerror(errno));
+      }
+      ::fchdir(cwd_);
+   }
+
+   for (int fd : fds) {
+      ::close(fd);
+   }
+   // nothing of the finished job refers to its identifiers anymore
+   StringPool::reset();
+
+   if (valid) {
+      sendAll(conn, &status, sizeof(status));
+   }
+}
+// ---------------------------------------------------------------------------
+std::optional<int> CompileServer::forward(const std::string& socketPath, int argc, char** argv) {
+   std::string payload{};
+   char* cwd = ::getcwd(nullptr, 0);
+   if (!cwd) {
+      return std::nullopt;
+   }
+   payload.append(cwd).push_back('\0');
+   std::free(cwd);
+   for (int i = 1; i < argc; ++i) {
+      payload.append(argv[i]).push_back('\0');
+   }
+   if (payload.size() > MAX_REQUEST_SIZE) {
+      return std::nullopt;
+   }
+
+   int fd = connectTo(socketPath);
+   if (fd < 0) {
+      return std::nullopt;
+   }
+
+   Request req{.argc = static_cast<std::uint32_t>(argc - 1), .size = static_cast<std::uint32_t>(payload.size())};
+   int fds[STDIO_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+   alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+   iovec iov{.iov_base = &req, .iov_len = sizeof(req)};
+   msghdr msg{};
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+   cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+   std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+   ssize_t n;
+   do {
+      n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+   } while (n < 0 && errno == EINTR);
+   if (n != sizeof(req) || !sendAll(fd, payload.data(), payload.size())) {
+      ::close(fd);
+      return std::nullopt;
+   }
+
+   std::int32_t status;
+   bool ok = recvAll(fd, &status, sizeof(status));
+   ::close(fd);
+   if (!ok) {
+      // the job may have produced output already, so it is not retried
+      std::cerr << "Lost connection to the compile server\n";
+      return 1;
+   }
+   return status;
+}
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
@@ -2,6 +2,7 @@
 // qcp
 // ---------------------------------------------------------------------------
 #include "diagnostics.h"
+#include "simdscan.h"
 // ---------------------------------------------------------------------------
 #include <algorithm>
 #include <iomanip>
@@ -11,30 +12,34 @@ namespace qcp {
 // DiagnosticMessage
 // ---------------------------------------------------------------------------
 std::vector<long long>::const_iterator DiagnosticMessage::findLineBegin() const {
-   auto it = std::lower_bound(tracker_.lineBreaks_.begin(), tracker_.lineBreaks_.end(), loc_.value().loc());
-   assert(it != tracker_.lineBreaks_.begin());
+   const std::vector<long long> &lineBreaks = tracker_.lineBreaks();
+   auto it = std::lower_bound(lineBreaks.begin(), lineBreaks.end(), loc_.value().loc());
+   assert(it != lineBreaks.begin());
    return it - 1;
 }
 // ---------------------------------------------------------------------------
-std::map<std::size_t, std::pair<std::string, std::size_t>>::const_iterator DiagnosticMessage::findFileBegin() const {
-   auto it = tracker_.fileStack_.lower_bound(translationUnitLine());
+std::map<long long, std::pair<std::string, std::size_t>>::const_iterator DiagnosticMessage::findFileBegin() const {
+   auto it = tracker_.fileStack_.lower_bound(loc_.value().loc());
    assert(it != tracker_.fileStack_.begin());
    return --it;
 }
 // ---------------------------------------------------------------------------
 std::size_t DiagnosticMessage::translationUnitLine() const {
-   return std::distance(tracker_.lineBreaks_.begin(), findLineBegin()) + 1;
+   return std::distance(tracker_.lineBreaks().begin(), findLineBegin()) + 1;
 }
 // ---------------------------------------------------------------------------
 std::size_t DiagnosticMessage::line() const {
    auto fileIt = findFileBegin();
    std::size_t fileOffset = fileIt->second.second;
-   return translationUnitLine() - fileIt->first + fileOffset;
+   // the line of the line marker
+   const std::vector<long long> &lineBreaks = tracker_.lineBreaks();
+   std::size_t markerLine = std::distance(lineBreaks.begin(), std::lower_bound(lineBreaks.begin(), lineBreaks.end(), fileIt->first));
+   return translationUnitLine() - markerLine + fileOffset;
 }
 // ---------------------------------------------------------------------------
 std::size_t DiagnosticMessage::column() const {
    std::size_t lineNo = translationUnitLine();
-   auto lineBegin = tracker_.lineBreaks_[lineNo - 1];
+   auto lineBegin = tracker_.lineBreaks()[lineNo - 1];
    return loc_.value().loc() - lineBegin;
 }
 // ---------------------------------------------------------------------------
@@ -48,9 +53,9 @@ std::string_view DiagnosticMessage::file() const {
 // ---------------------------------------------------------------------------
 std::string_view DiagnosticMessage::getSourceLine() const {
    auto lineBegin = findLineBegin();
-   if (lineBegin == tracker_.lineBreaks_.end()) {
+   if (lineBegin == tracker_.lineBreaks().end()) {
       return {};
-   } else if (*lineBegin == tracker_.lineBreaks_.back()) {
+   } else if (*lineBegin == tracker_.lineBreaks().back()) {
       auto beginIt = tracker_.prog_.begin() + *lineBegin + 1;
       auto endIt = std::find(beginIt, tracker_.prog_.end(), '\n');
       return std::string_view{beginIt, endIt};
@@ -108,11 +113,13 @@ std::size_t DiagnosticTracker::count(DiagnosticMessage::Kind kind) const {
    });
 }
 // ---------------------------------------------------------------------------
-void DiagnosticTracker::registerLineBreak(long long pos) {
-   if (pos <= lineBreaks_.back()) {
-      return; // todo: this is only neccesary because operator++ may be called multiple times for a token. this should be removed.
+const std::vector<long long> &DiagnosticTracker::lineBreaks() const {
+   // the program grows while it is read from a stream
+   if (scanned_ < prog_.size()) {
+      simd::findNewlines(prog_.data(), prog_.data() + scanned_, prog_.data() + prog_.size(), lineBreaks_);
+      scanned_ = prog_.size();
    }
-   lineBreaks_.push_back(pos);
+   return lineBreaks_;
 }
 // ---------------------------------------------------------------------------
 DiagnosticTracker& DiagnosticTracker::operator<<(std::ostream& (*pf)(std::ostream&) ) {
@@ -121,7 +128,7 @@ DiagnosticTracker& DiagnosticTracker::operator<<(std::ostream& (*pf)(std::ostrea
       DiagnosticMessage diag{*this, os_.str(), loc_, kind_};
       if (!silenced || kind_ == DiagnosticMessage::Kind::NOTE) {
          diagnostics_.push_back(diag);
-         std::cerr << diag << '\n';
+         *out_ << diag << '\n';
       }
       os_.str("");
       loc_.reset();
@@ -0,0 +1,1575 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "directemitter.h"
+#include "basetype.h"
+#include "constantfolding.h"
+#include "operator.h"
+#include "type.h"
+#include "typefactory.h"
+// ---------------------------------------------------------------------------
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <elf.h>
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+using DirectEmitter = qcp::emitter::DirectEmitter;
+using OpKind = qcp::op::Kind;
+using Ty = DirectEmitter::Ty;
+using TyKind = DirectEmitter::Ty::Kind;
+using Value = DirectEmitter::Value;
+using ValueKind = DirectEmitter::Value::Kind;
+using Constant = DirectEmitter::Constant;
+using BasicBlock = DirectEmitter::BasicBlock;
+using Type = typename DirectEmitter::Type;
+using Section = qcp::ElfWriter::Section;
+// ---------------------------------------------------------------------------
+enum Reg : unsigned {
+   RAX,
+   RCX,
+   RDX,
+   RBX,
+   RSP,
+   RBP,
+   RSI,
+   RDI,
+   R8,
+   R9,
+   R10,
+   R11,
+};
+// ---------------------------------------------------------------------------
+constexpr unsigned INT_ARG_REGS[] = {RDI, RSI, RDX, RCX, R8, R9};
+constexpr unsigned FP_ARG_REGS = 8;
+// ---------------------------------------------------------------------------
+// condition codes of jcc and setcc
+enum Cond : unsigned {
+   CC_B = 0x2,
+   CC_AE = 0x3,
+   CC_E = 0x4,
+   CC_NE = 0x5,
+   CC_BE = 0x6,
+   CC_A = 0x7,
+   CC_P = 0xA,
+   CC_NP = 0xB,
+   CC_L = 0xC,
+   CC_GE = 0xD,
+   CC_LE = 0xE,
+   CC_G = 0xF,
+};
+// ---------------------------------------------------------------------------
+void emit8(std::string &code, unsigned byte) {
+   code.push_back(static_cast<char>(byte));
+}
+// ---------------------------------------------------------------------------
+void emit32(std::string &code, std::uint32_t value) {
+   for (unsigned i = 0; i < 4; ++i) {
+      emit8(code, (value >> (8 * i)) & 0xff);
+   }
+}
+// ---------------------------------------------------------------------------
+void emit64(std::string &code, std::uint64_t value) {
+   emit32(code, static_cast<std::uint32_t>(value));
+   emit32(code, static_cast<std::uint32_t>(value >> 32));
+}
+// ---------------------------------------------------------------------------
+// legacy prefix (0 for none), rex and the opcode. opcodes above 0xff are two byte opcodes starting with 0x0f
+void opcode(std::string &code, unsigned prefix, bool w, unsigned reg, unsigned rm, unsigned op) {
+   if (prefix) {
+      emit8(code, prefix);
+   }
+   unsigned rex = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+   if (rex != 0x40) {
+      emit8(code, rex);
+   }
+   if (op > 0xff) {
+      emit8(code, op >> 8);
+   }
+   emit8(code, op & 0xff);
+}
+// ---------------------------------------------------------------------------
+// op reg, [base + disp]
+void opMem(std::string &code, unsigned prefix, bool w, unsigned op, unsigned reg, unsigned base, std::int32_t disp) {
+   opcode(code, prefix, w, reg, base, op);
+   unsigned r = (reg & 7) << 3;
+   unsigned b = base & 7;
+   unsigned mod = disp == 0 && b != RBP ? 0x00 : disp >= -128 && disp <= 127 ? 0x40 : 0x80;
+   emit8(code, mod | r | b);
+   if (b == RSP) {
+      emit8(code, 0x24);
+   }
+   if (mod == 0x40) {
+      emit8(code, static_cast<std::uint8_t>(disp));
+   } else if (mod == 0x80) {
+      emit32(code, static_cast<std::uint32_t>(disp));
+   }
+}
+// ---------------------------------------------------------------------------
+// op reg, rm
+void opReg(std::string &code, unsigned prefix, bool w, unsigned op, unsigned reg, unsigned rm) {
+   opcode(code, prefix, w, reg, rm, op);
+   emit8(code, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+// ---------------------------------------------------------------------------
+void movImm(std::string &code, unsigned reg, std::uint64_t value) {
+   if (value <= std::numeric_limits<std::uint32_t>::max()) {
+      opcode(code, 0, false, 0, reg, 0xb8 + (reg & 7));
+      emit32(code, static_cast<std::uint32_t>(value));
+   } else if (static_cast<std::int64_t>(value) >= std::numeric_limits<std::int32_t>::min() && static_cast<std::int64_t>(value) < 0) {
+      opReg(code, 0, true, 0xc7, 0, reg);
+      emit32(code, static_cast<std::uint32_t>(value));
+   } else {
+      opcode(code, 0, true, 0, reg, 0xb8 + (reg & 7));
+      emit64(code, value);
+   }
+}
+// ---------------------------------------------------------------------------
+// integers narrower than 32 bit are extended
+void loadMem(std::string &code, unsigned reg, unsigned bits, bool signExtend, unsigned base, std::int32_t disp) {
+   if (bits <= 8) {
+      opMem(code, 0, false, signExtend && bits > 1 ? 0x0fbe : 0x0fb6, reg, base, disp);
+   } else if (bits <= 16) {
+      opMem(code, 0, false, signExtend ? 0x0fbf : 0x0fb7, reg, base, disp);
+   } else {
+      opMem(code, 0, bits > 32, 0x8b, reg, base, disp);
+   }
+}
+// ---------------------------------------------------------------------------
+void storeMem(std::string &code, unsigned reg, unsigned bits, unsigned base, std::int32_t disp) {
+   if (bits <= 8) {
+      opMem(code, 0, false, 0x88, reg, base, disp);
+   } else if (bits <= 16) {
+      opMem(code, 0x66, false, 0x89, reg, base, disp);
+   } else {
+      opMem(code, 0, bits > 32, 0x89, reg, base, disp);
+   }
+}
+// ---------------------------------------------------------------------------
+unsigned scalarBits(const Ty *ty) {
+   if (!ty) {
+      return 64;
+   }
+   switch (ty->kind) {
+      case TyKind::INT: return ty->bits;
+      case TyKind::FLOAT: return 32;
+      default: return 64;
+   }
+}
+// ---------------------------------------------------------------------------
+bool isFP(const Ty *ty) {
+   return ty && (ty->kind == TyKind::FLOAT || ty->kind == TyKind::DOUBLE);
+}
+// ---------------------------------------------------------------------------
+bool isAggregate(const Ty *ty) {
+   return ty && (ty->kind == TyKind::STRUCT || ty->kind == TyKind::ARRAY);
+}
+// ---------------------------------------------------------------------------
+// the scalar prefix of sse instructions
+unsigned fpPrefix(bool isDouble) {
+   return isDouble ? 0xf2 : 0xf3;
+}
+// ---------------------------------------------------------------------------
+bool isSigned(Type ty) {
+   return ty->isSignedTy() || ty->isSignedCharlikeTy();
+}
+// ---------------------------------------------------------------------------
+bool fitsInt32(std::int64_t value) {
+   return value >= std::numeric_limits<std::int32_t>::min() && value <= std::numeric_limits<std::int32_t>::max();
+}
+// ---------------------------------------------------------------------------
+std::uint64_t fpBits(double value, bool isDouble) {
+   return isDouble ? std::bit_cast<std::uint64_t>(value) : std::bit_cast<std::uint32_t>(static_cast<float>(value));
+}
+// ---------------------------------------------------------------------------
+std::uint64_t alignTo(std::uint64_t value, std::uint64_t align) {
+   return (value + align - 1) / align * align;
+}
+// ---------------------------------------------------------------------------
+Cond toCond(OpKind kind, bool isSigned) {
+   switch (kind) {
+      case OpKind::EQ: return CC_E;
+      case OpKind::NE: return CC_NE;
+      case OpKind::LT: return isSigned ? CC_L : CC_B;
+      case OpKind::LE: return isSigned ? CC_LE : CC_BE;
+      case OpKind::GT: return isSigned ? CC_G : CC_A;
+      default: return isSigned ? CC_GE : CC_AE;
+   }
+}
+// ---------------------------------------------------------------------------
+// addsd, subsd, mulsd and divsd, 0 for everything else
+unsigned fpArithOpcode(OpKind kind) {
+   switch (kind) {
+      case OpKind::ADD: return 0x0f58;
+      case OpKind::SUB: return 0x0f5c;
+      case OpKind::MUL: return 0x0f59;
+      case OpKind::DIV: return 0x0f5e;
+      default: return 0;
+   }
+}
+// ---------------------------------------------------------------------------
+bool isIntConstant(const Value *v) {
+   return v->kind == ValueKind::INT || v->kind == ValueKind::NULLPTR || v->kind == ValueKind::ZERO;
+}
+// ---------------------------------------------------------------------------
+double fpValue(const Constant *c) {
+   return c->kind == ValueKind::FP ? c->fp : static_cast<double>(static_cast<std::int64_t>(c->value));
+}
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+namespace qcp {
+namespace emitter {
+// ---------------------------------------------------------------------------
+DirectEmitter::DirectEmitter([[maybe_unused]] const Options &options) {
+#if !defined(__x86_64__) || !defined(__ELF__)
+   // the generated code only runs on x86-64 ELF hosts
+   supported_ = false;
+#endif
+   voidTy_ = newTy({.kind = Ty::Kind::VOID, .size = 1});
+   floatTy_ = newTy({.kind = Ty::Kind::FLOAT, .size = 4, .align = 4});
+   doubleTy_ = newTy({.kind = Ty::Kind::DOUBLE, .size = 8, .align = 8});
+   ptrTy_ = newTy({.kind = Ty::Kind::PTR, .size = 8, .align = 8});
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Value *DirectEmitter::unsupported() {
+   supported_ = false;
+   return newValue(Value::Kind::UNDEF, voidTy_);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Constant *DirectEmitter::unsupportedConstant(Ty *ty) {
+   supported_ = false;
+   return newConstant(Value::Kind::ZERO, ty);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Ty *DirectEmitter::newTy(Ty ty) {
+   return &tys_.emplace_back(std::move(ty));
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Value *DirectEmitter::newValue(Value::Kind kind, Ty *ty, std::int64_t offset, ElfWriter::SymbolId sym) {
+   return &values_.emplace_back(Value{kind, ty, offset, sym});
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Constant *DirectEmitter::newConstant(Value::Kind kind, Ty *ty) {
+   Constant &c = constants_.emplace_back();
+   c.kind = kind;
+   c.ty = ty;
+   return &c;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ConstantInt *DirectEmitter::newInt(Ty *ty, std::uint64_t value) {
+   // the parser compares integer constants by address, like LLVM they are unique
+   value = truncate(value, scalarBits(ty));
+   auto [it, inserted] = uniqueInts_.try_emplace({ty, value}, nullptr);
+   if (inserted) {
+      ConstantInt &c = ints_.emplace_back();
+      c.kind = Value::Kind::INT;
+      c.ty = ty;
+      c.value = value;
+      it->second = &c;
+   }
+   return it->second;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Constant *DirectEmitter::newFP(Ty *ty, double value) {
+   Constant *c = newConstant(Value::Kind::FP, ty);
+   c->fp = ty->kind == Ty::Kind::FLOAT ? static_cast<float>(value) : value;
+   return c;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Value *DirectEmitter::newTemp(BasicBlock *bb, Ty *ty) {
+   return newValue(Value::Kind::TEMP, ty, allocFrame(bb->fn, 8, 8));
+}
+// ---------------------------------------------------------------------------
+std::int64_t DirectEmitter::allocFrame(Function *fn, std::uint64_t size, std::uint64_t align) {
+   fn->frameSize = static_cast<std::int64_t>(alignTo(static_cast<std::uint64_t>(fn->frameSize) + size, align));
+   return -fn->frameSize;
+}
+// ---------------------------------------------------------------------------
+ElfWriter::SymbolId DirectEmitter::symbol(const std::string &name) {
+   if (name.empty()) {
+      return elf_.addSymbol(".Lqcp." + std::to_string(anonymous_++), ElfWriter::Binding::LOCAL);
+   }
+   auto [it, inserted] = symbols_.try_emplace(name, 0);
+   if (inserted) {
+      it->second = elf_.addSymbol(name, ElfWriter::Binding::GLOBAL);
+   }
+   return it->second;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Value *DirectEmitter::asValue(const value_t &value) {
+   if (ssa_t *const *ssa = std::get_if<ssa_t *>(&value)) {
+      return *ssa;
+   } else if (const_t *const *c = std::get_if<const_t *>(&value)) {
+      return *c;
+   } else if (iconst_t *const *ic = std::get_if<iconst_t *>(&value)) {
+      return *ic;
+   } else if (fn_t *const *fn = std::get_if<fn_t *>(&value)) {
+      return &(*fn)->address;
+   }
+   return nullptr;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Constant *DirectEmitter::asConstant(const const_or_iconst_t &value) {
+   if (const_t *const *c = std::get_if<const_t *>(&value)) {
+      return *c;
+   } else if (iconst_t *const *ic = std::get_if<iconst_t *>(&value)) {
+      return *ic;
+   }
+   return nullptr;
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::loadAddress(BasicBlock *bb, unsigned reg, ElfWriter::SymbolId sym, std::int64_t addend) {
+   std::string &code = bb->code;
+   if (elf_.isLocal(sym)) {
+      // lea reg, [rip + sym]
+      opcode(code, 0, true, reg, 0, 0x8d);
+      emit8(code, ((reg & 7) << 3) | 0x05);
+      bb->relocations.push_back({static_cast<std::uint32_t>(code.size()), sym, R_X86_64_PC32, addend - 4});
+      emit32(code, 0);
+      return;
+   }
+   // mov reg, [rip + sym@GOTPCREL], the linker relaxes it to a lea if sym is not preemptible
+   opcode(code, 0, true, reg, 0, 0x8b);
+   emit8(code, ((reg & 7) << 3) | 0x05);
+   bb->relocations.push_back({static_cast<std::uint32_t>(code.size()), sym, R_X86_64_REX_GOTPCRELX, -4});
+   emit32(code, 0);
+   if (addend) {
+      opReg(code, 0, true, 0x81, 0, reg);
+      emit32(code, static_cast<std::uint32_t>(addend));
+   }
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::load(BasicBlock *bb, unsigned reg, Value *value, bool signExtend) {
+   std::string &code = bb->code;
+   unsigned bits = scalarBits(value->ty);
+   bool cacheable = reg == RAX && value->kind == Value::Kind::TEMP && bits >= 32;
+   if (cacheable && bb->rax == value) {
+      return;
+   }
+   switch (value->kind) {
+      case Value::Kind::TEMP:
+         loadMem(code, reg, bits, signExtend, RBP, static_cast<std::int32_t>(value->offset));
+         break;
+      case Value::Kind::FRAME:
+      case Value::Kind::AGGREGATE:
+         opMem(code, 0, true, 0x8d, reg, RBP, static_cast<std::int32_t>(value->offset));
+         break;
+      case Value::Kind::GLOBAL:
+         loadAddress(bb, reg, value->sym, value->offset);
+         break;
+      case Value::Kind::FUNC:
+         loadAddress(bb, reg, value->sym, 0);
+         break;
+      case Value::Kind::INT: {
+         std::uint64_t v = static_cast<Constant *>(value)->value;
+         if (signExtend && bits < 32) {
+            v = truncate(static_cast<std::uint64_t>(emitter::signExtend(v, bits)), 32);
+         }
+         movImm(code, reg, v);
+         break;
+      }
+      case Value::Kind::FP:
+         movImm(code, reg, fpBits(static_cast<Constant *>(value)->fp, bits == 64));
+         break;
+      case Value::Kind::NULLPTR:
+      case Value::Kind::ZERO:
+      case Value::Kind::UNDEF:
+         movImm(code, reg, 0);
+         break;
+      default:
+         unsupported();
+         break;
+   }
+   if (reg == RAX) {
+      bb->rax = cacheable ? value : nullptr;
+   }
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::loadFP(BasicBlock *bb, unsigned xmm, Value *value, bool isDouble) {
+   std::string &code = bb->code;
+   switch (value->kind) {
+      case Value::Kind::TEMP:
+         opMem(code, fpPrefix(isDouble), false, 0x0f10, xmm, RBP, static_cast<std::int32_t>(value->offset));
+         return;
+      case Value::Kind::FP:
+      case Value::Kind::INT:
+      case Value::Kind::ZERO:
+      case Value::Kind::UNDEF: {
+         const Constant *c = static_cast<const Constant *>(value);
+         std::uint64_t bits = value->kind == Value::Kind::FP ? fpBits(c->fp, isDouble) : value->kind == Value::Kind::INT ? fpBits(fpValue(c), isDouble) : 0;
+         // r11 is neither an argument nor cached
+         movImm(code, R11, bits);
+         opReg(code, 0x66, isDouble, 0x0f6e, xmm, R11);
+         return;
+      }
+      default:
+         unsupported();
+   }
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Mem DirectEmitter::address(BasicBlock *bb, Value *ptr, unsigned scratch) {
+   switch (ptr->kind) {
+      case Value::Kind::FRAME:
+      case Value::Kind::AGGREGATE:
+         return {RBP, static_cast<std::int32_t>(ptr->offset)};
+      case Value::Kind::GLOBAL:
+         loadAddress(bb, scratch, ptr->sym, 0);
+         return {scratch, static_cast<std::int32_t>(ptr->offset)};
+      default:
+         load(bb, scratch, ptr, false);
+         return {scratch, 0};
+   }
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::storeTemp(BasicBlock *bb, Value *temp, bool isFP, bool isDouble) {
+   if (isFP) {
+      opMem(bb->code, fpPrefix(isDouble), false, 0x0f11, 0, RBP, static_cast<std::int32_t>(temp->offset));
+      return;
+   }
+   opMem(bb->code, 0, true, 0x89, RAX, RBP, static_cast<std::int32_t>(temp->offset));
+   bb->rax = temp;
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::copy(BasicBlock *bb, Value *src, Value *dst, std::uint64_t size) {
+   load(bb, RSI, src, false);
+   load(bb, RDI, dst, false);
+   movImm(bb->code, RCX, size);
+   // rep movsb
+   emit8(bb->code, 0xf3);
+   emit8(bb->code, 0xa4);
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::zero(BasicBlock *bb, Value *dst, std::uint64_t size) {
+   load(bb, RDI, dst, false);
+   movImm(bb->code, RCX, size);
+   movImm(bb->code, RAX, 0);
+   // rep stosb
+   emit8(bb->code, 0xf3);
+   emit8(bb->code, 0xaa);
+   bb->rax = nullptr;
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::store(BasicBlock *bb, Ty *ty, Value *value, Value *ptr) {
+   if (!bb || !value || !ptr) {
+      unsupported();
+      return;
+   }
+   if (isAggregate(ty)) {
+      switch (value->kind) {
+         case Value::Kind::ZERO:
+         case Value::Kind::UNDEF:
+            zero(bb, ptr, ty->size);
+            return;
+         case Value::Kind::ARRAY:
+         case Value::Kind::STRUCT:
+         case Value::Kind::STRING: {
+            ElfWriter::SymbolId sym = constantSymbol(static_cast<Constant *>(value), ty->size);
+            copy(bb, newValue(Value::Kind::GLOBAL, ptrTy_, 0, sym), ptr, ty->size);
+            return;
+         }
+         case Value::Kind::AGGREGATE:
+         case Value::Kind::FRAME:
+         case Value::Kind::GLOBAL:
+            copy(bb, value, ptr, ty->size);
+            return;
+         default:
+            unsupported();
+            return;
+      }
+   }
+   if (isFP(ty)) {
+      bool isDouble = ty->kind == Ty::Kind::DOUBLE;
+      loadFP(bb, 0, value, isDouble);
+      Mem mem = address(bb, ptr, RCX);
+      opMem(bb->code, fpPrefix(isDouble), false, 0x0f11, 0, mem.base, mem.disp);
+      return;
+   }
+   if (ty->kind != Ty::Kind::INT && ty->kind != Ty::Kind::PTR) {
+      unsupported();
+      return;
+   }
+   load(bb, RAX, value, false);
+   Mem mem = address(bb, ptr, RCX);
+   storeMem(bb->code, RAX, scalarBits(ty), mem.base, mem.disp);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Value *DirectEmitter::retype(BasicBlock *bb, Value *value, Ty *ty) {
+   if (value->kind == Value::Kind::TEMP) {
+      // the slot already holds the bits
+      return newValue(Value::Kind::TEMP, ty, value->offset);
+   }
+   load(bb, RAX, value, false);
+   Value *result = newTemp(bb, ty);
+   storeTemp(bb, result);
+   return result;
+}
+// ---------------------------------------------------------------------------
+ElfWriter::SymbolId DirectEmitter::constantSymbol(Constant *c, std::uint64_t size) {
+   size = std::max(size, c->ty ? c->ty->size : 0);
+   if (auto it = constantSymbols_.find(c); it != constantSymbols_.end() && it->second.second >= size) {
+      return it->second.first;
+   }
+   std::string data(size, '\0');
+   std::vector<std::pair<std::size_t, ElfWriter::SymbolId>> relocations{};
+   serialize(c, data, 0, relocations);
+   // function pointers need relocations, they cannot be read-only in position independent code
+   Section section = relocations.empty() ? Section::RODATA : Section::DATA;
+   std::uint64_t offset = elf_.append(section, data, c->ty ? c->ty->align : 8);
+   for (auto [at, target] : relocations) {
+      elf_.addRelocation(section, offset + at, target, R_X86_64_64, 0);
+   }
+   ElfWriter::SymbolId sym = symbol("");
+   elf_.define(sym, section, offset, size, ElfWriter::SymbolType::OBJECT);
+   constantSymbols_[c] = {sym, size};
+   return sym;
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::serialize(Constant *c, std::string &data, std::size_t offset, std::vector<std::pair<std::size_t, ElfWriter::SymbolId>> &relocations) {
+   if (offset >= data.size()) {
+      return;
+   }
+   std::size_t remaining = data.size() - offset;
+   switch (c->kind) {
+      case Value::Kind::INT: {
+         std::size_t size = std::min<std::size_t>(c->ty ? c->ty->size : 8, remaining);
+         for (std::size_t i = 0; i < size && i < 8; ++i) {
+            data[offset + i] = static_cast<char>((c->value >> (8 * i)) & 0xff);
+         }
+         break;
+      }
+      case Value::Kind::FP:
+         if (c->ty->kind == Ty::Kind::FLOAT) {
+            float f = static_cast<float>(c->fp);
+            std::memcpy(&data[offset], &f, std::min(sizeof(f), remaining));
+         } else {
+            std::memcpy(&data[offset], &c->fp, std::min(sizeof(c->fp), remaining));
+         }
+         break;
+      case Value::Kind::NULLPTR:
+      case Value::Kind::ZERO:
+      case Value::Kind::UNDEF:
+         break;
+      case Value::Kind::ARRAY:
+         for (std::size_t i = 0; i < c->elems.size(); ++i) {
+            serialize(c->elems[i], data, offset + i * c->ty->elem->size, relocations);
+         }
+         break;
+      case Value::Kind::STRUCT:
+         for (std::size_t i = 0; i < c->elems.size() && i < c->ty->offsets.size(); ++i) {
+            serialize(c->elems[i], data, offset + c->ty->offsets[i], relocations);
+         }
+         break;
+      case Value::Kind::STRING:
+         std::memcpy(&data[offset], c->str.data(), std::min(c->str.size(), remaining));
+         break;
+      case Value::Kind::FUNC:
+         if (remaining >= 8) {
+            relocations.emplace_back(offset, c->sym);
+         }
+         break;
+      default:
+         unsupported();
+         break;
+   }
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::writeToObjFile(int fd) {
+   for (GlobalVar &var : globals_) {
+      if (elf_.isDefined(var.sym) || (!var.init && !var.zeroInit)) {
+         // a declaration
+         continue;
+      }
+      std::uint64_t size = std::max<std::uint64_t>(var.varTy->size, var.init && var.init->ty ? var.init->ty->size : 0);
+      std::uint64_t align = std::max<std::uint64_t>(var.varTy->align, 1);
+      if (!var.init || var.init->kind == Value::Kind::ZERO) {
+         std::uint64_t offset = elf_.reserve(Section::BSS, size, align);
+         elf_.define(var.sym, Section::BSS, offset, size, ElfWriter::SymbolType::OBJECT);
+         continue;
+      }
+      std::string data(size, '\0');
+      std::vector<std::pair<std::size_t, ElfWriter::SymbolId>> relocations{};
+      serialize(var.init, data, 0, relocations);
+      std::uint64_t offset = elf_.append(Section::DATA, data, align);
+      for (auto [at, target] : relocations) {
+         elf_.addRelocation(Section::DATA, offset + at, target, R_X86_64_64, 0);
+      }
+      elf_.define(var.sym, Section::DATA, offset, size, ElfWriter::SymbolType::OBJECT);
+   }
+   if (!elf_.write(fd)) {
+      std::cerr << "Failed to write object file\n";
+   }
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::dumpToStdout() {
+   for (const Function &fn : fns_) {
+      std::cout << fn.name << (fn.blocks.empty() ? " (declaration)" : "") << '\n';
+   }
+}
+// ---------------------------------------------------------------------------
+long long DirectEmitter::getIntegerValue(iconst_t *c) {
+   return signExtend(c->value, scalarBits(c->ty));
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::iconst_t *DirectEmitter::sizeOf(Type ty) {
+   Ty *t = ty;
+   return newInt(emitIntTy(64), t ? t->size : 0);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ty_t *DirectEmitter::emitVoidTy() {
+   return voidTy_;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ty_t *DirectEmitter::emitIntTy(unsigned bits) {
+   if (bits > 64) {
+      unsupported();
+      bits = 64;
+   }
+   if (!intTys_[bits]) {
+      std::uint64_t size = std::max(1u, (bits + 7) / 8);
+      intTys_[bits] = newTy({.kind = Ty::Kind::INT, .bits = bits, .size = size, .align = size});
+   }
+   return intTys_[bits];
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ty_t *DirectEmitter::emitFloatTy() {
+   return floatTy_;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ty_t *DirectEmitter::emitDoubleTy() {
+   return doubleTy_;
+}
+// ---------------------------------------------------------------------------
+// like the LLVMEmitter, long double is a double
+typename DirectEmitter::ty_t *DirectEmitter::emitLongDoubleTy() {
+   return doubleTy_;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ty_t *DirectEmitter::emitPtrTo([[maybe_unused]] Type ty) {
+   return ptrTy_;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ty_t *DirectEmitter::emitArrayTy(Type ty, iconst_t *size) {
+   Ty *elem = ty;
+   std::uint64_t elemSize = elem ? elem->size : 0;
+   return newTy({.kind = Ty::Kind::ARRAY, .size = elemSize * size->value, .align = elem ? elem->align : 1, .elem = elem, .count = size->value});
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ty_t *DirectEmitter::emitStructTy(std::span<const Type> tys, [[maybe_unused]] bool incomplete, [[maybe_unused]] Ident name) {
+   Ty ty{.kind = Ty::Kind::STRUCT};
+   std::uint64_t offset = 0;
+   for (const Type &member : tys) {
+      Ty *m = member;
+      if (!m) {
+         unsupported();
+         m = voidTy_;
+      }
+      offset = alignTo(offset, m->align);
+      ty.members.push_back(m);
+      ty.offsets.push_back(offset);
+      offset += m->size;
+      ty.align = std::max(ty.align, m->align);
+   }
+   ty.size = alignTo(offset, ty.align);
+   return newTy(std::move(ty));
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitUndef() {
+   return newValue(Value::Kind::UNDEF, voidTy_);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitPoison() {
+   return newValue(Value::Kind::UNDEF, voidTy_);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ty_t *DirectEmitter::emitFnTy(Type retTy, std::vector<Type> argTys, bool isVarArgFnTy) {
+   Ty ty{.kind = Ty::Kind::FN, .elem = retTy, .signedRet = isSigned(retTy), .varArg = isVarArgFnTy};
+   for (const Type &argTy : argTys) {
+      ty.members.push_back(argTy);
+      ty.signedParams.push_back(isSigned(argTy));
+   }
+   return newTy(std::move(ty));
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitGlobalVar(Type ty, Ident name) {
+   GlobalVar &var = globals_.emplace_back();
+   var.kind = Value::Kind::GLOBAL;
+   var.ty = ptrTy_;
+   var.varTy = ty;
+   if (!var.varTy) {
+      unsupported();
+      var.varTy = voidTy_;
+   }
+   var.sym = symbol(static_cast<std::string>(name));
+   return &var;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_t *DirectEmitter::emitFnPtr([[maybe_unused]] Type ty, fn_t *fn) {
+   return &fn->address;
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::setInitValueGlobalVar(ssa_t *val, const_or_iconst_t init) {
+   if (!val || val->kind != Value::Kind::GLOBAL) {
+      unsupported();
+      return;
+   }
+   static_cast<GlobalVar *>(val)->init = asConstant(init);
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::zeroInitGlobalVar([[maybe_unused]] Type ty, ssa_t *val) {
+   if (!val || val->kind != Value::Kind::GLOBAL) {
+      unsupported();
+      return;
+   }
+   static_cast<GlobalVar *>(val)->zeroInit = true;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::fn_t *DirectEmitter::emitFnProto(Type fnTy, [[maybe_unused]] bool alwaysInline, [[maybe_unused]] bool noReturn, Ident name) {
+   Function &fn = fns_.emplace_back();
+   fn.ty = fnTy;
+   fn.name = static_cast<std::string>(name);
+   fn.sym = symbol(fn.name);
+   fn.address.kind = Value::Kind::FUNC;
+   fn.address.ty = ptrTy_;
+   fn.address.sym = fn.sym;
+   return &fn;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::bb_t *DirectEmitter::emitFn(fn_t *fnProto) {
+   bb_t *entry = emitBB(fnProto);
+   // parameters passed in registers are spilled to a slot by the prologue
+   unsigned ints = 0;
+   unsigned fps = 0;
+   std::int64_t stack = 16;
+   for (Ty *param : fnProto->ty->members) {
+      if (!param || isAggregate(param)) {
+         fnProto->params.push_back(unsupported());
+      } else if (isFP(param) ? fps++ < FP_ARG_REGS : ints++ < std::size(INT_ARG_REGS)) {
+         fnProto->params.push_back(newTemp(entry, param));
+      } else {
+         fnProto->params.push_back(newValue(Value::Kind::TEMP, param, stack));
+         stack += 8;
+      }
+   }
+   return entry;
+}
+// ---------------------------------------------------------------------------
+bool DirectEmitter::isFnProto(fn_t *fn) {
+   return fn->blocks.empty();
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::getParam(fn_t *fn, unsigned idx) {
+   if (idx >= fn->params.size()) {
+      return unsupported();
+   }
+   return fn->params[idx];
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::bb_t *DirectEmitter::emitBB(fn_t *fn, bb_t *insertBefore, [[maybe_unused]] Ident name) {
+   BasicBlock *bb = &blocks_.emplace_back();
+   bb->fn = fn;
+   auto it = std::find(fn->blocks.begin(), fn->blocks.end(), insertBefore);
+   fn->blocks.insert(it, bb);
+   return bb;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::iconst_t *DirectEmitter::emitIConst(Type ty, unsigned long value) {
+   return newInt(ty, value);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_t *DirectEmitter::emitFPConst(Type ty, double value) {
+   return newFP(ty, value);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_t *DirectEmitter::emitNullPtr(Type ty) {
+   return newConstant(Value::Kind::NULLPTR, ty);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_or_iconst_t DirectEmitter::emitZeroConst(Type ty) {
+   return newConstant(Value::Kind::ZERO, ty);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_t *DirectEmitter::emitArrayConst(Type ty, std::span<const const_or_iconst_t> values) {
+   Constant *c = newConstant(Value::Kind::ARRAY, ty);
+   c->elems.reserve(values.size());
+   for (const auto &value : values) {
+      c->elems.push_back(asConstant(value));
+   }
+   return c;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_t *DirectEmitter::emitArrayConst(Type ty, const_or_iconst_t value) {
+   Constant *c = newConstant(Value::Kind::ARRAY, ty);
+   c->elems.assign(c->ty->count, asConstant(value));
+   return c;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_t *DirectEmitter::emitStructConst(Type ty, std::span<const const_or_iconst_t> values) {
+   Constant *c = newConstant(Value::Kind::STRUCT, ty);
+   c->elems.reserve(values.size());
+   for (const auto &value : values) {
+      c->elems.push_back(asConstant(value));
+   }
+   return c;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_t *DirectEmitter::emitStringLiteral(const std::string_view str) {
+   // null terminated like the LLVMEmitter's
+   Ty *ty = newTy({.kind = Ty::Kind::ARRAY, .size = str.size() + 1, .elem = emitIntTy(8), .count = str.size() + 1});
+   Constant *c = newConstant(Value::Kind::STRING, ty);
+   c->str.reserve(str.size() + 1);
+   c->str.append(str).push_back('\0');
+   return c;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitLocalVar(fn_t *fn, [[maybe_unused]] bb_t *entry, Type ty, [[maybe_unused]] Ident name, [[maybe_unused]] bool insertAtBegin) {
+   Ty *t = ty;
+   if (!t) {
+      return unsupported();
+   }
+   return newValue(Value::Kind::FRAME, ptrTy_, allocFrame(fn, std::max<std::uint64_t>(t->size, 1), t->align));
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::zeroInitLocalVar(bb_t *entry, Type ty, ssa_t *val) {
+   Ty *t = ty;
+   zero(entry, val, t->size);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitLoad(bb_t *bb, Type ty, ssa_t *ptr, [[maybe_unused]] Ident name) {
+   Ty *t = ty;
+   if (!bb || !ptr || !t) {
+      return unsupported();
+   }
+   if (isAggregate(t)) {
+      Value *result = newValue(Value::Kind::AGGREGATE, t, allocFrame(bb->fn, std::max<std::uint64_t>(t->size, 1), t->align));
+      copy(bb, ptr, result, t->size);
+      return result;
+   }
+   Value *result = newTemp(bb, t);
+   Mem mem = address(bb, ptr, RCX);
+   if (isFP(t)) {
+      bool isDouble = t->kind == Ty::Kind::DOUBLE;
+      opMem(bb->code, fpPrefix(isDouble), false, 0x0f10, 0, mem.base, mem.disp);
+      storeTemp(bb, result, true, isDouble);
+   } else if (t->kind == Ty::Kind::INT || t->kind == Ty::Kind::PTR) {
+      loadMem(bb->code, RAX, scalarBits(t), false, mem.base, mem.disp);
+      storeTemp(bb, result);
+   } else {
+      return unsupported();
+   }
+   return result;
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::emitStore(bb_t *bb, Type ty, value_t value, ssa_t *ptr) {
+   store(bb, ty, asValue(value), ptr);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitJump(bb_t *bb, bb_t *target) {
+   if (bb && bb->term == BasicBlock::Term::NONE) {
+      bb->term = BasicBlock::Term::JUMP;
+      bb->targets[0] = target;
+   }
+   return nullptr;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitBranch(bb_t *bb, bb_t *trueBB, bb_t *falseBB, value_t cond) {
+   if (bb && bb->term == BasicBlock::Term::NONE) {
+      bb->term = BasicBlock::Term::BRANCH;
+      bb->targets[0] = trueBB;
+      bb->targets[1] = falseBB;
+      bb->operand = asValue(cond);
+      if (!bb->operand) {
+         return unsupported();
+      }
+   }
+   return nullptr;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitRet(bb_t *bb, value_t value) {
+   if (bb && bb->term == BasicBlock::Term::NONE) {
+      bb->term = BasicBlock::Term::RET;
+      bb->operand = asValue(value);
+   }
+   return nullptr;
+}
+// ---------------------------------------------------------------------------
+// the incoming values are copied to the slot of the phi at the end of the predecessors
+typename DirectEmitter::ssa_t *DirectEmitter::emitPhi(bb_t *bb, Type ty, std::span<std::pair<value_t, bb_t *>> incoming, [[maybe_unused]] Ident name) {
+   Ty *t = ty;
+   if (!bb || isAggregate(t)) {
+      return unsupported();
+   }
+   Value *result = newTemp(bb, t);
+   for (const auto &[value, pred] : incoming) {
+      Value *v = asValue(value);
+      if (!v || !pred) {
+         continue;
+      }
+      load(pred, RAX, v, false);
+      opMem(pred->code, 0, true, 0x89, RAX, RBP, static_cast<std::int32_t>(result->offset));
+   }
+   return result;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitBinOp(bb_t *bb, Type ty, op::Kind kind, value_t lhs, value_t rhs, ssa_t *dest, [[maybe_unused]] Ident name) {
+   Value *l = asValue(lhs);
+   Value *r = asValue(rhs);
+   Ty *t = ty;
+   if (!bb || !l || !r || !t) {
+      return unsupported();
+   }
+   if (kind == OpKind::ASSIGN) {
+      store(bb, t, r, dest);
+      return r;
+   }
+   OpKind assignOp = qcp::emitter::decomposeAssignOp(kind);
+   bool isAssign = assignOp != OpKind::END;
+   kind = isAssign ? assignOp : kind;
+   std::string &code = bb->code;
+   Value *result;
+   if (isFP(t)) {
+      bool isDouble = t->kind == Ty::Kind::DOUBLE;
+      loadFP(bb, 0, l, isDouble);
+      loadFP(bb, 1, r, isDouble);
+      if (unsigned op = fpArithOpcode(kind)) {
+         opReg(code, fpPrefix(isDouble), false, op, 0, 1);
+         result = newTemp(bb, t);
+         storeTemp(bb, result, true, isDouble);
+      } else if (op::isComparisonOp(kind)) {
+         // ucomis sets the flags like an unsigned compare, unordered sets all of zf, pf and cf
+         unsigned prefix = isDouble ? 0x66 : 0;
+         bool swap = kind == OpKind::LT || kind == OpKind::LE;
+         opReg(code, prefix, false, 0x0f2e, swap ? 1 : 0, swap ? 0 : 1);
+         if (kind == OpKind::EQ || kind == OpKind::NE) {
+            opReg(code, 0, false, 0x0f90 | (kind == OpKind::EQ ? CC_E : CC_NE), 0, RAX);
+            opReg(code, 0, false, 0x0f90 | (kind == OpKind::EQ ? CC_NP : CC_P), 0, RCX);
+            // and al, cl / or al, cl
+            opReg(code, 0, false, kind == OpKind::EQ ? 0x20 : 0x08, RCX, RAX);
+         } else {
+            opReg(code, 0, false, 0x0f90 | (kind == OpKind::LT || kind == OpKind::GT ? CC_A : CC_AE), 0, RAX);
+         }
+         opReg(code, 0, false, 0x0fb6, RAX, RAX);
+         result = newTemp(bb, emitIntTy(1));
+         storeTemp(bb, result);
+      } else {
+         return unsupported();
+      }
+   } else {
+      bool sign = isSigned(ty);
+      bool w = scalarBits(t) > 32;
+      load(bb, RAX, l, sign);
+      load(bb, RCX, r, sign);
+      Ty *resultTy = t;
+      switch (kind) {
+         case OpKind::ADD: opReg(code, 0, w, 0x01, RCX, RAX); break;
+         case OpKind::SUB: opReg(code, 0, w, 0x29, RCX, RAX); break;
+         case OpKind::MUL: opReg(code, 0, w, 0x0faf, RAX, RCX); break;
+         case OpKind::L_AND:
+         case OpKind::BW_AND: opReg(code, 0, w, 0x21, RCX, RAX); break;
+         case OpKind::L_OR:
+         case OpKind::BW_OR: opReg(code, 0, w, 0x09, RCX, RAX); break;
+         case OpKind::BW_XOR: opReg(code, 0, w, 0x31, RCX, RAX); break;
+         case OpKind::SHL: opReg(code, 0, w, 0xd3, 4, RAX); break;
+         case OpKind::SHR: opReg(code, 0, w, 0xd3, sign ? 7 : 5, RAX); break;
+         case OpKind::DIV:
+         case OpKind::REM:
+            if (sign) {
+               // cdq / cqo
+               opcode(code, 0, w, 0, 0, 0x99);
+               opReg(code, 0, w, 0xf7, 7, RCX);
+            } else {
+               opReg(code, 0, false, 0x31, RDX, RDX);
+               opReg(code, 0, w, 0xf7, 6, RCX);
+            }
+            if (kind == OpKind::REM) {
+               opReg(code, 0, w, 0x89, RDX, RAX);
+            }
+            break;
+         case OpKind::EQ:
+         case OpKind::NE:
+         case OpKind::LT:
+         case OpKind::LE:
+         case OpKind::GT:
+         case OpKind::GE:
+            opReg(code, 0, w, 0x39, RCX, RAX);
+            opReg(code, 0, false, 0x0f90 | toCond(kind, sign), 0, RAX);
+            opReg(code, 0, false, 0x0fb6, RAX, RAX);
+            resultTy = emitIntTy(1);
+            break;
+         default:
+            return unsupported();
+      }
+      result = newTemp(bb, resultTy);
+      storeTemp(bb, result);
+   }
+   if (isAssign) {
+      store(bb, t, result, dest);
+   }
+   return result;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_or_iconst_t DirectEmitter::emitConstBinOp([[maybe_unused]] bb_t *bb, Type ty, op::Kind kind, const_or_iconst_t lhs, const_or_iconst_t rhs, [[maybe_unused]] Ident name) {
+   Constant *l = asConstant(lhs);
+   Constant *r = asConstant(rhs);
+   Ty *t = ty;
+   if (!l || !r || !t) {
+      return unsupportedConstant(t);
+   }
+   OpKind assignOp = qcp::emitter::decomposeAssignOp(kind);
+   kind = assignOp != OpKind::END ? assignOp : kind;
+   if (isFP(t)) {
+      if ((l->kind != Value::Kind::FP && !isIntConstant(l)) || (r->kind != Value::Kind::FP && !isIntConstant(r))) {
+         return unsupportedConstant(t);
+      }
+      std::optional<double> result = foldFPBinOp(kind, fpValue(l), fpValue(r));
+      if (!result) {
+         return unsupportedConstant(t);
+      } else if (op::isComparisonOp(kind)) {
+         return newInt(emitIntTy(1), *result != 0);
+      }
+      return newFP(t, *result);
+   }
+   if (!isIntConstant(l) || !isIntConstant(r)) {
+      return unsupportedConstant(t);
+   }
+   std::optional<std::uint64_t> result = foldIntBinOp(kind, l->value, r->value, scalarBits(t), isSigned(ty));
+   if (!result) {
+      return unsupportedConstant(t);
+   }
+   return newInt(op::isComparisonOp(kind) ? emitIntTy(1) : t, *result);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitIncDecOp(bb_t *bb, Type ty, op::Kind kind, ssa_t *operand, Ident name) {
+   Ty *t = ty;
+   Value *value = emitLoad(bb, ty, operand, name);
+   if (!supported_) {
+      return value;
+   }
+   bool isInc = kind == OpKind::POSTINC || kind == OpKind::PREINC;
+   bool isPost = kind == OpKind::POSTINC || kind == OpKind::POSTDEC;
+   std::string &code = bb->code;
+   Value *result = newTemp(bb, t);
+   if (isFP(t)) {
+      bool isDouble = t->kind == Ty::Kind::DOUBLE;
+      loadFP(bb, 0, value, isDouble);
+      movImm(code, R11, fpBits(1.0, isDouble));
+      opReg(code, 0x66, isDouble, 0x0f6e, 1, R11);
+      opReg(code, fpPrefix(isDouble), false, isInc ? 0x0f58 : 0x0f5c, 0, 1);
+      storeTemp(bb, result, true, isDouble);
+   } else {
+      std::int64_t step = 1;
+      if (t->kind == Ty::Kind::PTR) {
+         Ty *pointee = ty->getPointedToTy();
+         step = pointee && pointee->size ? static_cast<std::int64_t>(pointee->size) : 1;
+      }
+      load(bb, RAX, value, false);
+      opReg(code, 0, scalarBits(t) > 32, 0x81, isInc ? 0 : 5, RAX);
+      emit32(code, static_cast<std::uint32_t>(step));
+      storeTemp(bb, result);
+   }
+   store(bb, t, result, operand);
+   return isPost ? value : result;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitNeg(bb_t *bb, Type ty, ssa_t *operand, [[maybe_unused]] Ident name) {
+   Ty *t = ty;
+   if (!bb || !operand) {
+      return unsupported();
+   }
+   std::string &code = bb->code;
+   load(bb, RAX, operand, false);
+   bool w = scalarBits(t) > 32;
+   if (isFP(t)) {
+      // flip the sign bit, btc rax, 63 / btc eax, 31
+      opReg(code, 0, w, 0x0fba, 7, RAX);
+      emit8(code, w ? 63 : 31);
+   } else if (ty->kind() == type::Kind::BOOL) {
+      // like the LLVMEmitter, xor with true
+      opReg(code, 0, false, 0x81, 6, RAX);
+      emit32(code, 1);
+   } else {
+      opReg(code, 0, w, 0xf7, 3, RAX);
+   }
+   Value *result = newTemp(bb, t);
+   storeTemp(bb, result);
+   return result;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_or_iconst_t DirectEmitter::emitConstNeg([[maybe_unused]] bb_t *bb, Type ty, const_or_iconst_t operand, [[maybe_unused]] Ident name) {
+   Constant *c = asConstant(operand);
+   if (!c) {
+      return unsupportedConstant(ty);
+   } else if (c->kind == Value::Kind::FP) {
+      return newFP(c->ty, -c->fp);
+   } else if (!isIntConstant(c)) {
+      return unsupportedConstant(ty);
+   }
+   return newInt(c->ty, 0 - c->value);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitBWNeg(bb_t *bb, Type ty, ssa_t *operand, [[maybe_unused]] Ident name) {
+   Ty *t = ty;
+   if (!bb || !operand) {
+      return unsupported();
+   }
+   load(bb, RAX, operand, false);
+   opReg(bb->code, 0, scalarBits(t) > 32, 0xf7, 2, RAX);
+   Value *result = newTemp(bb, t);
+   storeTemp(bb, result);
+   return result;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_or_iconst_t DirectEmitter::emitConstBWNeg([[maybe_unused]] bb_t *bb, Type ty, const_or_iconst_t operand, [[maybe_unused]] Ident name) {
+   Constant *c = asConstant(operand);
+   if (!c || !isIntConstant(c)) {
+      return unsupportedConstant(ty);
+   }
+   return newInt(ty, ~c->value);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::const_or_iconst_t DirectEmitter::emitConstCast([[maybe_unused]] bb_t *bb, Type fromTy, const_or_iconst_t val, Type toTy, qcp::type::Cast cast) {
+   Constant *c = asConstant(val);
+   Ty *to = toTy;
+   if (!c || !to) {
+      return unsupportedConstant(to);
+   }
+   if (c->kind == Value::Kind::FP) {
+      switch (cast) {
+         case qcp::type::Cast::FPTRUNC:
+         case qcp::type::Cast::FPEXT:
+            return newFP(to, c->fp);
+         case qcp::type::Cast::FPTOSI:
+         case qcp::type::Cast::FPTOUI:
+            return newInt(to, static_cast<std::uint64_t>(static_cast<std::int64_t>(c->fp)));
+         default:
+            return unsupportedConstant(to);
+      }
+   } else if (!isIntConstant(c)) {
+      return unsupportedConstant(to);
+   }
+   switch (cast) {
+      case qcp::type::Cast::TRUNC:
+      case qcp::type::Cast::ZEXT:
+      case qcp::type::Cast::PTRTOINT:
+         return newInt(to, c->value);
+      case qcp::type::Cast::SEXT:
+         return newInt(to, static_cast<std::uint64_t>(signExtend(c->value, scalarBits(fromTy))));
+      case qcp::type::Cast::INTTOPTR:
+      case qcp::type::Cast::BITCAST:
+         // a pointer constant, not an integer constant expression
+         return static_cast<const_t *>(newInt(to, c->value));
+      case qcp::type::Cast::UITOFP:
+         return newFP(to, static_cast<double>(c->value));
+      case qcp::type::Cast::SITOFP:
+         return newFP(to, static_cast<double>(signExtend(c->value, scalarBits(fromTy))));
+      default:
+         return unsupportedConstant(to);
+   }
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitCast(bb_t *bb, Type fromTy, ssa_t *val, Type toTy, qcp::type::Cast cast) {
+   Ty *from = fromTy;
+   Ty *to = toTy;
+   if (!bb || !val || !from || !to) {
+      return unsupported();
+   }
+   std::string &code = bb->code;
+   Value *result;
+   switch (cast) {
+      case qcp::type::Cast::TRUNC:
+         if (to->bits != 1) {
+            return retype(bb, val, to);
+         }
+         load(bb, RAX, val, false);
+         opReg(code, 0, false, 0x81, 4, RAX);
+         emit32(code, 1);
+         break;
+      case qcp::type::Cast::PTRTOINT:
+      case qcp::type::Cast::INTTOPTR:
+      case qcp::type::Cast::BITCAST:
+         return retype(bb, val, to);
+      case qcp::type::Cast::ZEXT:
+         load(bb, RAX, val, false);
+         // clears the upper half
+         opReg(code, 0, false, 0x89, RAX, RAX);
+         break;
+      case qcp::type::Cast::SEXT:
+         load(bb, RAX, val, true);
+         if (scalarBits(to) > 32) {
+            opReg(code, 0, true, 0x63, RAX, RAX);
+         }
+         break;
+      case qcp::type::Cast::SITOFP:
+      case qcp::type::Cast::UITOFP: {
+         bool sign = cast == qcp::type::Cast::SITOFP;
+         if (!sign && scalarBits(from) > 32) {
+            return unsupported();
+         }
+         load(bb, RAX, val, sign);
+         if (!sign) {
+            opReg(code, 0, false, 0x89, RAX, RAX);
+         }
+         bool isDouble = to->kind == Ty::Kind::DOUBLE;
+         opReg(code, fpPrefix(isDouble), !sign || scalarBits(from) > 32, 0x0f2a, 0, RAX);
+         result = newTemp(bb, to);
+         storeTemp(bb, result, true, isDouble);
+         return result;
+      }
+      case qcp::type::Cast::FPTOSI:
+      case qcp::type::Cast::FPTOUI: {
+         bool isDouble = from->kind == Ty::Kind::DOUBLE;
+         loadFP(bb, 0, val, isDouble);
+         opReg(code, fpPrefix(isDouble), true, 0x0f2c, RAX, 0);
+         break;
+      }
+      case qcp::type::Cast::FPEXT:
+      case qcp::type::Cast::FPTRUNC: {
+         if (from->kind == to->kind) {
+            // long double is a double
+            return retype(bb, val, to);
+         }
+         bool fromDouble = from->kind == Ty::Kind::DOUBLE;
+         loadFP(bb, 0, val, fromDouble);
+         // cvtsd2ss / cvtss2sd
+         opReg(code, fpPrefix(fromDouble), false, 0x0f5a, 0, 0);
+         result = newTemp(bb, to);
+         storeTemp(bb, result, true, !fromDouble);
+         return result;
+      }
+      default:
+         return unsupported();
+   }
+   result = newTemp(bb, to);
+   storeTemp(bb, result);
+   return result;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitCall(bb_t *bb, fn_t *fn, std::span<const value_t> args, [[maybe_unused]] Ident name) {
+   return emitCallImpl(bb, fn->ty, fn, nullptr, args);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitCall(bb_t *bb, Type fnTy, value_t fnPtr, std::span<const value_t> args, [[maybe_unused]] Ident name) {
+   if (fn_t **fn = std::get_if<fn_t *>(&fnPtr)) {
+      return emitCallImpl(bb, fnTy, *fn, nullptr, args);
+   }
+   return emitCallImpl(bb, fnTy, nullptr, asValue(fnPtr), args);
+}
+// ---------------------------------------------------------------------------
+// System V calling convention without aggregates
+typename DirectEmitter::ssa_t *DirectEmitter::emitCallImpl(BasicBlock *bb, Ty *fnTy, Function *callee, Value *target, std::span<const value_t> args) {
+   if (!bb || !fnTy || fnTy->kind != Ty::Kind::FN || (!callee && !target) || isAggregate(fnTy->elem)) {
+      return unsupported();
+   }
+   struct Arg {
+      Value* value;
+      Ty* ty;
+      bool sign;
+   };
+   std::vector<Arg> intArgs{};
+   std::vector<Arg> fpArgs{};
+   std::vector<Arg> stackArgs{};
+   for (std::size_t i = 0; i < args.size(); ++i) {
+      Value *value = asValue(args[i]);
+      if (!value) {
+         return unsupported();
+      }
+      bool isParam = i < fnTy->members.size();
+      Arg arg{value, isParam ? fnTy->members[i] : value->ty, isParam && fnTy->signedParams[i]};
+      if (!arg.ty || isAggregate(arg.ty) || arg.ty->kind == Ty::Kind::VOID) {
+         return unsupported();
+      }
+      if (isFP(arg.ty)) {
+         (fpArgs.size() < FP_ARG_REGS ? fpArgs : stackArgs).push_back(arg);
+      } else {
+         (intArgs.size() < std::size(INT_ARG_REGS) ? intArgs : stackArgs).push_back(arg);
+      }
+   }
+
+   std::string &code = bb->code;
+   // rsp stays 16 byte aligned at the call
+   std::uint32_t stackSize = static_cast<std::uint32_t>(alignTo(stackArgs.size() * 8, 16));
+   if (stackSize != stackArgs.size() * 8) {
+      opReg(code, 0, true, 0x81, 5, RSP);
+      emit32(code, 8);
+   }
+   for (auto it = stackArgs.rbegin(); it != stackArgs.rend(); ++it) {
+      load(bb, RAX, it->value, it->sign);
+      // push rax
+      emit8(code, 0x50);
+   }
+   for (std::size_t i = 0; i < intArgs.size(); ++i) {
+      load(bb, INT_ARG_REGS[i], intArgs[i].value, intArgs[i].sign);
+   }
+   for (std::size_t i = 0; i < fpArgs.size(); ++i) {
+      loadFP(bb, static_cast<unsigned>(i), fpArgs[i].value, fpArgs[i].ty->kind == Ty::Kind::DOUBLE);
+   }
+   if (target) {
+      load(bb, R11, target, false);
+   }
+   // the number of vector registers used by a variadic call
+   movImm(code, RAX, fpArgs.size());
+   if (target) {
+      // call r11
+      opReg(code, 0, false, 0xff, 2, R11);
+   } else {
+      emit8(code, 0xe8);
+      bb->relocations.push_back({static_cast<std::uint32_t>(code.size()), callee->sym, R_X86_64_PLT32, -4});
+      emit32(code, 0);
+   }
+   if (stackSize) {
+      opReg(code, 0, true, 0x81, 0, RSP);
+      emit32(code, stackSize);
+   }
+   bb->rax = nullptr;
+
+   Ty *retTy = fnTy->elem;
+   if (!retTy || retTy->kind == Ty::Kind::VOID) {
+      return newValue(Value::Kind::UNDEF, voidTy_);
+   }
+   Value *result = newTemp(bb, retTy);
+   storeTemp(bb, result, isFP(retTy), retTy->kind == Ty::Kind::DOUBLE);
+   return result;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::Value *DirectEmitter::offsetPointer(BasicBlock *bb, Value *ptr, std::int64_t offset) {
+   if (offset == 0) {
+      return ptr;
+   } else if (ptr->kind == Value::Kind::FRAME) {
+      return newValue(Value::Kind::FRAME, ptrTy_, ptr->offset + offset);
+   } else if (ptr->kind == Value::Kind::GLOBAL) {
+      return newValue(Value::Kind::GLOBAL, ptrTy_, ptr->offset + offset, ptr->sym);
+   } else if (!bb || !fitsInt32(offset)) {
+      return unsupported();
+   }
+   load(bb, RAX, ptr, false);
+   opReg(bb->code, 0, true, 0x81, 0, RAX);
+   emit32(bb->code, static_cast<std::uint32_t>(offset));
+   Value *result = newTemp(bb, ptrTy_);
+   storeTemp(bb, result);
+   return result;
+}
+// ---------------------------------------------------------------------------
+// constant indices are folded into the address
+template <typename T>
+typename DirectEmitter::ssa_t *DirectEmitter::emitGEPImpl(bb_t *bb, Ty *ty, value_t ptr, std::span<T> indices) {
+   Value *p = asValue(ptr);
+   if (!p || !ty || indices.empty()) {
+      return unsupported();
+   }
+   std::int64_t offset = static_cast<std::int64_t>(indices[0]) * static_cast<std::int64_t>(ty->size);
+   for (std::size_t i = 1; i < indices.size(); ++i) {
+      if (ty->kind == Ty::Kind::ARRAY) {
+         ty = ty->elem;
+         offset += static_cast<std::int64_t>(indices[i]) * static_cast<std::int64_t>(ty->size);
+      } else if (ty->kind == Ty::Kind::STRUCT && indices[i] < ty->members.size()) {
+         offset += static_cast<std::int64_t>(ty->offsets[indices[i]]);
+         ty = ty->members[indices[i]];
+      } else {
+         return unsupported();
+      }
+   }
+   return offsetPointer(bb, p, offset);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitGEP(bb_t *bb, Type ty, value_t ptr, value_t idx, [[maybe_unused]] Ident name) {
+   Ty *t = ty;
+   Value *p = asValue(ptr);
+   Value *i = asValue(idx);
+   if (!p || !i || !t) {
+      return unsupported();
+   }
+   // indices are signed
+   if (i->kind == Value::Kind::INT) {
+      return offsetPointer(bb, p, signExtend(static_cast<Constant *>(i)->value, scalarBits(i->ty)) * static_cast<std::int64_t>(t->size));
+   } else if (!bb) {
+      return unsupported();
+   }
+   std::string &code = bb->code;
+   load(bb, RCX, i, true);
+   if (scalarBits(i->ty) < 64) {
+      opReg(code, 0, true, 0x63, RCX, RCX);
+   }
+   if (t->size != 1) {
+      opReg(code, 0, true, 0x69, RCX, RCX);
+      emit32(code, static_cast<std::uint32_t>(t->size));
+   }
+   load(bb, RAX, p, false);
+   opReg(code, 0, true, 0x01, RCX, RAX);
+   Value *result = newTemp(bb, ptrTy_);
+   storeTemp(bb, result);
+   return result;
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitGEP(bb_t *bb, Type ty, value_t ptr, std::span<const uint64_t> idx, [[maybe_unused]] Ident name) {
+   return emitGEPImpl(bb, ty, ptr, idx);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::ssa_t *DirectEmitter::emitGEP(bb_t *bb, Type ty, value_t ptr, std::span<const std::uint32_t> idx, [[maybe_unused]] Ident name) {
+   return emitGEPImpl(bb, ty, ptr, idx);
+}
+// ---------------------------------------------------------------------------
+typename DirectEmitter::sw_t *DirectEmitter::emitSwitch(bb_t *bb, value_t value) {
+   Switch *sw = &switches_.emplace_back(Switch{asValue(value)});
+   if (!bb || !sw->value) {
+      unsupported();
+   } else if (bb->term == BasicBlock::Term::NONE) {
+      bb->term = BasicBlock::Term::SWITCH;
+      bb->sw = sw;
+   }
+   return sw;
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::addSwitchCase(sw_t *sw, iconst_t *value, bb_t *target) {
+   sw->cases.emplace_back(value->value, target);
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::addSwitchDefault(sw_t *sw, bb_t *target) {
+   sw->defaultTarget = target;
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::emitTerminator(BasicBlock *bb, BasicBlock *next) {
+   std::string &code = bb->code;
+   auto jump = [&](std::optional<Cond> cond, BasicBlock *target) {
+      if (cond) {
+         emit8(code, 0x0f);
+         emit8(code, 0x80 | *cond);
+      } else {
+         emit8(code, 0xe9);
+      }
+      bb->jumps.emplace_back(static_cast<std::uint32_t>(code.size()), target);
+      emit32(code, 0);
+   };
+   // the code of the block may not be contiguous with the cached value
+   bb->rax = nullptr;
+   switch (bb->term) {
+      case BasicBlock::Term::NONE:
+         // ud2
+         emit8(code, 0x0f);
+         emit8(code, 0x0b);
+         break;
+      case BasicBlock::Term::JUMP:
+         if (bb->targets[0] != next) {
+            jump(std::nullopt, bb->targets[0]);
+         }
+         break;
+      case BasicBlock::Term::BRANCH:
+         load(bb, RAX, bb->operand, false);
+         // test al, al
+         opReg(code, 0, false, 0x84, RAX, RAX);
+         if (bb->targets[0] == next) {
+            jump(CC_E, bb->targets[1]);
+         } else {
+            jump(CC_NE, bb->targets[0]);
+            if (bb->targets[1] != next) {
+               jump(std::nullopt, bb->targets[1]);
+            }
+         }
+         break;
+      case BasicBlock::Term::RET: {
+         Ty *retTy = bb->fn->ty->elem;
+         if (bb->operand && isFP(retTy)) {
+            loadFP(bb, 0, bb->operand, retTy->kind == Ty::Kind::DOUBLE);
+         } else if (bb->operand && retTy && (retTy->kind == Ty::Kind::INT || retTy->kind == Ty::Kind::PTR)) {
+            load(bb, RAX, bb->operand, bb->fn->ty->signedRet);
+         } else if (bb->operand && retTy && retTy->kind != Ty::Kind::VOID) {
+            unsupported();
+         }
+         // leave, ret
+         emit8(code, 0xc9);
+         emit8(code, 0xc3);
+         break;
+      }
+      case BasicBlock::Term::SWITCH: {
+         Switch *sw = bb->sw;
+         unsigned bits = scalarBits(sw->value->ty);
+         bool w = bits > 32;
+         load(bb, RAX, sw->value, false);
+         for (auto [value, target] : sw->cases) {
+            std::uint64_t v = truncate(value, bits);
+            if (w && !fitsInt32(static_cast<std::int64_t>(v))) {
+               movImm(code, RCX, v);
+               opReg(code, 0, true, 0x39, RCX, RAX);
+            } else {
+               opReg(code, 0, w, 0x81, 7, RAX);
+               emit32(code, static_cast<std::uint32_t>(v));
+            }
+            jump(CC_E, target);
+         }
+         if (sw->defaultTarget) {
+            if (sw->defaultTarget != next) {
+               jump(std::nullopt, sw->defaultTarget);
+            }
+         } else {
+            emit8(code, 0x0f);
+            emit8(code, 0x0b);
+         }
+         break;
+      }
+   }
+}
+// ---------------------------------------------------------------------------
+void DirectEmitter::finalizeFn(fn_t *fn) {
+   if (!supported_) {
+      return;
+   }
+   for (std::size_t i = 0; i < fn->blocks.size(); ++i) {
+      emitTerminator(fn->blocks[i], i + 1 < fn->blocks.size() ? fn->blocks[i + 1] : nullptr);
+   }
+
+   std::string code{};
+   // push rbp; mov rbp, rsp; sub rsp, frame
+   emit8(code, 0x55);
+   opReg(code, 0, true, 0x89, RSP, RBP);
+   opReg(code, 0, true, 0x81, 5, RSP);
+   emit32(code, static_cast<std::uint32_t>(alignTo(static_cast<std::uint64_t>(fn->frameSize), 16)));
+   unsigned ints = 0;
+   unsigned fps = 0;
+   for (std::size_t i = 0; i < fn->params.size(); ++i) {
+      Value *param = fn->params[i];
+      std::int32_t offset = static_cast<std::int32_t>(param->offset);
+      if (param->kind != Value::Kind::TEMP || offset > 0) {
+         // passed on the stack
+         continue;
+      } else if (isFP(param->ty)) {
+         opMem(code, fpPrefix(param->ty->kind == Ty::Kind::DOUBLE), false, 0x0f11, fps++, RBP, offset);
+      } else {
+         opMem(code, 0, true, 0x89, INT_ARG_REGS[ints++], RBP, offset);
+      }
+   }
+
+   std::vector<BasicBlock::Relocation> relocations{};
+   for (BasicBlock *bb : fn->blocks) {
+      bb->offset = static_cast<std::uint32_t>(code.size());
+      for (BasicBlock::Relocation r : bb->relocations) {
+         r.offset += bb->offset;
+         relocations.push_back(r);
+      }
+      code += bb->code;
+   }
+   for (BasicBlock *bb : fn->blocks) {
+      for (auto [at, target] : bb->jumps) {
+         std::uint32_t pos = bb->offset + at;
+         std::uint32_t rel = target->offset - (pos + 4);
+         for (unsigned i = 0; i < 4; ++i) {
+            code[pos + i] = static_cast<char>((rel >> (8 * i)) & 0xff);
+         }
+      }
+      // the blocks are not needed anymore
+      std::string{}.swap(bb->code);
+      std::vector<BasicBlock::Relocation>{}.swap(bb->relocations);
+   }
+
+   std::uint64_t offset = elf_.append(Section::TEXT, code, 16);
+   for (const BasicBlock::Relocation &r : relocations) {
+      elf_.addRelocation(Section::TEXT, offset + r.offset, r.sym, r.type, r.addend);
+   }
+   elf_.define(fn->sym, Section::TEXT, offset, code.size(), ElfWriter::SymbolType::FUNC);
+}
+// ---------------------------------------------------------------------------
+} // namespace emitter
+} // namespace qcp
+// ---------------------------------------------------------------------------
@@ -0,0 +1,230 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "elfwriter.h"
+// ---------------------------------------------------------------------------
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <elf.h>
+#include <unistd.h>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+std::uint64_t alignTo(std::uint64_t value, std::uint64_t align) {
+   return (value + align - 1) & ~(align - 1);
+}
+// ---------------------------------------------------------------------------
+template <typename T>
+void put(std::string& out, const T& value) {
+   out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+// ---------------------------------------------------------------------------
+void pad(std::string& out, std::uint64_t align) {
+   out.resize(alignTo(out.size(), align), '\0');
+}
+// ---------------------------------------------------------------------------
+// appends a null terminated string and returns its offset
+std::uint32_t addString(std::string& table, std::string_view str) {
+   auto offset = static_cast<std::uint32_t>(table.size());
+   table.append(str).push_back('\0');
+   return offset;
+}
+// ---------------------------------------------------------------------------
+bool writeAll(int fd, std::string_view data) {
+   while (!data.empty()) {
+      ssize_t n = ::write(fd, data.data(), data.size());
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n < 0) {
+         return false;
+      }
+      data.remove_prefix(static_cast<std::size_t>(n));
+   }
+   return true;
+}
+// ---------------------------------------------------------------------------
+constexpr const char* SECTION_NAMES[] = {".text", ".data", ".rodata", ".bss"};
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+ElfWriter::SymbolId ElfWriter::addSymbol(std::string name, Binding binding) {
+   symbols_.push_back(Symbol{.name = std::move(name), .binding = binding});
+   return static_cast<SymbolId>(symbols_.size() - 1);
+}
+// ---------------------------------------------------------------------------
+void ElfWriter::define(SymbolId sym, Section section, std::uint64_t offset, std::uint64_t size, SymbolType type) {
+   Symbol& symbol = symbols_[sym];
+   symbol.defined = true;
+   symbol.section = section;
+   symbol.offset = offset;
+   symbol.size = size;
+   symbol.type = type;
+}
+// ---------------------------------------------------------------------------
+std::uint64_t ElfWriter::append(Section sec, std::string_view data, std::uint64_t align) {
+   SectionData& s = section(sec);
+   pad(s.data, align);
+   std::uint64_t offset = s.data.size();
+   s.data.append(data);
+   s.size = s.data.size();
+   s.align = std::max(s.align, align);
+   return offset;
+}
+// ---------------------------------------------------------------------------
+std::uint64_t ElfWriter::reserve(Section sec, std::uint64_t size, std::uint64_t align) {
+   SectionData& s = section(sec);
+   std::uint64_t offset = alignTo(s.size, align);
+   s.size = offset + size;
+   s.align = std::max(s.align, align);
+   return offset;
+}
+// ---------------------------------------------------------------------------
+void ElfWriter::addRelocation(Section sec, std::uint64_t offset, SymbolId sym, std::uint32_t type, std::int64_t addend) {
+   section(sec).relocations.push_back({offset, sym, type, addend});
+}
+// ---------------------------------------------------------------------------
+bool ElfWriter::write(int fd) const {
+   // section header indices: null, the four content sections, their relocations,
+   // .note.GNU-stack, .symtab, .strtab, .shstrtab
+   constexpr unsigned CONTENT = static_cast<unsigned>(Section::COUNT);
+   constexpr unsigned FIRST_RELA = 1 + CONTENT;
+   constexpr unsigned NOTE = FIRST_RELA + CONTENT;
+   constexpr unsigned SYMTAB = NOTE + 1;
+   constexpr unsigned STRTAB = SYMTAB + 1;
+   constexpr unsigned SHSTRTAB = STRTAB + 1;
+   constexpr unsigned SECTION_COUNT = SHSTRTAB + 1;
+
+   // locals have to precede globals in the symbol table
+   std::vector<std::uint32_t> index(symbols_.size());
+   std::string strtab{'\0'};
+   std::string symtab{};
+   put(symtab, Elf64_Sym{});
+   std::uint32_t next = 1;
+   std::uint32_t firstGlobal = 0;
+   for (Binding binding : {Binding::LOCAL, Binding::GLOBAL}) {
+      if (binding == Binding::GLOBAL) {
+         firstGlobal = next;
+      }
+      for (std::size_t i = 0; i < symbols_.size(); ++i) {
+         const Symbol& sym = symbols_[i];
+         if (sym.binding != binding) {
+            continue;
+         }
+         Elf64_Sym entry{};
+         entry.st_name = addString(strtab, sym.name);
+         unsigned char type = sym.type == SymbolType::FUNC ? STT_FUNC : sym.type == SymbolType::OBJECT ? STT_OBJECT : STT_NOTYPE;
+         entry.st_info = ELF64_ST_INFO(binding == Binding::GLOBAL ? STB_GLOBAL : STB_LOCAL, type);
+         if (sym.defined) {
+            entry.st_shndx = static_cast<Elf64_Half>(1 + static_cast<unsigned>(sym.section));
+            entry.st_value = sym.offset;
+            entry.st_size = sym.size;
+         }
+         put(symtab, entry);
+         index[i] = next++;
+      }
+   }
+
+   std::string shstrtab{'\0'};
+   std::array<Elf64_Shdr, SECTION_COUNT> headers{};
+   std::string body{};
+   // the file header comes first
+   std::uint64_t base = sizeof(Elf64_Ehdr);
+   auto place = [&](unsigned i, std::string_view data, std::uint64_t align) {
+      pad(body, align);
+      headers[i].sh_offset = base + body.size();
+      headers[i].sh_size = data.size();
+      headers[i].sh_addralign = align;
+      body.append(data);
+   };
+
+   for (unsigned i = 0; i < CONTENT; ++i) {
+      const SectionData& s = sections_[i];
+      Elf64_Shdr& h = headers[1 + i];
+      h.sh_name = addString(shstrtab, SECTION_NAMES[i]);
+      h.sh_flags = SHF_ALLOC;
+      if (static_cast<Section>(i) == Section::TEXT) {
+         h.sh_flags |= SHF_EXECINSTR;
+      } else if (static_cast<Section>(i) != Section::RODATA) {
+         h.sh_flags |= SHF_WRITE;
+      }
+      if (static_cast<Section>(i) == Section::BSS) {
+         h.sh_type = SHT_NOBITS;
+         h.sh_offset = base + body.size();
+         h.sh_size = s.size;
+         h.sh_addralign = s.align;
+      } else {
+         h.sh_type = SHT_PROGBITS;
+         place(1 + i, s.data, s.align);
+      }
+
+      std::string rela{};
+      for (const Relocation& r : s.relocations) {
+         Elf64_Rela entry{};
+         entry.r_offset = r.offset;
+         entry.r_info = ELF64_R_INFO(index[r.sym], r.type);
+         entry.r_addend = r.addend;
+         put(rela, entry);
+      }
+      Elf64_Shdr& rh = headers[FIRST_RELA + i];
+      rh.sh_name = addString(shstrtab, std::string(".rela") + SECTION_NAMES[i]);
+      rh.sh_type = SHT_RELA;
+      rh.sh_flags = SHF_INFO_LINK;
+      rh.sh_link = SYMTAB;
+      rh.sh_info = 1 + i;
+      rh.sh_entsize = sizeof(Elf64_Rela);
+      place(FIRST_RELA + i, rela, 8);
+   }
+
+   // the stack does not need to be executable
+   headers[NOTE].sh_name = addString(shstrtab, ".note.GNU-stack");
+   headers[NOTE].sh_type = SHT_PROGBITS;
+   headers[NOTE].sh_offset = base + body.size();
+   headers[NOTE].sh_addralign = 1;
+
+   headers[SYMTAB].sh_name = addString(shstrtab, ".symtab");
+   headers[SYMTAB].sh_type = SHT_SYMTAB;
+   headers[SYMTAB].sh_link = STRTAB;
+   headers[SYMTAB].sh_info = firstGlobal;
+   headers[SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+   place(SYMTAB, symtab, 8);
+
+   headers[STRTAB].sh_name = addString(shstrtab, ".strtab");
+   headers[STRTAB].sh_type = SHT_STRTAB;
+   place(STRTAB, strtab, 1);
+
+   headers[SHSTRTAB].sh_name = addString(shstrtab, ".shstrtab");
+   headers[SHSTRTAB].sh_type = SHT_STRTAB;
+   place(SHSTRTAB, shstrtab, 1);
+
+   pad(body, 8);
+   Elf64_Ehdr ehdr{};
+   std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+   ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+   ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+   ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+   ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+   ehdr.e_type = ET_REL;
+   ehdr.e_machine = EM_X86_64;
+   ehdr.e_version = EV_CURRENT;
+   ehdr.e_shoff = base + body.size();
+   ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+   ehdr.e_shentsize = sizeof(Elf64_Shdr);
+   ehdr.e_shnum = SECTION_COUNT;
+   ehdr.e_shstrndx = SHSTRTAB;
+
+   std::string out{};
+   out.reserve(base + body.size() + sizeof(headers));
+   put(out, ehdr);
+   out.append(body);
+   for (const Elf64_Shdr& h : headers) {
+      put(out, h);
+   }
+   return writeAll(fd, out);
+}
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
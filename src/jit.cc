@@ -0,0 +1,377 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "jit.h"
+#include "compilecache.h"
+// ---------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+// ---------------------------------------------------------------------------
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/TargetParser/Host.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+// the stub of a function keeps its name, the code of each tier gets a suffix
+constexpr std::string_view TIER0_SUFFIX = ".tier0";
+constexpr std::string_view TIER1_SUFFIX = ".tier1";
+constexpr std::string_view TIER_UP_FN = "__qcp_tier_up";
+// ---------------------------------------------------------------------------
+// the JIT whose program is running, its first tier reports hot functions
+JIT *running = nullptr;
+// ---------------------------------------------------------------------------
+// static functions and variables are referenced by name from the modules of hot functions
+void exportGlobals(llvm::Module &mod) {
+   unsigned anonymous = 0;
+   for (llvm::GlobalValue &gv : mod.global_values()) {
+      if (!gv.hasName()) {
+         gv.setName("__unnamed_" + std::to_string(++anonymous));
+      }
+      if (gv.hasLocalLinkage()) {
+         gv.setLinkage(llvm::GlobalValue::ExternalLinkage);
+      }
+   }
+}
+// ---------------------------------------------------------------------------
+// the name of fn is taken over by a declaration that resolves to the stub, so that
+// its address stays the same whichever tier runs. the first tier calls itself
+// through the stub too, so that deep recursions switch to the hot code
+void renameToTier(llvm::Function &fn, std::string_view suffix, bool directSelfCalls) {
+   std::string name = fn.getName().str();
+   fn.setName(name + std::string(suffix));
+   llvm::Function *stub = llvm::Function::Create(fn.getFunctionType(), llvm::GlobalValue::ExternalLinkage, name, fn.getParent());
+   stub->setCallingConv(fn.getCallingConv());
+   stub->setAttributes(fn.getAttributes());
+   fn.replaceUsesWithIf(stub, [&](llvm::Use &use) {
+      auto *call = llvm::dyn_cast<llvm::CallBase>(use.getUser());
+      return !directSelfCalls || !call || !call->isCallee(&use) || call->getFunction() != &fn;
+   });
+}
+// ---------------------------------------------------------------------------
+// calls tierUp on the hotCalls-th call of fn. the counter is incremented at the end of
+// the entry block, which runs once per call and keeps its allocas static
+void countCalls(llvm::Function &fn, std::uint32_t id, unsigned hotCalls, llvm::FunctionCallee tierUp) {
+   llvm::IRBuilder<> B(fn.getContext());
+   auto *counter = new llvm::GlobalVariable(*fn.getParent(), B.getInt32Ty(), false, llvm::GlobalValue::InternalLinkage, B.getInt32(0), fn.getName() + ".calls");
+
+   llvm::Instruction *term = fn.getEntryBlock().getTerminator();
+   B.SetInsertPoint(term);
+   // programs may call a function from several threads
+   llvm::Value *calls = B.CreateAtomicRMW(llvm::AtomicRMWInst::Add, counter, B.getInt32(1), llvm::MaybeAlign(4), llvm::AtomicOrdering::Monotonic);
+   llvm::Instruction *hot = llvm::SplitBlockAndInsertIfThen(B.CreateICmpEQ(calls, B.getInt32(hotCalls - 1)), term, false);
+   B.SetInsertPoint(hot);
+   B.CreateCall(tierUp, {B.getInt32(id)});
+}
+// ---------------------------------------------------------------------------
+// strips mod down to the code of the hot function name. the functions it calls are kept
+// for inlining, everything else refers to the definitions of the first tier
+void isolateFunction(llvm::Module &mod, const std::string &name) {
+   llvm::Function *fn = mod.getFunction(name);
+   llvm::SmallPtrSet<llvm::Function *, 16> callees{fn};
+   llvm::SmallVector<llvm::Function *, 16> worklist{fn};
+   while (!worklist.empty()) {
+      for (llvm::Instruction &inst : llvm::instructions(*worklist.pop_back_val())) {
+         for (llvm::Value *op : inst.operands()) {
+            auto *callee = llvm::dyn_cast<llvm::Function>(op->stripPointerCasts());
+            if (callee && !callee->isDeclaration() && callees.insert(callee).second) {
+               worklist.push_back(callee);
+            }
+         }
+      }
+   }
+
+   for (llvm::Function &f : mod) {
+      if (&f == fn || f.isDeclaration()) {
+         continue;
+      } else if (callees.count(&f)) {
+         f.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+      } else {
+         f.deleteBody();
+      }
+   }
+   for (llvm::GlobalVariable &gv : mod.globals()) {
+      if (gv.isDeclaration()) {
+         continue;
+      } else if (gv.isConstant()) {
+         // the initializer can still be folded into the code
+         gv.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+      } else {
+         gv.setInitializer(nullptr);
+      }
+   }
+   renameToTier(*fn, TIER1_SUFFIX, true);
+}
+// ---------------------------------------------------------------------------
+llvm::Expected<std::unique_ptr<llvm::TargetMachine>> createTargetMachine(const emitter::LLVMEmitter::Options &options, bool optimize) {
+   llvm::orc::JITTargetMachineBuilder JTMB{llvm::Triple(llvm::sys::getProcessTriple())};
+   JTMB.setCPU(options.cpu);
+   std::vector<std::string> features{};
+   std::istringstream is{options.features};
+   for (std::string feature; std::getline(is, feature, ',');) {
+      features.push_back(feature);
+   }
+   JTMB.addFeatures(features);
+   JTMB.setCodeGenOptLevel(optimize ? llvm::CodeGenOptLevel::Default : llvm::CodeGenOptLevel::None);
+   auto tm = JTMB.createTargetMachine();
+   if (tm && !optimize) {
+      (*tm)->setFastISel(true);
+   }
+   return tm;
+}
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+JIT::JIT(Options options) : options_{std::move(options)} {}
+// ---------------------------------------------------------------------------
+JIT::~JIT() {
+   stop();
+   if (running == this) {
+      running = nullptr;
+   }
+}
+// ---------------------------------------------------------------------------
+bool JIT::load(emitter::LLVMEmitter::OwnedModule module, std::ostream &log) {
+   auto jit = llvm::orc::LLJITBuilder().create();
+   if (!jit) {
+      log << "Failed to create the JIT: " << llvm::toString(jit.takeError()) << '\n';
+      return false;
+   }
+   jit_ = std::move(*jit);
+   llvm::orc::JITDylib &JD = jit_->getMainJITDylib();
+   // the program calls into the libc qcp is linked against
+   auto libc = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(jit_->getDataLayout().getGlobalPrefix());
+   if (!libc) {
+      log << "Failed to create the JIT: " << llvm::toString(libc.takeError()) << '\n';
+      return false;
+   }
+   JD.addGenerator(std::move(*libc));
+   stubs_ = llvm::orc::createLocalIndirectStubsManagerBuilder(jit_->getTargetTriple())();
+
+   llvm::Module &mod = *module.mod;
+   exportGlobals(mod);
+   llvm::raw_svector_ostream OS(bitcode_);
+   llvm::WriteBitcodeToFile(mod, OS);
+
+   llvm::FunctionCallee tierUp = mod.getOrInsertFunction(TIER_UP_FN, llvm::Type::getVoidTy(mod.getContext()), llvm::Type::getInt32Ty(mod.getContext()));
+   std::vector<llvm::Function *> bodies{};
+   for (llvm::Function &fn : mod) {
+      if (!fn.isDeclaration()) {
+         bodies.push_back(&fn);
+      }
+   }
+   llvm::orc::IndirectStubsManager::StubInitsMap inits{};
+   for (llvm::Function *fn : bodies) {
+      auto id = static_cast<std::uint32_t>(fns_.size());
+      fns_.push_back(fn->getName().str());
+      // pointed at the first tier once it is linked
+      inits[fns_.back()] = {llvm::orc::ExecutorAddr(), llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable};
+      renameToTier(*fn, TIER0_SUFFIX, false);
+      countCalls(*fn, id, options_.hotCalls, tierUp);
+   }
+   if (auto err = stubs_->createStubs(inits)) {
+      log << "Failed to create stubs: " << llvm::toString(std::move(err)) << '\n';
+      return false;
+   }
+
+   llvm::orc::SymbolMap symbols{};
+   for (const std::string &name : fns_) {
+      symbols[jit_->mangleAndIntern(name)] = stubs_->findStub(name, false);
+   }
+   symbols[jit_->mangleAndIntern(TIER_UP_FN)] = llvm::orc::ExecutorSymbolDef(llvm::orc::ExecutorAddr::fromPtr(&JIT::tierUp), llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+   if (auto err = JD.define(llvm::orc::absoluteSymbols(std::move(symbols)))) {
+      log << "Failed to define stubs: " << llvm::toString(std::move(err)) << '\n';
+      return false;
+   }
+
+   std::string key = objectKey("tier0", "");
+   auto obj = cachedObject(key);
+   if (!obj) {
+      auto tm = createTargetMachine(options_.hot, false);
+      if (!tm) {
+         log << "Failed to create the target machine: " << llvm::toString(tm.takeError()) << '\n';
+         return false;
+      }
+      auto compiled = compile(mod, **tm, key);
+      if (!compiled) {
+         log << "Failed to compile: " << llvm::toString(compiled.takeError()) << '\n';
+         return false;
+      }
+      obj = std::move(*compiled);
+   }
+   module.mod.reset();
+
+   if (auto err = jit_->addObjectFile(std::move(obj))) {
+      log << "Failed to load: " << llvm::toString(std::move(err)) << '\n';
+      return false;
+   }
+   // the first lookup links the object
+   for (const std::string &name : fns_) {
+      auto addr = lookup(name + std::string(TIER0_SUFFIX));
+      if (!addr) {
+         log << "Failed to link: " << llvm::toString(addr.takeError()) << '\n';
+         return false;
+      }
+      if (auto err = stubs_->updatePointer(name, llvm::orc::ExecutorAddr(*addr))) {
+         log << "Failed to link: " << llvm::toString(std::move(err)) << '\n';
+         return false;
+      }
+   }
+
+   // the program may call exit(), the background thread has to stop before static destructors run
+   static bool stopAtExit = [] {
+      return std::atexit([] {
+                if (running) {
+                   running->stop();
+                }
+             }) == 0;
+   }();
+   (void) stopAtExit;
+   running = this;
+   compiler_ = std::thread{[this] { compileHotFunctions(); }};
+   return true;
+}
+// ---------------------------------------------------------------------------
+std::optional<int> JIT::run(std::vector<char *> args, std::ostream &log) {
+   if (std::find(fns_.begin(), fns_.end(), "main") == fns_.end()) {
+      log << "No definition of 'main'\n";
+      return std::nullopt;
+   }
+   auto main = lookup("main");
+   if (!main) {
+      log << "Failed to link: " << llvm::toString(main.takeError()) << '\n';
+      return std::nullopt;
+   }
+   int argc = static_cast<int>(args.size());
+   args.push_back(nullptr);
+   return reinterpret_cast<int (*)(int, char **)>(*main)(argc, args.data());
+}
+// ---------------------------------------------------------------------------
+void JIT::tierUp(std::uint32_t fn) {
+   JIT *jit = running;
+   if (!jit) {
+      return;
+   }
+   {
+      std::lock_guard lock{jit->mutex_};
+      jit->hot_.push_back(fn);
+   }
+   jit->cv_.notify_one();
+}
+// ---------------------------------------------------------------------------
+void JIT::compileHotFunctions() {
+   // most programs end before a function gets hot
+   std::unique_ptr<llvm::TargetMachine> tm{};
+   while (true) {
+      std::uint32_t fn;
+      {
+         std::unique_lock lock{mutex_};
+         cv_.wait(lock, [this] { return stop_ || !hot_.empty(); });
+         if (stop_) {
+            return;
+         }
+         fn = hot_.front();
+         hot_.pop_front();
+      }
+
+      // failures are reported, the function keeps running its first tier
+      const std::string &name = fns_[fn];
+      std::string key = objectKey("tier1", name);
+      auto obj = cachedObject(key);
+      if (!obj) {
+         if (!tm) {
+            auto created = createTargetMachine(options_.hot, true);
+            if (!created) {
+               llvm::errs() << "Failed to create the target machine: " << llvm::toString(created.takeError()) << '\n';
+               return;
+            }
+            tm = std::move(*created);
+         }
+         llvm::LLVMContext ctx;
+         auto mod = llvm::parseBitcodeFile(llvm::MemoryBufferRef(llvm::StringRef(bitcode_.data(), bitcode_.size()), "qcp"), ctx);
+         if (!mod) {
+            llvm::errs() << "Failed to recompile '" << name << "': " << llvm::toString(mod.takeError()) << '\n';
+            continue;
+         }
+         isolateFunction(**mod, name);
+         emitter::LLVMEmitter::runPassPipeline(**mod, tm.get(), options_.hot);
+         auto compiled = compile(**mod, *tm, key);
+         if (!compiled) {
+            llvm::errs() << "Failed to recompile '" << name << "': " << llvm::toString(compiled.takeError()) << '\n';
+            continue;
+         }
+         obj = std::move(*compiled);
+      }
+
+      if (auto err = jit_->addObjectFile(std::move(obj))) {
+         llvm::errs() << "Failed to load '" << name << "': " << llvm::toString(std::move(err)) << '\n';
+         continue;
+      }
+      auto addr = lookup(name + std::string(TIER1_SUFFIX));
+      if (!addr) {
+         llvm::errs() << "Failed to link '" << name << "': " << llvm::toString(addr.takeError()) << '\n';
+         continue;
+      }
+      if (auto err = stubs_->updatePointer(name, llvm::orc::ExecutorAddr(*addr))) {
+         llvm::errs() << "Failed to link '" << name << "': " << llvm::toString(std::move(err)) << '\n';
+      }
+   }
+}
+// ---------------------------------------------------------------------------
+void JIT::stop() {
+   {
+      std::lock_guard lock{mutex_};
+      stop_ = true;
+   }
+   cv_.notify_one();
+   if (compiler_.joinable()) {
+      compiler_.join();
+   }
+}
+// ---------------------------------------------------------------------------
+llvm::Expected<std::uint64_t> JIT::lookup(const std::string &name) {
+   auto symbol = jit_->lookup(name);
+   if (!symbol) {
+      return symbol.takeError();
+   }
+   return symbol->getValue();
+}
+// ---------------------------------------------------------------------------
+std::string JIT::objectKey(std::string_view tier, std::string_view fn) const {
+   CacheKey key{};
+   key.add(options_.cacheKey).add(emitter::LLVMEmitter::targetDescription(options_.hot)).add(options_.hotCalls);
+   return key.add(tier).add(fn).hex();
+}
+// ---------------------------------------------------------------------------
+std::unique_ptr<llvm::MemoryBuffer> JIT::cachedObject(const std::string &key) const {
+   if (!options_.cache) {
+      return nullptr;
+   }
+   auto obj = options_.cache->fetch(key);
+   return obj ? llvm::MemoryBuffer::getMemBufferCopy(*obj, "qcp") : nullptr;
+}
+// ---------------------------------------------------------------------------
+llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> JIT::compile(llvm::Module &mod, llvm::TargetMachine &tm, const std::string &key) const {
+   auto obj = llvm::orc::SimpleCompiler{tm}(mod);
+   if (obj && options_.cache) {
+      options_.cache->store(key, std::string_view{(*obj)->getBufferStart(), (*obj)->getBufferSize()});
+   }
+   return obj;
+}
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
@@ -6,16 +6,42 @@
 #include "operator.h"
 #include "type.h"
 #include "typefactory.h"
+#include "workerpool.h"
 // ---------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <mutex>
 #include <span>
 #include <string>
-// ---------------------------------------------------------------------------
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+// ---------------------------------------------------------------------------
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/MC/MCSubtargetInfo.h"
 #include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Program.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/TargetParser/Host.h"
+#include "llvm/Transforms/IPO/ConstantMerge.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
 #include <llvm/IR/Verifier.h>
 // ---------------------------------------------------------------------------
 namespace {
@@ -171,37 +197,296 @@ llvm::Constant *llvmUint64T(llvm::LLVMContext &Ctx, uint64_t val) {
    return llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), val);
 }
 // ---------------------------------------------------------------------------
+// the target registry is process global, emitters may be created concurrently
+void initializeNativeTargetOnce() {
+   static std::once_flag initialized;
+   std::call_once(initialized, [] {
+      llvm::InitializeNativeTarget();
+      llvm::InitializeNativeTargetAsmParser();
+      llvm::InitializeNativeTargetAsmPrinter();
+   });
+}
+// ---------------------------------------------------------------------------
+constexpr llvm::Reloc::Model TARGET_RELOC = llvm::Reloc::PIC_;
+// ---------------------------------------------------------------------------
+llvm::CodeGenOptLevel codeGenOptLevel(qcp::emitter::LLVMEmitter::Options::OptLevel level) {
+   using OptLevel = qcp::emitter::LLVMEmitter::Options::OptLevel;
+   switch (level) {
+      case OptLevel::O0:
+         return llvm::CodeGenOptLevel::None;
+      case OptLevel::O1:
+         return llvm::CodeGenOptLevel::Less;
+      case OptLevel::O3:
+         return llvm::CodeGenOptLevel::Aggressive;
+      default:
+         return llvm::CodeGenOptLevel::Default;
+   }
+}
+// ---------------------------------------------------------------------------
+llvm::OptimizationLevel optimizationLevel(qcp::emitter::LLVMEmitter::Options::OptLevel level) {
+   using OptLevel = qcp::emitter::LLVMEmitter::Options::OptLevel;
+   switch (level) {
+      case OptLevel::O0:
+         return llvm::OptimizationLevel::O0;
+      case OptLevel::O1:
+         return llvm::OptimizationLevel::O1;
+      case OptLevel::O2:
+         return llvm::OptimizationLevel::O2;
+      case OptLevel::O3:
+         return llvm::OptimizationLevel::O3;
+      case OptLevel::Os:
+         return llvm::OptimizationLevel::Os;
+      case OptLevel::Oz:
+         return llvm::OptimizationLevel::Oz;
+   }
+   return llvm::OptimizationLevel::O0;
+}
+// ---------------------------------------------------------------------------
+// pooled target machines may have been used with other options
+void configureTargetMachine(llvm::TargetMachine &tm, const qcp::emitter::LLVMEmitter::Options &options) {
+   using OptLevel = qcp::emitter::LLVMEmitter::Options::OptLevel;
+   bool fastCodeGen = options.fastCodeGen || options.optLevel != OptLevel::O0;
+   tm.setOptLevel(fastCodeGen ? codeGenOptLevel(options.optLevel) : llvm::CodeGenOptLevel::Default);
+   tm.setFastISel(options.fastISel && options.optLevel == OptLevel::O0);
+   tm.setGlobalISel(false);
+}
+// ---------------------------------------------------------------------------
+// cheap function passes that shrink the ir before the module pipeline runs
+constexpr std::array<std::string_view, 4> FUNCTION_PASSES = {"sroa", "early-cse", "simplifycfg", "instcombine"};
+// ---------------------------------------------------------------------------
+bool runsFunctionPasses(const qcp::emitter::LLVMEmitter::Options &options) {
+   return options.optLevel != qcp::emitter::LLVMEmitter::Options::OptLevel::O0 && options.passes.empty();
+}
+// ---------------------------------------------------------------------------
+// gives anonymous globals the names the mangler would use for them in an object file
+void nameAnonymousGlobals(llvm::Module &mod) {
+   unsigned anonymous = 0;
+   for (llvm::GlobalValue &gv : mod.global_values()) {
+      if (!gv.hasName()) {
+         gv.setName("__unnamed_" + std::to_string(++anonymous));
+      }
+   }
+}
+// ---------------------------------------------------------------------------
+// collects the errors of the linker, the default handler exits on them
+struct LinkerDiagnostics : llvm::DiagnosticHandler {
+   std::string &errors;
+
+   explicit LinkerDiagnostics(std::string &errors) : errors{errors} {}
+
+   bool handleDiagnostics(const llvm::DiagnosticInfo &info) override {
+      llvm::raw_string_ostream OS{errors};
+      llvm::DiagnosticPrinterRawOStream printer{OS};
+      info.print(printer);
+      OS << '\n';
+      return true;
+   }
+};
+// ---------------------------------------------------------------------------
+// target machines are expensive to create, emitters return them for reuse
+// by later translation units of the process
+class TargetMachinePool {
+   public:
+   llvm::TargetMachine* acquire(const std::string& cpu, const std::string& features) {
+      {
+         std::lock_guard lock{mutex_};
+         auto it = free_.find(key(cpu, features));
+         if (it != free_.end() && !it->second.empty()) {
+            llvm::TargetMachine* tm = it->second.back().release();
+            it->second.pop_back();
+            return tm;
+         }
+      }
+
+      initializeNativeTargetOnce();
+      auto triple = llvm::sys::getDefaultTargetTriple();
+      std::string error;
+      auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+      if (!target) {
+         llvm::errs() << error;
+         return nullptr;
+      }
+      llvm::TargetOptions opt;
+      return target->createTargetMachine(triple, cpu, features, opt, TARGET_RELOC);
+   }
+
+   void release(llvm::TargetMachine* tm) {
+      if (!tm) {
+         return;
+      }
+      std::lock_guard lock{mutex_};
+      free_[key(tm->getTargetCPU().str(), tm->getTargetFeatureString().str())].emplace_back(tm);
+   }
+
+   private:
+   static std::string key(const std::string& cpu, const std::string& features) {
+      return cpu + ';' + features;
+   }
+
+   std::mutex mutex_;
+   std::unordered_map<std::string, std::vector<std::unique_ptr<llvm::TargetMachine>>> free_;
+};
+// ---------------------------------------------------------------------------
+TargetMachinePool& targetMachinePool() {
+   static TargetMachinePool pool;
+   return pool;
+}
+// ---------------------------------------------------------------------------
 } // namespace
 // ---------------------------------------------------------------------------
 namespace qcp {
 namespace emitter {
 // ---------------------------------------------------------------------------
-LLVMEmitter::LLVMEmitter() : mod_{std::make_unique<llvm::Module>("qcp", Ctx)}, Mod{&*mod_}, Builder{Ctx} {
-   // form https://llvm.org/docs/tutorial/MyFirstLanguageFrontend/LangImpl08.html
+std::string LLVMEmitter::targetDescription(const Options& options) {
+   // codegenThreads is left out, the partitions keep the symbols and linkage of a single object
+   return llvm::sys::getDefaultTargetTriple() + ';' + options.cpu + ';' + options.features + ';' + std::to_string(TARGET_RELOC) +
+          ";O" + std::to_string(static_cast<unsigned>(options.optLevel)) + ';' + options.passes + ';' +
+          std::to_string(options.thinLTOPreLink);
+}
+// ---------------------------------------------------------------------------
+std::optional<std::string> LLVMEmitter::checkPasses(const std::string& passes) {
+   llvm::PassBuilder PB;
+   llvm::ModulePassManager MPM;
+   if (auto err = PB.parsePassPipeline(MPM, passes)) {
+      return llvm::toString(std::move(err));
+   }
+   return std::nullopt;
+}
+// ---------------------------------------------------------------------------
+bool LLVMEmitter::checkCPU(const std::string& cpu) {
+   Options options;
+   std::unique_ptr<llvm::TargetMachine, TargetMachineDeleter> tm{targetMachinePool().acquire(options.cpu, options.features)};
+   return tm && tm->getMCSubtargetInfo()->isCPUStringValid(cpu);
+}
+// ---------------------------------------------------------------------------
+void LLVMEmitter::TargetMachineDeleter::operator()(llvm::TargetMachine* tm) const {
+   targetMachinePool().release(tm);
+}
+// ---------------------------------------------------------------------------
+void LLVMEmitter::prepareTarget() {
+   Options options;
+   TargetMachineDeleter{}(targetMachinePool().acquire(options.cpu, options.features));
+}
+// ---------------------------------------------------------------------------
+std::string LLVMEmitter::hostCPU() {
+   return llvm::sys::getHostCPUName().str();
+}
+// ---------------------------------------------------------------------------
+std::string LLVMEmitter::hostFeatures() {
+   llvm::StringMap<bool> features;
+   if (!llvm::sys::getHostCPUFeatures(features)) {
+      return "";
+   }
+   // sorted, so that the string does not change between runs
+   std::vector<std::string> names;
+   for (const auto &feature : features) {
+      names.push_back((feature.getValue() ? "+" : "-") + feature.getKey().str());
+   }
+   std::sort(names.begin(), names.end());
+   std::string result;
+   for (const auto &name : names) {
+      result += (result.empty() ? "" : ",") + name;
+   }
+   return result;
+}
+// ---------------------------------------------------------------------------
+// the verifier and function passes run on every finished function, on the worker or inline
+class LLVMEmitter::FunctionPasses {
+   public:
+   FunctionPasses(llvm::TargetMachine *tm, const Options &options) : verify_{options.verify}, PB{tm} {
+      PB.registerModuleAnalyses(MAM);
+      PB.registerCGSCCAnalyses(CGAM);
+      PB.registerFunctionAnalyses(FAM);
+      PB.registerLoopAnalyses(LAM);
+      PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
 
-   Mod->setTargetTriple("x86_64-unknown-linux-gnu");
+      // one manager per pass, so that the parser gets the context back in between
+      if (runsFunctionPasses(options)) {
+         for (std::string_view name : FUNCTION_PASSES) {
+            llvm::FunctionPassManager FPM;
+            if (auto err = PB.parsePassPipeline(FPM, llvm::StringRef{name.data(), name.size()})) {
+               llvm::errs() << "Invalid function pass '" << name << "': " << llvm::toString(std::move(err)) << '\n';
+               assert(false && "function pass missing from llvm");
+               continue;
+            }
+            passes_.push_back(std::move(FPM));
+         }
+      }
+   }
 
-   auto TargetTriple = llvm::sys::getDefaultTargetTriple();
+   // ctxMutex is locked around every pass if the parser uses the context concurrently
+   void run(fn_t &fn, std::recursive_mutex *ctxMutex) {
+      auto lock = [ctxMutex] { return ctxMutex ? std::unique_lock{*ctxMutex} : std::unique_lock<std::recursive_mutex>{}; };
+      if (verify_) {
+         auto guard = lock();
+         // broken functions are not optimized
+         if (llvm::verifyFunction(fn, &llvm::errs())) {
+            return;
+         }
+      }
+      for (llvm::FunctionPassManager &FPM : passes_) {
+         auto guard = lock();
+         FPM.run(fn, FAM);
+      }
+      FAM.clear(fn, fn.getName());
+   }
 
-   llvm::InitializeNativeTarget();
-   llvm::InitializeNativeTargetAsmParser();
-   llvm::InitializeNativeTargetAsmPrinter();
+   private:
+   bool verify_;
+   llvm::LoopAnalysisManager LAM;
+   llvm::FunctionAnalysisManager FAM;
+   llvm::CGSCCAnalysisManager CGAM;
+   llvm::ModuleAnalysisManager MAM;
+   llvm::PassBuilder PB;
+   std::vector<llvm::FunctionPassManager> passes_{};
+};
+// ---------------------------------------------------------------------------
+LLVMEmitter::LLVMEmitter(const Options& options) : options_{options}, ctx_{options.context ? nullptr : std::make_unique<llvm::LLVMContext>()}, Ctx{options.context ? *options.context : *ctx_}, mod_{std::make_unique<llvm::Module>("qcp", Ctx)}, Mod{&*mod_}, TM{targetMachinePool().acquire(options.cpu, options.features)}, Builder{Ctx} {
+   // form https://llvm.org/docs/tutorial/MyFirstLanguageFrontend/LangImpl08.html
 
-   std::string Error;
-   auto Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
+   Ctx.setDiscardValueNames(options_.discardValueNames);
+   Mod->setTargetTriple("x86_64-unknown-linux-gnu");
 
-   if (!Target) {
-      llvm::errs() << Error;
+   if (!TM) {
       return;
    }
 
-   auto CPU = "generic";
-   auto Features = "";
-
-   llvm::TargetOptions opt;
-   TM = Target->createTargetMachine(TargetTriple, CPU, Features, opt, llvm::Reloc::PIC_);
+   configureTargetMachine(*TM, options_);
    Mod->setDataLayout(TM->createDataLayout());
-   Mod->setTargetTriple(TargetTriple);
+   Mod->setTargetTriple(TM->getTargetTriple().str());
+
+   // the same passes run without the worker, so that the output does not depend on it
+   if (options_.verify || runsFunctionPasses(options_)) {
+      if (options_.backgroundPasses) {
+         worker_ = std::thread{[this] { runFunctionPasses(); }};
+      } else {
+         inlinePasses_ = std::make_unique<FunctionPasses>(TM.get(), options_);
+      }
+   }
+}
+// ---------------------------------------------------------------------------
+LLVMEmitter::~LLVMEmitter() {
+   finishFunctions();
+}
+// ---------------------------------------------------------------------------
+std::unique_lock<std::recursive_mutex> LLVMEmitter::lockContext() {
+   // the context is only shared while the worker runs
+   return worker_.joinable() ? std::unique_lock{ctxMutex_} : std::unique_lock<std::recursive_mutex>{};
+}
+// ---------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+void LLVMEmitter::runFunctionPasses() {
+   FunctionPasses passes{TM.get(), options_};
+   while (fn_t *fn = finished_.pop()) {
+      passes.run(*fn, &ctxMutex_);
+   }
+}
+// ---------------------------------------------------------------------------
+void LLVMEmitter::finishFunctions() {
+   if (worker_.joinable()) {
+      finished_.push(nullptr);
+      worker_.join();
+   }
 }
 // ---------------------------------------------------------------------------
 void LLVMEmitter::writeToObjFile(int fd) {
@@ -209,6 +494,26 @@ void LLVMEmitter::writeToObjFile(int fd) {
    writeToObjFileImpl(OS);
 }
 // ---------------------------------------------------------------------------
+void LLVMEmitter::writeToBitcodeFile(int fd) {
+   optimize();
+   // summary entries refer to globals by name
+   nameAnonymousGlobals(*Mod);
+   llvm::ProfileSummaryInfo PSI(*Mod);
+   llvm::ModuleSummaryIndex index = llvm::buildModuleSummaryIndex(*Mod, nullptr, &PSI);
+
+   if (options_.streamBitcode) {
+      // the writer only flushes to a raw_fd_stream, which reads back what it wrote and needs its own descriptor
+      std::error_code EC;
+      llvm::raw_fd_stream OS("/proc/self/fd/" + std::to_string(fd), EC);
+      if (!EC) {
+         llvm::WriteBitcodeToFile(*Mod, OS, false, &index, true);
+         return;
+      }
+   }
+   llvm::raw_fd_ostream OS(fd, false);
+   llvm::WriteBitcodeToFile(*Mod, OS, false, &index, true);
+}
+// ---------------------------------------------------------------------------
 void LLVMEmitter::writeToObjFile(const std::string &filename) {
    std::error_code EC;
    llvm::raw_fd_ostream OS(filename, EC);
@@ -221,6 +526,84 @@ void LLVMEmitter::writeToObjFile(const std::string &filename) {
    writeToObjFileImpl(OS);
 }
 // ---------------------------------------------------------------------------
+void LLVMEmitter::optimize() {
+   finishFunctions();
+   if (optimized_ || (options_.optLevel == Options::OptLevel::O0 && options_.passes.empty())) {
+      return;
+   }
+   optimized_ = true;
+   runPassPipeline(*Mod, TM.get(), options_);
+}
+// ---------------------------------------------------------------------------
+void LLVMEmitter::runPassPipeline(llvm::Module &mod, llvm::TargetMachine *tm, const Options &options) {
+   llvm::LoopAnalysisManager LAM;
+   llvm::FunctionAnalysisManager FAM;
+   llvm::CGSCCAnalysisManager CGAM;
+   llvm::ModuleAnalysisManager MAM;
+
+   llvm::PassBuilder PB(tm);
+   PB.registerModuleAnalyses(MAM);
+   PB.registerCGSCCAnalyses(CGAM);
+   PB.registerFunctionAnalyses(FAM);
+   PB.registerLoopAnalyses(LAM);
+   PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+   llvm::ModulePassManager MPM;
+   if (!options.passes.empty()) {
+      if (auto err = PB.parsePassPipeline(MPM, options.passes)) {
+         llvm::errs() << "Invalid pass pipeline: " << llvm::toString(std::move(err)) << '\n';
+         return;
+      }
+   } else {
+      MPM = options.thinLTOPreLink ? PB.buildThinLTOPreLinkDefaultPipeline(optimizationLevel(options.optLevel)) : PB.buildPerModuleDefaultPipeline(optimizationLevel(options.optLevel));
+   }
+   MPM.run(mod, MAM);
+}
+// ---------------------------------------------------------------------------
+LLVMEmitter::OwnedModule LLVMEmitter::takeModule() {
+   optimize();
+   Mod = nullptr;
+   return {std::move(ctx_), std::move(mod_)};
+}
+// ---------------------------------------------------------------------------
+bool LLVMEmitter::linkIn(LLVMEmitter &other, std::ostream &log) {
+   finishFunctions();
+   other.finishFunctions();
+   other.Mod = nullptr;
+
+   std::string errors{};
+   auto handler = Ctx.getDiagnosticHandler();
+   Ctx.setDiagnosticHandler(std::make_unique<LinkerDiagnostics>(errors));
+   // types of the same name are mapped onto each other, definitions are moved instead of copied
+   bool failed = llvm::Linker::linkModules(*Mod, std::move(other.mod_));
+   Ctx.setDiagnosticHandler(std::move(handler));
+   log << errors;
+   return !failed;
+}
+// ---------------------------------------------------------------------------
+void LLVMEmitter::internalize(std::span<const std::string> exports) {
+   finishFunctions();
+   std::unordered_set<std::string_view> keep{exports.begin(), exports.end()};
+   keep.insert("main");
+   llvm::internalizeModule(*Mod, [&keep](const llvm::GlobalValue &gv) {
+      return keep.contains(std::string_view{gv.getName().data(), gv.getName().size()});
+   });
+
+   // string literals are the only unnamed globals and must not be written to,
+   // so those that several files contain are only kept once
+   for (llvm::GlobalVariable &gv : Mod->globals()) {
+      auto *init = gv.hasInitializer() ? llvm::dyn_cast<llvm::ConstantDataSequential>(gv.getInitializer()) : nullptr;
+      if (!gv.hasName() && init && init->isString()) {
+         gv.setConstant(true);
+         gv.setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+      }
+   }
+   llvm::ModuleAnalysisManager MAM;
+   llvm::PassBuilder PB(TM.get());
+   PB.registerModuleAnalyses(MAM);
+   llvm::ConstantMergePass{}.run(*Mod, MAM);
+}
+// ---------------------------------------------------------------------------
 void LLVMEmitter::writeToObjFileImpl(llvm::raw_fd_ostream &OS) {
    std::error_code EC;
 
@@ -229,6 +612,11 @@ void LLVMEmitter::writeToObjFileImpl(llvm::raw_fd_ostream &OS) {
       return;
    }
 
+   optimize();
+   if (options_.codegenThreads > 1 && writeToObjFileParallel(OS)) {
+      return;
+   }
+
    llvm::legacy::PassManager pass;
    auto FileType = llvm::CodeGenFileType::ObjectFile;
 
@@ -241,32 +629,130 @@ void LLVMEmitter::writeToObjFileImpl(llvm::raw_fd_ostream &OS) {
    OS.flush();
 }
 // ---------------------------------------------------------------------------
+bool LLVMEmitter::writeToObjFileParallel(llvm::raw_fd_ostream &OS) {
+   // a context must not be used by multiple threads, so the partitions are passed on as bitcode.
+   // locals stay in the partition of their users, symbol names and linkage do not change
+   // SplitModule would name them differently than a single object file does
+   nameAnonymousGlobals(*Mod);
+
+   std::vector<llvm::SmallString<0>> parts;
+   llvm::SplitModule(
+       *Mod, options_.codegenThreads, [&parts](std::unique_ptr<llvm::Module> part) {
+          llvm::raw_svector_ostream BOS(parts.emplace_back());
+          llvm::WriteBitcodeToFile(*part, BOS);
+       },
+       true);
+
+   auto linker = llvm::sys::findProgramByName(options_.linker);
+   if (!linker) {
+      llvm::errs() << "Could not find '" << options_.linker << "' for the partial link\n";
+      return false;
+   }
+
+   std::vector<std::string> objects(parts.size());
+   std::atomic<bool> failed{false};
+   {
+      unsigned workers = static_cast<unsigned>(parts.size());
+      if (options_.codegenWorkers) {
+         workers = std::min(workers, options_.codegenWorkers);
+      }
+      WorkerPool pool{workers};
+      for (std::size_t i = 0; i < parts.size(); ++i) {
+         pool.run([&, i] {
+            llvm::LLVMContext ctx;
+            auto part = llvm::parseBitcodeFile(llvm::MemoryBufferRef(parts[i], "qcp"), ctx);
+            if (!part) {
+               llvm::consumeError(part.takeError());
+               failed = true;
+               return;
+            }
+            std::unique_ptr<llvm::TargetMachine, TargetMachineDeleter> tm{targetMachinePool().acquire(options_.cpu, options_.features)};
+            int fd;
+            llvm::SmallString<128> path;
+            if (!tm || llvm::sys::fs::createTemporaryFile("qcp-part", "o", fd, path)) {
+               failed = true;
+               return;
+            }
+            configureTargetMachine(*tm, options_);
+            objects[i] = path.str().str();
+
+            llvm::raw_fd_ostream POS(fd, true);
+            llvm::legacy::PassManager pass;
+            if (tm->addPassesToEmitFile(pass, POS, nullptr, llvm::CodeGenFileType::ObjectFile)) {
+               failed = true;
+               return;
+            }
+            pass.run(**part);
+         });
+      }
+   }
+
+   int fd;
+   llvm::SmallString<128> output;
+   if (!failed && !llvm::sys::fs::createTemporaryFile("qcp-combined", "o", fd, output)) {
+      llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+      std::vector<llvm::StringRef> args{*linker, "-r", "-o", output};
+      for (const auto &object : objects) {
+         args.push_back(object);
+      }
+      std::string error;
+      if (llvm::sys::ExecuteAndWait(*linker, args, std::nullopt, {}, 0, 0, &error) == 0) {
+         if (auto buffer = llvm::MemoryBuffer::getFile(output)) {
+            OS << (*buffer)->getBuffer();
+         } else {
+            failed = true;
+         }
+      } else {
+         llvm::errs() << "Partial link failed" << (error.empty() ? "" : ": ") << error << '\n';
+         failed = true;
+      }
+      llvm::sys::fs::remove(output);
+   } else {
+      failed = true;
+   }
+
+   for (const auto &object : objects) {
+      if (!object.empty()) {
+         llvm::sys::fs::remove(object);
+      }
+   }
+   // the module is unchanged, it is emitted in one piece instead
+   return !failed;
+}
+// ---------------------------------------------------------------------------
 typename LLVMEmitter::ty_t *LLVMEmitter::emitVoidTy() {
+   auto lock = lockContext();
    return llvm::Type::getVoidTy(Ctx);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ty_t *LLVMEmitter::emitIntTy(unsigned bits) {
+   auto lock = lockContext();
    return llvm::IntegerType::get(Ctx, bits);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ty_t *LLVMEmitter::emitFloatTy() {
+   auto lock = lockContext();
    return llvm::Type::getFloatTy(Ctx);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ty_t *LLVMEmitter::emitDoubleTy() {
+   auto lock = lockContext();
    return llvm::Type::getDoubleTy(Ctx);
 }
 // ---------------------------------------------------------------------------
 // todo: how to check if this is supported?
 typename LLVMEmitter::ty_t *LLVMEmitter::emitLongDoubleTy() {
+   auto lock = lockContext();
    return emitDoubleTy();
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ty_t *LLVMEmitter::emitPtrTo(Type ty) {
+   auto lock = lockContext();
    return static_cast<ty_t *>(ty)->getPointerTo();
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ty_t *LLVMEmitter::emitFnTy(Type retTy, std::vector<Type> argTys, bool isVarArgFnTy) {
+   auto lock = lockContext();
    std::vector<ty_t *> emitterArgTys;
    emitterArgTys.reserve(argTys.size());
    for (auto &argTy : argTys) {
@@ -276,10 +762,12 @@ typename LLVMEmitter::ty_t *LLVMEmitter::emitFnTy(Type retTy, std::vector<Type>
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ty_t *LLVMEmitter::emitArrayTy(Type ty, iconst_t *size) {
+   auto lock = lockContext();
    return llvm::ArrayType::get(static_cast<ty_t *>(ty), size->getZExtValue());
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ty_t *LLVMEmitter::emitStructTy(std::span<const Type> tys, bool incomplete, Ident name) {
+   auto lock = lockContext();
    if (incomplete) {
       return llvm::StructType::create(Ctx, static_cast<std::string>(name));
    }
@@ -292,24 +780,35 @@ typename LLVMEmitter::ty_t *LLVMEmitter::emitStructTy(std::span<const Type> tys,
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitUndef() {
+   auto lock = lockContext();
    return llvm::UndefValue::get(llvm::Type::getVoidTy(Ctx));
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitPoison() {
+   auto lock = lockContext();
    return llvm::PoisonValue::get(llvm::Type::getVoidTy(Ctx));
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitGlobalVar(Type ty, Ident name) {
-   return new llvm::GlobalVariable(*Mod, static_cast<ty_t *>(ty), false, llvm::GlobalValue::ExternalLinkage, nullptr, static_cast<std::string>(name).c_str());
+   auto lock = lockContext();
+   // unnamed globals cannot be referenced by other files, they would clash with those of other files in the link
+   auto linkage = name ? llvm::GlobalValue::ExternalLinkage : llvm::GlobalValue::PrivateLinkage;
+   return new llvm::GlobalVariable(*Mod, static_cast<ty_t *>(ty), false, linkage, nullptr, static_cast<std::string>(name).c_str());
 }
 // ---------------------------------------------------------------------------
 void LLVMEmitter::setInitValueGlobalVar(ssa_t *val, const_or_iconst_t init) {
+   auto lock = lockContext();
    static_cast<llvm::GlobalVariable *>(val)->setInitializer(toLLVMConstant(init));
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::fn_t *LLVMEmitter::emitFnProto(Type fnTy, bool alwaysInline = false, bool noReturn = false, Ident name) {
+   auto lock = lockContext();
    fn_t *fn = llvm::Function::Create(static_cast<llvm::FunctionType *>(static_cast<ty_t *>(fnTy)), llvm::Function::ExternalLinkage, static_cast<std::string>(name).c_str(), Mod);
    fn->setCallingConv(llvm::CallingConv::C);
+   fn->addFnAttr("target-cpu", options_.cpu);
+   if (!options_.features.empty()) {
+      fn->addFnAttr("target-features", options_.features);
+   }
    // make params noundef
    for (auto &arg : fn->args()) {
       arg.addAttr(llvm::Attribute::NoUndef);
@@ -324,26 +823,35 @@ typename LLVMEmitter::fn_t *LLVMEmitter::emitFnProto(Type fnTy, bool alwaysInlin
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::bb_t *LLVMEmitter::emitFn(fn_t *fnProto) {
+   auto lock = lockContext();
    return llvm::BasicBlock::Create(Ctx, "", fnProto);
 }
 // ---------------------------------------------------------------------------
 void LLVMEmitter::finalizeFn(fn_t *fn) {
-   llvm::verifyFunction(*fn, &llvm::errs());
+   if (worker_.joinable()) {
+      finished_.push(fn);
+   } else if (inlinePasses_) {
+      inlinePasses_->run(*fn, nullptr);
+   }
 }
 // ---------------------------------------------------------------------------
 bool LLVMEmitter::isFnProto(fn_t *fn) {
+   auto lock = lockContext();
    return fn->isDeclaration();
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::getParam(fn_t *fn, unsigned idx) {
+   auto lock = lockContext();
    return fn->getArg(idx);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::bb_t *LLVMEmitter::emitBB(fn_t *fn, bb_t *insertBefore, Ident name) {
+   auto lock = lockContext();
    return llvm::BasicBlock::Create(Ctx, static_cast<std::string>(name).c_str(), fn, insertBefore);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitLocalVar([[maybe_unused]] fn_t *fn, bb_t *entry, Type ty, Ident name, bool insertAtBegin) {
+   auto lock = lockContext();
    return emitAllocaImpl(entry, ty, nullptr, name, insertAtBegin);
 }
 // ---------------------------------------------------------------------------
@@ -364,10 +872,12 @@ typename LLVMEmitter::ssa_t *LLVMEmitter::emitAllocaImpl(bb_t *bb, Type ty, ssa_
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitAlloca(bb_t *bb, Type ty, ssa_t *size, Ident name) {
+   auto lock = lockContext();
    return emitAllocaImpl(bb, ty, size, name, false);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitLoad(bb_t *bb, Type ty, ssa_t *ptr, Ident name) {
+   auto lock = lockContext();
    Builder.SetInsertPoint(bb);
    if (ty->isBoolTy()) {
       auto result = Builder.CreateLoad(llvm::Type::getInt8Ty(Ctx), ptr, static_cast<std::string>(name).c_str());
@@ -377,6 +887,7 @@ typename LLVMEmitter::ssa_t *LLVMEmitter::emitLoad(bb_t *bb, Type ty, ssa_t *ptr
 }
 // ---------------------------------------------------------------------------
 void LLVMEmitter::emitStore(bb_t *bb, Type ty, value_t value, ssa_t *ptr) {
+   auto lock = lockContext();
    Builder.SetInsertPoint(bb);
    auto llvmVal = asLLVMValue(value);
    if (ty->isBoolTy()) {
@@ -386,34 +897,42 @@ void LLVMEmitter::emitStore(bb_t *bb, Type ty, value_t value, ssa_t *ptr) {
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitJump(bb_t *bb, bb_t *target) {
+   auto lock = lockContext();
    return llvm::BranchInst::Create(target, bb);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitBranch(bb_t *bb, bb_t *trueBB, bb_t *falseBB, value_t cond) {
+   auto lock = lockContext();
    return llvm::BranchInst::Create(trueBB, falseBB, asLLVMValue(cond), bb);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitRet(bb_t *bb, value_t value) {
+   auto lock = lockContext();
    return llvm::ReturnInst::Create(Ctx, asLLVMValue(value), bb);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_t *LLVMEmitter::emitFnPtr(Type ty, fn_t *fn) {
+   auto lock = lockContext();
    return static_cast<const_t *>(fn);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::iconst_t *LLVMEmitter::emitIConst(Type ty, unsigned long value) {
+   auto lock = lockContext();
    return static_cast<iconst_t *>(llvm::ConstantInt::get(static_cast<ty_t *>(ty), value, true));
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_t *LLVMEmitter::emitFPConst(Type ty, double value) {
+   auto lock = lockContext();
    return llvm::ConstantFP::get(static_cast<ty_t *>(ty), value);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_t *LLVMEmitter::emitNullPtr(Type ty) {
+   auto lock = lockContext();
    return llvm::ConstantPointerNull::get(static_cast<llvm::PointerType *>(static_cast<ty_t *>(ty)));
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_t *LLVMEmitter::emitArrayConst(Type ty, std::span<const const_or_iconst_t> values) {
+   auto lock = lockContext();
    std::vector<llvm::Constant *> llvmValues;
    llvmValues.reserve(values.size());
    for (const auto &val : values) {
@@ -423,11 +942,13 @@ typename LLVMEmitter::const_t *LLVMEmitter::emitArrayConst(Type ty, std::span<co
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_t *LLVMEmitter::emitArrayConst(Type ty, const_or_iconst_t value) {
+   auto lock = lockContext();
    std::vector<llvm::Constant *> llvmValues(ty->getArraySize(), toLLVMConstant(value)); // todo: ask alexis how to handle this
    return llvm::ConstantArray::get(static_cast<llvm::ArrayType *>(static_cast<ty_t *>(ty)), llvmValues);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_t *LLVMEmitter::emitStructConst(Type ty, std::span<const const_or_iconst_t> values) {
+   auto lock = lockContext();
    std::vector<llvm::Constant *> llvmValues;
    llvmValues.reserve(values.size());
    for (const auto &val : values) {
@@ -437,10 +958,12 @@ typename LLVMEmitter::const_t *LLVMEmitter::emitStructConst(Type ty, std::span<c
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_t *LLVMEmitter::emitStringLiteral(const std::string_view str) {
+   auto lock = lockContext();
    return llvm::ConstantDataArray::getString(Ctx, str);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitPhi(bb_t *bb, Type ty, std::span<std::pair<value_t, bb_t *>> incoming, Ident name) {
+   auto lock = lockContext();
    auto phi = llvm::PHINode::Create(static_cast<ty_t *>(ty), incoming.size(), static_cast<std::string>(name).c_str(), bb);
    for (const auto &[value, pred] : incoming) {
       phi->addIncoming(asLLVMValue(value), pred);
@@ -449,6 +972,7 @@ typename LLVMEmitter::ssa_t *LLVMEmitter::emitPhi(bb_t *bb, Type ty, std::span<s
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitBinOp(bb_t *bb, Type ty, op::Kind kind, value_t lhs, value_t rhs, ssa_t *dest, Ident name) {
+   auto lock = lockContext();
    Builder.SetInsertPoint(bb);
    ssa_t *lhs_ = asLLVMValue(lhs);
    ssa_t *rhs_ = asLLVMValue(rhs);
@@ -470,6 +994,7 @@ typename LLVMEmitter::ssa_t *LLVMEmitter::emitBinOp(bb_t *bb, Type ty, op::Kind
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_or_iconst_t LLVMEmitter::emitConstBinOp([[maybe_unused]] bb_t *bb, Type ty, op::Kind kind, const_or_iconst_t lhs, const_or_iconst_t rhs, [[maybe_unused]] Ident name) {
+   auto lock = lockContext();
    auto lhs_ = toLLVMConstant(lhs);
    auto rhs_ = toLLVMConstant(rhs);
    if (auto [isAssign, binOp] = toLLVMBinOp(ty, kind); binOp != Instr::BinaryOps::BinaryOpsEnd) {
@@ -482,6 +1007,7 @@ typename LLVMEmitter::const_or_iconst_t LLVMEmitter::emitConstBinOp([[maybe_unus
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitIncDecOp(bb_t *bb, Type ty, op::Kind kind, ssa_t *operand, Ident name) {
+   auto lock = lockContext();
    auto [isPost, plusMinusOne] = decomposeIncDecOp(kind);
    ssa_t *value = emitLoad(bb, ty, operand, name);
    const_t *incDecVal = nullptr;
@@ -501,6 +1027,7 @@ typename LLVMEmitter::ssa_t *LLVMEmitter::emitIncDecOp(bb_t *bb, Type ty, op::Ki
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitNeg(bb_t *bb, Type ty, ssa_t *operand, Ident name) {
+   auto lock = lockContext();
    if (ty->isFloatingTy()) {
       return llvm::UnaryOperator::Create(Instr::FNeg, operand, static_cast<std::string>(name).c_str(), bb);
    } else if (ty->kind() == type::Kind::BOOL) {
@@ -512,21 +1039,25 @@ typename LLVMEmitter::ssa_t *LLVMEmitter::emitNeg(bb_t *bb, Type ty, ssa_t *oper
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_or_iconst_t LLVMEmitter::emitConstNeg([[maybe_unused]] bb_t *bb, Type ty, const_or_iconst_t operand, [[maybe_unused]] Ident name) {
+   auto lock = lockContext();
    // todo: check if this is correct
    return toQCPConstant(llvm::ConstantExpr::getNeg(toLLVMConstant(operand)));
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitBWNeg(bb_t *bb, Type ty, ssa_t *operand, Ident name) {
+   auto lock = lockContext();
    const_t *allOnes = llvm::ConstantInt::getAllOnesValue(static_cast<ty_t *>(ty));
    return llvm::BinaryOperator::Create(Instr::Xor, operand, allOnes, static_cast<std::string>(name).c_str(), bb);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_or_iconst_t LLVMEmitter::emitConstBWNeg([[maybe_unused]] bb_t *bb, Type ty, const_or_iconst_t operand, [[maybe_unused]] Ident name) {
+   auto lock = lockContext();
    const_t *allOnes = llvm::ConstantInt::getAllOnesValue(static_cast<ty_t *>(ty));
    return toQCPConstant(llvm::ConstantExpr::getXor(toLLVMConstant(operand), allOnes));
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_or_iconst_t LLVMEmitter::emitConstCast([[maybe_unused]] bb_t *bb, [[maybe_unused]] Type fromTy, const_or_iconst_t val, Type toTy, qcp::type::Cast cast) {
+   auto lock = lockContext();
    switch (cast) {
       case qcp::type::Cast::TRUNC:
       case qcp::type::Cast::PTRTOINT:
@@ -552,15 +1083,18 @@ typename LLVMEmitter::const_or_iconst_t LLVMEmitter::emitConstCast([[maybe_unuse
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitCast(bb_t *bb, [[maybe_unused]] Type fromTy, ssa_t *val, Type toTy, qcp::type::Cast cast) {
+   auto lock = lockContext();
    return llvm::CastInst::Create(toLLVMCastOp(cast), val, static_cast<ty_t *>(toTy), "", bb);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitCall(bb_t *bb, fn_t *fn, std::span<const value_t> args, Ident name) {
+   auto lock = lockContext();
    llvm::FunctionCallee callee{fn};
    return emitCall(bb, callee, args, name);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitCall(bb_t *bb, Type fnTy, value_t fnPtr, std::span<const value_t> args, Ident name) {
+   auto lock = lockContext();
    llvm::FunctionCallee fn{llvm::cast<llvm::FunctionType>(static_cast<ty_t *>(fnTy)), asLLVMValue(fnPtr)};
    return emitCall(bb, fn, args, name);
 }
@@ -575,39 +1109,48 @@ typename LLVMEmitter::ssa_t *LLVMEmitter::emitCall(bb_t *bb, llvm::FunctionCalle
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::iconst_t *LLVMEmitter::sizeOf(Type ty) {
+   auto lock = lockContext();
    auto size = Mod->getDataLayout().getTypeAllocSize(static_cast<ty_t *>(ty));
    return llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), size);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitGEP(bb_t *bb, Type ty, value_t ptr, value_t idx, Ident name) {
+   auto lock = lockContext();
    return emitGEPImpl(bb, ty, asLLVMValue(ptr), std::span<value_t>(&idx, 1), name, asLLVMValue);
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitGEP(bb_t *bb, Type ty, value_t ptr, std::span<const uint64_t> idx, Ident name) {
+   auto lock = lockContext();
    return emitGEPImpl(bb, ty, asLLVMValue(ptr), idx, name, [this](uint64_t val) { return llvmUint64T(Ctx, val); });
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::ssa_t *LLVMEmitter::emitGEP(bb_t *bb, Type ty, value_t ptr, std::span<const std::uint32_t> idx, Ident name) {
+   auto lock = lockContext();
    return emitGEPImpl(bb, ty, asLLVMValue(ptr), idx, name, [this](std::uint32_t val) { return llvmUint32T(Ctx, val); });
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::sw_t *LLVMEmitter::emitSwitch(bb_t *bb, value_t value) {
+   auto lock = lockContext();
    return llvm::SwitchInst::Create(asLLVMValue(value), nullptr, 0, bb);
 }
 // ---------------------------------------------------------------------------
 void LLVMEmitter::addSwitchCase(sw_t *sw, iconst_t *value, bb_t *target) {
+   auto lock = lockContext();
    sw->addCase(value, target);
 }
 // ---------------------------------------------------------------------------
 void LLVMEmitter::addSwitchDefault(sw_t *sw, bb_t *target) {
+   auto lock = lockContext();
    sw->setDefaultDest(target);
 }
 // ---------------------------------------------------------------------------
 void LLVMEmitter::zeroInitGlobalVar(Type ty, ssa_t *val) {
+   auto lock = lockContext();
    static_cast<llvm::GlobalVariable *>(val)->setInitializer(zeroConst(ty));
 }
 // ---------------------------------------------------------------------------
 void LLVMEmitter::zeroInitLocalVar(bb_t *entry, Type ty, ssa_t *val) {
+   auto lock = lockContext();
    Builder.SetInsertPoint(entry);
    Builder.CreateStore(zeroConst(ty), val);
 }
@@ -620,6 +1163,7 @@ typename LLVMEmitter::const_t *LLVMEmitter::zeroConst(Type ty) {
 }
 // ---------------------------------------------------------------------------
 typename LLVMEmitter::const_or_iconst_t LLVMEmitter::emitZeroConst(Type ty) {
+   auto lock = lockContext();
    return {zeroConst(ty)}; // todo: this never returns iconst_t
 }
 
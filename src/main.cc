@@ -2,39 +2,94 @@
 // qcp
 // ---------------------------------------------------------------------------
 // Alexis hates iostream
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
+#include <fcntl.h>
 #include <getopt.h>
+#include <spawn.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 // ---------------------------------------------------------------------------
+#include "bytecodeemitter.h"
+#include "compilecache.h"
+#include "compileserver.h"
 #include "diagnostics.h"
+#include "directemitter.h"
+#include "jit.h"
 #include "llvmemitter.h"
+#include "nullemitter.h"
 #include "parser.h"
+#include "preprocessor.h"
+#include "streambuffer.h"
+#include "thinlto.h"
 #include "tokenizer.h"
+#include "workerpool.h"
 // ---------------------------------------------------------------------------
 using Parser = qcp::Parser<qcp::emitter::LLVMEmitter>;
 // ---------------------------------------------------------------------------
+// long options without a short form, 0 is used for --ld and --pp
+enum : int {
+   OPT_CACHE = 256,
+   OPT_CACHE_DIR,
+   OPT_CACHE_DIRECT,
+   OPT_PASSES,
+   OPT_CODEGEN_THREADS,
+   OPT_STREAM_BC,
+   OPT_VERIFY,
+   OPT_BACKEND,
+   OPT_RUN,
+   OPT_WHOLE_PROGRAM,
+   OPT_EXPORT,
+   OPT_LEX_THREADS,
+   OPT_BACKGROUND_PASSES,
+};
+// ---------------------------------------------------------------------------
 struct option longopts[] = {
     {"help", no_argument, nullptr, 'h'},
     {"ld", required_argument, nullptr, 0},
     {"pp", required_argument, nullptr, 0},
     {"no-pp", no_argument, nullptr, 'p'},
-    {"--emit-bc", no_argument, nullptr, 'b'},
-    {"--emit-llvm", no_argument, nullptr, 'l'},
+    {"emit-bc", no_argument, nullptr, 'b'},
+    {"emit-llvm", no_argument, nullptr, 'l'},
+    {"jobs", required_argument, nullptr, 'j'},
+    {"cache", no_argument, nullptr, OPT_CACHE},
+    {"cache-dir", required_argument, nullptr, OPT_CACHE_DIR},
+    {"cache-direct", no_argument, nullptr, OPT_CACHE_DIRECT},
+    {"passes", required_argument, nullptr, OPT_PASSES},
+    {"codegen-threads", required_argument, nullptr, OPT_CODEGEN_THREADS},
+    {"stream-bc", no_argument, nullptr, OPT_STREAM_BC},
+    {"verify", no_argument, nullptr, OPT_VERIFY},
+    {"backend", required_argument, nullptr, OPT_BACKEND},
+    {"run", no_argument, nullptr, OPT_RUN},
+    {"whole-program", no_argument, nullptr, OPT_WHOLE_PROGRAM},
+    {"export", required_argument, nullptr, OPT_EXPORT},
+    {"lex-threads", required_argument, nullptr, OPT_LEX_THREADS},
+    {"background-passes", no_argument, nullptr, OPT_BACKGROUND_PASSES},
     {0, 0, nullptr, 0}};
+// the short options of the driver, -L and -l are parsed with the input files
+const char *optstring = "I:U:D:o:O::Ebchpj:f:";
 // ---------------------------------------------------------------------------
 const char *helpmsg = R"(
-Usage: qcp [options] file0 ...fileN
+Usage: qcp [options] file0 ...fileN (- reads from stdin)
   -h, --help          Display this help message
   --ld                Path to the linker (default: ld)
-  --pp                preprocessor command (default: cc -nostdinc -E)
+  --pp                External preprocessor command (default: built-in)
   -I                  Add a directory to the include path
   -D                  Define a macro
   -U                  Undefine a macro
@@ -42,114 +97,460 @@ Usage: qcp [options] file0 ...fileN
    -o                  Output file (default: a.out)
    -E                  Stop after the preprocessing stage
    -c                  Compile only (do not link)
+  -fsyntax-only       Only report diagnostics, no code is generated
+  --run               Compile and run the file in memory, arguments after -- are passed to it
    -p, --no-pp         Do not run the preprocessor
-   -b, --emit-bc       Emit LLVM bitcode
-   -l, --emit-llvm     Emit LLVM IR
+   -b, --emit-bc       Emit LLVM bitcode with a module summary
+  --stream-bc         Flush large bitcode files while writing them instead of buffering them
+   --emit-llvm         Emit LLVM IR
+   -j, --jobs N        Compile up to N files in parallel (0: one per core)
+   -O0, -O1, -O2, -O3  Optimization level (default: -O0, -O: -O1)
+   -Os, -Oz            Optimize for size
+  -march=, -mcpu=     Target CPU (default: generic, native: the CPU qcp runs on)
+  -mattr=             Enable (+) or disable (-) CPU features, e.g. -mattr=+avx2,-fma
+  --passes PIPELINE   Run a custom LLVM pass pipeline instead, e.g. 'function(mem2reg,instcombine)'
+  --codegen-threads N Generate the code of each file on N threads (0: one per core)
+  --lex-threads N     Lex large preprocessed files on N threads (0: one per core)
+  --whole-program     Link all files into one module and optimize it as a whole,
+                      only main and the symbols of --export stay visible
+  --export SYMBOL     Keep SYMBOL visible with --whole-program or -flto=thin, e.g. for dlsym
+  -flto=thin          Write bitcode with a module summary, the link imports functions across
+                      files and compiles the modules on -j threads. .o and .bc inputs are linked,
+                      those without bitcode go to the system linker as they are
+  --verify            Check the generated IR (default in assert builds)
+  --background-passes Verify and simplify finished functions on another thread while parsing
+  --backend=BACKEND   llvm (default) or direct: fast unoptimized x86-64 code without LLVM,
+                      with --run also bytecode: interpret the file without generating code
+  --cache             Reuse outputs of earlier compilations of the same source
+  --cache-dir DIR     Cache directory (default: $QCP_CACHE_DIR or ~/.cache/qcp), implies --cache
+  --cache-direct      Also skip the built-in preprocessor if no included file changed, implies --cache
+  --server            Serve compile jobs on $QCP_SERVER (default: $XDG_RUNTIME_DIR/qcp.sock)
+  --connect           Run on the compile server if one is running (default if $QCP_SERVER is set)
 )";
 // ---------------------------------------------------------------------------
 struct ParserConfig {
    std::string pp;
-   std::string ppargs;
-   std::string OF;
+   // -I, -D and -U in command line order
+   std::vector<std::pair<char, std::string>> ppopts;
+   qcp::pp::FileCache *ppcache;
+   // nullptr if caching is disabled
+   const qcp::CompileCache *cache;
    std::string ld;
    std::string ldargs;
+   // kept visible by --whole-program
+   std::vector<std::string> exports;
+   qcp::emitter::LLVMEmitter::Options emitterOptions;
+   unsigned jobs;
+   // only files that are read completely before they are parsed
+   unsigned lexThreads;
    unsigned char stopAfterPP : 1,
        compileOnly : 1,
        noPP : 1,
        emitBC : 1,
-       emitLLVM : 1;
+       emitLLVM : 1,
+       cacheDirect : 1,
+       directBackend : 1,
+       bytecodeBackend : 1,
+       syntaxOnly : 1,
+       run : 1,
+       wholeProgram : 1,
+       thinLTO : 1;
+};
+// ---------------------------------------------------------------------------
+// a translation unit and where its output goes
+struct Input {
+   std::string filename;
+   std::string OF;
+   // diagnostics are buffered per file when compiling in parallel
+   std::ostringstream log{};
+   std::FILE *result = nullptr;
+   // set by -fsyntax-only
+   bool hasErrors = false;
+   // a .o or .bc file that -flto=thin links instead of compiling it
+   bool bitcode = false;
+   // such a file that holds native code, it goes to the system linker as it is
+   bool native = false;
 };
 // ---------------------------------------------------------------------------
 // } // namespace
 // ---------------------------------------------------------------------------
-std::FILE *processFile(const std::string &filename, ParserConfig &cfg) {
-   std::FILE *tmpf;
+// deps receives the included files if the output only depends on the contents of the files read
+bool preprocess(const std::string &filename, const ParserConfig &cfg, std::string &out, std::ostream &log,
+                std::optional<std::vector<qcp::CompileCache::Dependency>> *deps = nullptr) {
+   qcp::pp::Preprocessor pp{*cfg.ppcache, log};
+   for (const auto &[opt, arg] : cfg.ppopts) {
+      switch (opt) {
+         case 'I':
+            pp.addIncludeDir(arg);
+            break;
+         case 'D':
+            pp.define(arg);
+            break;
+         case 'U':
+            pp.undefine(arg);
+            break;
+      }
+   }
+   if (filename == "-") {
+      auto file = qcp::pp::FileCache::read(STDIN_FILENO, "<stdin>");
+      return file && pp.run(std::move(file), out);
+   }
+   if (!pp.run(filename, out)) {
+      return false;
+   }
+   if (deps && !pp.timeDependent()) {
+      deps->emplace();
+      // the main file is part of the direct key
+      for (std::size_t i = 1; i < pp.dependencies().size(); ++i) {
+         auto file = cfg.ppcache->get(pp.dependencies()[i]);
+         if (!file) {
+            deps->reset();
+            break;
+         }
+         (*deps)->push_back({.path = file->path, .hash = qcp::CompileCache::hashFile(file->contents), .mtime = file->mtime, .size = file->size});
+      }
+      // a header created in an earlier include directory would be found instead
+      if (*deps) {
+         for (const std::string &path : pp.missing()) {
+            (*deps)->push_back({.path = path, .hash = {}, .mtime = 0, .size = 0});
+         }
+      }
+   }
+   return true;
+}
+// ---------------------------------------------------------------------------
+// everything but the input that determines the output of a compilation
+qcp::CacheKey cacheKey(const ParserConfig &cfg) {
+   qcp::CacheKey key = qcp::CompileCache::baseKey();
+   key.add(qcp::emitter::LLVMEmitter::targetDescription(cfg.emitterOptions));
+   key.add(cfg.emitLLVM ? "ll" : cfg.emitBC || cfg.thinLTO ? "bc" : "obj").add(cfg.compileOnly);
+   key.add(cfg.directBackend ? "direct" : "llvm");
+   return key;
+}
+// ---------------------------------------------------------------------------
+// identifies a compilation before preprocessing: the main file and how it is preprocessed
+std::string directCacheKey(const std::string &filename, std::string_view contents, const ParserConfig &cfg) {
+   qcp::CacheKey key = cacheKey(cfg);
+   // relative include paths depend on the working directory
+   key.add("direct").add(std::filesystem::current_path().string()).add(filename).add(contents);
+   for (const auto &[opt, arg] : cfg.ppopts) {
+      key.add(std::string_view{&opt, 1}).add(arg);
+   }
+   return key.hex();
+}
+// ---------------------------------------------------------------------------
+// splits a command on whitespace, quoting is not supported
+std::vector<std::string> splitCommand(const std::string &cmd) {
+   std::vector<std::string> args{};
+   std::istringstream is{cmd};
+   for (std::string arg; is >> arg;) {
+      args.push_back(std::move(arg));
+   }
+   return args;
+}
+// ---------------------------------------------------------------------------
+// starts the external preprocessor with its output connected to outFd, no shell is involved
+pid_t spawnPreprocessor(const std::string &filename, const ParserConfig &cfg, int outFd, std::ostream &log) {
+   std::vector<std::string> args = splitCommand(cfg.pp);
+   for (const auto &[opt, arg] : cfg.ppopts) {
+      args.push_back(std::string{'-', opt});
+      args.push_back(arg);
+   }
+   args.push_back(filename);
+
+   std::vector<char *> argv{};
+   for (auto &arg : args) {
+      argv.push_back(arg.data());
+   }
+   argv.push_back(nullptr);
+
+   posix_spawn_file_actions_t actions;
+   posix_spawn_file_actions_init(&actions);
+   posix_spawn_file_actions_adddup2(&actions, outFd, STDOUT_FILENO);
+   pid_t pid;
+   int err = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+   posix_spawn_file_actions_destroy(&actions);
+   if (err) {
+      log << "Failed to run preprocessor '" << args[0] << "': " << std::strerror(err) << '\n';
+      return -1;
+   }
+   return pid;
+}
+// ---------------------------------------------------------------------------
+bool waitForPreprocessor(pid_t pid) {
+   int status;
+   while (waitpid(pid, &status, 0) < 0) {
+      if (errno != EINTR) {
+         return false;
+      }
+   }
+   return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+// ---------------------------------------------------------------------------
+// with -fsyntax-only nothing is written, hasErrors tells whether the file could not be checked or has errors
+std::FILE *processFile(const std::string &filename, const std::string &OFName, const ParserConfig &cfg, std::ostream &log, bool &hasErrors) {
+   std::FILE *tmpf = nullptr;
    int tmpfd;
+   // handed to the linker once the object file is written
+   std::FILE *result = nullptr;
 
    std::FILE *OF = nullptr;
    int OFd;
+   int outFd;
 
    void *data = nullptr;
    std::size_t mmapSize;
 
-   if (!cfg.OF.empty()) {
-      OF = std::fopen(cfg.OF.c_str(), "w");
+   bool builtinPP = !cfg.noPP && cfg.pp.empty();
+   bool fromStdin = filename == "-";
+   // output of the built-in preprocessor
+   std::string ppout{};
+   // output of an external preprocessor or stdin, parsed while it is read
+   std::unique_ptr<qcp::StreamBuffer> stream{};
+   pid_t ppPid = -1;
+   std::string_view sv{};
+
+   bool useCache = cfg.cache && !cfg.stopAfterPP && !cfg.syntaxOnly;
+   // the preprocessed input, empty if the result is not cached
+   std::string cacheKeyHex{};
+   // the unpreprocessed input, empty if not in direct mode
+   std::string directKeyHex{};
+   std::optional<std::vector<qcp::CompileCache::Dependency>> deps{};
+
+   // cleared once the file is checked
+   hasErrors = cfg.syntaxOnly;
+
+   if (cfg.syntaxOnly) {
+      // no output
+   } else if (!OFName.empty()) {
+      // readable, so that the output can be copied into the cache
+      OF = std::fopen(OFName.c_str(), useCache ? "w+e" : "we");
       if (!OF) {
-         std::cerr << "Failed to open output file '" << cfg.OF << "'\n";
+         log << "Failed to open output file '" << OFName << "'\n";
          goto cleanup;
       }
       OFd = fileno(OF);
+      outFd = OFd;
+   } else {
+      // the object file is handed to the linker through a temporary file
+      tmpf = tmpfile();
+      if (!tmpf) {
+         log << "Failed to open temporary file\n";
+         goto cleanup;
+      }
+      tmpfd = fileno(tmpf);
+      outFd = tmpfd;
+   }
+
+   if (useCache && cfg.cacheDirect && builtinPP && !fromStdin) {
+      if (auto file = cfg.ppcache->get(filename)) {
+         directKeyHex = directCacheKey(filename, file->contents, cfg);
+         auto key = cfg.cache->lookupManifest(directKeyHex);
+         if (key && cfg.cache->fetch(*key, outFd)) {
+            result = tmpf;
+            goto cleanup;
+         }
+      }
    }
 
-   if (cfg.stopAfterPP) {
+   if (builtinPP) {
+      if (!preprocess(filename, cfg, ppout, log, directKeyHex.empty() ? nullptr : &deps)) {
+         log << "Preprocessor failed\n";
+         goto cleanup;
+      }
+      if (cfg.stopAfterPP) {
+         assert(OF && "OF must be open");
+         std::fwrite(ppout.data(), 1, ppout.size(), OF);
+         goto cleanup;
+      }
+      sv = ppout;
+   } else if (!cfg.noPP && cfg.stopAfterPP) {
       assert(OF && "OF must be open");
-      tmpf = OF;
-   } else if (cfg.noPP) {
-      tmpf = std::fopen(filename.c_str(), "r");
+      ppPid = spawnPreprocessor(filename, cfg, OFd, log);
+      if (ppPid < 0 || !waitForPreprocessor(ppPid)) {
+         log << "Preprocessor failed\n";
+      }
+      ppPid = -1;
+      goto cleanup;
+   } else if (!cfg.noPP) {
+      int fds[2];
+      if (pipe2(fds, O_CLOEXEC)) {
+         log << "Failed to create pipe\n";
+         goto cleanup;
+      }
+      ppPid = spawnPreprocessor(filename, cfg, fds[1], log);
+      close(fds[1]);
+      if (ppPid < 0) {
+         close(fds[0]);
+         goto cleanup;
+      }
+      stream = std::make_unique<qcp::StreamBuffer>(fds[0]);
+   } else if (cfg.stopAfterPP) {
+      goto cleanup;
+   } else if (fromStdin) {
+      stream = std::make_unique<qcp::StreamBuffer>(dup(STDIN_FILENO));
    } else {
-      tmpf = tmpfile();
+      int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+         log << "Failed to open file\n";
+         goto cleanup;
+      }
+      struct stat statbuf;
+      fstat(fd, &statbuf);
+      mmapSize = static_cast<std::size_t>(statbuf.st_size);
+      if (mmapSize) {
+         data = mmap(nullptr, mmapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+         sv = std::string_view{static_cast<const char *>(data), mmapSize};
+      }
+      close(fd);
    }
-   if (!tmpf) {
-      std::cerr << "Failed to open file\n";
+
+   if (cfg.syntaxOnly) {
+      qcp::DiagnosticTracker diag{fromStdin ? "<stdin>" : filename, stream ? std::string_view{stream->data(), 0} : sv, log};
+      std::optional<qcp::Parser<qcp::emitter::NullEmitter>> parser{};
+      if (stream) {
+         parser.emplace(*stream, diag);
+      } else {
+         parser.emplace(sv, diag, std::cout, qcp::emitter::NullEmitter::Options{}, cfg.lexThreads);
+      }
+      parser->addIntTypeDef("__builtin_va_list");
+      parser->parse();
+
+      log << diag;
+
+      if (stream) {
+         stream->finish();
+         if (stream->failed()) {
+            log << "Failed to read input\n";
+            goto cleanup;
+         }
+      }
+      if (ppPid >= 0) {
+         bool ok = waitForPreprocessor(ppPid);
+         ppPid = -1;
+         if (!ok) {
+            log << "Preprocessor failed\n";
+            goto cleanup;
+         }
+      }
+      hasErrors = diag.count(qcp::DiagnosticMessage::Kind::ERROR) != 0;
       goto cleanup;
    }
-   tmpfd = fileno(tmpf);
-
-   if (!cfg.noPP) {
-      std::string cmd = cfg.pp + " " + cfg.ppargs + " " + filename + " > /dev/fd/" + std::to_string(tmpfd);
-      int ret = std::system(cmd.c_str());
 
-      if (ret != 0) {
-         std::cerr << "Preprocessor failed\n";
+   if (useCache) {
+      if (stream) {
+         // the key covers the whole input, so it cannot be parsed while it is read
+         sv = stream->finish();
+      }
+      cacheKeyHex = cacheKey(cfg).add(sv).hex();
+      if (cfg.cache->fetch(cacheKeyHex, outFd)) {
+         if (deps) {
+            cfg.cache->storeManifest(directKeyHex, cacheKeyHex, *deps);
+         }
+         result = tmpf;
          goto cleanup;
       }
    }
 
-   if (cfg.stopAfterPP) {
-      goto cleanup;
-   }
+   if (cfg.directBackend) {
+      if (stream) {
+         // the LLVMEmitter parses the input again if the DirectEmitter cannot compile it
+         sv = stream->finish();
+      }
+      // only the diagnostics of the parse whose output is used are reported
+      std::ostringstream directLog{};
+      qcp::DiagnosticTracker diag{fromStdin ? "<stdin>" : filename, sv, directLog};
+      qcp::Parser<qcp::emitter::DirectEmitter> parser{sv, diag, std::cout, {}, cfg.lexThreads};
+      parser.addIntTypeDef("__builtin_va_list");
+      parser.parse();
 
-   {
-      struct stat statbuf;
-      fstat(tmpfd, &statbuf);
-      mmapSize = static_cast<std::size_t>(statbuf.st_size);
+      auto &emitter = parser.getEmitter();
+      if (emitter.supported()) {
+         log << directLog.str() << diag;
+         if (stream && stream->failed()) {
+            log << "Failed to read input\n";
+            goto cleanup;
+         }
+         if (ppPid >= 0) {
+            bool ok = waitForPreprocessor(ppPid);
+            ppPid = -1;
+            if (!ok) {
+               log << "Preprocessor failed\n";
+               goto cleanup;
+            }
+         }
 
-      data = mmap(nullptr, mmapSize, PROT_READ, MAP_PRIVATE, tmpfd, 0);
+         emitter.writeToObjFile(outFd);
+         result = tmpf;
 
-      std::string_view sv{static_cast<const char *>(data), mmapSize};
+         if (!cacheKeyHex.empty() && diag.empty() && cfg.cache->store(cacheKeyHex, outFd) && deps) {
+            cfg.cache->storeManifest(directKeyHex, cacheKeyHex, *deps);
+         }
+         goto cleanup;
+      }
+   }
 
-      qcp::DiagnosticTracker diag{filename, sv};
-      Parser parser{sv, diag};
-      parser.addIntTypeDef("__builtin_va_list");
-      parser.parse();
+   {
+      qcp::DiagnosticTracker diag{fromStdin ? "<stdin>" : filename, stream ? std::string_view{stream->data(), 0} : sv, log};
+      std::optional<Parser> parser{};
+      if (stream) {
+         parser.emplace(*stream, diag, std::cout, cfg.emitterOptions);
+      } else {
+         parser.emplace(sv, diag, std::cout, cfg.emitterOptions, cfg.lexThreads);
+      }
+      parser->addIntTypeDef("__builtin_va_list");
+      parser->parse();
 
-      std::cerr << diag;
+      log << diag;
+
+      if (stream) {
+         stream->finish();
+         if (stream->failed()) {
+            log << "Failed to read input\n";
+            goto cleanup;
+         }
+      }
+      if (ppPid >= 0) {
+         bool ok = waitForPreprocessor(ppPid);
+         ppPid = -1;
+         if (!ok) {
+            log << "Preprocessor failed\n";
+            goto cleanup;
+         }
+      }
 
-      ftruncate(tmpfd, 0);
-      
-      auto& emitter = parser.getEmitter();
-      int fd = OF ? OFd : tmpfd;
+      auto &emitter = parser->getEmitter();
       if (cfg.emitLLVM) {
-         emitter.writeLLVMToFile(fd);
-      } else if (cfg.emitBC) {
-         emitter.writeToBitcodeFile(fd);
+         emitter.writeLLVMToFile(outFd);
+      } else if (cfg.emitBC || cfg.thinLTO) {
+         emitter.writeToBitcodeFile(outFd);
       } else {
-         emitter.writeToObjFile(fd);
+         emitter.writeToObjFile(outFd);
       }
+      result = tmpf;
 
-      if (cfg.compileOnly) {
-         goto cleanup;
+      // diagnostics would be lost on a hit
+      if (!cacheKeyHex.empty() && diag.empty() && cfg.cache->store(cacheKeyHex, outFd) && deps) {
+         cfg.cache->storeManifest(directKeyHex, cacheKeyHex, *deps);
       }
    }
 
 cleanup:
+   if (stream) {
+      // wait for the reader before the preprocessor is reaped
+      stream.reset();
+   }
+   if (ppPid >= 0) {
+      waitForPreprocessor(ppPid);
+   }
+
    if (data) {
       if (munmap(data, mmapSize)) {
-         std::cerr << "munmap failed\n";
+         log << "munmap failed\n";
       }
    }
 
-   if (tmpf && OF) {
+   if (tmpf && tmpf != result) {
       std::fclose(tmpf);
    }
 
@@ -157,7 +558,167 @@ cleanup:
       std::fclose(OF);
    }
 
-   return OF ? nullptr : tmpf;
+   return result;
+}
+// ---------------------------------------------------------------------------
+// reads the whole input, preprocessed unless disabled
+bool readSource(const std::string &filename, const ParserConfig &cfg, std::string &source, std::ostream &log) {
+   if (!cfg.noPP && cfg.pp.empty()) {
+      if (!preprocess(filename, cfg, source, log)) {
+         log << "Preprocessor failed\n";
+         return false;
+      }
+   } else if (!cfg.noPP) {
+      int fds[2];
+      if (pipe2(fds, O_CLOEXEC)) {
+         log << "Failed to create pipe\n";
+         return false;
+      }
+      pid_t ppPid = spawnPreprocessor(filename, cfg, fds[1], log);
+      close(fds[1]);
+      if (ppPid < 0) {
+         close(fds[0]);
+         return false;
+      }
+      bool failed;
+      {
+         qcp::StreamBuffer stream{fds[0]};
+         source = stream.finish();
+         failed = stream.failed();
+      }
+      if (!waitForPreprocessor(ppPid) || failed) {
+         log << "Preprocessor failed\n";
+         return false;
+      }
+   } else {
+      std::shared_ptr<const qcp::pp::FileCache::File> file = filename == "-" ? qcp::pp::FileCache::read(STDIN_FILENO, "<stdin>") : cfg.ppcache->get(filename);
+      if (!file) {
+         log << "Failed to open file\n";
+         return false;
+      }
+      source = file->contents;
+   }
+   return true;
+}
+// ---------------------------------------------------------------------------
+// --whole-program: parses every file into one context and links the modules, so that the optimizer
+// can inline and drop functions across files. returns the object file, nullptr on errors
+std::FILE *compileWholeProgram(const std::vector<std::unique_ptr<Input>> &inputs, const ParserConfig &cfg, std::ostream &log) {
+   // outlives the parsers, their types and constants belong to it
+   llvm::LLVMContext ctx;
+   qcp::emitter::LLVMEmitter::Options options = cfg.emitterOptions;
+   options.context = &ctx;
+   // no other thread may use the context while the next file is parsed
+   options.backgroundPasses = false;
+
+   std::vector<std::string> sources(inputs.size());
+   // the other modules are linked into the one of the first file
+   std::unique_ptr<qcp::DiagnosticTracker> programDiag{};
+   std::unique_ptr<Parser> program{};
+   bool failed = false;
+   for (std::size_t i = 0; i < inputs.size(); ++i) {
+      const std::string &filename = inputs[i]->filename;
+      if (!readSource(filename, cfg, sources[i], log)) {
+         return nullptr;
+      }
+      auto diag = std::make_unique<qcp::DiagnosticTracker>(filename == "-" ? "<stdin>" : filename, sources[i], log);
+      auto parser = std::make_unique<Parser>(sources[i], *diag, std::cout, options);
+      parser->addIntTypeDef("__builtin_va_list");
+      parser->parse();
+      log << *diag;
+      if (diag->count(qcp::DiagnosticMessage::Kind::ERROR)) {
+         failed = true;
+      } else if (!program) {
+         programDiag = std::move(diag);
+         program = std::move(parser);
+      } else if (!failed && !program->getEmitter().linkIn(parser->getEmitter(), log)) {
+         log << "Failed to link '" << filename << "' into the program\n";
+         failed = true;
+      }
+   }
+   if (failed) {
+      return nullptr;
+   }
+
+   std::FILE *tmpf = tmpfile();
+   if (!tmpf) {
+      log << "Failed to open temporary file\n";
+      return nullptr;
+   }
+   auto &emitter = program->getEmitter();
+   emitter.internalize(cfg.exports);
+   emitter.writeToObjFile(fileno(tmpf));
+   return tmpf;
+}
+// ---------------------------------------------------------------------------
+// --run: compiles the file in memory and runs it, only returns if the program could not be started
+int runFile(const std::string &filename, const ParserConfig &cfg, const std::vector<char *> &programArgs, std::ostream &log) {
+   bool fromStdin = filename == "-";
+   // the cache key covers the whole input, so it is read before it is parsed
+   std::string source{};
+   if (!readSource(filename, cfg, source, log)) {
+      return 1;
+   }
+
+   std::vector<char *> args{const_cast<char *>(filename.c_str())};
+   args.insert(args.end(), programArgs.begin(), programArgs.end());
+
+   if (cfg.bytecodeBackend) {
+      // the JIT parses the input again if the BytecodeEmitter cannot run it
+      std::ostringstream bytecodeLog{};
+      qcp::DiagnosticTracker diag{fromStdin ? "<stdin>" : filename, source, bytecodeLog};
+      qcp::Parser<qcp::emitter::BytecodeEmitter> parser{source, diag, std::cout};
+      parser.addIntTypeDef("__builtin_va_list");
+      parser.parse();
+
+      auto &emitter = parser.getEmitter();
+      if (emitter.supported() || diag.count(qcp::DiagnosticMessage::Kind::ERROR)) {
+         log << bytecodeLog.str() << diag;
+         if (diag.count(qcp::DiagnosticMessage::Kind::ERROR)) {
+            return 1;
+         }
+         std::cout.flush();
+         auto status = emitter.run(std::move(args), log);
+         if (!status) {
+            return 1;
+         }
+         std::exit(*status);
+      }
+   }
+
+   // the first tier is generated as fast as possible, -O applies to hot functions
+   qcp::emitter::LLVMEmitter::Options emitterOptions = cfg.emitterOptions;
+   emitterOptions.optLevel = qcp::emitter::LLVMEmitter::Options::OptLevel::O0;
+   emitterOptions.passes.clear();
+   qcp::DiagnosticTracker diag{fromStdin ? "<stdin>" : filename, source, log};
+   Parser parser{source, diag, std::cout, emitterOptions};
+   parser.addIntTypeDef("__builtin_va_list");
+   parser.parse();
+   log << diag;
+   if (diag.count(qcp::DiagnosticMessage::Kind::ERROR)) {
+      return 1;
+   }
+
+   qcp::JIT::Options options{.hot = cfg.emitterOptions};
+   if (options.hot.optLevel == qcp::emitter::LLVMEmitter::Options::OptLevel::O0 && options.hot.passes.empty()) {
+      options.hot.optLevel = qcp::emitter::LLVMEmitter::Options::OptLevel::O2;
+   }
+   if (cfg.cache) {
+      options.cache = cfg.cache;
+      options.cacheKey = cacheKey(cfg).add("run").add(source).hex();
+   }
+   qcp::JIT jit{std::move(options)};
+   if (!jit.load(parser.getEmitter().takeModule(), log)) {
+      return 1;
+   }
+
+   std::cout.flush();
+   auto status = jit.run(std::move(args), log);
+   if (!status) {
+      return 1;
+   }
+   // like a return from main in C, so that the atexit handlers of the program run while its code is still loaded
+   std::exit(*status);
 }
 // ---------------------------------------------------------------------------
 #define NOT_BOTH_OPTS(repx, x, repy, y)\
@@ -166,28 +727,110 @@ cleanup:
       return 1; \
    }
 // ---------------------------------------------------------------------------
-int main(int argc, char **argv) {
+// -march=, -mcpu= and -mattr= are gcc-style long options with a single dash, getopt cannot parse them.
+// returns the remaining arguments
+std::vector<char *> parseTargetOptions(int argc, char **argv, qcp::emitter::LLVMEmitter::Options &options) {
+   std::vector<char *> args{};
+   std::string_view cpu{};
+   std::string attrs{};
+   for (int i = 0; i < argc; ++i) {
+      std::string_view arg = argv[i];
+      if (i > 0 && (arg.starts_with("-march=") || arg.starts_with("-mcpu="))) {
+         cpu = arg.substr(arg.find('=') + 1);
+      } else if (i > 0 && arg.starts_with("-mattr=")) {
+         // bare feature names are enabled
+         std::istringstream is{std::string(arg.substr(7))};
+         for (std::string attr; std::getline(is, attr, ',');) {
+            if (!attr.empty()) {
+               attrs += ',' + (attr[0] == '+' || attr[0] == '-' ? attr : '+' + attr);
+            }
+         }
+      } else {
+         args.push_back(argv[i]);
+      }
+   }
+
+   if (cpu == "native") {
+      options.cpu = qcp::emitter::LLVMEmitter::hostCPU();
+      options.features = qcp::emitter::LLVMEmitter::hostFeatures();
+   } else if (!cpu.empty()) {
+      options.cpu = cpu;
+   }
+   // later features take precedence
+   options.features += attrs;
+   if (options.features.starts_with(',')) {
+      options.features.erase(0, 1);
+   }
+   return args;
+}
+// ---------------------------------------------------------------------------
+// with --run, the arguments after -- belong to the program. returns them and removes them from argv
+std::vector<char *> splitProgramArgs(int &argc, char **argv) {
+   bool run = false;
+   for (int i = 1; i < argc; ++i) {
+      if (std::strcmp(argv[i], "--run") == 0) {
+         run = true;
+      } else if (std::strcmp(argv[i], "--") == 0 && run) {
+         std::vector<char *> programArgs(argv + i + 1, argv + argc);
+         argc = i;
+         return programArgs;
+      } else if (std::strcmp(argv[i], "--") == 0) {
+         break;
+      }
+   }
+   return {};
+}
+// ---------------------------------------------------------------------------
+int runDriver(int argc, char **argv) {
    int EC = 0;
    int c;
    const char *OFName = nullptr;
+   // included files are read once for all translation units
+   qcp::pp::FileCache ppcache{};
+   std::optional<qcp::CompileCache> cache{};
+   std::string cacheDir{};
    ParserConfig cfg = {
-       .pp = "cc -nostdinc -E",
-       .ppargs = "",
-       .OF = "",
+       .pp = "",
+       .ppopts = {},
+       .ppcache = &ppcache,
+       .cache = nullptr,
        .ld = "ld",
        .ldargs = "",
+       .exports = {},
+       .emitterOptions = {},
+       .jobs = 1,
+       .lexThreads = 1,
        .stopAfterPP = false,
        .compileOnly = false,
        .noPP = false,
        .emitBC = false,
-       .emitLLVM = false};
+       .emitLLVM = false,
+       .cacheDirect = false,
+       .directBackend = false,
+       .bytecodeBackend = false,
+       .syntaxOnly = false,
+       .run = false,
+       .wholeProgram = false,
+       .thinLTO = false};
+
+   std::vector<char *> programArgs = splitProgramArgs(argc, argv);
+   std::vector<char *> args = parseTargetOptions(argc, argv, cfg.emitterOptions);
+   if (cfg.emitterOptions.cpu != "generic" && !qcp::emitter::LLVMEmitter::checkCPU(cfg.emitterOptions.cpu)) {
+      std::cerr << "Unknown target CPU '" << cfg.emitterOptions.cpu << "'\n";
+      return 1;
+   }
+   argc = static_cast<int>(args.size());
+   args.push_back(nullptr);
+   argv = args.data();
 
    // process options that affect all files
+   // the compile server runs the driver repeatedly, getopt has to start over
+   optind = 0;
    opterr = 0;
    while (1) {
       int option_index = 0;
 
-      c = getopt_long(argc, argv, "I:U:D:o:Echp", longopts, &option_index);
+      c = getopt_long(argc, argv, optstring, longopts, &option_index);
       if (c == -1) {
          break;
       }
@@ -203,11 +846,12 @@ int main(int argc, char **argv) {
          case 'D':
          case 'U':
          case 'I':
-            cfg.ppargs += " -" + std::string(1, c) + " " + optarg;
+            cfg.ppopts.emplace_back(static_cast<char>(c), optarg);
             break;
 
          case 'E':
             NOT_BOTH_OPTS("E", cfg.stopAfterPP, "c", cfg.compileOnly);
+            NOT_BOTH_OPTS("E", true, "fsyntax-only", cfg.syntaxOnly);
             cfg.stopAfterPP = 1;
             break;
 
@@ -236,6 +880,19 @@ int main(int argc, char **argv) {
             cfg.emitLLVM = 1;
             break;
 
+         case 'f':
+            if (std::string_view{optarg} == "lto=thin") {
+               cfg.thinLTO = 1;
+               break;
+            }
+            if (std::string_view{optarg} != "syntax-only") {
+               std::cerr << "Unknown option '-f" << optarg << "'\n";
+               return 1;
+            }
+            NOT_BOTH_OPTS("fsyntax-only", true, "E", cfg.stopAfterPP);
+            cfg.syntaxOnly = 1;
+            break;
+
          case 'c':
             NOT_BOTH_OPTS("c", cfg.compileOnly, "E", cfg.stopAfterPP);
             if (cfg.compileOnly) {
@@ -252,16 +909,160 @@ int main(int argc, char **argv) {
             OFName = optarg;
             break;
 
+         case 'j':
+            cfg.jobs = static_cast<unsigned>(std::strtoul(optarg, nullptr, 10));
+            if (cfg.jobs == 0) {
+               cfg.jobs = std::max(1u, std::thread::hardware_concurrency());
+            }
+            break;
+
+         case 'O': {
+            using OptLevel = qcp::emitter::LLVMEmitter::Options::OptLevel;
+            std::string_view level = optarg ? optarg : "1";
+            if (level == "0") {
+               cfg.emitterOptions.optLevel = OptLevel::O0;
+            } else if (level == "1") {
+               cfg.emitterOptions.optLevel = OptLevel::O1;
+            } else if (level == "2") {
+               cfg.emitterOptions.optLevel = OptLevel::O2;
+            } else if (level == "3") {
+               cfg.emitterOptions.optLevel = OptLevel::O3;
+            } else if (level == "s") {
+               cfg.emitterOptions.optLevel = OptLevel::Os;
+            } else if (level == "z") {
+               cfg.emitterOptions.optLevel = OptLevel::Oz;
+            } else {
+               std::cerr << "Unknown optimization level '-O" << level << "'\n";
+               return 1;
+            }
+            break;
+         }
+
+         case OPT_PASSES:
+            if (auto error = qcp::emitter::LLVMEmitter::checkPasses(optarg)) {
+               std::cerr << "Invalid pass pipeline '" << optarg << "': " << *error << '\n';
+               return 1;
+            }
+            cfg.emitterOptions.passes = optarg;
+            break;
+
+         case OPT_VERIFY:
+            cfg.emitterOptions.verify = true;
+            break;
+
+         case OPT_BACKGROUND_PASSES:
+            cfg.emitterOptions.backgroundPasses = true;
+            break;
+
+         case OPT_BACKEND:
+            cfg.directBackend = 0;
+            cfg.bytecodeBackend = 0;
+            if (std::string_view{optarg} == "direct") {
+               cfg.directBackend = 1;
+            } else if (std::string_view{optarg} == "bytecode") {
+               cfg.bytecodeBackend = 1;
+            } else if (std::string_view{optarg} != "llvm") {
+               std::cerr << "Unknown backend '" << optarg << "'\n";
+               return 1;
+            }
+            break;
+
+         case OPT_RUN:
+            cfg.run = 1;
+            break;
+
+         case OPT_WHOLE_PROGRAM:
+            cfg.wholeProgram = 1;
+            break;
+
+         case OPT_EXPORT:
+            cfg.exports.emplace_back(optarg);
+            break;
+
+         case OPT_STREAM_BC:
+            cfg.emitterOptions.streamBitcode = true;
+            break;
+
+         case OPT_CODEGEN_THREADS:
+            cfg.emitterOptions.codegenThreads = static_cast<unsigned>(std::strtoul(optarg, nullptr, 10));
+            if (cfg.emitterOptions.codegenThreads == 0) {
+               cfg.emitterOptions.codegenThreads = std::max(1u, std::thread::hardware_concurrency());
+            }
+            break;
+
+         case OPT_LEX_THREADS:
+            cfg.lexThreads = static_cast<unsigned>(std::strtoul(optarg, nullptr, 10));
+            if (cfg.lexThreads == 0) {
+               cfg.lexThreads = std::max(1u, std::thread::hardware_concurrency());
+            }
+            break;
+
+         case OPT_CACHE_DIRECT:
+            cfg.cacheDirect = 1;
+            [[fallthrough]];
+         case OPT_CACHE:
+            if (cacheDir.empty()) {
+               cacheDir = qcp::CompileCache::defaultDir();
+            }
+            break;
+
+         case OPT_CACHE_DIR:
+            cacheDir = optarg;
+            break;
+
          default:
             break;
       }
    }
 
+   if (cfg.directBackend && (cfg.emitBC || cfg.emitLLVM)) {
+      std::cerr << "'--backend=direct' only writes object files, cannot use it with '" << (cfg.emitBC ? "-b" : "--emit-llvm") << "'\n";
+      return 1;
+   }
+   // the direct backend neither optimizes nor uses cpu features
+   if (cfg.directBackend && (cfg.emitterOptions.optLevel != qcp::emitter::LLVMEmitter::Options::OptLevel::O0 || !cfg.emitterOptions.passes.empty())) {
+      std::cerr << "Cannot specify '--backend=direct' with -O1, -O2, -O3, -Os, -Oz or --passes\n";
+      return 1;
+   }
+   if (cfg.directBackend && (cfg.emitterOptions.cpu != "generic" || !cfg.emitterOptions.features.empty())) {
+      std::cerr << "Cannot specify '--backend=direct' with -march, -mcpu or -mattr\n";
+      return 1;
+   }
+   if (cfg.bytecodeBackend && !cfg.run) {
+      std::cerr << "'--backend=bytecode' can only be used with '--run'\n";
+      return 1;
+   }
+   if (cfg.run && (cfg.stopAfterPP || cfg.compileOnly || cfg.syntaxOnly || cfg.emitBC || cfg.emitLLVM || cfg.directBackend || OFName)) {
+      std::cerr << "Cannot specify '--run' with -E, -c, -fsyntax-only, -b, --emit-llvm, --backend=direct or -o\n";
+      return 1;
+   }
+   if (cfg.wholeProgram && (cfg.stopAfterPP || cfg.compileOnly || cfg.syntaxOnly || cfg.emitBC || cfg.emitLLVM || cfg.directBackend || cfg.run)) {
+      std::cerr << "Cannot specify '--whole-program' with -E, -c, -fsyntax-only, -b, --emit-llvm, --backend=direct or --run\n";
+      return 1;
+   }
+   if (cfg.thinLTO && (cfg.emitLLVM || cfg.directBackend || cfg.wholeProgram || cfg.run)) {
+      std::cerr << "Cannot specify '-flto=thin' with --emit-llvm, --backend=direct, --whole-program or --run\n";
+      return 1;
+   }
+   if (cfg.run && cfg.emitterOptions.cpu == "generic" && cfg.emitterOptions.features.empty()) {
+      // the code never leaves this machine
+      cfg.emitterOptions.cpu = qcp::emitter::LLVMEmitter::hostCPU();
+      cfg.emitterOptions.features = qcp::emitter::LLVMEmitter::hostFeatures();
+   }
+   if (!cacheDir.empty()) {
+      cfg.cache = &cache.emplace(cacheDir);
+   }
+   cfg.emitterOptions.linker = cfg.ld;
+   cfg.emitterOptions.thinLTOPreLink = cfg.thinLTO;
+   // names are only kept where someone reads them
+   cfg.emitterOptions.discardValueNames = !cfg.emitLLVM;
+
    if (optind == argc) {
       std::cerr << "No input files\n";
       return 1;
    }
 
+   std::vector<std::unique_ptr<Input>> inputs{};
    std::vector<std::FILE *> OFs{};
 
    // cannot reuse argc and argv because the '-' in the optstring requires optind to be set to zero
@@ -278,22 +1079,36 @@ int main(int argc, char **argv) {
             cfg.ldargs += " -" + std::string(1, c) + " " + optarg;
             break;
 
-         case 1:
-            if (!OFs.empty() && OFName && (cfg.compileOnly || cfg.stopAfterPP)) {
+         case 1: {
+            auto input = std::make_unique<Input>();
+            input->filename = optarg;
+            if (!inputs.empty() && OFName && (cfg.compileOnly || cfg.stopAfterPP)) {
                std::cerr << "Cannot specify '-o' with -c or -E and multiple files\n";
                return 1;
-            } else if (!OFName && (cfg.stopAfterPP || cfg.compileOnly)) {
+            } else if (OFName && (cfg.stopAfterPP || cfg.compileOnly)) {
+               input->OF = OFName;
+            } else if (cfg.stopAfterPP || cfg.compileOnly) {
                const char *ext =
                    cfg.emitBC      ? ".bc" :
-                   cfg.emitBC      ? ".ll" :
+                   cfg.emitLLVM    ? ".ll" :
                    cfg.stopAfterPP ? ".i" :
                                      ".o";
-               cfg.OF = std::filesystem::path(optarg).replace_extension(ext).string();
+               input->OF = std::filesystem::path(optarg).replace_extension(ext).string();
             }
-            if (auto *of = processFile(optarg, cfg)) {
-               OFs.push_back(of);
+            std::string_view ext = std::string_view{optarg}.substr(std::string_view{optarg}.find_last_of('.') + 1);
+            if (cfg.thinLTO && !cfg.compileOnly && !cfg.stopAfterPP && !cfg.syntaxOnly && (ext == "o" || ext == "bc")) {
+               input->bitcode = true;
+               input->native = !qcp::ThinLTO::isBitcode(optarg);
+               // the linker reads native objects through /dev/fd, bitcode is only read here
+               input->result = std::fopen(optarg, input->native ? "r" : "re");
+               if (!input->result) {
+                  std::cerr << "Failed to open '" << optarg << "'\n";
+                  EC = 1;
+               }
             }
+            inputs.push_back(std::move(input));
             break;
+         }
 
          case '?':
             // todo:
@@ -317,7 +1132,94 @@ int main(int argc, char **argv) {
       goto cleanup;
    }
 
-   if (!cfg.compileOnly && !cfg.stopAfterPP) {
+   if (cfg.jobs > 1 && inputs.size() > 1) {
+      // files compiled in parallel share the cores with their partitions
+      unsigned files = std::min(cfg.jobs, static_cast<unsigned>(inputs.size()));
+      cfg.emitterOptions.codegenWorkers = std::max(1u, std::thread::hardware_concurrency() / files);
+   }
+
+   if (cfg.run) {
+      if (inputs.size() != 1) {
+         std::cerr << "'--run' takes exactly one file\n";
+         return 1;
+      }
+      return runFile(inputs[0]->filename, cfg, programArgs, std::cerr);
+   }
+
+   if (cfg.wholeProgram) {
+      if (std::FILE *result = compileWholeProgram(inputs, cfg, std::cerr)) {
+         OFs.push_back(result);
+      } else {
+         EC = 1;
+         goto cleanup;
+      }
+   } else if (cfg.jobs <= 1 || inputs.size() <= 1) {
+      for (auto &input : inputs) {
+         if (!input->bitcode) {
+            input->result = processFile(input->filename, input->OF, cfg, std::cerr, input->hasErrors);
+         }
+      }
+   } else {
+      // every job has its own parser and emitter, only the output order is shared
+      std::vector<std::future<void>> done;
+      done.reserve(inputs.size());
+      {
+         qcp::WorkerPool pool{std::min(cfg.jobs, static_cast<unsigned>(inputs.size()))};
+         for (auto &input : inputs) {
+            auto task = std::make_shared<std::packaged_task<void()>>([&cfg, &input] {
+               if (!input->bitcode) {
+                  input->result = processFile(input->filename, input->OF, cfg, input->log, input->hasErrors);
+               }
+            });
+            done.push_back(task->get_future());
+            pool.run([task] { (*task)(); });
+         }
+         // report diagnostics in input order while the remaining files compile
+         for (std::size_t i = 0; i < inputs.size(); ++i) {
+            done[i].wait();
+            std::cerr << inputs[i]->log.str();
+         }
+      }
+   }
+   for (auto &input : inputs) {
+      if (input->result) {
+         OFs.push_back(input->result);
+      }
+      if (input->hasErrors) {
+         EC = 1;
+      }
+   }
+
+   if (cfg.thinLTO && !cfg.compileOnly && !cfg.stopAfterPP && !cfg.syntaxOnly) {
+      // the bitcode files are replaced by the objects of the backends
+      qcp::ThinLTO lto{{.codegen = cfg.emitterOptions, .threads = cfg.jobs, .cacheDir = cfg.cache ? cacheDir + "/thinlto" : "", .exports = cfg.exports}};
+      bool added = EC == 0;
+      std::vector<std::FILE *> natives{};
+      for (auto &input : inputs) {
+         if (input->native && input->result) {
+            natives.push_back(input->result);
+         } else if (added && input->result) {
+            added = lto.add(fileno(input->result), input->filename, std::cerr);
+         }
+      }
+      std::optional<std::vector<std::FILE *>> objects{};
+      if (added) {
+         objects = lto.run(std::cerr);
+      }
+      for (auto *of : OFs) {
+         if (std::find(natives.begin(), natives.end(), of) == natives.end()) {
+            std::fclose(of);
+         }
+      }
+      OFs = std::move(natives);
+      if (!objects) {
+         EC = 1;
+         goto cleanup;
+      }
+      OFs.insert(OFs.begin(), objects->begin(), objects->end());
+   }
+
+   if (!cfg.compileOnly && !cfg.stopAfterPP && !cfg.syntaxOnly) {
       if (!OFName) {
          OFName = "a.out";
       }
@@ -337,3 +1239,73 @@ cleanup:
    return EC;
 }
 // ---------------------------------------------------------------------------
+// the options the client acts on. they are parsed with the driver's table, so every spelling
+// of an option that turns on the cache is seen
+struct ClientOptions {
+   bool run = false;
+   // the cache is used without --cache-dir
+   bool defaultCacheDir = false;
+};
+// ---------------------------------------------------------------------------
+ClientOptions parseClientOptions(std::vector<char *> args) {
+   ClientOptions options{};
+   bool cache = false;
+   bool cacheDir = false;
+   int argc = static_cast<int>(args.size());
+   args.push_back(nullptr);
+   optind = 0;
+   opterr = 0;
+   int c;
+   while ((c = getopt_long(argc, args.data(), optstring, longopts, nullptr)) != -1) {
+      options.run |= c == OPT_RUN;
+      cache |= c == OPT_CACHE || c == OPT_CACHE_DIRECT;
+      cacheDir |= c == OPT_CACHE_DIR;
+   }
+   options.defaultCacheDir = cache && !cacheDir;
+   return options;
+}
+// ---------------------------------------------------------------------------
+int main(int argc, char **argv) {
+   // the mode switches are not seen by the driver
+   bool server = false;
+   bool connect = std::getenv("QCP_SERVER") != nullptr;
+   std::vector<char *> args{};
+   for (int i = 0; i < argc; ++i) {
+      if (i > 0 && std::strcmp(argv[i], "--server") == 0) {
+         server = true;
+      } else if (i > 0 && std::strcmp(argv[i], "--connect") == 0) {
+         connect = true;
+      } else {
+         args.push_back(argv[i]);
+      }
+   }
+   // the program of --run must not run in the server
+   ClientOptions client = parseClientOptions(args);
+   // the server would pick the default cache directory from its own environment
+   std::string cacheDirArg{};
+   if (connect && !client.run && !server && client.defaultCacheDir) {
+      cacheDirArg = "--cache-dir=" + qcp::CompileCache::defaultDir();
+      args.insert(args.begin() + 1, cacheDirArg.data());
+   }
+   int nargs = static_cast<int>(args.size());
+   args.push_back(nullptr);
+
+   if (server) {
+      qcp::CompileServer srv{qcp::CompileServer::defaultSocketPath(), runDriver};
+      if (!srv.listen(std::cerr)) {
+         return 1;
+      }
+      // pay for the target setup before the first job arrives
+      qcp::emitter::LLVMEmitter::prepareTarget();
+      srv.run();
+      return 0;
+   }
+   if (connect && !client.run) {
+      // without a server the job runs in this process
+      if (auto EC = qcp::CompileServer::forward(qcp::CompileServer::defaultSocketPath(), nargs, args.data())) {
+         return *EC;
+      }
+   }
+   return runDriver(nargs, args.data());
+}
+// ---------------------------------------------------------------------------
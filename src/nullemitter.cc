@@ -0,0 +1,225 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "nullemitter.h"
+#include "basetype.h"
+#include "constantfolding.h"
+#include "operator.h"
+#include "type.h"
+#include "typefactory.h"
+// ---------------------------------------------------------------------------
+#include <algorithm>
+// ---------------------------------------------------------------------------
+namespace qcp {
+namespace emitter {
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+std::uint64_t alignTo(std::uint64_t value, std::uint64_t align) {
+   return (value + align - 1) / align * align;
+}
+// ---------------------------------------------------------------------------
+bool isSigned(NullEmitter::Type ty) {
+   return ty->isSignedTy() || ty->isSignedCharlikeTy();
+}
+// ---------------------------------------------------------------------------
+double fpValue(const NullEmitter::Constant *c) {
+   return c->kind == NullEmitter::Constant::Kind::FP ? c->fp : static_cast<double>(signExtend(c->value, c->ty->bits));
+}
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+NullEmitter::NullEmitter([[maybe_unused]] const Options &options) {}
+// ---------------------------------------------------------------------------
+typename NullEmitter::Ty *NullEmitter::newTy(Ty ty) {
+   return &tys_.emplace_back(ty);
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::ConstantInt *NullEmitter::newInt(Ty *ty, std::uint64_t value) {
+   // the parser compares integer constants by address, like LLVM they are unique
+   value = truncate(value, ty->bits);
+   auto [it, inserted] = uniqueInts_.try_emplace({ty, value}, nullptr);
+   if (inserted) {
+      ConstantInt &c = ints_.emplace_back();
+      c.ty = ty;
+      c.kind = Constant::Kind::INT;
+      c.value = value;
+      it->second = &c;
+   }
+   return it->second;
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::Constant *NullEmitter::newFP(Ty *ty, double value) {
+   Constant &c = constants_.emplace_back();
+   c.ty = ty;
+   c.kind = Constant::Kind::FP;
+   c.fp = ty->bits == 32 ? static_cast<float>(value) : value;
+   return &c;
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::Constant *NullEmitter::asConstant(const const_or_iconst_t &value) {
+   if (const_t *const *c = std::get_if<const_t *>(&value)) {
+      return *c;
+   } else if (iconst_t *const *ic = std::get_if<iconst_t *>(&value)) {
+      return *ic;
+   }
+   return &address_;
+}
+// ---------------------------------------------------------------------------
+long long NullEmitter::getIntegerValue(iconst_t *c) {
+   return signExtend(c->value, c->ty->bits);
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::iconst_t *NullEmitter::sizeOf(Type ty) {
+   Ty *t = ty;
+   return newInt(emitIntTy(64), t ? t->size : 0);
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::ty_t *NullEmitter::emitIntTy(unsigned bits) {
+   bits = std::min(bits, 64u);
+   if (!intTys_[bits]) {
+      // the x86-64 System V layout, bool takes a byte
+      std::uint64_t size = std::max(1u, (bits + 7) / 8);
+      intTys_[bits] = newTy({.kind = Ty::Kind::INT, .bits = bits, .size = size, .align = size});
+   }
+   return intTys_[bits];
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::ty_t *NullEmitter::emitArrayTy(Type ty, iconst_t *size) {
+   Ty *elem = ty;
+   if (!elem) {
+      return newTy({.kind = Ty::Kind::AGGREGATE, .count = size->value});
+   }
+   return newTy({.kind = Ty::Kind::AGGREGATE, .size = elem->size * size->value, .align = elem->align, .count = size->value});
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::ty_t *NullEmitter::emitStructTy(std::span<const Type> tys, [[maybe_unused]] bool incomplete, [[maybe_unused]] Ident name) {
+   Ty ty{.kind = Ty::Kind::AGGREGATE};
+   for (const Type &member : tys) {
+      Ty *m = member;
+      if (!m) {
+         continue;
+      }
+      ty.size = alignTo(ty.size, m->align) + m->size;
+      ty.align = std::max(ty.align, m->align);
+   }
+   ty.size = alignTo(ty.size, ty.align);
+   return newTy(ty);
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::ty_t *NullEmitter::emitFnTy([[maybe_unused]] Type retTy, [[maybe_unused]] std::vector<Type> argTys, [[maybe_unused]] bool isVarArgFnTy) {
+   // like LLVM, sizeof a function is 1
+   return newTy({.kind = Ty::Kind::FN, .size = 1});
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::fn_t *NullEmitter::emitFnProto(Type fnTy, [[maybe_unused]] bool alwaysInline, [[maybe_unused]] bool noReturn, [[maybe_unused]] Ident name) {
+   return &fns_.emplace_back(Function{fnTy});
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::bb_t *NullEmitter::emitFn(fn_t *fnProto) {
+   fnProto->hasBody = true;
+   return emitBB(fnProto);
+}
+// ---------------------------------------------------------------------------
+bool NullEmitter::isFnProto(fn_t *fn) {
+   return !fn->hasBody;
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::iconst_t *NullEmitter::emitIConst(Type ty, unsigned long value) {
+   return newInt(ty, value);
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::const_t *NullEmitter::emitFPConst(Type ty, double value) {
+   return newFP(ty, value);
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::const_or_iconst_t NullEmitter::emitZeroConst(Type ty) {
+   Ty *t = ty;
+   if (t->kind == Ty::Kind::INT) {
+      return newInt(t, 0);
+   } else if (t->kind == Ty::Kind::FP) {
+      return newFP(t, 0);
+   }
+   return &address_;
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::const_or_iconst_t NullEmitter::emitConstBinOp([[maybe_unused]] bb_t *bb, Type ty, op::Kind kind, const_or_iconst_t lhs, const_or_iconst_t rhs, [[maybe_unused]] Ident name) {
+   Constant *l = asConstant(lhs);
+   Constant *r = asConstant(rhs);
+   Ty *t = ty;
+   if (l->kind == Constant::Kind::OTHER || r->kind == Constant::Kind::OTHER) {
+      return &address_;
+   }
+   op::Kind assignOp = decomposeAssignOp(kind);
+   kind = assignOp != op::Kind::END ? assignOp : kind;
+   if (t->kind == Ty::Kind::FP) {
+      std::optional<double> result = foldFPBinOp(kind, fpValue(l), fpValue(r));
+      if (!result) {
+         return &address_;
+      } else if (op::isComparisonOp(kind)) {
+         return newInt(emitIntTy(1), *result != 0);
+      }
+      return newFP(t, *result);
+   }
+   // division by zero and overlong shifts are not constants
+   std::optional<std::uint64_t> result = foldIntBinOp(kind, l->value, r->value, t->bits, isSigned(ty));
+   if (!result) {
+      return &address_;
+   }
+   return newInt(op::isComparisonOp(kind) ? emitIntTy(1) : t, *result);
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::const_or_iconst_t NullEmitter::emitConstNeg([[maybe_unused]] bb_t *bb, [[maybe_unused]] Type ty, const_or_iconst_t operand, [[maybe_unused]] Ident name) {
+   Constant *c = asConstant(operand);
+   if (c->kind == Constant::Kind::FP) {
+      return newFP(c->ty, -c->fp);
+   } else if (c->kind == Constant::Kind::INT) {
+      return newInt(c->ty, 0 - c->value);
+   }
+   return &address_;
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::const_or_iconst_t NullEmitter::emitConstBWNeg([[maybe_unused]] bb_t *bb, [[maybe_unused]] Type ty, const_or_iconst_t operand, [[maybe_unused]] Ident name) {
+   Constant *c = asConstant(operand);
+   if (c->kind == Constant::Kind::INT) {
+      return newInt(c->ty, ~c->value);
+   }
+   return &address_;
+}
+// ---------------------------------------------------------------------------
+typename NullEmitter::const_or_iconst_t NullEmitter::emitConstCast([[maybe_unused]] bb_t *bb, [[maybe_unused]] Type fromTy, const_or_iconst_t val, Type toTy, qcp::type::Cast cast) {
+   Constant *c = asConstant(val);
+   Ty *to = toTy;
+   if (c->kind == Constant::Kind::FP) {
+      switch (cast) {
+         case qcp::type::Cast::FPTRUNC:
+         case qcp::type::Cast::FPEXT:
+            return newFP(to, c->fp);
+         case qcp::type::Cast::FPTOSI:
+         case qcp::type::Cast::FPTOUI:
+            return newInt(to, static_cast<std::uint64_t>(static_cast<std::int64_t>(c->fp)));
+         default:
+            return &address_;
+      }
+   } else if (c->kind != Constant::Kind::INT) {
+      return &address_;
+   }
+   switch (cast) {
+      case qcp::type::Cast::TRUNC:
+      case qcp::type::Cast::ZEXT:
+         return newInt(to, c->value);
+      case qcp::type::Cast::SEXT:
+         return newInt(to, static_cast<std::uint64_t>(signExtend(c->value, c->ty->bits)));
+      case qcp::type::Cast::UITOFP:
+         return newFP(to, static_cast<double>(c->value));
+      case qcp::type::Cast::SITOFP:
+         return newFP(to, static_cast<double>(signExtend(c->value, c->ty->bits)));
+      default:
+         // casts from and to pointers are address constants
+         return &address_;
+   }
+}
+// ---------------------------------------------------------------------------
+} // namespace emitter
+} // namespace qcp
+// ---------------------------------------------------------------------------
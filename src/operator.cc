@@ -66,9 +66,9 @@ bool isArithmeticBinOp(op::Kind op) {
 // ---------------------------------------------------------------------------
 std::ostream& operator<<(std::ostream& os, const Kind& kind) {
    static const char* names[] = {
-#define ENUM_AS_STRING
+#define ENUM_AS_NAME
 #include "defs/operators.def"
-#undef ENUM_AS_STRING
+#undef ENUM_AS_NAME
    };
    return os << names[static_cast<int>(kind)];
 }
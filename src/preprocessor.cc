@@ -0,0 +1,1562 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "preprocessor.h"
+// ---------------------------------------------------------------------------
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// ---------------------------------------------------------------------------
+namespace qcp {
+namespace pp {
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+constexpr unsigned MAX_INCLUDE_DEPTH = 200;
+// ---------------------------------------------------------------------------
+// longest punctuators first
+constexpr std::string_view PUNCTUATORS[] = {
+    "%:%:", "...", "<<=", ">>=", "->", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "*=", "/=",
+    "%=", "+=", "-=", "&=", "^=", "|=", "##", "::", "<:", ":>", "<%", "%>", "%:"};
+// ---------------------------------------------------------------------------
+constexpr std::string_view PREDEFINED[] = {
+    "__STDC__ 1",
+    "__STDC_VERSION__ 202311L",
+    "__STDC_HOSTED__ 1",
+    "__qcp__ 1",
+    "__x86_64__ 1",
+    "__x86_64 1",
+    "__amd64__ 1",
+    "__amd64 1",
+    "__linux__ 1",
+    "__linux 1",
+    "__gnu_linux__ 1",
+    "__unix__ 1",
+    "__unix 1",
+    "__ELF__ 1",
+    "__LP64__ 1",
+    "_LP64 1",
+    "__CHAR_BIT__ 8",
+    "__SIZEOF_SHORT__ 2",
+    "__SIZEOF_INT__ 4",
+    "__SIZEOF_LONG__ 8",
+    "__SIZEOF_LONG_LONG__ 8",
+    "__SIZEOF_POINTER__ 8",
+    "__SIZEOF_FLOAT__ 4",
+    "__SIZEOF_DOUBLE__ 8",
+    "__SIZEOF_LONG_DOUBLE__ 8", // long double is a double
+    "__SCHAR_MAX__ 0x7f",
+    "__SHRT_MAX__ 0x7fff",
+    "__INT_MAX__ 0x7fffffff",
+    "__LONG_MAX__ 0x7fffffffffffffffL",
+    "__LONG_LONG_MAX__ 0x7fffffffffffffffLL",
+    "__SIZE_MAX__ 0xffffffffffffffffUL",
+    "__SIZE_TYPE__ long unsigned int",
+    "__PTRDIFF_TYPE__ long int",
+    "__WCHAR_TYPE__ int",
+    "__INTMAX_TYPE__ long int",
+    "__UINTMAX_TYPE__ long unsigned int",
+    "__INTPTR_TYPE__ long int",
+    "__UINTPTR_TYPE__ long unsigned int",
+    "__ORDER_LITTLE_ENDIAN__ 1234",
+    "__ORDER_BIG_ENDIAN__ 4321",
+    "__BYTE_ORDER__ __ORDER_LITTLE_ENDIAN__",
+};
+// ---------------------------------------------------------------------------
+bool isIdentStart(char c) {
+   return std::isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '$' || (c & 0x80);
+}
+// ---------------------------------------------------------------------------
+bool isIdentCont(char c) {
+   return isIdentStart(c) || std::isdigit(static_cast<unsigned char>(c));
+}
+// ---------------------------------------------------------------------------
+bool isDigit(char c) {
+   return c >= '0' && c <= '9';
+}
+// ---------------------------------------------------------------------------
+bool isSpace(char c) {
+   return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+// ---------------------------------------------------------------------------
+// length of the pp-number starting at s[i]
+std::size_t ppNumberLength(std::string_view s, std::size_t i) {
+   std::size_t start = i++;
+   while (i < s.size()) {
+      char c = s[i];
+      if ((c == '+' || c == '-') && std::strchr("eEpP", s[i - 1])) {
+         ++i;
+      } else if (isIdentCont(c) || c == '.') {
+         ++i;
+      } else if (c == '\'' && i + 1 < s.size() && isIdentCont(s[i + 1])) {
+         i += 2;
+      } else {
+         break;
+      }
+   }
+   return i - start;
+}
+// ---------------------------------------------------------------------------
+// length of the string or character literal starting with the quote at s[i]
+std::size_t quotedLength(std::string_view s, std::size_t i) {
+   char quote = s[i];
+   std::size_t start = i++;
+   while (i < s.size() && s[i] != quote) {
+      if (s[i] == '\\' && i + 1 < s.size()) {
+         ++i;
+      }
+      ++i;
+   }
+   return std::min(i + 1, s.size()) - start;
+}
+// ---------------------------------------------------------------------------
+std::size_t punctuatorLength(std::string_view s) {
+   for (std::string_view p : PUNCTUATORS) {
+      if (s.starts_with(p)) {
+         return p.size();
+      }
+   }
+   return 1;
+}
+// ---------------------------------------------------------------------------
+bool isPunctuator(std::string_view s) {
+   return s.size() == 1 || std::find(std::begin(PUNCTUATORS), std::end(PUNCTUATORS), s) != std::end(PUNCTUATORS);
+}
+// ---------------------------------------------------------------------------
+void appendEscaped(std::string& res, std::string_view s) {
+   for (char c : s) {
+      if (c == '"' || c == '\\') {
+         res += '\\';
+      }
+      res += c;
+   }
+}
+// ---------------------------------------------------------------------------
+std::string quote(std::string_view s) {
+   std::string res = "\"";
+   appendEscaped(res, s);
+   return res + '"';
+}
+// ---------------------------------------------------------------------------
+std::string dirName(const std::string& path) {
+   std::string dir = std::filesystem::path(path).parent_path().string();
+   return dir.empty() ? "." : dir;
+}
+// ---------------------------------------------------------------------------
+// values of #if expressions
+struct Value {
+   std::uint64_t v;
+   bool isUnsigned;
+};
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+std::shared_ptr<const FileCache::File> FileCache::get(const std::string& path) {
+   struct stat st;
+   if (::stat(path.c_str(), &st) || !S_ISREG(st.st_mode)) {
+      return nullptr;
+   }
+   std::int64_t mtime = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+   {
+      std::lock_guard lock{mutex_};
+      auto it = entries_.find(path);
+      if (it != entries_.end() && it->second.file->mtime == mtime && it->second.file->size == st.st_size) {
+         return it->second.file;
+      }
+   }
+
+   int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      return nullptr;
+   }
+   auto file = read(fd, path);
+   ::close(fd);
+   if (!file) {
+      return nullptr;
+   }
+   file->mtime = mtime;
+   file->size = st.st_size;
+
+   std::lock_guard lock{mutex_};
+   entries_[path] = Entry{file, std::nullopt};
+   return file;
+}
+// ---------------------------------------------------------------------------
+std::shared_ptr<FileCache::File> FileCache::read(int fd, std::string path) {
+   auto file = std::make_shared<File>(File{std::move(path), {}, 0, 0});
+   std::size_t size = 0;
+   while (true) {
+      if (file->contents.size() - size < 4096) {
+         file->contents.resize(std::max<std::size_t>(file->contents.size() * 2, 64 * 1024));
+      }
+      ssize_t n = ::read(fd, file->contents.data() + size, file->contents.size() - size);
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n < 0) {
+         return nullptr;
+      }
+      if (n == 0) {
+         break;
+      }
+      size += static_cast<std::size_t>(n);
+   }
+   file->contents.resize(size);
+   return file;
+}
+// ---------------------------------------------------------------------------
+std::optional<std::string> FileCache::guard(const std::shared_ptr<const File>& file) {
+   std::lock_guard lock{mutex_};
+   auto it = entries_.find(file->path);
+   if (it == entries_.end() || it->second.file != file) {
+      return std::nullopt;
+   }
+   return it->second.guard;
+}
+// ---------------------------------------------------------------------------
+void FileCache::setGuard(const std::shared_ptr<const File>& file, std::string macro) {
+   std::lock_guard lock{mutex_};
+   auto it = entries_.find(file->path);
+   if (it != entries_.end() && it->second.file == file) {
+      it->second.guard = std::move(macro);
+   }
+}
+// ---------------------------------------------------------------------------
+Preprocessor::Preprocessor(FileCache& cache, std::ostream& log) : cache_{cache}, log_{log} {
+   for (std::string_view def : PREDEFINED) {
+      std::size_t space = def.find(' ');
+      define(std::string(def.substr(0, space)) + '=' + std::string(def.substr(space + 1)));
+   }
+
+   std::time_t now = std::time(nullptr);
+   std::tm tm;
+   localtime_r(&now, &tm);
+   char buf[32];
+   std::strftime(buf, sizeof(buf), "\"%b %e %Y\"", &tm);
+   date_ = buf;
+   std::strftime(buf, sizeof(buf), "\"%H:%M:%S\"", &tm);
+   time_ = buf;
+
+   for (auto [name, builtin] : {std::pair{"__FILE__", Macro::Builtin::FILE},
+                                std::pair{"__LINE__", Macro::Builtin::LINE},
+                                std::pair{"__COUNTER__", Macro::Builtin::COUNTER},
+                                std::pair{"__DATE__", Macro::Builtin::DATE},
+                                std::pair{"__TIME__", Macro::Builtin::TIME},
+                                std::pair{"_Pragma", Macro::Builtin::PRAGMA}}) {
+      macros_[name] = Macro{.name = name, .builtin = builtin};
+   }
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::addIncludeDir(std::string dir) {
+   includeDirs_.push_back(std::move(dir));
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::define(std::string_view def) {
+   std::string& line = strings_.emplace_back(def);
+   std::size_t eq = line.find('=');
+   if (eq == std::string::npos) {
+      line += " 1";
+   } else {
+      line[eq] = ' ';
+   }
+   TokenList tokens;
+   lexLine(line, tokens);
+   handleDefine(tokens, 0, 0);
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::undefine(std::string_view name) {
+   if (auto it = macros_.find(name); it != macros_.end()) {
+      macros_.erase(it);
+   }
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::run(const std::string& filename, std::string& out) {
+   auto file = cache_.get(filename);
+   if (!file) {
+      log_ << "Failed to open file '" << filename << "'\n";
+      return false;
+   }
+   return run(std::move(file), out);
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::run(std::shared_ptr<const FileCache::File> file, std::string& out) {
+   out_ = &out;
+   outLine_ = 1;
+   errors_ = 0;
+   std::string name = file->path;
+   pushSource(std::move(file), std::move(name), includeDirs_.size());
+
+   TokenList tokens;
+   std::deque<Token> in;
+   while (!sources_.empty()) {
+      Source& src = sources_.back();
+      std::string_view line;
+      unsigned firstLine;
+      if (!readLine(src, line, firstLine)) {
+         popSource();
+         continue;
+      }
+      currentLine_ = firstLine;
+
+      // fast path for lines in skipped groups: only directives matter
+      bool active = conds_.empty() || conds_.back().active;
+      if (!active) {
+         auto first = std::find_if_not(line.begin(), line.end(), isSpace);
+         if (first == line.end() || *first != '#') {
+            continue;
+         }
+      }
+
+      tokens.clear();
+      lexLine(line, tokens);
+      if (tokens.empty()) {
+         continue;
+      }
+      if (tokens[0].is("#") || tokens[0].is("%:")) {
+         handleDirective(tokens, firstLine);
+         continue;
+      }
+      invalidateGuard(src);
+
+      in.assign(tokens.begin(), tokens.end());
+      tokens.clear();
+      expand(in, tokens, true);
+      syncLine(firstLine);
+      emitTokens(tokens, line);
+      // invocations of function-like macros may span multiple lines
+      outLine_ = firstLine + 1;
+   }
+
+   out_ = nullptr;
+   return errors_ == 0;
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::pushSource(std::shared_ptr<const FileCache::File> file, std::string name, std::size_t dirIndex) {
+   dependencies_.push_back(file->path);
+   std::string dir = dirName(file->path);
+   sources_.push_back(Source{.file = std::move(file), .name = std::move(name), .dir = std::move(dir), .condDepth = conds_.size(), .dirIndex = dirIndex});
+   emitMarker(1, sources_.size() > 1 ? 1 : 0);
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::popSource() {
+   Source& src = sources_.back();
+   if (conds_.size() > src.condDepth) {
+      error(src.line) << "unterminated conditional directive\n";
+      conds_.resize(src.condDepth);
+   }
+   if (src.guardState == Source::Guard::CLOSED) {
+      cache_.setGuard(src.file, std::string(src.guard));
+   }
+   sources_.pop_back();
+   if (!sources_.empty()) {
+      emitMarker(sources_.back().line, 2);
+   }
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::readLine(Source& src, std::string_view& line, unsigned& firstLine) {
+   std::string_view text = src.file->contents;
+   std::size_t pos = src.pos;
+   if (pos >= text.size()) {
+      return false;
+   }
+   firstLine = src.line;
+
+   std::size_t nl = text.find('\n', pos);
+   std::size_t end = nl == std::string_view::npos ? text.size() : nl;
+   std::string_view physical = text.substr(pos, end - pos);
+
+   // fast path: nothing to splice or strip
+   if (physical.find_first_of("\\/\"'") == std::string_view::npos) {
+      line = physical;
+      src.pos = end + 1;
+      ++src.line;
+      return true;
+   }
+
+   std::string buf;
+   buf.reserve(physical.size());
+   enum { NORMAL,
+          COMMENT,
+          LITERAL } state = NORMAL;
+   char quoteChar = 0;
+   std::size_t i = pos;
+   while (i < text.size()) {
+      char c = text[i];
+      // line splices are removed in every state
+      if (c == '\\' && (text.substr(i + 1, 1) == "\n" || text.substr(i + 1, 2) == "\r\n")) {
+         i += text[i + 1] == '\n' ? 2 : 3;
+         ++src.line;
+         continue;
+      }
+      if (state == COMMENT) {
+         if (c == '*' && i + 1 < text.size() && text[i + 1] == '/') {
+            state = NORMAL;
+            i += 2;
+            continue;
+         }
+         if (c == '\n') {
+            ++src.line;
+         }
+         ++i;
+         continue;
+      }
+      if (c == '\n') {
+         break;
+      }
+      if (state == LITERAL) {
+         buf += c;
+         if (c == '\\' && i + 1 < text.size() && text[i + 1] != '\n') {
+            buf += text[++i];
+         } else if (c == quoteChar) {
+            state = NORMAL;
+         }
+         ++i;
+         continue;
+      }
+      if (c == '/' && i + 1 < text.size() && text[i + 1] == '/') {
+         // skip to the end of the line, splices continue the comment
+         while (i < text.size() && text[i] != '\n') {
+            if (text[i] == '\\' && i + 1 < text.size() && text[i + 1] == '\n') {
+               ++src.line;
+               ++i;
+            }
+            ++i;
+         }
+         buf += ' ';
+         break;
+      }
+      if (c == '/' && i + 1 < text.size() && text[i + 1] == '*') {
+         state = COMMENT;
+         buf += ' ';
+         i += 2;
+         continue;
+      }
+      if (isDigit(c) && (buf.empty() || !isIdentCont(buf.back()))) {
+         // keep digit separators from starting a character literal
+         std::size_t len = ppNumberLength(text, i);
+         std::string_view number = text.substr(i, len);
+         if (number.find('\\') == std::string_view::npos) {
+            buf += number;
+            i += len;
+            continue;
+         }
+      }
+      if (c == '"' || c == '\'') {
+         state = LITERAL;
+         quoteChar = c;
+      }
+      buf += c;
+      ++i;
+   }
+
+   if (state == COMMENT) {
+      error(firstLine) << "unterminated comment\n";
+   }
+   src.pos = i + 1;
+   ++src.line;
+   line = strings_.emplace_back(std::move(buf));
+   return true;
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::lexLine(std::string_view line, TokenList& tokens) {
+   std::size_t i = 0;
+   bool space = false;
+   while (i < line.size()) {
+      char c = line[i];
+      if (isSpace(c)) {
+         space = true;
+         ++i;
+         continue;
+      }
+
+      Token tok{.text = {}, .kind = Token::Kind::PUNCT, .space = space};
+      std::size_t len;
+      if (isIdentStart(c)) {
+         len = std::find_if_not(line.begin() + i, line.end(), isIdentCont) - (line.begin() + i);
+         tok.kind = Token::Kind::IDENT;
+         // encoding prefixes of string and character literals
+         std::string_view ident = line.substr(i, len);
+         if (i + len < line.size() && (line[i + len] == '"' || line[i + len] == '\'') &&
+             (ident == "u8" || ident == "u" || ident == "U" || ident == "L")) {
+            tok.kind = line[i + len] == '"' ? Token::Kind::STRING : Token::Kind::CHAR;
+            len += quotedLength(line, i + len);
+         }
+      } else if (isDigit(c) || (c == '.' && i + 1 < line.size() && isDigit(line[i + 1]))) {
+         len = ppNumberLength(line, i);
+         tok.kind = Token::Kind::NUMBER;
+      } else if (c == '"' || c == '\'') {
+         len = quotedLength(line, i);
+         tok.kind = c == '"' ? Token::Kind::STRING : Token::Kind::CHAR;
+      } else if (std::ispunct(static_cast<unsigned char>(c))) {
+         len = punctuatorLength(line.substr(i));
+      } else {
+         len = 1;
+         tok.kind = Token::Kind::OTHER;
+      }
+      tok.text = line.substr(i, len);
+      tokens.push_back(tok);
+      i += len;
+      space = false;
+   }
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::invalidateGuard(Source& src) {
+   if (src.guardState != Source::Guard::OPEN) {
+      src.guardState = Source::Guard::NONE;
+   }
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::handleDirective(TokenList& tokens, unsigned line) {
+   Source& src = sources_.back();
+   bool active = conds_.empty() || conds_.back().active;
+   if (tokens.size() == 1) {
+      // null directive
+      return;
+   }
+   const Token& name = tokens[1];
+
+   if (name.is("if") || name.is("ifdef") || name.is("ifndef")) {
+      bool cond = false;
+      if (active) {
+         if (name.is("if")) {
+            // #if !defined X and #if !defined(X) are include guards as well
+            if (src.guardState == Source::Guard::START && tokens.size() >= 5 && tokens[2].is("!") && tokens[3].is("defined")) {
+               bool parens = tokens[4].is("(");
+               std::size_t ident = parens ? 5 : 4;
+               if (tokens.size() == ident + 1 + parens && tokens[ident].kind == Token::Kind::IDENT && (!parens || tokens[ident + 1].is(")"))) {
+                  src.guardState = Source::Guard::OPEN;
+                  src.guard = tokens[ident].text;
+               }
+            }
+            if (src.guardState != Source::Guard::OPEN || conds_.size() != src.condDepth) {
+               invalidateGuard(src);
+            }
+            cond = evalCondition(tokens, 2, line);
+         } else if (tokens.size() < 3 || tokens[2].kind != Token::Kind::IDENT) {
+            error(line) << "macro name missing in #" << name.text << '\n';
+            invalidateGuard(src);
+         } else {
+            if (name.is("ifndef") && src.guardState == Source::Guard::START) {
+               src.guardState = Source::Guard::OPEN;
+               src.guard = tokens[2].text;
+            } else if (src.guardState != Source::Guard::OPEN || conds_.size() != src.condDepth) {
+               invalidateGuard(src);
+            }
+            cond = isMacroDefined(tokens[2].text) == name.is("ifdef");
+         }
+      }
+      conds_.push_back(Cond{.active = active && cond, .taken = cond, .parentActive = active});
+      return;
+   }
+
+   if (name.is("elif") || name.is("elifdef") || name.is("elifndef") || name.is("else")) {
+      if (conds_.size() <= src.condDepth) {
+         error(line) << "#" << name.text << " without #if\n";
+         return;
+      }
+      Cond& cond = conds_.back();
+      if (cond.sawElse) {
+         error(line) << "#" << name.text << " after #else\n";
+      }
+      if (conds_.size() == src.condDepth + 1 && src.guardState == Source::Guard::OPEN) {
+         src.guardState = Source::Guard::NONE;
+      }
+      if (name.is("else")) {
+         cond.sawElse = true;
+         cond.active = cond.parentActive && !cond.taken;
+         cond.taken = true;
+      } else if (!cond.parentActive || cond.taken) {
+         cond.active = false;
+      } else {
+         bool value;
+         if (name.is("elif")) {
+            value = evalCondition(tokens, 2, line);
+         } else if (tokens.size() < 3 || tokens[2].kind != Token::Kind::IDENT) {
+            error(line) << "macro name missing in #" << name.text << '\n';
+            value = false;
+         } else {
+            value = isMacroDefined(tokens[2].text) == name.is("elifdef");
+         }
+         cond.active = value;
+         cond.taken = value;
+      }
+      return;
+   }
+
+   if (name.is("endif")) {
+      if (conds_.size() <= src.condDepth) {
+         error(line) << "#endif without #if\n";
+         return;
+      }
+      conds_.pop_back();
+      if (conds_.size() == src.condDepth && src.guardState == Source::Guard::OPEN) {
+         src.guardState = Source::Guard::CLOSED;
+      }
+      return;
+   }
+
+   if (!active) {
+      return;
+   }
+   invalidateGuard(src);
+
+   if (name.is("define")) {
+      handleDefine(tokens, 2, line);
+   } else if (name.is("undef")) {
+      if (tokens.size() < 3 || tokens[2].kind != Token::Kind::IDENT) {
+         error(line) << "macro name missing in #undef\n";
+      } else {
+         undefine(tokens[2].text);
+      }
+   } else if (name.is("include") || name.is("include_next")) {
+      handleInclude(tokens, 2, line, name.is("include_next"));
+   } else if (name.is("line") || name.kind == Token::Kind::NUMBER) {
+      handleLine(tokens, name.kind == Token::Kind::NUMBER ? 1 : 2, line);
+   } else if (name.is("error") || name.is("warning")) {
+      std::ostream& os = name.is("error") ? error(line) : diag(line, "warning");
+      os << '#' << name.text;
+      for (std::size_t i = 2; i < tokens.size(); ++i) {
+         os << ' ' << tokens[i].text;
+      }
+      os << '\n';
+   } else if (name.is("pragma")) {
+      if (tokens.size() >= 3 && tokens[2].is("once")) {
+         pragmaOnce_.insert(src.file->path);
+      }
+      // other pragmas have no effect on the generated code
+   } else if (name.is("ident") || name.is("sccs") || name.is("assert") || name.is("unassert")) {
+      // ignored, as they are by gcc without -fpreprocessed
+   } else {
+      error(line) << "invalid preprocessing directive #" << name.text << '\n';
+   }
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::handleDefine(const TokenList& tokens, std::size_t i, unsigned line) {
+   if (i >= tokens.size() || tokens[i].kind != Token::Kind::IDENT) {
+      error(line) << "macro name missing in #define\n";
+      return;
+   }
+   Macro m{.name = std::string(tokens[i].text)};
+   if (m.name == "defined") {
+      error(line) << "'defined' cannot be used as a macro name\n";
+      return;
+   }
+   ++i;
+
+   // a parenthesis directly after the name starts the parameter list
+   if (i < tokens.size() && tokens[i].is("(") && !tokens[i].space) {
+      m.fnLike = true;
+      ++i;
+      if (i < tokens.size() && tokens[i].is(")")) {
+         ++i;
+      } else {
+         while (true) {
+            if (i < tokens.size() && tokens[i].is("...")) {
+               m.variadic = true;
+               m.params.push_back("__VA_ARGS__");
+               ++i;
+            } else if (i < tokens.size() && tokens[i].kind == Token::Kind::IDENT) {
+               m.params.push_back(tokens[i++].text);
+               // gnu named variadic parameter
+               if (i < tokens.size() && tokens[i].is("...")) {
+                  m.variadic = true;
+                  ++i;
+               }
+            } else {
+               error(line) << "expected parameter name in macro '" << m.name << "'\n";
+               return;
+            }
+            if (i < tokens.size() && tokens[i].is(")")) {
+               ++i;
+               break;
+            }
+            if (m.variadic || i >= tokens.size() || !tokens[i].is(",")) {
+               error(line) << "expected ',' or ')' in parameter list of macro '" << m.name << "'\n";
+               return;
+            }
+            ++i;
+         }
+      }
+   }
+
+   m.body.assign(tokens.begin() + static_cast<std::ptrdiff_t>(i), tokens.end());
+   if (!m.body.empty()) {
+      m.body.front().space = false;
+      if (m.body.front().is("##") || m.body.back().is("##")) {
+         error(line) << "'##' cannot appear at either end of a macro expansion\n";
+         return;
+      }
+   }
+
+   auto it = macros_.find(m.name);
+   if (it != macros_.end()) {
+      const Macro& old = it->second;
+      bool same = old.fnLike == m.fnLike && old.variadic == m.variadic && old.params == m.params &&
+                  std::equal(old.body.begin(), old.body.end(), m.body.begin(), m.body.end(), [](const Token& a, const Token& b) {
+                     return a.text == b.text && a.space == b.space;
+                  });
+      if (!same && line) {
+         diag(line, "warning") << "'" << m.name << "' macro redefined\n";
+      }
+      it->second = std::move(m);
+   } else {
+      std::string name = m.name;
+      macros_.emplace(std::move(name), std::move(m));
+   }
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::parseHeaderName(TokenList& tokens, std::size_t i, std::string& name, bool& angled, unsigned line) {
+   if (i < tokens.size() && tokens[i].kind == Token::Kind::STRING && tokens[i].text.front() == '"') {
+      name = tokens[i].text.substr(1, tokens[i].text.size() - 2);
+      angled = false;
+      return true;
+   }
+   if (i < tokens.size() && tokens[i].is("<")) {
+      name.clear();
+      for (++i; i < tokens.size() && !tokens[i].is(">"); ++i) {
+         if (tokens[i].space && !name.empty()) {
+            name += ' ';
+         }
+         name += tokens[i].text;
+      }
+      if (i == tokens.size()) {
+         error(line) << "expected '>' after header name\n";
+         return false;
+      }
+      angled = true;
+      return true;
+   }
+
+   // computed include
+   std::deque<Token> in(tokens.begin() + static_cast<std::ptrdiff_t>(i), tokens.end());
+   TokenList expanded;
+   expand(in, expanded, false);
+   if (expanded.empty() || (!expanded[0].is("<") && expanded[0].kind != Token::Kind::STRING)) {
+      error(line) << "expected \"FILENAME\" or <FILENAME>\n";
+      return false;
+   }
+   return parseHeaderName(expanded, 0, name, angled, line);
+}
+// ---------------------------------------------------------------------------
+std::shared_ptr<const FileCache::File> Preprocessor::findInclude(const std::string& name, bool angled, std::size_t firstDir, std::string& path, std::size_t& dirIndex) {
+   auto tryPath = [&](std::filesystem::path candidate) -> std::shared_ptr<const FileCache::File> {
+      path = candidate.lexically_normal().string();
+      auto file = cache_.get(path);
+      if (!file) {
+         missing_.insert(path);
+      }
+      return file;
+   };
+
+   dirIndex = includeDirs_.size();
+   if (!name.empty() && name.front() == '/') {
+      return tryPath(name);
+   }
+   if (!angled && firstDir == 0) {
+      if (auto file = tryPath(std::filesystem::path(sources_.back().dir) / name)) {
+         return file;
+      }
+   }
+   for (dirIndex = firstDir; dirIndex < includeDirs_.size(); ++dirIndex) {
+      if (auto file = tryPath(std::filesystem::path(includeDirs_[dirIndex]) / name)) {
+         return file;
+      }
+   }
+   return nullptr;
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::handleInclude(TokenList& tokens, std::size_t i, unsigned line, bool next) {
+   std::string name;
+   bool angled;
+   if (!parseHeaderName(tokens, i, name, angled, line)) {
+      return;
+   }
+
+   // #include_next continues the search after the directory of the current file
+   std::size_t firstDir = 0;
+   if (next && sources_.back().dirIndex < includeDirs_.size()) {
+      firstDir = sources_.back().dirIndex + 1;
+   }
+   std::string path;
+   std::size_t dirIndex;
+   auto file = findInclude(name, angled, firstDir, path, dirIndex);
+   if (!file) {
+      error(line) << "'" << name << "' file not found\n";
+      return;
+   }
+   if (sources_.size() >= MAX_INCLUDE_DEPTH) {
+      error(line) << "#include nested too deeply\n";
+      return;
+   }
+
+   // skip files that would not produce any output without reading them again
+   if (pragmaOnce_.contains(file->path)) {
+      return;
+   }
+   if (auto guard = cache_.guard(file); guard && macros_.contains(*guard)) {
+      return;
+   }
+
+   pushSource(std::move(file), path, dirIndex);
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::handleLine(TokenList& tokens, std::size_t i, unsigned line) {
+   Source& src = sources_.back();
+   std::deque<Token> in(tokens.begin() + static_cast<std::ptrdiff_t>(i), tokens.end());
+   TokenList expanded;
+   expand(in, expanded, false);
+
+   if (expanded.empty() || expanded[0].kind != Token::Kind::NUMBER) {
+      error(line) << "#line directive requires a positive integer argument\n";
+      return;
+   }
+   unsigned long lineNo = std::strtoul(std::string(expanded[0].text).c_str(), nullptr, 10);
+   if (expanded.size() > 1) {
+      if (expanded[1].kind != Token::Kind::STRING) {
+         error(line) << "invalid filename for #line directive\n";
+         return;
+      }
+      std::string_view fn = expanded[1].text;
+      src.name = std::string(fn.substr(1, fn.size() - 2));
+   }
+   src.line = static_cast<unsigned>(lineNo);
+   emitMarker(src.line, 0);
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::evalCondition(TokenList& tokens, std::size_t i, unsigned line) {
+   // defined and __has_include are evaluated before macro expansion
+   std::deque<Token> in;
+   for (; i < tokens.size(); ++i) {
+      const Token& tok = tokens[i];
+      bool isDefined = tok.is("defined");
+      if (!isDefined && !tok.is("__has_include")) {
+         in.push_back(tok);
+         continue;
+      }
+
+      bool parens = i + 1 < tokens.size() && tokens[i + 1].is("(");
+      std::size_t arg = i + 1 + parens;
+      bool value = false;
+      if (isDefined) {
+         if (arg >= tokens.size() || tokens[arg].kind != Token::Kind::IDENT || (parens && (arg + 1 >= tokens.size() || !tokens[arg + 1].is(")")))) {
+            error(line) << "macro name missing after 'defined'\n";
+            return false;
+         }
+         value = isMacroDefined(tokens[arg].text);
+         i = arg + parens;
+      } else {
+         std::size_t close = arg;
+         while (close < tokens.size() && !tokens[close].is(")")) {
+            ++close;
+         }
+         if (!parens || close == tokens.size()) {
+            error(line) << "expected '(' header name ')' after '__has_include'\n";
+            return false;
+         }
+         TokenList header(tokens.begin() + static_cast<std::ptrdiff_t>(arg), tokens.begin() + static_cast<std::ptrdiff_t>(close));
+         std::string name, path;
+         bool angled;
+         std::size_t dirIndex;
+         if (!parseHeaderName(header, 0, name, angled, line)) {
+            return false;
+         }
+         auto file = findInclude(name, angled, 0, path, dirIndex);
+         if (file) {
+            dependencies_.push_back(file->path);
+         }
+         value = file != nullptr;
+         i = close;
+      }
+      in.push_back(makeToken(value ? "1" : "0", Token::Kind::NUMBER));
+   }
+
+   TokenList expr;
+   expand(in, expr, false);
+
+   std::size_t pos = 0;
+   bool failed = false;
+   auto fail = [&](std::string_view msg) {
+      if (!failed) {
+         error(line) << msg << " in preprocessor expression\n";
+      }
+      failed = true;
+      return Value{0, false};
+   };
+   auto peek = [&](std::string_view s) {
+      return pos < expr.size() && expr[pos].kind == Token::Kind::PUNCT && expr[pos].is(s);
+   };
+
+   auto parseNumber = [&](std::string_view text) -> Value {
+      std::string digits;
+      std::size_t j = 0;
+      int base = 10;
+      if (text.size() > 1 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+         base = 16;
+         j = 2;
+      } else if (text.size() > 1 && text[0] == '0' && (text[1] == 'b' || text[1] == 'B')) {
+         base = 2;
+         j = 2;
+      } else if (text[0] == '0') {
+         base = 8;
+      }
+      for (; j < text.size() && (std::isxdigit(static_cast<unsigned char>(text[j])) || text[j] == '\''); ++j) {
+         if (text[j] != '\'') {
+            digits += text[j];
+         }
+      }
+      bool isUnsigned = false;
+      std::string_view suffix = text.substr(j);
+      for (char c : suffix) {
+         if (c == 'u' || c == 'U') {
+            isUnsigned = true;
+         } else if (c != 'l' && c != 'L') {
+            return fail("invalid integer constant");
+         }
+      }
+      char* end;
+      errno = 0;
+      std::uint64_t v = std::strtoull(digits.empty() ? "0" : digits.c_str(), &end, base);
+      if (*end || errno) {
+         return fail("invalid integer constant");
+      }
+      // constants that do not fit intmax_t are unsigned
+      return Value{v, isUnsigned || v > static_cast<std::uint64_t>(INT64_MAX)};
+   };
+
+   auto parseChar = [&](std::string_view text) -> Value {
+      text = text.substr(text.find('\'') + 1);
+      text.remove_suffix(1);
+      std::int64_t v = 0;
+      bool first = true;
+      for (std::size_t j = 0; j < text.size();) {
+         unsigned char c = static_cast<unsigned char>(text[j++]);
+         if (c == '\\' && j < text.size()) {
+            c = static_cast<unsigned char>(text[j++]);
+            switch (c) {
+               case 'n': c = '\n'; break;
+               case 't': c = '\t'; break;
+               case 'r': c = '\r'; break;
+               case 'a': c = '\a'; break;
+               case 'b': c = '\b'; break;
+               case 'f': c = '\f'; break;
+               case 'v': c = '\v'; break;
+               case 'e': c = 27; break;
+               case 'x': {
+                  unsigned x = 0;
+                  while (j < text.size() && std::isxdigit(static_cast<unsigned char>(text[j]))) {
+                     x = x * 16 + (isDigit(text[j]) ? text[j] - '0' : (text[j] | 0x20) - 'a' + 10);
+                     ++j;
+                  }
+                  c = static_cast<unsigned char>(x);
+                  break;
+               }
+               default:
+                  if (c >= '0' && c <= '7') {
+                     unsigned o = c - '0';
+                     for (int k = 0; k < 2 && j < text.size() && text[j] >= '0' && text[j] <= '7'; ++k) {
+                        o = o * 8 + (text[j++] - '0');
+                     }
+                     c = static_cast<unsigned char>(o);
+                  }
+                  break;
+            }
+         }
+         // char is signed, multi-character constants are combined like gcc does
+         v = first ? static_cast<signed char>(c) : (v << 8) | c;
+         first = false;
+      }
+      return Value{static_cast<std::uint64_t>(v), false};
+   };
+
+   // precedence climbing over the binary operators, evaluate is false in
+   // the unevaluated operands of &&, || and ?:
+   std::function<Value(int, bool)> parseExpr;
+   std::function<Value(bool)> parseUnary = [&](bool evaluate) -> Value {
+      if (pos >= expr.size()) {
+         return fail("expected value");
+      }
+      const Token& tok = expr[pos++];
+      if (tok.is("(") && tok.kind == Token::Kind::PUNCT) {
+         Value v = parseExpr(0, evaluate);
+         if (!peek(")")) {
+            return fail("expected ')'");
+         }
+         ++pos;
+         return v;
+      }
+      if (tok.kind == Token::Kind::PUNCT && (tok.is("+") || tok.is("-") || tok.is("~") || tok.is("!"))) {
+         Value v = parseUnary(evaluate);
+         switch (tok.text[0]) {
+            case '-': return Value{0 - v.v, v.isUnsigned};
+            case '~': return Value{~v.v, v.isUnsigned};
+            case '!': return Value{v.v == 0, false};
+            default: return v;
+         }
+      }
+      switch (tok.kind) {
+         case Token::Kind::NUMBER:
+            if (tok.text.find_first_of(".") != std::string_view::npos ||
+                (tok.text.find_first_of("eEpP") != std::string_view::npos && !tok.text.starts_with("0x") && !tok.text.starts_with("0X"))) {
+               return fail("floating constant");
+            }
+            return parseNumber(tok.text);
+         case Token::Kind::CHAR:
+            return parseChar(tok.text);
+         case Token::Kind::IDENT:
+            // identifiers left after macro expansion are 0
+            return Value{tok.is("true"), false};
+         default:
+            return fail("unexpected token '" + std::string(tok.text) + "'");
+      }
+   };
+
+   auto precedence = [&](std::string_view op) {
+      static constexpr std::pair<std::string_view, int> OPS[] = {
+          {"?", 1}, {"||", 2}, {"&&", 3}, {"|", 4}, {"^", 5}, {"&", 6}, {"==", 7}, {"!=", 7}, {"<", 8}, {">", 8}, {"<=", 8}, {">=", 8}, {"<<", 9}, {">>", 9}, {"+", 10}, {"-", 10}, {"*", 11}, {"/", 11}, {"%", 11}};
+      for (auto [o, p] : OPS) {
+         if (o == op) {
+            return p;
+         }
+      }
+      return -1;
+   };
+
+   parseExpr = [&](int minPrec, bool evaluate) -> Value {
+      Value lhs = parseUnary(evaluate);
+      while (pos < expr.size() && expr[pos].kind == Token::Kind::PUNCT) {
+         std::string_view op = expr[pos].text;
+         int prec = precedence(op);
+         if (prec < minPrec || prec < 0) {
+            break;
+         }
+         ++pos;
+         if (op == "?") {
+            Value t = parseExpr(0, evaluate && lhs.v);
+            if (!peek(":")) {
+               return fail("expected ':'");
+            }
+            ++pos;
+            Value f = parseExpr(1, evaluate && !lhs.v);
+            bool isUnsigned = t.isUnsigned || f.isUnsigned;
+            lhs = lhs.v ? Value{t.v, isUnsigned} : Value{f.v, isUnsigned};
+            continue;
+         }
+         if (op == "||" || op == "&&") {
+            bool shortCircuit = (op == "||") == (lhs.v != 0);
+            Value rhs = parseExpr(prec + 1, evaluate && !shortCircuit);
+            lhs = Value{op == "||" ? (lhs.v || rhs.v) : (lhs.v && rhs.v), false};
+            continue;
+         }
+         Value rhs = parseExpr(prec + 1, evaluate);
+         bool u = lhs.isUnsigned || rhs.isUnsigned;
+         std::int64_t a = static_cast<std::int64_t>(lhs.v), b = static_cast<std::int64_t>(rhs.v);
+         Value res{0, u};
+         switch (op[0]) {
+            case '*': res.v = lhs.v * rhs.v; break;
+            case '/':
+            case '%':
+               if (rhs.v == 0) {
+                  if (evaluate) {
+                     return fail("division by zero");
+                  }
+                  break;
+               }
+               if (u) {
+                  res.v = op[0] == '/' ? lhs.v / rhs.v : lhs.v % rhs.v;
+               } else if (a == INT64_MIN && b == -1) {
+                  res.v = op[0] == '/' ? lhs.v : 0;
+               } else {
+                  res.v = static_cast<std::uint64_t>(op[0] == '/' ? a / b : a % b);
+               }
+               break;
+            case '+': res.v = lhs.v + rhs.v; break;
+            case '-': res.v = lhs.v - rhs.v; break;
+            case '^': res.v = lhs.v ^ rhs.v; break;
+            case '|': res.v = lhs.v | rhs.v; break;
+            case '&': res.v = lhs.v & rhs.v; break;
+            case '=': res = Value{lhs.v == rhs.v, false}; break;
+            case '!': res = Value{lhs.v != rhs.v, false}; break;
+            case '<':
+            case '>':
+               if (op.size() == 2 && op[1] == op[0]) {
+                  // shifts have the type of the left operand
+                  unsigned amount = rhs.v & 63;
+                  res.isUnsigned = lhs.isUnsigned;
+                  if (op[0] == '<') {
+                     res.v = lhs.v << amount;
+                  } else {
+                     res.v = lhs.isUnsigned ? lhs.v >> amount : static_cast<std::uint64_t>(a >> amount);
+                  }
+                  break;
+               }
+               {
+                  bool less = u ? lhs.v < rhs.v : a < b;
+                  bool equal = lhs.v == rhs.v;
+                  bool r = op[0] == '<' ? (less || (op.size() == 2 && equal)) : (!less && (op.size() == 2 || !equal));
+                  res = Value{r, false};
+               }
+               break;
+         }
+         lhs = res;
+      }
+      return lhs;
+   };
+
+   if (expr.empty()) {
+      error(line) << "expected value in preprocessor expression\n";
+      return false;
+   }
+   Value v = parseExpr(0, true);
+   if (pos != expr.size()) {
+      fail("token is not a valid binary operator");
+   }
+   return !failed && v.v != 0;
+}
+// ---------------------------------------------------------------------------
+const Preprocessor::Macro* Preprocessor::findMacro(const Token& tok) const {
+   if (tok.kind != Token::Kind::IDENT) {
+      return nullptr;
+   }
+   auto it = macros_.find(tok.text);
+   if (it == macros_.end() || hideSetContains(tok.hideSet, &it->second)) {
+      return nullptr;
+   }
+   return &it->second;
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::isMacroDefined(std::string_view name) const {
+   // headers test for it with #ifdef __has_include or #if defined(__has_include)
+   return name == "__has_include" || macros_.contains(name);
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::hideSetContains(const HideSet* hs, const Macro* m) {
+   for (; hs; hs = hs->next) {
+      if (hs->macro == m) {
+         return true;
+      }
+   }
+   return false;
+}
+// ---------------------------------------------------------------------------
+const Preprocessor::HideSet* Preprocessor::hideSetAdd(const HideSet* hs, const Macro* m) {
+   return hideSetContains(hs, m) ? hs : &hideSets_.emplace_back(HideSet{m, hs});
+}
+// ---------------------------------------------------------------------------
+const Preprocessor::HideSet* Preprocessor::hideSetUnion(const HideSet* a, const HideSet* b) {
+   for (; a; a = a->next) {
+      b = hideSetAdd(b, a->macro);
+   }
+   return b;
+}
+// ---------------------------------------------------------------------------
+const Preprocessor::HideSet* Preprocessor::hideSetIntersection(const HideSet* a, const HideSet* b) {
+   const HideSet* res = nullptr;
+   for (; a; a = a->next) {
+      if (hideSetContains(b, a->macro)) {
+         res = hideSetAdd(res, a->macro);
+      }
+   }
+   return res;
+}
+// ---------------------------------------------------------------------------
+Preprocessor::Token Preprocessor::makeToken(std::string text, Token::Kind kind) {
+   return Token{.text = strings_.emplace_back(std::move(text)), .kind = kind};
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::refill(std::deque<Token>& in) {
+   if (sources_.empty()) {
+      return false;
+   }
+   Source& src = sources_.back();
+   // directives end the arguments of a macro invocation
+   std::size_t pos = src.pos;
+   unsigned lineNo = src.line;
+   std::string_view line;
+   unsigned firstLine;
+   TokenList tokens;
+   while (tokens.empty()) {
+      if (!readLine(src, line, firstLine)) {
+         return false;
+      }
+      lexLine(line, tokens);
+      if (!tokens.empty() && (tokens[0].is("#") || tokens[0].is("%:"))) {
+         src.pos = pos;
+         src.line = lineNo;
+         return false;
+      }
+   }
+   tokens[0].space = true;
+   in.insert(in.end(), tokens.begin(), tokens.end());
+   return true;
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::peekToken(std::deque<Token>& in, bool readMoreLines) {
+   return !in.empty() || (readMoreLines && refill(in));
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::expand(std::deque<Token>& in, TokenList& out, bool readMoreLines) {
+   while (!in.empty()) {
+      Token tok = in.front();
+      in.pop_front();
+      const Macro* m = findMacro(tok);
+      if (!m || !expandMacro(*m, tok, in, readMoreLines)) {
+         out.push_back(tok);
+      }
+   }
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::expandMacro(const Macro& m, const Token& tok, std::deque<Token>& in, bool readMoreLines) {
+   switch (m.builtin) {
+      case Macro::Builtin::NONE:
+         break;
+      case Macro::Builtin::FILE:
+         in.push_front(makeToken(quote(sources_.empty() ? "<command line>" : sources_.back().name), Token::Kind::STRING));
+         in.front().space = tok.space;
+         return true;
+      case Macro::Builtin::LINE:
+         in.push_front(makeToken(std::to_string(currentLine_), Token::Kind::NUMBER));
+         in.front().space = tok.space;
+         return true;
+      case Macro::Builtin::COUNTER:
+         in.push_front(makeToken(std::to_string(counter_++), Token::Kind::NUMBER));
+         in.front().space = tok.space;
+         return true;
+      case Macro::Builtin::DATE:
+      case Macro::Builtin::TIME:
+         timeDependent_ = true;
+         in.push_front(makeToken(m.builtin == Macro::Builtin::DATE ? date_ : time_, Token::Kind::STRING));
+         in.front().space = tok.space;
+         return true;
+      case Macro::Builtin::PRAGMA: {
+         // _Pragma("...") is dropped like #pragma
+         if (!peekToken(in, readMoreLines) || !in.front().is("(")) {
+            return false;
+         }
+         std::vector<TokenList> args;
+         Token rparen;
+         return collectArgs(m, in, readMoreLines, args, rparen);
+      }
+   }
+
+   if (!m.fnLike) {
+      const HideSet* hs = hideSetAdd(tok.hideSet, &m);
+      TokenList body = substitute(m, {}, tok);
+      for (auto it = body.rbegin(); it != body.rend(); ++it) {
+         it->hideSet = hideSetUnion(it->hideSet, hs);
+         in.push_front(*it);
+      }
+      return true;
+   }
+
+   // a function-like macro name not followed by '(' is not an invocation
+   if (!peekToken(in, readMoreLines) || !in.front().is("(")) {
+      return false;
+   }
+   std::vector<TokenList> args;
+   Token rparen;
+   if (!collectArgs(m, in, readMoreLines, args, rparen)) {
+      return true;
+   }
+   const HideSet* hs = hideSetAdd(hideSetIntersection(tok.hideSet, rparen.hideSet), &m);
+   TokenList body = substitute(m, args, tok);
+   for (auto it = body.rbegin(); it != body.rend(); ++it) {
+      it->hideSet = hideSetUnion(it->hideSet, hs);
+      in.push_front(*it);
+   }
+   return true;
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::collectArgs(const Macro& m, std::deque<Token>& in, bool readMoreLines, std::vector<TokenList>& args, Token& rparen) {
+   // skip '('
+   in.pop_front();
+   args.emplace_back();
+   unsigned depth = 0;
+   while (true) {
+      if (!peekToken(in, readMoreLines)) {
+         error(currentLine_) << "unterminated argument list invoking macro '" << m.name << "'\n";
+         return false;
+      }
+      Token tok = in.front();
+      in.pop_front();
+      if (tok.kind == Token::Kind::PUNCT) {
+         if (tok.is("(")) {
+            ++depth;
+         } else if (tok.is(")")) {
+            if (depth == 0) {
+               rparen = tok;
+               break;
+            }
+            --depth;
+         } else if (tok.is(",") && depth == 0 && !(m.variadic && args.size() == m.params.size())) {
+            args.emplace_back();
+            continue;
+         }
+      }
+      args.back().push_back(tok);
+   }
+
+   if (m.builtin != Macro::Builtin::NONE) {
+      return true;
+   }
+   // 'f()' passes one empty argument
+   if (m.params.empty() && args.size() == 1 && args[0].empty()) {
+      args.clear();
+   }
+   // the variadic arguments may be omitted entirely
+   if (m.variadic && args.size() + 1 == m.params.size()) {
+      args.emplace_back();
+   }
+   if (args.size() != m.params.size()) {
+      error(currentLine_) << "macro '" << m.name << "' requires " << m.params.size() << " arguments, but " << args.size() << " given\n";
+      return false;
+   }
+   return true;
+}
+// ---------------------------------------------------------------------------
+Preprocessor::TokenList Preprocessor::substitute(const Macro& m, const std::vector<TokenList>& args, const Token& macroTok) {
+   auto findArg = [&](std::size_t i) -> const TokenList* {
+      if (i >= m.body.size() || m.body[i].kind != Token::Kind::IDENT) {
+         return nullptr;
+      }
+      for (std::size_t p = 0; p < m.params.size(); ++p) {
+         if (m.body[i].text == m.params[p]) {
+            return &args[p];
+         }
+      }
+      return nullptr;
+   };
+   auto append = [](TokenList& res, const TokenList& tokens, bool space) {
+      std::size_t first = res.size();
+      res.insert(res.end(), tokens.begin(), tokens.end());
+      if (first < res.size()) {
+         res[first].space = space;
+      }
+   };
+   bool vaEmpty = m.variadic && args.back().empty();
+
+   TokenList res;
+   for (std::size_t i = 0; i < m.body.size();) {
+      const Token& tok = m.body[i];
+
+      // '#' followed by a parameter is replaced by the stringized argument
+      if (m.fnLike && tok.is("#")) {
+         const TokenList* arg = findArg(i + 1);
+         if (!arg) {
+            error(currentLine_) << "'#' is not followed by a macro parameter\n";
+            ++i;
+            continue;
+         }
+         res.push_back(stringize(*arg));
+         res.back().space = tok.space;
+         i += 2;
+         continue;
+      }
+
+      // gnu: ', ## __VA_ARGS__' drops the comma if the variadic arguments are empty
+      if (tok.is(",") && i + 2 < m.body.size() && m.body[i + 1].is("##") && m.variadic && m.body[i + 2].text == m.params.back()) {
+         if (!vaEmpty) {
+            res.push_back(tok);
+            res.insert(res.end(), args.back().begin(), args.back().end());
+         }
+         i += 3;
+         continue;
+      }
+
+      if (tok.is("##")) {
+         if (const TokenList* arg = findArg(i + 1)) {
+            if (!arg->empty()) {
+               if (res.empty() || !paste(res.back(), arg->front())) {
+                  error(currentLine_) << "pasting does not give a valid preprocessing token\n";
+               }
+               res.insert(res.end(), arg->begin() + 1, arg->end());
+            }
+         } else if (i + 1 < m.body.size()) {
+            if (res.empty() || !paste(res.back(), m.body[i + 1])) {
+               error(currentLine_) << "pasting does not give a valid preprocessing token\n";
+            }
+         }
+         i += 2;
+         continue;
+      }
+
+      // C23 __VA_OPT__(...) expands to its contents only if there are variadic arguments
+      if (m.variadic && tok.is("__VA_OPT__") && i + 1 < m.body.size() && m.body[i + 1].is("(")) {
+         std::size_t close = i + 2;
+         for (unsigned depth = 0; close < m.body.size(); ++close) {
+            if (m.body[close].is("(")) {
+               ++depth;
+            } else if (m.body[close].is(")") && depth-- == 0) {
+               break;
+            }
+         }
+         if (!vaEmpty) {
+            Macro inner = m;
+            inner.body.assign(m.body.begin() + static_cast<std::ptrdiff_t>(i + 2), m.body.begin() + static_cast<std::ptrdiff_t>(std::min(close, m.body.size())));
+            append(res, substitute(inner, args, macroTok), tok.space);
+         }
+         i = close + 1;
+         continue;
+      }
+
+      const TokenList* arg = findArg(i);
+      // operands of '##' are not macro expanded
+      if (arg && i + 1 < m.body.size() && m.body[i + 1].is("##")) {
+         if (arg->empty()) {
+            // placemarker: the right operand is taken as is
+            if (const TokenList* rhs = findArg(i + 2)) {
+               append(res, *rhs, tok.space);
+            } else if (i + 2 < m.body.size()) {
+               res.push_back(m.body[i + 2]);
+               res.back().space = tok.space;
+            }
+            i += 3;
+         } else {
+            append(res, *arg, tok.space);
+            i += 1;
+         }
+         continue;
+      }
+
+      if (arg) {
+         // arguments are completely macro expanded before they are substituted
+         std::deque<Token> in(arg->begin(), arg->end());
+         TokenList expanded;
+         expand(in, expanded, false);
+         append(res, expanded, tok.space);
+         ++i;
+         continue;
+      }
+
+      res.push_back(tok);
+      ++i;
+   }
+
+   if (!res.empty()) {
+      res.front().space = macroTok.space;
+   }
+   return res;
+}
+// ---------------------------------------------------------------------------
+Preprocessor::Token Preprocessor::stringize(const TokenList& arg) {
+   // only string and character literals are escaped, a backslash outside of them is kept
+   std::string text = "\"";
+   for (const Token& tok : arg) {
+      if (tok.space && text.size() > 1) {
+         text += ' ';
+      }
+      if (tok.kind == Token::Kind::STRING || tok.kind == Token::Kind::CHAR) {
+         appendEscaped(text, tok.text);
+      } else {
+         text += tok.text;
+      }
+   }
+   return makeToken(text + '"', Token::Kind::STRING);
+}
+// ---------------------------------------------------------------------------
+bool Preprocessor::paste(Token& lhs, const Token& rhs) {
+   std::string text = std::string(lhs.text) + std::string(rhs.text);
+   TokenList tokens;
+   lexLine(text, tokens);
+   if (tokens.size() != 1 || (tokens[0].kind == Token::Kind::PUNCT && !isPunctuator(tokens[0].text))) {
+      return false;
+   }
+   Token res = makeToken(std::move(text), tokens[0].kind);
+   res.space = lhs.space;
+   res.hideSet = lhs.hideSet;
+   lhs = res;
+   return true;
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::syncLine(unsigned line) {
+   if (line == outLine_) {
+      return;
+   }
+   // a few empty lines are shorter than a line marker
+   if (line > outLine_ && line - outLine_ < 8) {
+      out_->append(line - outLine_, '\n');
+      outLine_ = line;
+      return;
+   }
+   emitMarker(line, 0);
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::emitMarker(unsigned line, int flag) {
+   if (!out_) {
+      return;
+   }
+   if (!out_->empty() && out_->back() != '\n') {
+      *out_ += '\n';
+   }
+   *out_ += "# " + std::to_string(line) + ' ' + quote(sources_.back().name);
+   if (flag) {
+      *out_ += ' ' + std::to_string(flag);
+   }
+   *out_ += '\n';
+   outLine_ = line;
+}
+// ---------------------------------------------------------------------------
+void Preprocessor::emitTokens(const TokenList& tokens, std::string_view line) {
+   // whitespace between tokens of the source line is kept, so that columns in diagnostics match
+   auto inLine = [line](std::string_view text) {
+      return text.data() >= line.data() && text.data() + text.size() <= line.data() + line.size();
+   };
+   auto whitespace = [](const char* begin, const char* end) {
+      return std::all_of(begin, end, isSpace);
+   };
+   if (!tokens.empty()) {
+      out_->append(line.data(), std::find_if_not(line.begin(), line.end(), isSpace));
+   }
+
+   const Token* prev = nullptr;
+   for (const Token& tok : tokens) {
+      const char* prevEnd = prev ? prev->text.data() + prev->text.size() : nullptr;
+      if (prev && inLine(prev->text) && inLine(tok.text) && prevEnd <= tok.text.data() && whitespace(prevEnd, tok.text.data())) {
+         out_->append(prevEnd, tok.text.data());
+         *out_ += tok.text;
+         prev = &tok;
+         continue;
+      }
+      bool space = tok.space;
+      // keep adjacent tokens from macro expansions from being lexed as one
+      if (prev && !space) {
+         char l = prev->text.back(), r = tok.text.front();
+         space = ((isIdentCont(l) || prev->kind == Token::Kind::NUMBER) && (isIdentCont(r) || r == '.')) ||
+                 (prev->kind == Token::Kind::NUMBER && std::strchr("eEpP", l) && (r == '+' || r == '-')) ||
+                 (prev->kind == Token::Kind::PUNCT && tok.kind == Token::Kind::PUNCT && punctuatorLength(std::string(prev->text) + std::string(tok.text)) > prev->text.size()) ||
+                 (l == '/' && (r == '/' || r == '*'));
+      }
+      if (space && prev) {
+         *out_ += ' ';
+      }
+      *out_ += tok.text;
+      prev = &tok;
+   }
+   *out_ += '\n';
+}
+// ---------------------------------------------------------------------------
+std::ostream& Preprocessor::diag(unsigned line, const char* kind) {
+   if (!sources_.empty()) {
+      log_ << sources_.back().name << ':' << line << ": ";
+   } else {
+      log_ << "<command line>: ";
+   }
+   return log_ << kind << ": ";
+}
+// ---------------------------------------------------------------------------
+std::ostream& Preprocessor::error(unsigned line) {
+   ++errors_;
+   return diag(line, "error");
+}
+// ---------------------------------------------------------------------------
+} // namespace pp
+} // namespace qcp
+// ---------------------------------------------------------------------------
@@ -0,0 +1,268 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "simdscan.h"
+#include "lextables.h"
+// ---------------------------------------------------------------------------
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <string_view>
+// ---------------------------------------------------------------------------
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+// ---------------------------------------------------------------------------
+namespace qcp::simd {
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+bool tokenStart(const char *it) {
+   return lex::is(*it, lex::TOKEN_START);
+}
+// ---------------------------------------------------------------------------
+bool identCont(const char *it) {
+   return lex::is(*it, lex::IDENT_START | lex::DIGIT);
+}
+// ---------------------------------------------------------------------------
+const char *findTokenStartScalar(const char *begin, const char *end) {
+   while (begin != end && !tokenStart(begin)) {
+      ++begin;
+   }
+   return begin;
+}
+// ---------------------------------------------------------------------------
+const char *findIdentEndScalar(const char *begin, const char *end) {
+   while (begin != end && identCont(begin)) {
+      ++begin;
+   }
+   return begin;
+}
+// ---------------------------------------------------------------------------
+const char *findNewlineScalar(const char *begin, const char *end) {
+   return std::find(begin, end, '\n');
+}
+// ---------------------------------------------------------------------------
+const char *findCommentEndScalar(const char *begin, const char *end) {
+   std::string_view commentEnd{"*/"};
+   return std::search(begin, end, commentEnd.begin(), commentEnd.end());
+}
+// ---------------------------------------------------------------------------
+void findNewlinesScalar(const char *base, const char *begin, const char *end, std::vector<long long> &offsets) {
+   for (; begin != end; ++begin) {
+      if (*begin == '\n') {
+         offsets.push_back(begin - base);
+      }
+   }
+}
+// ---------------------------------------------------------------------------
+// glibc picks the widest memchr the cpu supports by itself
+const char *findNewlineMemchr(const char *begin, const char *end) {
+   const void *nl = std::memchr(begin, '\n', static_cast<std::size_t>(end - begin));
+   return nl ? static_cast<const char *>(nl) : end;
+}
+// ---------------------------------------------------------------------------
+#if defined(__x86_64__)
+// ---------------------------------------------------------------------------
+// 256 bit registers are only passed between functions of this file, which all run with avx2
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+// ---------------------------------------------------------------------------
+// the vector scans are written once for both register widths
+struct SSE2 {
+   using reg = __m128i;
+   static constexpr std::ptrdiff_t WIDTH = 16;
+
+   static reg load(const char *p) { return _mm_loadu_si128(reinterpret_cast<const reg *>(p)); }
+   static reg set1(char c) { return _mm_set1_epi8(c); }
+   static reg eq(reg a, reg b) { return _mm_cmpeq_epi8(a, b); }
+   static reg either(reg a, reg b) { return _mm_or_si128(a, b); }
+   static reg both(reg a, reg b) { return _mm_and_si128(a, b); }
+   static reg sub(reg a, reg b) { return _mm_sub_epi8(a, b); }
+   static reg min(reg a, reg b) { return _mm_min_epu8(a, b); }
+   static unsigned mask(reg a) { return static_cast<unsigned>(_mm_movemask_epi8(a)); }
+   // bytes with lo <= c <= hi, compared unsigned
+   static reg inRange(reg a, char lo, char hi) {
+      reg offset = sub(a, set1(lo));
+      return eq(min(offset, set1(static_cast<char>(hi - lo))), offset);
+   }
+   static constexpr unsigned ALL = 0xffff;
+};
+// ---------------------------------------------------------------------------
+struct AVX2 {
+   using reg = __m256i;
+   static constexpr std::ptrdiff_t WIDTH = 32;
+
+   __attribute__((target("avx2"))) static reg load(const char *p) { return _mm256_loadu_si256(reinterpret_cast<const reg *>(p)); }
+   __attribute__((target("avx2"))) static reg set1(char c) { return _mm256_set1_epi8(c); }
+   __attribute__((target("avx2"))) static reg eq(reg a, reg b) { return _mm256_cmpeq_epi8(a, b); }
+   __attribute__((target("avx2"))) static reg either(reg a, reg b) { return _mm256_or_si256(a, b); }
+   __attribute__((target("avx2"))) static reg both(reg a, reg b) { return _mm256_and_si256(a, b); }
+   __attribute__((target("avx2"))) static reg sub(reg a, reg b) { return _mm256_sub_epi8(a, b); }
+   __attribute__((target("avx2"))) static reg min(reg a, reg b) { return _mm256_min_epu8(a, b); }
+   __attribute__((target("avx2"))) static unsigned mask(reg a) { return static_cast<unsigned>(_mm256_movemask_epi8(a)); }
+   __attribute__((target("avx2"))) static reg inRange(reg a, char lo, char hi) {
+      reg offset = sub(a, set1(lo));
+      return eq(min(offset, set1(static_cast<char>(hi - lo))), offset);
+   }
+   static constexpr unsigned ALL = 0xffffffff;
+};
+// ---------------------------------------------------------------------------
+// blanks make up most of the bytes between tokens, runs of them are skipped a vector at a time.
+// everything else is classified by the table, so that the result is the same as without vectors
+template <typename V>
+__attribute__((always_inline)) inline const char *findTokenStartVector(const char *begin, const char *end) {
+   while (begin != end && !tokenStart(begin)) {
+      ++begin;
+      while (end - begin >= V::WIDTH) {
+         typename V::reg x = V::load(begin);
+         unsigned other = ~V::mask(V::either(V::eq(x, V::set1(' ')), V::eq(x, V::set1('\t')))) & V::ALL;
+         if (other) {
+            begin += std::countr_zero(other);
+            break;
+         }
+         begin += V::WIDTH;
+      }
+   }
+   return begin;
+}
+// ---------------------------------------------------------------------------
+template <typename V>
+__attribute__((always_inline)) inline const char *findIdentEndVector(const char *begin, const char *end) {
+   while (end - begin >= V::WIDTH) {
+      typename V::reg x = V::load(begin);
+      // setting bit 5 maps upper to lower case letters and no other byte into a-z
+      typename V::reg letter = V::inRange(V::either(x, V::set1(0x20)), 'a', 'z');
+      typename V::reg cont = V::either(V::either(letter, V::inRange(x, '0', '9')), V::eq(x, V::set1('_')));
+      unsigned other = ~V::mask(cont) & V::ALL;
+      if (other) {
+         return begin + std::countr_zero(other);
+      }
+      begin += V::WIDTH;
+   }
+   return findIdentEndScalar(begin, end);
+}
+// ---------------------------------------------------------------------------
+// compares every byte with '*' and its successor with '/'
+template <typename V>
+__attribute__((always_inline)) inline const char *findCommentEndVector(const char *begin, const char *end) {
+   while (end - begin > V::WIDTH) {
+      typename V::reg star = V::eq(V::load(begin), V::set1('*'));
+      typename V::reg slash = V::eq(V::load(begin + 1), V::set1('/'));
+      if (unsigned found = V::mask(V::both(star, slash))) {
+         return begin + std::countr_zero(found);
+      }
+      begin += V::WIDTH;
+   }
+   return findCommentEndScalar(begin, end);
+}
+// ---------------------------------------------------------------------------
+template <typename V>
+__attribute__((always_inline)) inline void findNewlinesVector(const char *base, const char *begin, const char *end, std::vector<long long> &offsets) {
+   while (end - begin >= V::WIDTH) {
+      for (unsigned found = V::mask(V::eq(V::load(begin), V::set1('\n'))); found; found &= found - 1) {
+         offsets.push_back(begin - base + std::countr_zero(found));
+      }
+      begin += V::WIDTH;
+   }
+   findNewlinesScalar(base, begin, end, offsets);
+}
+// ---------------------------------------------------------------------------
+const char *findTokenStartSSE2(const char *begin, const char *end) {
+   return findTokenStartVector<SSE2>(begin, end);
+}
+// ---------------------------------------------------------------------------
+const char *findIdentEndSSE2(const char *begin, const char *end) {
+   return findIdentEndVector<SSE2>(begin, end);
+}
+// ---------------------------------------------------------------------------
+const char *findCommentEndSSE2(const char *begin, const char *end) {
+   return findCommentEndVector<SSE2>(begin, end);
+}
+// ---------------------------------------------------------------------------
+void findNewlinesSSE2(const char *base, const char *begin, const char *end, std::vector<long long> &offsets) {
+   findNewlinesVector<SSE2>(base, begin, end, offsets);
+}
+// ---------------------------------------------------------------------------
+__attribute__((target("avx2"))) const char *findTokenStartAVX2(const char *begin, const char *end) {
+   return findTokenStartVector<AVX2>(begin, end);
+}
+// ---------------------------------------------------------------------------
+__attribute__((target("avx2"))) const char *findIdentEndAVX2(const char *begin, const char *end) {
+   return findIdentEndVector<AVX2>(begin, end);
+}
+// ---------------------------------------------------------------------------
+__attribute__((target("avx2"))) const char *findCommentEndAVX2(const char *begin, const char *end) {
+   return findCommentEndVector<AVX2>(begin, end);
+}
+// ---------------------------------------------------------------------------
+__attribute__((target("avx2"))) void findNewlinesAVX2(const char *base, const char *begin, const char *end, std::vector<long long> &offsets) {
+   findNewlinesVector<AVX2>(base, begin, end, offsets);
+}
+// ---------------------------------------------------------------------------
+#pragma GCC diagnostic pop
+#endif
+// ---------------------------------------------------------------------------
+struct Scans {
+   const char *(*findTokenStart)(const char *, const char *);
+   const char *(*findIdentEnd)(const char *, const char *);
+   const char *(*findNewline)(const char *, const char *);
+   const char *(*findCommentEnd)(const char *, const char *);
+   void (*findNewlines)(const char *, const char *, const char *, std::vector<long long> &);
+};
+// ---------------------------------------------------------------------------
+// indexed by Isa
+#if defined(__x86_64__)
+constexpr std::array<Scans, 3> SCANS = {{
+    {findTokenStartScalar, findIdentEndScalar, findNewlineScalar, findCommentEndScalar, findNewlinesScalar},
+    {findTokenStartSSE2, findIdentEndSSE2, findNewlineMemchr, findCommentEndSSE2, findNewlinesSSE2},
+    {findTokenStartAVX2, findIdentEndAVX2, findNewlineMemchr, findCommentEndAVX2, findNewlinesAVX2},
+}};
+#else
+constexpr std::array<Scans, 1> SCANS = {{
+    {findTokenStartScalar, findIdentEndScalar, findNewlineMemchr, findCommentEndScalar, findNewlinesScalar},
+}};
+#endif
+// ---------------------------------------------------------------------------
+Isa active = detect();
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+Isa detect() {
+#if defined(__x86_64__)
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("avx2") ? Isa::AVX2 : Isa::SSE2;
+#else
+   return Isa::SCALAR;
+#endif
+}
+// ---------------------------------------------------------------------------
+Isa use(Isa isa) {
+   Isa previous = active;
+   active = std::min(isa, detect());
+   return previous;
+}
+// ---------------------------------------------------------------------------
+const char *findTokenStart(const char *begin, const char *end) {
+   return SCANS[static_cast<unsigned>(active)].findTokenStart(begin, end);
+}
+// ---------------------------------------------------------------------------
+const char *findIdentEnd(const char *begin, const char *end) {
+   return SCANS[static_cast<unsigned>(active)].findIdentEnd(begin, end);
+}
+// ---------------------------------------------------------------------------
+const char *findNewline(const char *begin, const char *end) {
+   return SCANS[static_cast<unsigned>(active)].findNewline(begin, end);
+}
+// ---------------------------------------------------------------------------
+const char *findCommentEnd(const char *begin, const char *end) {
+   return SCANS[static_cast<unsigned>(active)].findCommentEnd(begin, end);
+}
+// ---------------------------------------------------------------------------
+void findNewlines(const char *base, const char *begin, const char *end, std::vector<long long> &offsets) {
+   SCANS[static_cast<unsigned>(active)].findNewlines(base, begin, end, offsets);
+}
+// ---------------------------------------------------------------------------
+} // namespace qcp::simd
+// ---------------------------------------------------------------------------
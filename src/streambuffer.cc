@@ -0,0 +1,90 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "streambuffer.h"
+// ---------------------------------------------------------------------------
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+constexpr std::size_t CHUNK_SIZE = 64 * 1024;
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+StreamBuffer::StreamBuffer(int fd, std::size_t capacity) : capacity_{capacity}, fd_{fd} {
+   // address space only, pages are allocated as they are written
+   void* mem = mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   if (mem == MAP_FAILED) {
+      data_ = nullptr;
+      capacity_ = 0;
+   } else {
+      data_ = static_cast<char*>(mem);
+   }
+   reader_ = std::thread{[this] { read(); }};
+}
+// ---------------------------------------------------------------------------
+StreamBuffer::~StreamBuffer() {
+   reader_.join();
+   if (data_) {
+      munmap(data_, capacity_);
+   }
+   ::close(fd_);
+}
+// ---------------------------------------------------------------------------
+std::size_t StreamBuffer::wait(std::size_t size) const {
+   std::size_t available = available_.load(std::memory_order_acquire);
+   if (available > size) {
+      return available;
+   }
+   std::unique_lock lock{mutex_};
+   cv_.wait(lock, [&] { return available_.load(std::memory_order_relaxed) > size || done_; });
+   return available_.load(std::memory_order_relaxed);
+}
+// ---------------------------------------------------------------------------
+void StreamBuffer::read() {
+   std::size_t size = 0;
+   bool failed = false;
+   while (true) {
+      if (size == capacity_) {
+         failed = true;
+         break;
+      }
+      ssize_t n = ::read(fd_, data_ + size, std::min(CHUNK_SIZE, capacity_ - size));
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         failed = n < 0;
+         break;
+      }
+      std::size_t begin = size;
+      size += static_cast<std::size_t>(n);
+
+      // tokens never straddle the end of the available input if only complete lines are published
+      const void* nl = memrchr(data_ + begin, '\n', size - begin);
+      if (nl) {
+         {
+            std::lock_guard lock{mutex_};
+            available_.store(static_cast<const char*>(nl) - data_ + 1, std::memory_order_release);
+         }
+         cv_.notify_all();
+      }
+   }
+
+   {
+      std::lock_guard lock{mutex_};
+      available_.store(size, std::memory_order_release);
+      failed_ = failed;
+      done_ = true;
+   }
+   cv_.notify_all();
+}
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
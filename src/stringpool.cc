@@ -6,12 +6,17 @@
 #include <cassert>
 #include <iostream>
 #include <algorithm>
+#include <iterator>
+#include <mutex>
 #include <string_view>
 // ---------------------------------------------------------------------------
 namespace qcp {
 // ---------------------------------------------------------------------------
-std::vector<std::string> StringPool::strings_(1);
+std::shared_mutex StringPool::mutex_{};
+// index 0 is the empty Ident
+std::deque<std::string> StringPool::strings_(1);
 std::unordered_map<std::size_t, std::vector<unsigned>> StringPool::map_{};
+std::vector<unsigned> StringPool::statics_{};
 // ---------------------------------------------------------------------------
 unsigned StringPool::insert(const char* str) {
    return insert(std::string(str));
@@ -19,23 +24,41 @@ unsigned StringPool::insert(const char* str) {
 // ---------------------------------------------------------------------------
 unsigned StringPool::insert(std::string&& str) {
    std::size_t h = std::hash<std::string>{}(str);
-   auto mIt = map_.find(h);
-   if (mIt != map_.end()) {
-      std::vector<unsigned>& range = mIt->second;
-      auto vIt = std::find_if(range.begin(), range.end(), [&str](unsigned idx) {
+   auto find = [&str](const std::vector<unsigned>& range) {
+      return std::find_if(range.begin(), range.end(), [&str](unsigned idx) {
          return strings_[idx] == str;
       });
+   };
 
-      if (vIt != range.end()) {
-         return *vIt;
+   {
+      // fast path: most identifiers are already in the pool
+      std::shared_lock lock{mutex_};
+      auto mIt = map_.find(h);
+      if (mIt != map_.end()) {
+         auto vIt = find(mIt->second);
+         if (vIt != mIt->second.end()) {
+            return *vIt;
+         }
       }
-   } 
+   }
+
+   std::unique_lock lock{mutex_};
+   // another thread may have inserted the string in the meantime
+   std::vector<unsigned>& range = map_[h];
+   if (auto vIt = find(range); vIt != range.end()) {
+      return *vIt;
+   }
    unsigned idx = strings_.size();
    strings_.emplace_back(std::move(str));
-   if (mIt == map_.end()) {
-      map_[h] = {idx};
-   } else {
-      map_[h].push_back(idx);
+   range.push_back(idx);
+   return idx;
+}
+// ---------------------------------------------------------------------------
+unsigned StringPool::insertStatic(const char* str) {
+   unsigned idx = insert(str);
+   std::unique_lock lock{mutex_};
+   if (std::find(statics_.begin(), statics_.end(), idx) == statics_.end()) {
+      statics_.push_back(idx);
    }
    return idx;
 }
@@ -61,10 +84,27 @@ bool Ident::operator!=(const Ident& other) const {
 }
 // ---------------------------------------------------------------------------
 std::string_view StringPool::get(unsigned idx) {
+   std::shared_lock lock{mutex_};
    assert(idx < strings_.size() && "StringPool::get: index out of bounds");
    return strings_[idx];
 }
 // ---------------------------------------------------------------------------
+void StringPool::reset() {
+   std::unique_lock lock{mutex_};
+   // the statics keep their indices, the slots in between stay empty and are not found by insert()
+   unsigned size = 1;
+   for (unsigned idx : statics_) {
+      size = std::max(size, idx + 1);
+   }
+   std::deque<std::string> strings(size);
+   map_.clear();
+   for (unsigned idx : statics_) {
+      strings[idx] = std::move(strings_[idx]);
+      map_[std::hash<std::string>{}(strings[idx])].push_back(idx);
+   }
+   strings_ = std::move(strings);
+}
+// ---------------------------------------------------------------------------
 std::ostream& operator<<(std::ostream& os, const Ident& ident) {
    return os << static_cast<std::string_view>(ident);
 }
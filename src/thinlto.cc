@@ -0,0 +1,168 @@
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "thinlto.h"
+// ---------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+// ---------------------------------------------------------------------------
+#include "llvm/BinaryFormat/Magic.h"
+#include "llvm/LTO/LTO.h"
+#include "llvm/Support/Caching.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+// ---------------------------------------------------------------------------
+namespace qcp {
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+llvm::lto::Config config(const emitter::LLVMEmitter::Options &options) {
+   using OptLevel = emitter::LLVMEmitter::Options::OptLevel;
+   llvm::lto::Config conf;
+   conf.CPU = options.cpu;
+   std::istringstream is{options.features};
+   for (std::string feature; std::getline(is, feature, ',');) {
+      if (!feature.empty()) {
+         conf.MAttrs.push_back(feature);
+      }
+   }
+   // like the objects of LLVMEmitter
+   conf.RelocModel = llvm::Reloc::PIC_;
+   switch (options.optLevel) {
+      case OptLevel::O0:
+         conf.OptLevel = 0;
+         conf.CGOptLevel = llvm::CodeGenOptLevel::None;
+         break;
+      case OptLevel::O1:
+         conf.OptLevel = 1;
+         conf.CGOptLevel = llvm::CodeGenOptLevel::Less;
+         break;
+      case OptLevel::O3:
+         conf.OptLevel = 3;
+         conf.CGOptLevel = llvm::CodeGenOptLevel::Aggressive;
+         break;
+      default:
+         // the lto pipelines have no size levels
+         conf.OptLevel = 2;
+         conf.CGOptLevel = llvm::CodeGenOptLevel::Default;
+         break;
+   }
+   conf.OptPipeline = options.passes;
+   conf.DisableVerify = !options.verify;
+   return conf;
+}
+// ---------------------------------------------------------------------------
+bool report(llvm::Error err, std::ostream &log) {
+   if (!err) {
+      return true;
+   }
+   log << llvm::toString(std::move(err)) << '\n';
+   return false;
+}
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+ThinLTO::ThinLTO(Options options) : options_{std::move(options)} {
+   // the backends look up the target in the registry
+   emitter::LLVMEmitter::prepareTarget();
+   auto backend = llvm::lto::createInProcessThinBackend(llvm::heavyweight_hardware_concurrency(options_.threads));
+   lto_ = std::make_unique<llvm::lto::LTO>(config(options_.codegen), std::move(backend));
+   options_.exports.emplace_back("main");
+}
+// ---------------------------------------------------------------------------
+ThinLTO::~ThinLTO() = default;
+// ---------------------------------------------------------------------------
+bool ThinLTO::isBitcode(const std::string &path) {
+   llvm::file_magic magic;
+   return !llvm::identify_magic(path, magic) && magic == llvm::file_magic::bitcode;
+}
+// ---------------------------------------------------------------------------
+bool ThinLTO::add(int fd, const std::string &name, std::ostream &log) {
+   // reads from the start of the file, whatever the position of fd
+   auto buffer = llvm::MemoryBuffer::getOpenFile(llvm::sys::fs::convertFDToNativeFile(fd), name, -1);
+   if (!buffer) {
+      log << "Failed to read '" << name << "': " << buffer.getError().message() << '\n';
+      return false;
+   }
+   auto input = llvm::lto::InputFile::create((*buffer)->getMemBufferRef());
+   if (!input) {
+      log << "'" << name << "' is not a bitcode file: " << llvm::toString(input.takeError()) << '\n';
+      return false;
+   }
+   buffers_.push_back(std::move(*buffer));
+
+   // all code is in bitcode, so only the exports may be used by objects that are not
+   std::vector<llvm::lto::SymbolResolution> resolutions{};
+   for (const llvm::lto::InputFile::Symbol &sym : (*input)->symbols()) {
+      llvm::lto::SymbolResolution &res = resolutions.emplace_back();
+      if (sym.isUndefined()) {
+         continue;
+      }
+      std::string symName = sym.getName().str();
+      res.Prevailing = defined_.insert(symName).second;
+      if (!res.Prevailing && !sym.isWeak()) {
+         log << "Multiple definitions of '" << symName << "', the second one in '" << name << "'\n";
+         return false;
+      }
+      res.FinalDefinitionInLinkageUnit = true;
+      res.VisibleToRegularObj = sym.isUsed() || std::find(options_.exports.begin(), options_.exports.end(), symName) != options_.exports.end();
+   }
+   return report(lto_->add(std::move(*input), resolutions), log);
+}
+// ---------------------------------------------------------------------------
+std::optional<std::vector<std::FILE *>> ThinLTO::run(std::ostream &log) {
+   // indexed by task, the backends run concurrently
+   std::vector<std::FILE *> objects(lto_->getMaxTasks(), nullptr);
+   std::atomic<bool> failed{false};
+   auto addStream = [&](unsigned task, const llvm::Twine &) -> llvm::Expected<std::unique_ptr<llvm::CachedFileStream>> {
+      objects[task] = std::tmpfile();
+      if (!objects[task]) {
+         return llvm::createStringError(llvm::inconvertibleErrorCode(), "Failed to open temporary file");
+      }
+      return std::make_unique<llvm::CachedFileStream>(std::make_unique<llvm::raw_fd_ostream>(fileno(objects[task]), false));
+   };
+
+   llvm::FileCache cache{};
+   if (!options_.cacheDir.empty()) {
+      // hits and freshly cached objects are copied out of the cache
+      auto addBuffer = [&](unsigned task, const llvm::Twine &name, std::unique_ptr<llvm::MemoryBuffer> buffer) {
+         auto stream = addStream(task, name);
+         if (!stream) {
+            llvm::consumeError(stream.takeError());
+            failed = true;
+            return;
+         }
+         *(*stream)->OS << buffer->getBuffer();
+      };
+      auto localCache = llvm::localCache("ThinLTO", "thinlto", options_.cacheDir, addBuffer);
+      if (!localCache) {
+         // compiling without the cache still works
+         log << "Failed to open the ThinLTO cache: " << llvm::toString(localCache.takeError()) << '\n';
+      } else {
+         cache = std::move(*localCache);
+      }
+   }
+
+   bool ok = report(lto_->run(addStream, cache), log);
+   ok = ok && !failed;
+
+   std::vector<std::FILE *> result{};
+   for (std::FILE *object : objects) {
+      if (object && ok) {
+         result.push_back(object);
+      } else if (object) {
+         std::fclose(object);
+      }
+   }
+   if (!ok) {
+      return std::nullopt;
+   }
+   return result;
+}
+// ---------------------------------------------------------------------------
+} // namespace qcp
+// ---------------------------------------------------------------------------
@@ -2,10 +2,16 @@
 // qcp
 // ---------------------------------------------------------------------------
 #include "tokenizer.h"
+#include "lextables.h"
+#include "simdscan.h"
+#include "workerpool.h"
 // ---------------------------------------------------------------------------
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <charconv>
+#include <limits>
+#include <sstream>
 #include <string_view>
 #include <utility>
 // ---------------------------------------------------------------------------
@@ -14,31 +20,23 @@ using sv_it = typename std::string_view::const_iterator;
 namespace { // anonymous
 // ---------------------------------------------------------------------------
 bool isSeparator(const char c) {
-   return c == ' ' or c == '\t' or c == '\n';
-}
-// ---------------------------------------------------------------------------
-bool isNoneDigit(const char c) {
-   return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_';
+   return qcp::lex::is(c, qcp::lex::SEPARATOR);
 }
 // ---------------------------------------------------------------------------
 bool isDigit(const char c) {
-   return c >= '0' and c <= '9';
+   return qcp::lex::is(c, qcp::lex::DIGIT);
 }
 // ---------------------------------------------------------------------------
 bool isIdentStart(const char c) {
-   return isNoneDigit(c);
-}
-// ---------------------------------------------------------------------------
-bool isIdentCont(const char c) {
-   return isNoneDigit(c) || isDigit(c);
+   return qcp::lex::is(c, qcp::lex::IDENT_START);
 }
 // ---------------------------------------------------------------------------
 bool isOctalDigit(const char c) {
-   return c >= '0' and c <= '7';
+   return qcp::lex::is(c, qcp::lex::OCTAL_DIGIT);
 }
 // ---------------------------------------------------------------------------
 bool isHexDigit(const char c) {
-   return (c >= '0' and c <= '9') or (c >= 'A' and c <= 'F') or (c >= 'a' and c <= 'f');
+   return qcp::lex::is(c, qcp::lex::HEX_DIGIT);
 }
 // ---------------------------------------------------------------------------
 bool isBinaryDigit(const char c) {
@@ -46,55 +44,11 @@ bool isBinaryDigit(const char c) {
 }
 // ---------------------------------------------------------------------------
 bool isPunctuatorStart(const char c) {
-   switch (c) {
-      case '[':
-      case ']':
-      case '(':
-      case ')':
-      case '{':
-      case '}':
-      case '.':
-      case '-':
-      case '+':
-      case '&':
-      case '*':
-      case '~':
-      case '!':
-      case '/':
-      case '%':
-      case '<':
-      case '>':
-      case '=':
-      case '^':
-      case '|':
-      case '?':
-      case ':':
-      case ';':
-      case '#':
-      case ',':
-         return true;
-      default:
-         return false;
-   }
+   return qcp::lex::is(c, qcp::lex::PUNCTUATOR_START);
 }
 // ---------------------------------------------------------------------------
 bool isSimpleEscapeSequenceChar(const char c) {
-   switch (c) {
-      case '\'':
-      case '\"':
-      case '\?':
-      case '\\':
-      case 'a':
-      case 'b':
-      case 'f':
-      case 'n':
-      case 'r':
-      case 't':
-      case 'v':
-         return true;
-      default:
-         return false;
-   }
+   return qcp::lex::is(c, qcp::lex::SIMPLE_ESCAPE);
 }
 // ---------------------------------------------------------------------------
 template <typename _NumberPredicate>
@@ -112,7 +66,7 @@ sv_it findEndOfINumber(sv_it begin, sv_it end, _NumberPredicate _p, qcp::Diagnos
       }
    } while (numberEnd != end && !(prev == '\'' && *numberEnd == '\'') && _p(*numberEnd));
    if (prev == '\'') {
-      diagnostics << "invalid number: number may not end with '";
+      diagnostics << "invalid number: number may not end with '" << std::endl;
    }
    return numberEnd;
 }
@@ -131,21 +85,39 @@ sv_it findEndOfExponent(sv_it begin, sv_it end, qcp::DiagnosticTracker &diagnost
    return expEnd;
 }
 // ---------------------------------------------------------------------------
+// the end of the literal at begin if it is terminated and has no escapes, so that its value
+// is the bytes between the quotes
 template <const char quoteChar>
-std::pair<std::string, sv_it> getCharSequence(sv_it progBegin, sv_it begin, sv_it end, qcp::DiagnosticTracker &diagnostics) {
+std::optional<sv_it> findPlainSequenceEnd(sv_it begin, sv_it end) {
+   sv_it quote = std::find_if(begin + 1, end, [](const char c) { return c == '\\' || c == quoteChar || c == '\n'; });
+   if (quote != end && *quote == quoteChar) {
+      return quote + 1;
+   }
+   return std::nullopt;
+}
+// ---------------------------------------------------------------------------
+// finds the end of the literal at begin. the tokenizer only reports errors, the escapes are
+// decoded into literal when the parser asks for its value and the errors are not reported again
+template <const char quoteChar>
+sv_it getCharSequence(sv_it progBegin, sv_it begin, sv_it end, qcp::DiagnosticTracker *diagnostics, qcp::Arena *literal) {
    sv_it cSeqEnd{begin + 1};
-   std::string literal{};
    while (cSeqEnd != end) {
       begin = cSeqEnd;
       cSeqEnd = std::find_if(cSeqEnd, end, [](const char c) { return c == '\\' || c == quoteChar || c == '\n'; });
+      if (literal) {
+         literal->append(&*begin, &*begin + std::distance(begin, cSeqEnd));
+      }
       if (cSeqEnd == end) {
-         diagnostics << "unterminated character sequence" << std::endl;
+         if (diagnostics) {
+            *diagnostics << "unterminated character sequence" << std::endl;
+         }
          break;
       }
-      literal += std::string_view{begin, cSeqEnd};
       if (*cSeqEnd == '\\') {
          if (cSeqEnd + 1 == end) {
-            diagnostics << "unterminated character sequence" << std::endl;
+            if (diagnostics) {
+               *diagnostics << "unterminated character sequence" << std::endl;
+            }
             break;
          }
          ++cSeqEnd;
@@ -160,28 +132,34 @@ std::pair<std::string, sv_it> getCharSequence(sv_it progBegin, sv_it begin, sv_i
                }
                value = value * 8 + (c - '0');
             }
-            if (octalCount == 0) {
-               diagnostics << "invalid octal escape sequence" << std::endl;
-            } else if (value > 255) {
-               diagnostics << "octal escape sequence out of range" << std::endl;
+            if (diagnostics && octalCount == 0) {
+               *diagnostics << "invalid octal escape sequence" << std::endl;
+            } else if (diagnostics && value > 255) {
+               *diagnostics << "octal escape sequence out of range" << std::endl;
             }
             cSeqEnd += octalCount;
-            literal += static_cast<char>(value);
+            if (literal) {
+               literal->push_back(static_cast<char>(value));
+            }
          } else if (*cSeqEnd == 'x') {
             // hex
             ++cSeqEnd;
-            char *endPtr;
-            long value = strtol(cSeqEnd, &endPtr, 16);
+            long value = 0;
+            auto [endPtr, ec] = std::from_chars(&*cSeqEnd, &*cSeqEnd + std::distance(cSeqEnd, end), value, 16);
             // todo: too large char or w_char
 
-            if (std::distance(&*cSeqEnd, static_cast<const char *>(endPtr)) == 0) {
-               diagnostics << "invalid hex escape sequence" << std::endl;
+            if (diagnostics && endPtr == &*cSeqEnd) {
+               *diagnostics << "invalid hex escape sequence" << std::endl;
+            }
+            cSeqEnd += std::distance(&*cSeqEnd, endPtr);
+            if (literal) {
+               literal->push_back(static_cast<char>(value));
             }
-            cSeqEnd = endPtr;
-            literal += static_cast<char>(value);
          } else if (*cSeqEnd == 'u' || *cSeqEnd == 'U') {
             // universal character name
-            diagnostics << qcp::DiagnosticMessage::Kind::WARNING << "universal character name not supported" << std::endl;
+            if (diagnostics) {
+               *diagnostics << qcp::DiagnosticMessage::Kind::WARNING << "universal character name not supported" << std::endl;
+            }
          } else if (isSimpleEscapeSequenceChar(*cSeqEnd)) {
             char c;
             switch (*cSeqEnd) {
@@ -210,13 +188,17 @@ std::pair<std::string, sv_it> getCharSequence(sv_it progBegin, sv_it begin, sv_i
                   c = *cSeqEnd;
                   break;
             }
-            literal += c;
+            if (literal) {
+               literal->push_back(c);
+            }
             ++cSeqEnd;
-         } else {
-            diagnostics << qcp::SrcLoc(progBegin, begin, cSeqEnd) << "unknown escape sequence" << std::endl;
+         } else if (diagnostics) {
+            *diagnostics << qcp::SrcLoc(progBegin, begin, cSeqEnd) << "unknown escape sequence" << std::endl;
          }
       } else if (*cSeqEnd == '\n') {
-         diagnostics << "unterminated character sequence" << std::endl;
+         if (diagnostics) {
+            *diagnostics << "unterminated character sequence" << std::endl;
+         }
          break;
       } else {
          // end of sequence found
@@ -228,7 +210,69 @@ std::pair<std::string, sv_it> getCharSequence(sv_it progBegin, sv_it begin, sv_i
       ++cSeqEnd;
    }
 
-   return {literal, cSeqEnd};
+   return cSeqEnd;
+}
+// ---------------------------------------------------------------------------
+// the value of the digits of an integer literal, skipping digit separators. like strtoull,
+// a value that does not fit is the largest one and parsing stops at the first other character
+std::from_chars_result parseInteger(const char *begin, const char *end, unsigned base, unsigned long long &value) {
+   value = 0;
+   bool overflow = false;
+   for (; begin != end; ++begin) {
+      if (*begin == '\'') {
+         continue;
+      }
+      unsigned digit = isDigit(*begin) ? *begin - '0' : isHexDigit(*begin) ? (*begin | 0x20) - 'a' + 10 : base;
+      if (digit >= base) {
+         break;
+      }
+      overflow |= __builtin_mul_overflow(value, base, &value);
+      overflow |= __builtin_add_overflow(value, digit, &value);
+   }
+   if (overflow) {
+      value = std::numeric_limits<unsigned long long>::max();
+      return {begin, std::errc::result_out_of_range};
+   }
+   return {begin, std::errc{}};
+}
+// ---------------------------------------------------------------------------
+// the correctly rounded value of the digits and exponent of a floating literal
+template <typename T>
+std::from_chars_result parseFloating(const char *begin, const char *end, unsigned base, T &value) {
+   std::chars_format format = base == 16 ? std::chars_format::hex : std::chars_format::general;
+   // digit separators are rare, without them the literal is parsed in place
+   if (std::find(begin, end, '\'') == end) {
+      return std::from_chars(begin, end, value, format);
+   }
+   std::array<char, 128> buffer;
+   std::string heap{};
+   char *data = buffer.data();
+   if (end - begin > static_cast<std::ptrdiff_t>(buffer.size())) {
+      heap.resize(static_cast<std::size_t>(end - begin));
+      data = heap.data();
+   }
+   char *dataEnd = std::remove_copy(begin, end, data, '\'');
+   auto [ptr, ec] = std::from_chars(data, dataEnd, value, format);
+   return {ptr == dataEnd ? end : begin, ec};
+}
+// ---------------------------------------------------------------------------
+// the first line start after from, preferably one after a statement or brace or of a
+// preprocessor line, which is unlikely to be within a comment. npos if there is none
+std::size_t findChunkBoundary(std::string_view prog, std::size_t from) {
+   constexpr std::size_t WINDOW = 4096;
+   std::size_t first = std::string_view::npos;
+   for (std::size_t nl = prog.find('\n', from); nl != std::string_view::npos && nl + 1 < prog.size(); nl = prog.find('\n', nl + 1)) {
+      if (first == std::string_view::npos) {
+         first = nl + 1;
+      }
+      if (prog[nl + 1] == '#' || (nl && std::string_view{";{}"}.find(prog[nl - 1]) != std::string_view::npos)) {
+         return nl + 1;
+      }
+      if (nl - from > WINDOW) {
+         break;
+      }
+   }
+   return first;
 }
 // ---------------------------------------------------------------------------
 } // anonymous
@@ -238,7 +282,7 @@ namespace qcp {
 // tokenizer
 // ---------------------------------------------------------------------------
 Tokenizer::const_iterator Tokenizer::begin() const {
-   return const_iterator{prog_, diagnostics_};
+   return const_iterator{*this};
 }
 // ---------------------------------------------------------------------------
 Tokenizer::const_iterator Tokenizer::end() const {
@@ -257,6 +301,214 @@ const std::string_view &Tokenizer::data() const {
    return prog_;
 }
 // ---------------------------------------------------------------------------
+std::string_view Tokenizer::getString(const Token &token) const {
+   assert((token.getKind() == TK::SLITERAL || token.getKind() == TK::CLITERAL) && "not a string or character literal");
+   if (!token.getPayload()) {
+      SrcLoc loc = token.getLoc();
+      return {prog_.data() + loc.loc() + 1, loc.len() - 2u};
+   }
+   std::optional<std::string_view> &literal = strings_[token.getPayload() - 1];
+   if (!literal) {
+      arena_.start();
+      decodeString(token);
+      literal = arena_.back();
+   }
+   return *literal;
+}
+// ---------------------------------------------------------------------------
+std::string_view Tokenizer::getString(std::string_view prefix, const Token &token) const {
+   assert(token.getKind() == TK::SLITERAL && "not a string literal");
+   std::string_view last = arena_.back();
+   if (last.data() != prefix.data() || last.size() != prefix.size()) {
+      arena_.start();
+      arena_.append(prefix.data(), prefix.data() + prefix.size());
+   }
+   if (token.getPayload()) {
+      decodeString(token);
+   } else {
+      std::string_view bytes = getString(token);
+      arena_.append(bytes.data(), bytes.data() + bytes.size());
+   }
+   return arena_.back();
+}
+// ---------------------------------------------------------------------------
+void Tokenizer::decodeString(const Token &token) const {
+   SrcLoc loc = token.getLoc();
+   sv_it begin = prog_.data() + loc.loc();
+   if (token.getKind() == TK::SLITERAL) {
+      getCharSequence<'"'>(prog_.data(), begin, begin + loc.len(), nullptr, &arena_);
+   } else {
+      getCharSequence<'\''>(prog_.data(), begin, begin + loc.len(), nullptr, &arena_);
+   }
+}
+// ---------------------------------------------------------------------------
+const Tokenizer::Number &Tokenizer::getNumber(const Token &token) const {
+   assert(token.getKind() >= TK::ICONST && token.getKind() <= TK::LDCONST && "not a numeric literal");
+   Number &number = numbers_[token.getPayload()];
+   if (number.decoded) {
+      return number;
+   }
+   number.decoded = true;
+
+   TK type = token.getKind();
+   const char *begin = prog_.data() + number.begin;
+   const char *end = prog_.data() + number.end;
+   std::from_chars_result result{end, std::errc{}};
+
+   if (type == TK::FCONST) {
+      // parsed as a float directly, rounding through a double may be off by one ulp
+      float value = 0;
+      if (number.valid) {
+         result = parseFloating(begin, end, number.base, value);
+      }
+      number.floating = value;
+   } else if (type >= TK::DCONST) {
+      double value = 0;
+      if (number.valid) {
+         result = parseFloating(begin, end, number.base, value);
+      }
+      number.floating = value;
+   } else {
+      unsigned long long value = 0;
+      if (number.valid) {
+         result = parseInteger(begin, end, number.base, value);
+      }
+      if (type == TK::ULL_ICONST) {
+         number.integer = value;
+      } else if (type == TK::UL_ICONST) {
+         number.integer = safe_cast<unsigned long>(value);
+      } else if (type == TK::U_ICONST) {
+         number.integer = safe_cast<unsigned>(value);
+      } else if (type == TK::LL_ICONST) {
+         number.integer = static_cast<unsigned long long>(safe_cast<long long>(static_cast<long long>(value)));
+      } else if (type == TK::L_ICONST) {
+         number.integer = static_cast<unsigned long long>(safe_cast<long>(static_cast<long long>(value)));
+      } else {
+         number.integer = static_cast<unsigned long long>(safe_cast<int>(static_cast<long long>(value)));
+      }
+   }
+
+   if (result.ec == std::errc::result_out_of_range) {
+      diagnostics_ << "range error" << std::endl;
+   } else if (result.ec != std::errc{} || result.ptr != end) {
+      diagnostics_ << "invalid number" << std::endl;
+   }
+   return number;
+}
+// ---------------------------------------------------------------------------
+std::vector<Tokenizer::Token> Tokenizer::tokenize(unsigned threads) const {
+   // smaller chunks are not worth a thread
+   constexpr std::size_t MIN_CHUNK = 256 * 1024;
+   std::size_t chunkCount = std::min<std::size_t>(threads, prog_.size() / MIN_CHUNK);
+   if (stream_ || chunkCount < 2) {
+      return {};
+   }
+
+   // every chunk is lexed with its own diagnostics and literals, which are only used
+   // if the chunk starts where the one before it stopped and has no diagnostics
+   struct Chunk {
+      Chunk(std::size_t begin, std::size_t limit) : begin{begin}, limit{limit} {}
+
+      std::size_t begin;
+      std::size_t limit;
+      std::ostringstream log{};
+      std::optional<DiagnosticTracker> diagnostics{};
+      std::optional<Tokenizer> tokenizer{};
+      std::vector<Token> tokens{};
+      std::size_t stop = 0;
+      int pp = 0;
+   };
+   std::deque<Chunk> chunks{};
+   for (std::size_t i = 0, begin = 0; i < chunkCount && begin != std::string_view::npos; ++i) {
+      std::size_t limit = std::string_view::npos;
+      if (i + 1 < chunkCount) {
+         limit = findChunkBoundary(prog_, std::max(begin, (i + 1) * prog_.size() / chunkCount));
+      }
+      chunks.emplace_back(begin, limit);
+      begin = limit;
+   }
+
+   {
+      WorkerPool pool{static_cast<unsigned>(chunks.size())};
+      for (Chunk &chunk : chunks) {
+         pool.run([this, &chunk] {
+            chunk.diagnostics.emplace("", prog_, chunk.log);
+            chunk.tokenizer.emplace(prog_, *chunk.diagnostics);
+            const_iterator it{*chunk.tokenizer, chunk.begin, chunk.limit, true, 0};
+            for (; it->getKind() != TK::END; ++it) {
+               chunk.tokens.push_back(*it);
+            }
+            chunk.stop = it.stop();
+            chunk.pp = it.inPP();
+         });
+      }
+   }
+
+   std::vector<Token> tokens{};
+   // appends the tokens of a chunk from the one at index first
+   auto append = [&](const Chunk &chunk, std::size_t first) {
+      auto numbers = static_cast<std::uint32_t>(numbers_.size());
+      auto strings = static_cast<std::uint32_t>(strings_.size());
+      for (std::size_t i = first; i < chunk.tokens.size(); ++i) {
+         const Token &t = chunk.tokens[i];
+         if (t.getKind() >= TK::ICONST && t.getKind() <= TK::LDCONST) {
+            tokens.emplace_back(t.getLoc(), t.getKind(), t.getPayload() + numbers);
+         } else if (t.getKind() == TK::SLITERAL || t.getKind() == TK::CLITERAL) {
+            tokens.emplace_back(t.getLoc(), t.getKind(), t.getPayload() ? t.getPayload() + strings : 0);
+         } else {
+            tokens.push_back(t);
+         }
+      }
+      numbers_.insert(numbers_.end(), chunk.tokenizer->numbers_.begin(), chunk.tokenizer->numbers_.end());
+      strings_.resize(strings_.size() + chunk.tokenizer->strings_.size());
+   };
+
+   // where and in which state the lexer continues
+   std::size_t pos = 0;
+   int pp = 0;
+   for (Chunk &chunk : chunks) {
+      if (pos == chunk.begin && !pp && chunk.diagnostics->empty()) {
+         append(chunk, 0);
+         pos = chunk.stop;
+         pp = chunk.pp;
+         continue;
+      }
+      // the chunk started within a comment or preprocessor line. lex it again until both
+      // lexers start the same token outside of a preprocessor line, from there on they agree
+      const_iterator it{*this, pos, chunk.limit, pos == chunk.begin, pp};
+      std::size_t next = 0;
+      int chunkPP = 0;
+      for (; it->getKind() != TK::END; ++it) {
+         if (it->getKind() == TK::PP_START || it->getKind() == TK::PP_END || it.inPP() || !chunk.diagnostics->empty()) {
+            tokens.push_back(*it);
+            continue;
+         }
+         // tokens outside of preprocessor lines have increasing offsets
+         long long offset = it->getLoc().loc();
+         while (next < chunk.tokens.size() && (chunkPP || chunk.tokens[next].getKind() == TK::PP_START || chunk.tokens[next].getLoc().loc() < offset)) {
+            if (chunk.tokens[next].getKind() == TK::PP_START || chunk.tokens[next].getKind() == TK::PP_END) {
+               chunkPP = chunk.tokens[next].getKind() == TK::PP_START;
+            }
+            ++next;
+         }
+         if (next < chunk.tokens.size() && chunk.tokens[next].getLoc().loc() == offset) {
+            break;
+         }
+         tokens.push_back(*it);
+      }
+      if (it->getKind() == TK::END) {
+         pos = it.stop();
+         pp = it.inPP();
+      } else {
+         append(chunk, next);
+         pos = chunk.stop;
+         pp = chunk.pp;
+      }
+   }
+   tokens.emplace_back(TK::END);
+   return tokens;
+}
+// ---------------------------------------------------------------------------
 // const_iterator
 // ---------------------------------------------------------------------------
 sv_it Tokenizer::const_iterator::getNumberConst(sv_it begin) {
@@ -330,16 +582,6 @@ sv_it Tokenizer::const_iterator::getNumberConst(sv_it begin) {
       }
    }
 
-   std::string valueRepr{begin, valueEnd};
-   // sanitize value representation (remove single quotes)
-   auto valueReprEnd = std::remove(valueRepr.begin(), valueRepr.end(), '\'');
-   valueRepr.erase(valueReprEnd, valueRepr.end());
-
-   // for hex float, strtod expects the '0x' prefix to be included
-   if (isFloat && base == 16) {
-      valueRepr = "0x" + valueRepr;
-   }
-
    bool unsignedSuffix = false;
    bool longSuffix = false;
    bool longLongSuffix = false;
@@ -391,286 +633,27 @@ sv_it Tokenizer::const_iterator::getNumberConst(sv_it begin) {
       }
    }
 
-   errno = 0;
-   char *pos;
-
-   SrcLoc loc{progBegin_, begin, suffixEnd};
+   // the value is converted when the parser asks for it
+   TK type;
    if (isFloat) {
-      double value = valid ? std::strtod(valueRepr.c_str(), &pos) : 0.0;
-      if (floatSuffix) {
-         token_ = Tokenizer::Token{loc, safe_cast<float>(value)};
-      } else {
-         token_ = Tokenizer::Token{loc, value};
-      }
+      type = floatSuffix ? TK::FCONST : TK::DCONST;
    } else if (unsignedSuffix) {
-      unsigned long long value = valid ? std::strtoull(valueRepr.c_str(), &pos, base) : 0;
-      if (longLongSuffix) {
-         token_ = Tokenizer::Token{loc, value};
-      } else if (longSuffix) {
-         token_ = Tokenizer::Token{loc, safe_cast<unsigned long>(value)};
-      } else {
-         token_ = Tokenizer::Token{loc, safe_cast<unsigned>(value)};
-      }
+      type = longLongSuffix ? TK::ULL_ICONST : longSuffix ? TK::UL_ICONST : TK::U_ICONST;
    } else {
-      long long value = valid ? static_cast<long long>(std::strtoull(valueRepr.c_str(), &pos, base)) : 0;
-      if (longLongSuffix) {
-         token_ = Tokenizer::Token{loc, safe_cast<long long>(value)};
-      } else if (longSuffix) {
-         token_ = Tokenizer::Token{loc, safe_cast<long>(value)};
-      } else {
-         token_ = Tokenizer::Token{loc, safe_cast<int>(value)};
-      }
-   }
-
-   if (errno == ERANGE) {
-      *diagnostics_ << "range error" << std::endl;
-   } else if (pos != valueRepr.c_str() + valueRepr.length()) {
-      *diagnostics_ << "invalid number" << std::endl;
+      type = longLongSuffix ? TK::LL_ICONST : longSuffix ? TK::L_ICONST : TK::ICONST;
    }
+   auto offset = [&](sv_it it) { return static_cast<std::uint32_t>(std::distance(progBegin_, it)); };
+   tokenizer_->numbers_.push_back({offset(begin), offset(valueEnd), static_cast<std::uint8_t>(base), valid});
+   token_ = Token{SrcLoc{progBegin_, begin, suffixEnd}, type, static_cast<std::uint32_t>(tokenizer_->numbers_.size() - 1)};
 
    return suffixEnd;
 }
 // ---------------------------------------------------------------------------
 sv_it Tokenizer::const_iterator::getPunctuator(sv_it begin) {
-   TK type;
-   unsigned len = 1;
-   std::array<char, 3> chars = {0, 0, 0};
-
-   for (int i = 0; i < 3; ++i) {
-      if (begin + i == prog_.end()) {
-         break;
-      }
-      chars[i] = *(begin + i);
-   }
-
-   switch (chars[0]) {
-      case '[':
-         type = TK::L_BRACKET;
-         break;
-      case ']':
-         type = TK::R_BRACKET;
-         break;
-      case '(':
-         type = TK::L_BRACE;
-         break;
-      case ')':
-         type = TK::R_BRACE;
-         break;
-      case '{':
-         type = TK::L_C_BRKT;
-         break;
-      case '}':
-         type = TK::R_C_BRKT;
-         break;
-      case '~':
-         type = TK::BW_INV;
-         break;
-      case ',':
-         type = TK::COMMA;
-         break;
-      case ';':
-         type = TK::SEMICOLON;
-         break;
-      case '?':
-         type = TK::QMARK;
-         break;
-      case '+':
-         switch (chars[1]) {
-            case '+':
-               len = 2;
-               type = TK::INC;
-               break;
-            case '=':
-               len = 2;
-               type = TK::ADD_ASSIGN;
-               break;
-            default:
-               type = TK::PLUS;
-               break;
-         }
-         break;
-      case '-':
-         len = 2;
-         switch (chars[1]) {
-            case '-':
-               type = TK::DEC;
-               break;
-            case '>':
-               type = TK::DEREF;
-               break;
-            case '=':
-               type = TK::SUB_ASSIGN;
-               break;
-            default:
-               type = TK::MINUS;
-               len = 1;
-               break;
-         }
-         break;
-      case '*':
-         switch (chars[1]) {
-            case '=':
-               len = 2;
-               type = TK::MUL_ASSIGN;
-               break;
-            default:
-               type = TK::ASTERISK;
-               break;
-         }
-         break;
-      case '/':
-         switch (chars[1]) {
-            case '=':
-               len = 2;
-               type = TK::DIV_ASSIGN;
-               break;
-            default:
-               type = TK::DIV;
-               break;
-         }
-         break;
-      case '%':
-         switch (chars[1]) {
-            case '=':
-               len = 2;
-               type = TK::REM_ASSIGN;
-               break;
-            default:
-               type = TK::PERCENT;
-               break;
-         }
-         break;
-      case '&':
-         switch (chars[1]) {
-            case '=':
-               len = 2;
-               type = TK::BW_AND_ASSIGN;
-               break;
-            case '&':
-               len = 2;
-               type = TK::L_AND;
-               break;
-            default:
-               type = TK::BW_AND;
-               break;
-         }
-         break;
-      case '|':
-         switch (chars[1]) {
-            case '=':
-               len = 2;
-               type = TK::BW_OR_ASSIGN;
-               break;
-            case '|':
-               len = 2;
-               type = TK::L_OR;
-               break;
-            default:
-               type = TK::BW_OR;
-               break;
-         }
-         break;
-      case '^':
-         switch (chars[1]) {
-            case '=':
-               len = 2;
-               type = TK::BW_XOR_ASSIGN;
-               break;
-            default:
-               type = TK::BW_XOR;
-               break;
-         }
-         break;
-      case '!':
-         switch (chars[1]) {
-            case '=':
-               len = 2;
-               type = TK::NE;
-               break;
-            default:
-               type = TK::NEG;
-               break;
-         }
-         break;
-      case '=':
-         switch (chars[1]) {
-            case '=':
-               len = 2;
-               type = TK::EQ;
-               break;
-            default:
-               type = TK::ASSIGN;
-               break;
-         }
-         break;
-      case ':':
-         switch (chars[1]) {
-            case ':':
-               len = 2;
-               type = TK::D_COLON;
-               break;
-            default:
-               type = TK::COLON;
-               break;
-         }
-         break;
-      case '<':
-         switch (chars[1]) {
-            case '<':
-               len = 2;
-               switch (chars[2]) {
-                  case '=':
-                     len = 3;
-                     type = TK::SHL_ASSIGN;
-                     break;
-                  default:
-                     type = TK::SHL;
-                     break;
-               }
-               break;
-            case '=':
-               len = 2;
-               type = TK::LE;
-               break;
-            default:
-               type = TK::L_ANGLE;
-               break;
-         }
-         break;
-      case '>':
-         switch (chars[1]) {
-            case '>':
-               len = 2;
-               switch (chars[2]) {
-                  case '=':
-                     len = 3;
-                     type = TK::SHR_ASSIGN;
-                     break;
-                  default:
-                     type = TK::SHR;
-                     break;
-               }
-               break;
-            case '=':
-               len = 2;
-               type = TK::GE;
-               break;
-            default:
-               type = TK::R_ANGLE;
-               break;
-         }
-         break;
-      case '.':
-         if (chars[1] == '.' && chars[2] == '.') {
-            len = 3;
-            type = TK::ELLIPSIS;
-         } else {
-            type = TK::PERIOD;
-         }
-         break;
-      default:
-         type = TK::UNKNOWN;
-         *diagnostics_ << SrcLoc(progBegin_, prog_.begin(), prog_.begin()) << "unknown punctuator '" << chars[0] << '\'' << std::endl;
+   auto [type, len] = lex::PUNCTUATORS.match(begin, prog_.end());
+   if (len == 0) {
+      len = 1;
+      *diagnostics_ << SrcLoc(progBegin_, prog_.begin(), prog_.begin()) << "unknown punctuator '" << *begin << '\'' << std::endl;
    }
 
    SrcLoc loc{progBegin_, begin, begin + len};
@@ -679,20 +662,63 @@ sv_it Tokenizer::const_iterator::getPunctuator(sv_it begin) {
 }
 // ---------------------------------------------------------------------------
 sv_it Tokenizer::const_iterator::getSCharSequence(sv_it begin) {
-   auto [literal, sSeqEnd] = getCharSequence<'"'>(progBegin_, begin, prog_.end(), *diagnostics_);
-   token_ = Token{SrcLoc(progBegin_, begin, sSeqEnd), std::move(literal), TK::SLITERAL};
+   if (std::optional<sv_it> sSeqEnd = findPlainSequenceEnd<'"'>(begin, prog_.end())) {
+      token_ = Token{SrcLoc(progBegin_, begin, *sSeqEnd), TK::SLITERAL};
+      return *sSeqEnd;
+   }
+   sv_it sSeqEnd = getCharSequence<'"'>(progBegin_, begin, prog_.end(), diagnostics_, nullptr);
+   tokenizer_->strings_.emplace_back();
+   token_ = Token{SrcLoc(progBegin_, begin, sSeqEnd), TK::SLITERAL, static_cast<std::uint32_t>(tokenizer_->strings_.size())};
    return sSeqEnd;
 }
 // ---------------------------------------------------------------------------
 sv_it Tokenizer::const_iterator::getCCharSequence(sv_it begin) {
-   auto [literal, cSeqEnd] = getCharSequence<'\''>(progBegin_, begin, prog_.end(), *diagnostics_);
-   token_ = Token{SrcLoc(progBegin_, begin, cSeqEnd), std::move(literal), TK::CLITERAL}; // todo: check if move
+   if (std::optional<sv_it> cSeqEnd = findPlainSequenceEnd<'\''>(begin, prog_.end())) {
+      token_ = Token{SrcLoc(progBegin_, begin, *cSeqEnd), TK::CLITERAL};
+      return *cSeqEnd;
+   }
+   sv_it cSeqEnd = getCharSequence<'\''>(progBegin_, begin, prog_.end(), diagnostics_, nullptr);
+   tokenizer_->strings_.emplace_back();
+   token_ = Token{SrcLoc(progBegin_, begin, cSeqEnd), TK::CLITERAL, static_cast<std::uint32_t>(tokenizer_->strings_.size())};
    return cSeqEnd;
 }
 // ---------------------------------------------------------------------------
+bool Tokenizer::const_iterator::refill() {
+   if (!stream_) {
+      return false;
+   }
+   std::size_t size = std::distance(progBegin_, prog_.end());
+   std::size_t available = stream_->wait(size);
+   if (available == size) {
+      return false;
+   }
+   prog_ = std::string_view{prog_.data(), prog_.size() + (available - size)};
+   diagnostics_->extendProgram(std::string_view{progBegin_, progBegin_ + available});
+   return true;
+}
+// ---------------------------------------------------------------------------
+Tokenizer::const_iterator::const_iterator(const Tokenizer &tokenizer, std::size_t begin, std::size_t limit, bool lineStart, int pp) : token_{TK::UNKNOWN}, prog_{tokenizer.prog_.substr(begin)}, progBegin_{tokenizer.prog_.begin()}, pp{pp}, tokenizer_{&tokenizer}, diagnostics_{&tokenizer.diagnostics_}, stream_{tokenizer.stream_}, limit_{limit} {
+   if (lineStart && begin < limit && !prog_.empty() && prog_.front() == '#') {
+      // like after a line break, the one at the start of the program has a location
+      token_ = begin ? Token(TK::PP_START) : Token{SrcLoc{0, 1u}, TK::PP_START};
+      this->pp = 1;
+      prog_ = prog_.substr(1);
+   } else {
+      ++(*this);
+   }
+}
+// ---------------------------------------------------------------------------
+Tokenizer::const_iterator &Tokenizer::const_iterator::stopAt(sv_it begin) {
+   // another iterator continues from here
+   prog_ = prog_.substr(std::distance(prog_.begin(), begin));
+   stop_ = static_cast<std::size_t>(std::distance(progBegin_, begin));
+   token_ = Token(TK::END);
+   return *this;
+}
+// ---------------------------------------------------------------------------
 Tokenizer::const_iterator &Tokenizer::const_iterator::operator++() {
    prevLoc_ = token_.getLoc();
-   if (prog_.empty()) {
+   if (prog_.empty() && !refill()) {
       token_ = Token(TK::END);
       return *this;
    }
@@ -700,16 +726,23 @@ Tokenizer::const_iterator &Tokenizer::const_iterator::operator++() {
    // find begin of next word
    decltype(prog_)::const_iterator begin = prog_.begin();
 find_token_start:
-   begin = std::find_if(begin, prog_.end(), [](char c) { return isPunctuatorStart(c) or isIdentStart(c) or isDigit(c) or c == '"' or c == '\'' or c == '\n'; });
+   if (static_cast<std::size_t>(std::distance(progBegin_, begin)) >= limit_) {
+      return stopAt(begin);
+   }
+   begin = simd::findTokenStart(begin, prog_.end());
+   if (begin == prog_.end() && refill()) {
+      goto find_token_start;
+   }
    if (begin != prog_.end() && *begin == '\n') {
-      diagnostics_->registerLineBreak(std::distance(progBegin_, begin));
       if (pp) {
          token_ = Token(TK::PP_END);
          pp = 0;
          return *this;
       }
       ++begin;
-      if (begin == prog_.end()) {
+      if (static_cast<std::size_t>(std::distance(progBegin_, begin)) >= limit_) {
+         return stopAt(begin);
+      } else if (begin == prog_.end() && !refill()) {
          token_ = Token(TK::END);
          return *this;
       } else if (*begin == '#') {
@@ -735,14 +768,18 @@ find_token_start:
    if (isPunctuatorStart(*begin) && !(*begin == '.' and isDigit(second))) {
       // todo: this should be preprocessor?
       if (*begin == '/' && second == '/') {
-         end = std::find_if(begin + 2, prog_.end(), [](char c) { return c == '\n'; });
-         diagnostics_->registerLineBreak(std::distance(progBegin_, end));
+         end = simd::findNewline(begin + 2, prog_.end());
+         while (end == prog_.end() && refill()) {
+            end = simd::findNewline(begin + 2, prog_.end());
+         }
          prog_ = prog_.substr(std::distance(prog_.begin(), end) + 1);
          begin = prog_.begin();
          goto find_token_start;
       } else if (*begin == '/' && second == '*') {
-         const char *commentEnd = "*/";
-         end = std::search(begin + 1, prog_.end(), commentEnd, commentEnd + 2);
+         end = simd::findCommentEnd(begin + 1, prog_.end());
+         while (end == prog_.end() && refill()) {
+            end = simd::findCommentEnd(begin + 1, prog_.end());
+         }
          if (end == prog_.end()) {
             *diagnostics_ << SrcLoc(progBegin_, begin, end) << "unterminated comment" << std::endl;
          }
@@ -752,11 +789,10 @@ find_token_start:
       } else {
          end = getPunctuator(begin);
       }
-      end = getPunctuator(begin);
    } else if (isIdentStart(*begin)) {
       requiresSeparator = true;
       // todo: (jr) u8, u, U, L prefix not supported
-      end = std::find_if_not(begin, prog_.end(), isIdentCont);
+      end = simd::findIdentEnd(begin, prog_.end());
       std::string_view ident{begin, end};
       const token::GPerfToken *t = token::ReservedKeywordHash::isInWordSet(ident.data(), ident.size());
       // todo: (jr) handle constants
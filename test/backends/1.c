@@ -0,0 +1,51 @@
+// integer arithmetic, comparisons and control flow
+int printf(const char *, ...);
+static int counter;
+int fib(int n) {
+   if (n < 2) return n;
+   return fib(n - 1) + fib(n - 2);
+}
+int sw(int v) {
+   switch (v) {
+      case 0: return 10;
+      case 1: return 20;
+      case 100: return 30;
+      case -5: return 40;
+      default: return -1;
+   }
+   return -2;
+}
+unsigned udiv(unsigned a, unsigned b) { return a / b + a % b; }
+int sdiv(int a, int b) { return a / b * 100 + a % b; }
+long shifts(long a, int n) { return (a << n) ^ (a >> n); }
+unsigned long ushifts(unsigned long a, int n) { return (a << n) | (a >> n); }
+int main(void) {
+   counter++;
+   ++counter;
+   counter--;
+   int s = 0;
+   for (int i = 0; i < 20; i++) {
+      if (i > 15) break;
+      if (i % 3) s += fib(i);
+   }
+   int k = 0;
+   while (k < 10) {
+      k++;
+      if (k & 1) continue;
+      s -= k;
+   }
+   int w = 0;
+   while (w < 100) w = w * 2 + 1;
+   do w -= 7; while (w > 50);
+   printf("counter %d s %d w %d\n", counter, s, w);
+   printf("sw %d %d %d %d %d\n", sw(0), sw(1), sw(100), sw(-5), sw(7));
+   printf("div %u %d %d\n", udiv(17u, 5u), sdiv(-17, 5), sdiv(17, -5));
+   printf("shifts %ld %ld %lu\n", shifts(-123456789, 5), shifts(987654321, 13), ushifts(123456789, 7));
+   unsigned char uc = 200;
+   signed char sc = -3;
+   short sh = -30000;
+   unsigned long ul = 18446744073709551615UL;
+   printf("conv %d %d %d %lu %d\n", uc > 100 && sc < 0, (unsigned char) (uc + 100), sh * 2, ul, ul > 5);
+   printf("logic %d %d %d\n", s > 10 && w < 60, s < 0 || w == 56, !s);
+   return 0;
+}
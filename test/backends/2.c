@@ -0,0 +1,33 @@
+// floating point values, conversions and calls with many arguments
+int printf(const char *, ...);
+double gd = 1.25;
+float gf = 0.5f;
+long many(int a, int b, int c, int d, int e, int f, int g, long h, double x, float y) {
+   return a + b + c + d + e + f + g + h + (long) x + (long) y;
+}
+double fmix(double a, float b, int c) { return a * b + c - a / 4.0; }
+double poly(double x) {
+   double r = 0;
+   for (int i = 0; i < 5; i++) r = r * x + i;
+   return r;
+}
+int main(void) {
+   printf("many %ld\n", many(1, 2, 3, 4, 5, 6, 7, 8, 9.5, 10.5f));
+   printf("fmix %f\n", fmix(3.0, 2.0f, 4));
+   printf("poly %f %f\n", poly(0.5), poly(0.5 - 3.5));
+   double d = gd;
+   d *= 2;
+   d -= 0.25;
+   float f = gf;
+   f += 1;
+   printf("cmp %f %f %d %d %d\n", d, (double) f, d > f, d < f, d == d);
+   unsigned u = 5;
+   long n = -7;
+   double du = u;
+   double dn = n;
+   double neg = 0.25 - 3.0;
+   double big = 1e10;
+   float small = 3.99f;
+   printf("conv %f %f %d %ld %lu\n", du, dn, (int) neg, (long) big, (unsigned long) small);
+   return 0;
+}
@@ -0,0 +1,43 @@
+// pointers, arrays and strings
+int printf(const char *, ...);
+int table[8];
+const char *names[3];
+void sort(int *a, int n) {
+   for (int i = 1; i < n; i++) {
+      int v = a[i];
+      int j = i - 1;
+      while (j >= 0 && a[j] > v) {
+         a[j + 1] = a[j];
+         j--;
+      }
+      a[j + 1] = v;
+   }
+}
+int length(const char *s) {
+   int n = 0;
+   while (s[n]) n++;
+   return n;
+}
+void fill(char *dst, const char *src, int n) {
+   for (int i = 0; i < n; i++) dst[i] = src[i];
+   dst[n] = 0;
+}
+int main(void) {
+   for (int i = 0; i < 8; i++) table[i] = (i * 5 + 3) % 8 * 3 - 7;
+   sort(table, 8);
+   for (int i = 0; i < 8; i++) printf("%d ", table[i]);
+   printf("\n");
+   int m[3][4];
+   for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 4; j++) m[i][j] = i * j;
+   int *flat = &m[0][0];
+   int *last = &flat[11];
+   printf("m %d %d %d %d\n", m[2][3], flat[7], flat[11], *last - last[-5]);
+   names[0] = "zero";
+   names[1] = "one";
+   names[2] = "two";
+   char buf[16];
+   fill(buf, names[1], length(names[1]));
+   printf("names %s %s %d %d %s\n", names[1], names[2], length(names[0]), length("hello, world"), buf);
+   return 0;
+}
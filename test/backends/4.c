@@ -0,0 +1,20 @@
+// the exit status and the output written before exit
+int printf(const char *, ...);
+void exit(int);
+static int total;
+static int add(int x) {
+   total += x;
+   return total;
+}
+const char *name(int i) {
+   if (i) return "one";
+   return "zero";
+}
+int main(void) {
+   for (int i = 0; i < 5000; i++) {
+      add(i);
+      name(i & 1);
+   }
+   printf("%d %s\n", total, name(1));
+   exit(total % 251);
+}
@@ -0,0 +1,14 @@
+// calls through function pointers
+int printf(const char *, ...);
+int sq(int x) { return x * x; }
+int neg(int x) { return -x; }
+int apply(int (*f)(int), int v) { return f(v); }
+int (*ops[2])(int);
+int main(void) {
+   int (*fp)(int) = sq;
+   int (*gp)(int) = neg;
+   ops[0] = gp;
+   ops[1] = fp;
+   printf("fp %d %d %d %d\n", fp(7), apply(gp, 5), ops[1](9), ops[0](9));
+   return 0;
+}
@@ -0,0 +1,102 @@
+#ifndef TEST_BACKENDS_H
+#define TEST_BACKENDS_H
+// ---------------------------------------------------------------------------
+// qcp
+// ---------------------------------------------------------------------------
+#include "bytecodeemitter.h"
+#include "diagnostics.h"
+#include "directemitter.h"
+#include "gtest/gtest.h"
+#include "parser.h"
+// ---------------------------------------------------------------------------
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+// ---------------------------------------------------------------------------
+// the programs in test/backends are compiled by the llvm backend and by the other backends,
+// the programs have to print the same output and exit with the same status
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+class backendtest : public testing::TestWithParam<int> {};
+class bytecodetest : public testing::TestWithParam<int> {};
+// ---------------------------------------------------------------------------
+std::string backendProgram(int i) {
+   return std::string{QCP_TEST_DIR} + "/backends/" + std::to_string(i) + ".c";
+}
+// ---------------------------------------------------------------------------
+std::string readOutput(const std::string& filename) {
+   std::ifstream file(filename);
+   std::stringstream content;
+   content << file.rdbuf();
+   return content.str();
+}
+// ---------------------------------------------------------------------------
+// the exit status of the command, -1 if it did not exit
+int runCommand(const std::string& command) {
+   int status = std::system(command.c_str());
+   return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+// ---------------------------------------------------------------------------
+// compiles the program with qcp and the given arguments, links it with cc and runs it
+int compileAndRun(const std::string& program, const std::string& args, const std::string& out) {
+   std::string qcp{QCP_BINARY};
+   if (runCommand(qcp + ' ' + args + " -c " + program + " -o " + out + ".o") || runCommand("cc " + out + ".o -o " + out)) {
+      return -1;
+   }
+   return runCommand(out + " > " + out + ".txt");
+}
+// ---------------------------------------------------------------------------
+// the backends fall back to llvm for unsupported programs, which would make the comparison pointless
+template <typename T>
+bool isSupported(const std::string& program, std::stringstream& log) {
+   std::string code = readOutput(program);
+   qcp::DiagnosticTracker diag{program, code, log};
+   qcp::Parser<T> parser{code, diag, log};
+   parser.addIntTypeDef("__builtin_va_list");
+   parser.parse();
+   return diag.empty() && parser.getEmitter().supported();
+}
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+TEST_P(backendtest, direct) {
+   std::string program = backendProgram(GetParam());
+   std::stringstream log;
+   ASSERT_TRUE(isSupported<qcp::emitter::DirectEmitter>(program, log)) << program << " is not supported by the backend\n"
+                                                                      << log.str();
+
+   std::string prefix = "/tmp/qcp_backend_" + std::to_string(GetParam());
+   int expectedStatus = compileAndRun(program, "", prefix + "_llvm");
+   ASSERT_NE(expectedStatus, -1) << "the llvm backend failed to compile " << program;
+   int status = compileAndRun(program, "--backend=direct", prefix + "_direct");
+   ASSERT_EQ(status, expectedStatus);
+   ASSERT_EQ(readOutput(prefix + "_direct.txt"), readOutput(prefix + "_llvm.txt"));
+}
+// ---------------------------------------------------------------------------
+TEST_P(bytecodetest, run) {
+   std::string program = backendProgram(GetParam());
+   std::stringstream log;
+   ASSERT_TRUE(isSupported<qcp::emitter::BytecodeEmitter>(program, log)) << program << " is not supported by the backend\n"
+                                                                        << log.str();
+
+   std::string prefix = "/tmp/qcp_backend_" + std::to_string(GetParam());
+   int expectedStatus = compileAndRun(program, "", prefix + "_llvm");
+   ASSERT_NE(expectedStatus, -1) << "the llvm backend failed to compile " << program;
+   int status = runCommand(std::string{QCP_BINARY} + " --backend=bytecode --run " + program + " > " + prefix + "_bytecode.txt");
+   ASSERT_EQ(status, expectedStatus);
+   ASSERT_EQ(readOutput(prefix + "_bytecode.txt"), readOutput(prefix + "_llvm.txt"));
+}
+// ---------------------------------------------------------------------------
+TEST(BytecodeBackend, addressTakenFunctionsAreLeftToTheJIT) {
+   // native code could call the functions whose address is taken, the interpreter cannot provide them
+   std::stringstream log;
+   ASSERT_FALSE(isSupported<qcp::emitter::BytecodeEmitter>(backendProgram(5), log)) << log.str();
+}
+// ---------------------------------------------------------------------------
+INSTANTIATE_TEST_CASE_P(Backends, backendtest, testing::Range(1, 6));
+INSTANTIATE_TEST_CASE_P(Backends, bytecodetest, testing::Range(1, 5));
+// ---------------------------------------------------------------------------
+#endif // TEST_BACKENDS_H
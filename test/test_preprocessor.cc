@@ -0,0 +1,102 @@
+// ---------------------------------------------------------------------------
+#include "gtest/gtest.h"
+#include "preprocessor.h"
+// ---------------------------------------------------------------------------
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+// ---------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------
+// the output lines of the preprocessor without line markers and empty lines
+std::string preprocess(const std::string& src, std::ostream& log) {
+   qcp::pp::FileCache cache{};
+   qcp::pp::Preprocessor pp{cache, log};
+   pp.addIncludeDir(QCP_TEST_DIR);
+   std::string out;
+   if (!pp.run(std::make_shared<qcp::pp::FileCache::File>(qcp::pp::FileCache::File{"<test>", src, 0, static_cast<std::int64_t>(src.size())}), out)) {
+      return "<error>";
+   }
+   std::stringstream lines{out};
+   std::string res;
+   for (std::string line; std::getline(lines, line);) {
+      line.erase(0, line.find_first_not_of(" \t"));
+      line.erase(line.find_last_not_of(" \t") + 1);
+      if (line.empty() || line.starts_with("# ")) {
+         continue;
+      }
+      res += res.empty() ? line : '\n' + line;
+   }
+   return res;
+}
+// ---------------------------------------------------------------------------
+// source and the expected output
+std::pair<std::string, std::string> directiveList[] = {
+    {"#define A 1\nA", "1"},
+    {"#ifdef A\nyes\n#else\nno\n#endif", "no"},
+    {"#define A\n#ifdef A\nyes\n#endif", "yes"},
+    {"#ifndef A\nyes\n#endif", "yes"},
+    {"#define A\n#undef A\n#ifdef A\nyes\n#else\nno\n#endif", "no"},
+    {"#if 1 + 2 * 3 == 7\nyes\n#else\nno\n#endif", "yes"},
+    {"#if (1 ? 2 : 3) != 2 || -1 > 0\nyes\n#else\nno\n#endif", "no"},
+    {"#define N 4\n#if N << 1 == 8\nyes\n#endif", "yes"},
+    {"#if UNKNOWN\nyes\n#else\nno\n#endif", "no"},
+    {"#if 0\na\n#elif 1\nb\n#else\nc\n#endif", "b"},
+    {"#if 0\n#if 1\na\n#endif\n#else\nb\n#endif", "b"},
+    {"#define B\n#ifdef A\na\n#elifdef B\nb\n#endif", "b"},
+    {"#if defined(A) || !defined B\nyes\n#endif", "yes"},
+    // headers test for __has_include before they use it
+    {"#ifdef __has_include\nyes\n#else\nno\n#endif", "yes"},
+    {"#ifndef __has_include\nyes\n#else\nno\n#endif", "no"},
+    {"#if 0\n#elifdef __has_include\nyes\n#endif", "yes"},
+    {"#if defined(__has_include) && defined __has_include\nyes\n#endif", "yes"},
+    {"#if defined __has_include\n#if __has_include(<test_parser.h>)\nfound\n#endif\n#endif", "found"},
+    {"#if __has_include(\"no_such_header.h\")\nfound\n#else\nmissing\n#endif", "missing"},
+};
+// ---------------------------------------------------------------------------
+std::pair<std::string, std::string> expansionList[] = {
+    {"#define A B\n#define B 2\nA", "2"},
+    {"#define A A + 1\nA", "A + 1"},
+    {"#define F(x) x + 1\nF(2)", "2 + 1"},
+    {"#define F(x, y) y x\nF((a, b), c)", "c (a, b)"},
+    {"#define F(x) x\nF", "F"},
+    {"#define cat(a, b) a ## b\ncat(x, y)", "xy"},
+    {"#define cat(a, b) a ## b\ncat(1, 2)", "12"},
+    {"#define V(...) __VA_ARGS__\nV(1, 2)", "1, 2"},
+    {"#define V(x, ...) x(__VA_ARGS__)\nV(f, 1, 2)", "f(1, 2)"},
+    {"#define str(x) #x\nstr(a   b)", "\"a b\""},
+    // the example of C11 6.10.3.2p2, a backslash outside of literals is kept
+    {"#define str(x) #x\nstr(: @\\n)", "\": @\\n\""},
+    {"#define str(x) #x\nstr(\"a\\n\" '\\'')", "\"\\\"a\\\\n\\\" '\\\\''\""},
+    {"#define xstr(x) str(x)\n#define str(x) #x\n#define N 4\nxstr(N) str(N)", "\"4\" \"N\""},
+    // the example of C11 6.10.3.5p5
+    {"#define f(a) a*g\n#define g(a) f(a)\nf(2)(9)", "2*9*g"},
+};
+// ---------------------------------------------------------------------------
+class DirectivePP : public ::testing::TestWithParam<std::pair<std::string, std::string>> {
+};
+// ---------------------------------------------------------------------------
+class ExpansionPP : public ::testing::TestWithParam<std::pair<std::string, std::string>> {
+};
+// ---------------------------------------------------------------------------
+} // namespace
+// ---------------------------------------------------------------------------
+TEST_P(DirectivePP, GetsEvaluated) {
+   auto [src, expected] = GetParam();
+   std::stringstream log;
+   ASSERT_EQ(preprocess(src, log), expected) << "Input string: " << std::quoted(src) << '\n'
+                                             << log.str();
+}
+// ---------------------------------------------------------------------------
+TEST_P(ExpansionPP, GetsExpanded) {
+   auto [src, expected] = GetParam();
+   std::stringstream log;
+   ASSERT_EQ(preprocess(src, log), expected) << "Input string: " << std::quoted(src) << '\n'
+                                             << log.str();
+}
+// ---------------------------------------------------------------------------
+INSTANTIATE_TEST_CASE_P(Directive, DirectivePP, ::testing::ValuesIn(directiveList));
+INSTANTIATE_TEST_CASE_P(Expansion, ExpansionPP, ::testing::ValuesIn(expansionList));
+// ---------------------------------------------------------------------------
@@ -9,7 +9,12 @@
 #include "tokenizer.h"
 // ---------------------------------------------------------------------------
 #include <array>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 // ---------------------------------------------------------------------------
 namespace {
 // ---------------------------------------------------------------------------
@@ -218,31 +223,71 @@ std::string invalidIconstList[] = {
     "0xGHIJ",
 };
 // ---------------------------------------------------------------------------
-std::array<std::string, 20> stringLiteralList{
-    "\"Simple string\"",
-    "\"\"", // Empty string
-    "\"single quote (')\"",
-    "\"double quote (\\\")\"",
-    "\"backslash (\\\\)\"",
-    "\"tab (\\t)\"",
-    "\"newline (\\n)\"",
-    "\"carriage return (\\r)\"",
-    "\"escape sequence (\\x1B[31m) for red color\"",
-    {"\"embedded (\\0) null in text\"", 28},
+// a literal, its kind and value and whether using the value is reported as an error
+std::tuple<std::string, tk, long double, bool> numberEdgeCaseList[] = {
+    {"0x1p0", tk::DCONST, 1.0, false},
+    {"0x1.8p1", tk::DCONST, 3.0, false},
+    {"0X.8P-1", tk::DCONST, 0.25, false},
+    {"0xA.Bp4", tk::DCONST, 171.0, false},
+    {"0x1p-2f", tk::FCONST, 0.25, false},
+    {"0x1'0p0", tk::DCONST, 16.0, false},
+    {"1'000.5", tk::DCONST, 1000.5, false},
+    {"1'0e1'0", tk::DCONST, 1e11, false},
+    {".5", tk::DCONST, 0.5, false},
+    {"5.", tk::DCONST, 5.0, false},
+    {"0.1f", tk::FCONST, 0.1f, false},
+    {"1e308", tk::DCONST, 1e308, false},
+    {"1e-400", tk::DCONST, 0.0, true},
+    {"1e-400f", tk::FCONST, 0.0, true},
+    {"10u", tk::U_ICONST, 10, false},
+    {"10ll", tk::LL_ICONST, 10, false},
+    {"10ull", tk::ULL_ICONST, 10, false},
+    {"0777u", tk::U_ICONST, 511, false},
+    {"0b1'0000u", tk::U_ICONST, 16, false},
+    {"9'223'372'036'854'775'807ll", tk::LL_ICONST, 9223372036854775807.0L, false},
+    {"18446744073709551615ull", tk::ULL_ICONST, 18446744073709551615.0L, false},
+    {"18446744073709551616ull", tk::ULL_ICONST, 18446744073709551615.0L, true},
+    {"0x1'0000'0000'0000'0000ull", tk::ULL_ICONST, 18446744073709551615.0L, true},
+};
+// ---------------------------------------------------------------------------
+// the source of a literal and its bytes
+std::pair<std::string, std::string> stringLiteralList[] = {
+    {"\"Simple string\"", "Simple string"},
+    {"\"\"", ""}, // Empty string
+    {"\"single quote (')\"", "single quote (')"},
+    {"\"double quote (\\\")\"", "double quote (\")"},
+    {"\"backslash (\\\\)\"", "backslash (\\)"},
+    {"\"tab (\\t)\"", "tab (\t)"},
+    {"\"newline (\\n)\"", "newline (\n)"},
+    {"\"carriage return (\\r)\"", "carriage return (\r)"},
+    {"\"escape sequence (\\x1B[31m) for red color\"", "escape sequence (\x1B[31m) for red color"},
+    {"\"embedded (\\0) null in text\"", {"embedded (\0) null in text", 25}},
     // "\"unicodes (\\u03A9 \\u03C0)\"",
-    "\"hex escape (\\x48\\x65\\x6C\\x6C\\x6F)\"",
-    "\"octal escape (\\1\\12\\110\\145\\154\\154\\157)\"",
-    "\"escape sequence (\\n\\t\\\'\\\"\\\\)\"",
-    "\"\\\"starts and ends with quote\\\"\"",
-    "\"\\\'String starts and ends with a single quote but is not char sequence\\\'\"",
-    "\"a /* block comment */ inside\"",
-    "\"a // line comment inside\"",
-    "\"`backticks`\"",
-    "\"special characters $!@#%^&*()-+=[]{}|;:,.<>?/\"",
-    "\"octal escape \\7 \\42 \\123 \"",
+    {"\"hex escape (\\x48\\x65\\x6C\\x6C\\x6F)\"", "hex escape (Hello)"},
+    {"\"octal escape (\\1\\12\\110\\145\\154\\154\\157)\"", "octal escape (\1\12Hello)"},
+    {"\"escape sequence (\\n\\t\\\'\\\"\\\\)\"", "escape sequence (\n\t\'\"\\)"},
+    {"\"\\\"starts and ends with quote\\\"\"", "\"starts and ends with quote\""},
+    {"\"\\\'String starts and ends with a single quote but is not char sequence\\\'\"", "'String starts and ends with a single quote but is not char sequence'"},
+    {"\"a /* block comment */ inside\"", "a /* block comment */ inside"},
+    {"\"a // line comment inside\"", "a // line comment inside"},
+    {"\"`backticks`\"", "`backticks`"},
+    {"\"special characters $!@#%^&*()-+=[]{}|;:,.<>?/\"", "special characters $!@#%^&*()-+=[]{}|;:,.<>?/"},
+    {"\"octal escape \\7 \\42 \\123 \"", "octal escape \7 \42 \123 "},
     // "\"non-standard escape \\e for ASCII escape \"",
 };
 // ---------------------------------------------------------------------------
+// adjacent literals and the bytes of their concatenation
+std::pair<std::string, std::string> concatenationList[] = {
+    {"\"plain\" \"text\"", "plaintext"},
+    {"\"a\" \"\\n\" \"b\\tc\" \"plain\"", "a\nb\tcplain"},
+    {"\"\\x41\" \"B\"", "AB"},
+    {"\"A\" \"\\x42\"", "AB"},
+    {"\"\\101\" \"\\102\" \"\\103\"", "ABC"},
+    {"\"\" \"\\\"quoted\\\"\" \"\"", "\"quoted\""},
+    {"\"x\"\n\"\\0\"\t\"y\"", {"x\0y", 3}},
+    {"\"end\\\\\" \"\\\\start\"", "end\\\\start"},
+};
+// ---------------------------------------------------------------------------
 class TokenMap : public ::testing::TestWithParam<std::pair<tk, std::string>> {
 };
 // ---------------------------------------------------------------------------
@@ -255,7 +300,13 @@ class IConstTK : public ::testing::TestWithParam<std::pair<std::string, std::siz
 class InvalidIConstTK : public ::testing::TestWithParam<std::string> {
 };
 // ---------------------------------------------------------------------------
-class StringLiteralTK : public ::testing::TestWithParam<std::string> {
+class NumberEdgeCaseTK : public ::testing::TestWithParam<std::tuple<std::string, tk, long double, bool>> {
+};
+// ---------------------------------------------------------------------------
+class StringLiteralTK : public ::testing::TestWithParam<std::pair<std::string, std::string>> {
+};
+// ---------------------------------------------------------------------------
+class ConcatenationTK : public ::testing::TestWithParam<std::pair<std::string, std::string>> {
 };
 // ---------------------------------------------------------------------------
 TEST_P(TokenMap, GetsRecognized) {
@@ -263,7 +314,7 @@ TEST_P(TokenMap, GetsRecognized) {
    for (auto& prefix : whiteSpaces) {
       for (auto& suffix : whiteSpaces) {
          std::string src{prefix + word + suffix};
-         qcp::DiagnosticTracker diagnostics{src};
+         qcp::DiagnosticTracker diagnostics{"<test>", src};
          qcp::Tokenizer ts{src, diagnostics};
          auto it = ts.begin();
          ASSERT_EQ(it->getKind(), token) << "Input string: " << std::quoted(src);
@@ -280,7 +331,7 @@ TEST_P(IdentTK, GetsRecognized) {
          src += word;
          src += suffix;
 
-         qcp::DiagnosticTracker diagnostics{src};
+         qcp::DiagnosticTracker diagnostics{"<test>", src};
          qcp::Tokenizer ts{src, diagnostics};
          auto it = ts.begin();
          ASSERT_EQ(it->getKind(), tk::IDENT) << "Input string: " << std::quoted(src);
@@ -303,11 +354,11 @@ void test_iconst(const std::string& word, const std::vector<std::string>& suffix
             src += suffix;
             src += wsSuffix;
 
-            qcp::DiagnosticTracker diagnostics{src};
+            qcp::DiagnosticTracker diagnostics{"<test>", src};
             qcp::Tokenizer ts{src, diagnostics};
             auto it = ts.begin();
             ASSERT_EQ(it->getKind(), type) << "Input string: " << std::quoted(src);
-            ASSERT_EQ(it->getValue<T>(), value) << "Input string: " << std::quoted(src);
+            ASSERT_EQ(ts.getValue<T>(*it), value) << "Input string: " << std::quoted(src);
             ASSERT_EQ(++it, ts.end()) << "Input string: " << std::quoted(src);
          }
       }
@@ -334,22 +385,43 @@ TEST_P(IConstTK, GetsRecognized) {
 }
 // ---------------------------------------------------------------------------
 TEST_P(StringLiteralTK, GetsRecognized) {
-   auto word = GetParam();
+   auto [word, bytes] = GetParam();
    std::array whiteSpaces{"", " ", "   ", "\t", "\n", "\r", "\r\n", " \t ", " \n ", " \r ", " \r\n "};
    for (auto& prefix : whiteSpaces) {
       for (auto& suffix : whiteSpaces) {
          std::string src{prefix + word + suffix};
 
-         qcp::DiagnosticTracker diagnostics{src};
+         qcp::DiagnosticTracker diagnostics{"<test>", src};
          qcp::Tokenizer ts{src, diagnostics};
          auto it = ts.begin();
          ASSERT_EQ(it->getKind(), tk::SLITERAL);
-         ASSERT_EQ(it->getValue<std::string_view>(), word.substr(1, word.size() - 2));
+         ASSERT_EQ(ts.getString(*it), bytes);
          ASSERT_EQ(++it, ts.end());
       }
    }
 }
 // ---------------------------------------------------------------------------
+TEST_P(ConcatenationTK, GetsConcatenated) {
+   auto [words, bytes] = GetParam();
+   std::string src{words + ";"};
+   qcp::DiagnosticTracker diagnostics{"<test>", src};
+   qcp::Tokenizer ts{src, diagnostics};
+   // concatenated like the parser does for primary expressions
+   auto it = ts.begin();
+   ASSERT_EQ(it->getKind(), tk::SLITERAL) << "Input string: " << std::quoted(src);
+   Token first = *it;
+   std::string alone{ts.getString(first)};
+   std::string_view str = ts.getString(first);
+   for (++it; it->getKind() == tk::SLITERAL; ++it) {
+      str = ts.getString(str, *it);
+   }
+   ASSERT_EQ(str, bytes) << "Input string: " << std::quoted(src);
+   ASSERT_EQ(it->getKind(), tk::SEMICOLON) << "Input string: " << std::quoted(src);
+   // the first literal keeps its own bytes
+   ASSERT_EQ(ts.getString(first), alone) << "Input string: " << std::quoted(src);
+   ASSERT_TRUE(diagnostics.empty()) << "Input string: " << std::quoted(src);
+}
+// ---------------------------------------------------------------------------
 TEST_P(InvalidIConstTK, invalidIConstNotParsed) {
    auto word = GetParam();
    for (auto& prefix : whiteSpaces) {
@@ -357,22 +429,173 @@ TEST_P(InvalidIConstTK, invalidIConstNotParsed) {
          std::string src{prefix};
          src += word;
          src += suffix;
-         qcp::DiagnosticTracker diagnostics{src};
-         qcp::Tokenizer<qcp::DiagnosticTracker> ts{src, diagnostics};
+         qcp::DiagnosticTracker diagnostics{"<test>", src};
+         qcp::Tokenizer ts{src, diagnostics};
          for (auto token : ts) {
-            (void) token;
+            // numbers are checked when their value is used
+            if (token.getKind() >= tk::ICONST && token.getKind() <= tk::ULL_ICONST) {
+               (void) ts.getValue<unsigned long long>(token);
+            }
          }
          ASSERT_FALSE(diagnostics.empty()) << "Input string: " << std::quoted(src);
       }
    }
 }
 // ---------------------------------------------------------------------------
+TEST_P(NumberEdgeCaseTK, GetsConverted) {
+   auto [word, type, value, error] = GetParam();
+   std::string src{word + ";"};
+   std::ostringstream log{};
+   qcp::DiagnosticTracker diagnostics{"<test>", src, log};
+   qcp::Tokenizer ts{src, diagnostics};
+   auto it = ts.begin();
+   ASSERT_EQ(it->getKind(), type) << "Input string: " << std::quoted(src);
+   // numbers are converted when their value is used
+   ASSERT_TRUE(diagnostics.empty()) << "Input string: " << std::quoted(src);
+   if (type == tk::FCONST || type == tk::DCONST) {
+      ASSERT_EQ(ts.getValue<double>(*it), static_cast<double>(value)) << "Input string: " << std::quoted(src);
+   } else {
+      ASSERT_EQ(ts.getValue<unsigned long long>(*it), static_cast<unsigned long long>(value)) << "Input string: " << std::quoted(src);
+   }
+   ASSERT_EQ(diagnostics.empty(), !error) << "Input string: " << std::quoted(src) << '\n' << log.str();
+   ASSERT_EQ((++it)->getKind(), tk::SEMICOLON) << "Input string: " << std::quoted(src);
+}
+// ---------------------------------------------------------------------------
 INSTANTIATE_TEST_CASE_P(Punctuator, TokenMap, ::testing::ValuesIn(punctuatorMap));
 INSTANTIATE_TEST_CASE_P(Keyword, TokenMap, ::testing::ValuesIn(keywordMap));
 INSTANTIATE_TEST_CASE_P(Identifier, IdentTK, ::testing::ValuesIn(identifierList));
 INSTANTIATE_TEST_CASE_P(IntegerConstant, IConstTK, ::testing::ValuesIn(iconstList));
 INSTANTIATE_TEST_CASE_P(InvalidIntegerConstant, InvalidIConstTK, ::testing::ValuesIn(invalidIconstList));
+INSTANTIATE_TEST_CASE_P(NumberEdgeCase, NumberEdgeCaseTK, ::testing::ValuesIn(numberEdgeCaseList));
 INSTANTIATE_TEST_CASE_P(StringLiteral, StringLiteralTK, ::testing::ValuesIn(stringLiteralList));
+INSTANTIATE_TEST_CASE_P(Concatenation, ConcatenationTK, ::testing::ValuesIn(concatenationList));
+// ---------------------------------------------------------------------------
+// a token with its location and decoded value, to compare the tokens of different tokenizers
+std::string describe(const qcp::Tokenizer& ts, const Token& token) {
+   std::ostringstream os;
+   os << token << '@' << token.getLoc().loc() << ':' << token.getLoc().len();
+   switch (token.getKind()) {
+      case tk::IDENT:
+         os << '=' << token.getIdent().getTag();
+         break;
+      case tk::ICONST:
+      case tk::U_ICONST:
+      case tk::L_ICONST:
+      case tk::UL_ICONST:
+      case tk::LL_ICONST:
+      case tk::ULL_ICONST:
+         os << '=' << ts.getValue<unsigned long long>(token);
+         break;
+      case tk::FCONST:
+      case tk::DCONST:
+         os << '=' << ts.getValue<double>(token);
+         break;
+      case tk::SLITERAL:
+      case tk::CLITERAL:
+         os << '=' << std::quoted(ts.getString(token));
+         break;
+      default:
+         break;
+   }
+   return os.str();
+}
+// ---------------------------------------------------------------------------
+TEST(Tokenizer, LocationsAfterCommentsAndLineMarkers) {
+   std::string src{"int a; /* one\n"
+                   "two\n"
+                   "three */ int b;\n"
+                   "# 10 \"b.c\"\n"
+                   "/* x\n"
+                   " y */  c;\n"
+                   "# 3 \"a.c\"\n"
+                   "  d; // f;\n"
+                   "/**/e;\n"};
+   std::ostringstream log{};
+   qcp::DiagnosticTracker diagnostics{"<test>", src, log};
+   qcp::Tokenizer ts{src, diagnostics};
+   // markers are registered like the parser does, every identifier is reported
+   for (auto it = ts.begin(); it != ts.end(); ++it) {
+      if (it->getKind() == tk::PP_START) {
+         Token lineNo = *++it;
+         Token file = *++it;
+         ASSERT_EQ(lineNo.getKind(), tk::ICONST);
+         ASSERT_EQ(file.getKind(), tk::SLITERAL);
+         diagnostics.registerFileMapping(std::string{ts.getString(file)}, ts.getValue<int>(lineNo) - 1, file.getLoc().loc());
+      } else if (it->getKind() == tk::IDENT) {
+         diagnostics << it->getLoc() << "here" << std::endl;
+         diagnostics.unsilence();
+      }
+   }
+   std::string expected[] = {"<test>:1:5: ", "<test>:3:14: ", "b.c:11:8: ", "a.c:3:3: ", "a.c:4:5: "};
+   std::size_t pos = 0;
+   for (auto& prefix : expected) {
+      pos = log.str().find(prefix + "error: here", pos);
+      ASSERT_NE(pos, std::string::npos) << prefix << " missing in\n" << log.str();
+   }
+   ASSERT_EQ(diagnostics.count(qcp::DiagnosticMessage::Kind::ERROR), std::size(expected)) << log.str();
+}
+// ---------------------------------------------------------------------------
+// a preprocessed file large enough to be lexed in chunks. most lines that end with a
+// semicolon are in block comments, so that many chunks start within one
+std::string chunkedProgram() {
+   std::string unit = R"(# 12 "a.h" 1
+int f(int a) { return a + 0x1F + 1.5e3 + 'c'; }
+/* a comment with code inside
+int g(void) { return 1; }
+# 7 "not a marker.h"
+char *s = "not a string;
+*/
+int LONG = 1 + \
+   2;
+char *s = "line" "\n" "adjacent";
+// a line comment \
+int continued;
+# 3 "b.c" 2
+/*
+x; y; z; x; y; z; x; y; z;
+*/
+)";
+   std::string src{};
+   while (src.size() < 3 * 1024 * 1024) {
+      src += unit;
+   }
+   // reported by the lexer of the last chunk
+   return src + "char *e = \"\\q\";\n";
+}
+// ---------------------------------------------------------------------------
+TEST(Tokenizer, ChunksMatchSequentialLexing) {
+   std::string src = chunkedProgram();
+   std::vector<std::string> expected{};
+   std::ostringstream expectedLog{};
+   {
+      qcp::DiagnosticTracker diagnostics{"<test>", src, expectedLog};
+      qcp::Tokenizer ts{src, diagnostics};
+      for (auto token : ts) {
+         expected.push_back(describe(ts, token));
+      }
+      expected.push_back(describe(ts, Token{tk::END}));
+   }
+   ASSERT_NE(expectedLog.str().find("unknown escape sequence"), std::string::npos) << expectedLog.str();
+
+   for (unsigned threads : {2u, 3u, 5u, 8u}) {
+      std::ostringstream log{};
+      qcp::DiagnosticTracker diagnostics{"<test>", src, log};
+      qcp::Tokenizer ts{src, diagnostics};
+      std::vector<Token> tokens = ts.tokenize(threads);
+      ASSERT_EQ(tokens.size(), expected.size()) << threads << " threads";
+      for (std::size_t i = 0; i < tokens.size(); ++i) {
+         ASSERT_EQ(describe(ts, tokens[i]), expected[i]) << threads << " threads, token " << i;
+      }
+      ASSERT_EQ(log.str(), expectedLog.str()) << threads << " threads";
+   }
+}
+// ---------------------------------------------------------------------------
+TEST(Tokenizer, SmallProgramsAreNotChunked) {
+   std::string src{"int a = 1;\n"};
+   qcp::DiagnosticTracker diagnostics{"<test>", src};
+   qcp::Tokenizer ts{src, diagnostics};
+   ASSERT_TRUE(ts.tokenize(8).empty());
+}
 // ---------------------------------------------------------------------------
 // TEST(Tokenizer, Random) {
 //    std::string src{qcp::tool::random_c_program("gcc", 0)};
@@ -4,6 +4,7 @@
 
 #include <gtest/gtest.h>
 
+#include "test_backends.h"
 #include "test_parser.h"
 
 int main(int argc, char* argv[]) {